@@ -404,6 +404,13 @@
 #define __NR_setns			(__NR_SYSCALL_BASE+375)
 #define __NR_process_vm_readv		(__NR_SYSCALL_BASE+376)
 #define __NR_process_vm_writev		(__NR_SYSCALL_BASE+377)
+					/* 378 and 379 reserved */
+#define __NR_sched_setattr		(__NR_SYSCALL_BASE+380)
+#define __NR_sched_getattr		(__NR_SYSCALL_BASE+381)
+					/* 382 - 424 reserved */
+#define __NR_io_uring_setup		(__NR_SYSCALL_BASE+425)
+#define __NR_io_uring_enter		(__NR_SYSCALL_BASE+426)
+#define __NR_io_uring_register		(__NR_SYSCALL_BASE+427)
 
 /*
  * The following SWIs are ARM private.
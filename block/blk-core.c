@@ -614,6 +614,9 @@ blk_init_allocated_queue(struct request_queue *q, request_fn_proc *rfn,
 
 	q->sg_reserved_size = INT_MAX;
 
+	if (wbt_init(q))
+		return NULL;
+
 	/*
 	 * all done
 	 */
@@ -1130,6 +1133,7 @@ void __blk_put_request(struct request_queue *q, struct request *req)
 		return;
 
 	elv_completed_request(q, req);
+	wbt_done(q, req);
 
 	/* this is a bio leak */
 	WARN_ON(req->bio != NULL);
@@ -1319,6 +1323,7 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	int el_ret, rw_flags, where = ELEVATOR_INSERT_SORT;
 	struct request *req;
 	unsigned int request_count = 0;
+	bool wbt;
 
 	/*
 	 * low level driver can indicate that it wants pages above a
@@ -1369,15 +1374,25 @@ get_rq:
 	if (sync)
 		rw_flags |= REQ_SYNC;
 
+	/*
+	 * Async writes may have to wait for the device to finish some of
+	 * the ones it already has.
+	 */
+	wbt = wbt_wait(q, bio);
+
 	/*
 	 * Grab a free request. This is might sleep but can not fail.
 	 * Returns with the queue unlocked.
 	 */
 	req = get_request_wait(q, rw_flags, bio);
 	if (unlikely(!req)) {
+		if (wbt)
+			wbt_put(q);
 		bio_endio(bio, -ENODEV);	/* @q is dead */
 		goto out_unlock;
 	}
+	if (wbt)
+		req->cmd_flags |= REQ_WBT;
 
 	/*
 	 * After dropping the lock and possibly sleeping here, our request
@@ -2032,6 +2047,7 @@ void blk_dequeue_request(struct request *rq)
 void blk_start_request(struct request *req)
 {
 	blk_dequeue_request(req);
+	wbt_issue(req->q, req);
 
 	/*
 	 * We are now handing the request to the hardware, initialize
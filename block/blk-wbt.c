@@ -0,0 +1,315 @@
+/*
+ * Writeback throttling based on device completion latency.
+ *
+ * Background writeback submits large batches of async writes, which fill
+ * the device queue and make synchronous reads to the same device wait
+ * behind them.  This caps the number of async write requests allocated on
+ * a queue and scales that cap with the latency reads see: each window in
+ * which the fastest read completed later than the target halves the cap,
+ * each window with reads within the target or without reads at all gives
+ * a step back until the full queue depth is allowed again.
+ *
+ * All state is protected by the queue lock.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+#include <linux/ktime.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/wbt.h>
+
+#include "blk.h"
+
+/* Default read latency targets, and the length of a sampling window */
+#define WBT_LAT_ROT_NSEC	(75 * NSEC_PER_MSEC)
+#define WBT_LAT_NONROT_NSEC	(2 * NSEC_PER_MSEC)
+#define WBT_WINDOW_NSEC		(100 * NSEC_PER_MSEC)
+
+/* Windows without reads before a step back up is taken */
+#define WBT_UNKNOWN_BUMP	5
+
+struct rq_wb {
+	struct request_queue	*q;
+	wait_queue_head_t	wait;
+
+	unsigned int		inflight;
+	unsigned int		wb_max;
+	unsigned int		wb_normal;
+	unsigned int		wb_background;
+	int			scale_step;
+	unsigned int		unknown_cnt;
+
+	/* 0 disables throttling, -1 picks the default for the device */
+	s64			lat_nsec;
+
+	u64			win_start;
+	u64			win_min_lat;
+	unsigned int		win_reads;
+	unsigned int		win_writes;
+	unsigned long		last_read;
+};
+
+static inline bool rwb_enabled(struct rq_wb *rwb)
+{
+	return rwb && rwb->lat_nsec;
+}
+
+static u64 rwb_lat(struct rq_wb *rwb)
+{
+	if (rwb->lat_nsec >= 0)
+		return rwb->lat_nsec;
+	return blk_queue_nonrot(rwb->q) ? WBT_LAT_NONROT_NSEC :
+					  WBT_LAT_ROT_NSEC;
+}
+
+static void calc_wb_limits(struct rq_wb *rwb)
+{
+	unsigned int depth = rwb->q->nr_requests;
+
+	if (rwb->scale_step > 0)
+		depth = 1 + ((depth - 1) >> min(31, rwb->scale_step));
+
+	rwb->wb_max = depth;
+	rwb->wb_normal = (depth + 1) / 2;
+	rwb->wb_background = (depth + 3) / 4;
+}
+
+static void scale_up(struct rq_wb *rwb, const char *msg)
+{
+	if (rwb->scale_step <= 0)
+		return;
+	rwb->scale_step--;
+	calc_wb_limits(rwb);
+	trace_wbt_step(&rwb->q->backing_dev_info, msg, rwb->scale_step,
+		       rwb->wb_background, rwb->wb_normal, rwb->wb_max);
+	wake_up_all(&rwb->wait);
+}
+
+static void scale_down(struct rq_wb *rwb, const char *msg)
+{
+	if (rwb->wb_max == 1)
+		return;
+	rwb->scale_step++;
+	calc_wb_limits(rwb);
+	trace_wbt_step(&rwb->q->backing_dev_info, msg, rwb->scale_step,
+		       rwb->wb_background, rwb->wb_normal, rwb->wb_max);
+}
+
+static void wbt_window_done(struct rq_wb *rwb, u64 now)
+{
+	trace_wbt_stat(&rwb->q->backing_dev_info, rwb->win_min_lat,
+		       rwb->win_reads, rwb->win_writes, rwb->inflight);
+
+	if (rwb->win_reads) {
+		rwb->unknown_cnt = 0;
+		if (rwb->win_min_lat > rwb_lat(rwb) &&
+		    (rwb->win_writes || rwb->inflight))
+			scale_down(rwb, "exceeded");
+		else
+			scale_up(rwb, "ok");
+	} else if (++rwb->unknown_cnt >= WBT_UNKNOWN_BUMP) {
+		rwb->unknown_cnt = 0;
+		scale_up(rwb, "idle");
+	}
+
+	rwb->win_start = now;
+	rwb->win_min_lat = ULLONG_MAX;
+	rwb->win_reads = 0;
+	rwb->win_writes = 0;
+}
+
+/*
+ * kswapd needs to make progress, so give it the whole allowance. Writes
+ * while reads are going on get the smallest share.
+ */
+static unsigned int wbt_limit(struct rq_wb *rwb)
+{
+	if (current_is_kswapd())
+		return rwb->wb_max;
+	if (time_before(jiffies, rwb->last_read +
+			nsecs_to_jiffies(WBT_WINDOW_NSEC)))
+		return rwb->wb_background;
+	return rwb->wb_normal;
+}
+
+/*
+ * Only async writes are throttled: reads, O_SYNC and fsync writes,
+ * flushes and discards go straight through.
+ */
+static inline bool wbt_should_throttle(struct bio *bio)
+{
+	return (bio->bi_rw & (REQ_WRITE | REQ_SYNC | REQ_FLUSH | REQ_FUA |
+			      REQ_META | REQ_DISCARD)) == REQ_WRITE;
+}
+
+/**
+ * wbt_wait - wait for a writeback slot before allocating a request
+ * @q: the request queue
+ * @bio: the bio a request is about to be allocated for
+ *
+ * Called with the queue lock held, which may be dropped while waiting.
+ * Returns true if the request has to be marked %REQ_WBT.
+ */
+bool wbt_wait(struct request_queue *q, struct bio *bio)
+{
+	struct rq_wb *rwb = q->rq_wb;
+	DEFINE_WAIT(wait);
+
+	if (!rwb_enabled(rwb) || !wbt_should_throttle(bio))
+		return false;
+
+	while (rwb_enabled(rwb) && rwb->inflight >= wbt_limit(rwb)) {
+		prepare_to_wait_exclusive(&rwb->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		if (!rwb_enabled(rwb) || rwb->inflight < wbt_limit(rwb))
+			break;
+		trace_wbt_sleep(&q->backing_dev_info, rwb->inflight,
+				wbt_limit(rwb));
+		spin_unlock_irq(q->queue_lock);
+		io_schedule();
+		spin_lock_irq(q->queue_lock);
+	}
+	finish_wait(&rwb->wait, &wait);
+
+	rwb->inflight++;
+	return true;
+}
+
+static void __wbt_put(struct rq_wb *rwb)
+{
+	rwb->inflight--;
+	if (waitqueue_active(&rwb->wait) &&
+	    (!rwb_enabled(rwb) || rwb->inflight < wbt_limit(rwb)))
+		wake_up(&rwb->wait);
+}
+
+/**
+ * wbt_put - give back a slot taken by wbt_wait() that was not used
+ * @q: the request queue
+ *
+ * Called with the queue lock held.
+ */
+void wbt_put(struct request_queue *q)
+{
+	__wbt_put(q->rq_wb);
+}
+
+/**
+ * wbt_issue - note that a request has been handed to the driver
+ * @q: the request queue
+ * @rq: the request
+ */
+void wbt_issue(struct request_queue *q, struct request *rq)
+{
+	if (rwb_enabled(q->rq_wb) && rq->cmd_type == REQ_TYPE_FS &&
+	    !rq_data_dir(rq))
+		rq->wbt_issue_ns = ktime_to_ns(ktime_get());
+}
+
+/**
+ * wbt_done - account a request being freed
+ * @q: the request queue
+ * @rq: the request
+ *
+ * Called with the queue lock held for every request that is freed, which
+ * includes requests that were merged into another one and never issued.
+ */
+void wbt_done(struct request_queue *q, struct request *rq)
+{
+	struct rq_wb *rwb = q->rq_wb;
+	u64 now;
+
+	if (!rwb)
+		return;
+
+	if (rq->cmd_flags & REQ_WBT) {
+		rq->cmd_flags &= ~REQ_WBT;
+		rwb->win_writes++;
+		__wbt_put(rwb);
+	}
+
+	if (!rwb_enabled(rwb))
+		return;
+
+	now = ktime_to_ns(ktime_get());
+	if (rq->wbt_issue_ns) {
+		u64 lat = now - rq->wbt_issue_ns;
+
+		rwb->win_min_lat = min(rwb->win_min_lat, lat);
+		rwb->win_reads++;
+		rwb->last_read = jiffies;
+		rq->wbt_issue_ns = 0;
+	}
+
+	if (now - rwb->win_start >= WBT_WINDOW_NSEC)
+		wbt_window_done(rwb, now);
+}
+
+/**
+ * wbt_update_limits - recompute the limits after the queue depth changed
+ * @q: the request queue
+ *
+ * Called with the queue lock held.
+ */
+void wbt_update_limits(struct request_queue *q)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (!rwb)
+		return;
+	calc_wb_limits(rwb);
+	wake_up_all(&rwb->wait);
+}
+
+s64 wbt_get_lat(struct request_queue *q)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (!rwb || !rwb->lat_nsec)
+		return 0;
+	return rwb_lat(rwb);
+}
+
+void wbt_set_lat(struct request_queue *q, s64 lat_nsec)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (!rwb)
+		return;
+
+	spin_lock_irq(q->queue_lock);
+	rwb->lat_nsec = lat_nsec;
+	rwb->scale_step = 0;
+	rwb->unknown_cnt = 0;
+	calc_wb_limits(rwb);
+	wake_up_all(&rwb->wait);
+	spin_unlock_irq(q->queue_lock);
+}
+
+int wbt_init(struct request_queue *q)
+{
+	struct rq_wb *rwb;
+
+	rwb = kzalloc_node(sizeof(*rwb), GFP_KERNEL, q->node);
+	if (!rwb)
+		return -ENOMEM;
+
+	rwb->q = q;
+	init_waitqueue_head(&rwb->wait);
+	rwb->lat_nsec = -1;
+	rwb->win_min_lat = ULLONG_MAX;
+	rwb->win_start = ktime_to_ns(ktime_get());
+	calc_wb_limits(rwb);
+
+	q->rq_wb = rwb;
+	return 0;
+}
+
+void wbt_exit(struct request_queue *q)
+{
+	kfree(q->rq_wb);
+	q->rq_wb = NULL;
+}
@@ -234,4 +234,30 @@ static inline void blk_throtl_exit(struct request_queue *q) { }
 static inline void blk_throtl_release(struct request_queue *q) { }
 #endif /* CONFIG_BLK_DEV_THROTTLING */
 
+/*
+ * Writeback throttling
+ */
+#ifdef CONFIG_BLK_WBT
+extern int wbt_init(struct request_queue *q);
+extern void wbt_exit(struct request_queue *q);
+extern bool wbt_wait(struct request_queue *q, struct bio *bio);
+extern void wbt_put(struct request_queue *q);
+extern void wbt_issue(struct request_queue *q, struct request *rq);
+extern void wbt_done(struct request_queue *q, struct request *rq);
+extern void wbt_update_limits(struct request_queue *q);
+extern s64 wbt_get_lat(struct request_queue *q);
+extern void wbt_set_lat(struct request_queue *q, s64 lat_nsec);
+#else /* CONFIG_BLK_WBT */
+static inline int wbt_init(struct request_queue *q) { return 0; }
+static inline void wbt_exit(struct request_queue *q) { }
+static inline bool wbt_wait(struct request_queue *q, struct bio *bio)
+{
+	return false;
+}
+static inline void wbt_put(struct request_queue *q) { }
+static inline void wbt_issue(struct request_queue *q, struct request *rq) { }
+static inline void wbt_done(struct request_queue *q, struct request *rq) { }
+static inline void wbt_update_limits(struct request_queue *q) { }
+#endif /* CONFIG_BLK_WBT */
+
 #endif /* BLK_INTERNAL_H */
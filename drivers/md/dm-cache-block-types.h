@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This file is released under the GPL.
+ */
+
+#ifndef DM_CACHE_BLOCK_TYPES_H
+#define DM_CACHE_BLOCK_TYPES_H
+
+#include "persistent-data/dm-block-manager.h"
+
+/*----------------------------------------------------------------*/
+
+/*
+ * The cache deals in two kinds of block address: blocks on the slow
+ * origin device (oblocks), and blocks on the fast cache device
+ * (cblocks).  Both are in units of the cache block size.
+ *
+ * The cache device is never going to hold more than 2^32 blocks, so
+ * cblocks are kept to 32 bits to save memory in the policies.
+ */
+typedef dm_block_t dm_oblock_t;
+typedef uint32_t dm_cblock_t;
+
+/*----------------------------------------------------------------*/
+
+#endif /* DM_CACHE_BLOCK_TYPES_H */
@@ -0,0 +1,894 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This file is released under the GPL.
+ */
+
+#include "dm-cache-metadata.h"
+
+#include "persistent-data/dm-btree.h"
+#include "persistent-data/dm-space-map.h"
+#include "persistent-data/dm-transaction-manager.h"
+
+#include <linux/device-mapper.h>
+
+/*--------------------------------------------------------------------------
+ * As far as the metadata goes, there is:
+ *
+ * - A superblock in block zero, taking up fewer than 512 bytes for
+ *   atomic writes.
+ *
+ * - A space map managing the metadata blocks.
+ *
+ * - A btree mapping each cache block onto the origin block it holds,
+ *   together with a dirty flag and the policy's hint for that block.
+ *
+ * A cache block is either mapped, in which case it appears in the
+ * mapping btree, or free.
+ *
+ * The dirty flags and hints are only brought up to date on a clean
+ * shutdown (see dm_cache_commit()).  The superblock records whether the
+ * last commit was such a shutdown.  If it wasn't, every mapped block is
+ * treated as dirty when the mappings are next loaded: writes may have been
+ * made to the cache since the flags were last written.  This keeps the
+ * normal io path from having to touch the metadata on every write.
+ *
+ * Mappings themselves are committed before any io is allowed to use them
+ * (see dm-cache-target.c), so after a crash the mapping btree never points
+ * at a cache block holding data for a different origin block.
+ *------------------------------------------------------------------------*/
+
+#define DM_MSG_PREFIX   "cache metadata"
+
+#define CACHE_SUPERBLOCK_MAGIC 06142003
+#define CACHE_SUPERBLOCK_LOCATION 0
+#define CACHE_VERSION 1
+#define CACHE_METADATA_CACHE_SIZE 64
+
+/*
+ *  3 for btree insert +
+ *  2 for btree lookup used within space map
+ */
+#define CACHE_MAX_CONCURRENT_LOCKS 5
+#define SPACE_MAP_ROOT_SIZE 128
+
+enum superblock_flag_bits {
+	/* for spotting crashes that would invalidate the dirty flags */
+	CLEAN_SHUTDOWN,
+};
+
+/*
+ * Each mapping from cache block -> origin block carries a set of flags.
+ */
+enum mapping_bits {
+	/*
+	 * The data on the cache is different from that on the origin.
+	 */
+	M_DIRTY = 1,
+};
+
+struct cache_disk_superblock {
+	__le32 csum;
+	__le32 flags;
+	__le64 blocknr;
+
+	__u8 uuid[16];
+	__le64 magic;
+	__le32 version;
+
+	__u8 policy_name[CACHE_POLICY_NAME_SIZE];
+	__le32 policy_hint_size;
+
+	__u8 metadata_space_map_root[SPACE_MAP_ROOT_SIZE];
+	__le64 mapping_root;
+
+	__le32 data_block_size;		/* In 512-byte sectors. */
+	__le32 metadata_block_size;	/* In 512-byte sectors. */
+	__le32 cache_blocks;
+
+	__le32 compat_flags;
+	__le32 compat_ro_flags;
+	__le32 incompat_flags;
+
+	__le32 read_hits;
+	__le32 read_misses;
+	__le32 write_hits;
+	__le32 write_misses;
+} __packed;
+
+/*
+ * The value stored in the mapping btree.  The origin block lives in the
+ * top 48 bits of @oblock_flags, the mapping flags in the bottom 16.
+ */
+struct disk_mapping {
+	__le64 oblock_flags;
+	__le32 hint;
+} __packed;
+
+struct dm_cache_metadata {
+	struct block_device *bdev;
+	struct dm_block_manager *bm;
+	struct dm_space_map *metadata_sm;
+	struct dm_transaction_manager *tm;
+
+	struct dm_btree_info info;
+
+	struct rw_semaphore root_lock;
+	dm_block_t root;
+	dm_cblock_t cache_blocks;
+	bool changed:1;
+	bool clean_when_opened:1;
+
+	char policy_name[CACHE_POLICY_NAME_SIZE];
+	size_t policy_hint_size;
+	struct dm_cache_statistics stats;
+
+	sector_t data_block_size;
+};
+
+/*-------------------------------------------------------------------
+ * superblock validator
+ *-----------------------------------------------------------------*/
+
+#define SUPERBLOCK_CSUM_XOR 9031977
+
+static void sb_prepare_for_write(struct dm_block_validator *v,
+				 struct dm_block *b,
+				 size_t sb_block_size)
+{
+	struct cache_disk_superblock *disk_super = dm_block_data(b);
+
+	disk_super->blocknr = cpu_to_le64(dm_block_location(b));
+	disk_super->csum = cpu_to_le32(dm_bm_checksum(&disk_super->flags,
+						      sb_block_size - sizeof(__le32),
+						      SUPERBLOCK_CSUM_XOR));
+}
+
+static int sb_check(struct dm_block_validator *v,
+		    struct dm_block *b,
+		    size_t sb_block_size)
+{
+	struct cache_disk_superblock *disk_super = dm_block_data(b);
+	__le32 csum_le;
+
+	if (dm_block_location(b) != le64_to_cpu(disk_super->blocknr)) {
+		DMERR("sb_check failed: blocknr %llu: wanted %llu",
+		      le64_to_cpu(disk_super->blocknr),
+		      (unsigned long long)dm_block_location(b));
+		return -ENOTBLK;
+	}
+
+	if (le64_to_cpu(disk_super->magic) != CACHE_SUPERBLOCK_MAGIC) {
+		DMERR("sb_check failed: magic %llu: wanted %llu",
+		      le64_to_cpu(disk_super->magic),
+		      (unsigned long long)CACHE_SUPERBLOCK_MAGIC);
+		return -EILSEQ;
+	}
+
+	csum_le = cpu_to_le32(dm_bm_checksum(&disk_super->flags,
+					     sb_block_size - sizeof(__le32),
+					     SUPERBLOCK_CSUM_XOR));
+	if (csum_le != disk_super->csum) {
+		DMERR("sb_check failed: csum %u: wanted %u",
+		      le32_to_cpu(csum_le), le32_to_cpu(disk_super->csum));
+		return -EILSEQ;
+	}
+
+	return 0;
+}
+
+static struct dm_block_validator sb_validator = {
+	.name = "superblock",
+	.prepare_for_write = sb_prepare_for_write,
+	.check = sb_check
+};
+
+/*----------------------------------------------------------------*/
+
+static __le64 pack_value(dm_oblock_t block, unsigned flags)
+{
+	uint64_t value = block;
+
+	value <<= 16;
+	value = value | (flags & ((1 << 16) - 1));
+	return cpu_to_le64(value);
+}
+
+static void unpack_value(__le64 value_le, dm_oblock_t *block, unsigned *flags)
+{
+	uint64_t value = le64_to_cpu(value_le);
+	uint64_t b = value >> 16;
+
+	*block = b;
+	*flags = value & ((1 << 16) - 1);
+}
+
+/*----------------------------------------------------------------*/
+
+static int superblock_all_zeroes(struct dm_block_manager *bm, int *result)
+{
+	int r;
+	unsigned i;
+	struct dm_block *b;
+	__le64 *data_le, zero = cpu_to_le64(0);
+	unsigned sb_block_size = dm_bm_block_size(bm) / sizeof(__le64);
+
+	/*
+	 * We can't use a validator here - it may be all zeroes.
+	 */
+	r = dm_bm_read_lock(bm, CACHE_SUPERBLOCK_LOCATION, NULL, &b);
+	if (r)
+		return r;
+
+	data_le = dm_block_data(b);
+	*result = 1;
+	for (i = 0; i < sb_block_size; i++) {
+		if (data_le[i] != zero) {
+			*result = 0;
+			break;
+		}
+	}
+
+	return dm_bm_unlock(b);
+}
+
+static void init_info(struct dm_cache_metadata *cmd)
+{
+	cmd->info.tm = cmd->tm;
+	cmd->info.levels = 1;
+	cmd->info.value_type.context = NULL;
+	cmd->info.value_type.size = sizeof(struct disk_mapping);
+	cmd->info.value_type.inc = NULL;
+	cmd->info.value_type.dec = NULL;
+	cmd->info.value_type.equal = NULL;
+}
+
+static int __write_initial_superblock(struct dm_cache_metadata *cmd)
+{
+	int r;
+	struct dm_block *sblock;
+	size_t metadata_len;
+	struct cache_disk_superblock *disk_super;
+
+	r = dm_sm_root_size(cmd->metadata_sm, &metadata_len);
+	if (r < 0)
+		return r;
+
+	r = dm_tm_pre_commit(cmd->tm);
+	if (r < 0)
+		return r;
+
+	r = dm_bm_write_lock(cmd->bm, CACHE_SUPERBLOCK_LOCATION,
+			     &sb_validator, &sblock);
+	if (r < 0)
+		return r;
+
+	disk_super = dm_block_data(sblock);
+	disk_super->flags = 0;
+	memset(disk_super->uuid, 0, sizeof(disk_super->uuid));
+	disk_super->magic = cpu_to_le64(CACHE_SUPERBLOCK_MAGIC);
+	disk_super->version = cpu_to_le32(CACHE_VERSION);
+	memset(disk_super->policy_name, 0, sizeof(disk_super->policy_name));
+	disk_super->policy_hint_size = 0;
+
+	r = dm_sm_copy_root(cmd->metadata_sm, &disk_super->metadata_space_map_root,
+			    metadata_len);
+	if (r < 0)
+		goto bad_locked;
+
+	disk_super->mapping_root = cpu_to_le64(cmd->root);
+	disk_super->metadata_block_size = cpu_to_le32(DM_CACHE_METADATA_BLOCK_SIZE >> SECTOR_SHIFT);
+	disk_super->data_block_size = cpu_to_le32(cmd->data_block_size);
+	disk_super->cache_blocks = cpu_to_le32(0);
+
+	disk_super->read_hits = cpu_to_le32(0);
+	disk_super->read_misses = cpu_to_le32(0);
+	disk_super->write_hits = cpu_to_le32(0);
+	disk_super->write_misses = cpu_to_le32(0);
+
+	return dm_tm_commit(cmd->tm, sblock);
+
+bad_locked:
+	dm_bm_unlock(sblock);
+	return r;
+}
+
+static int __format_metadata(struct dm_cache_metadata *cmd)
+{
+	int r;
+	struct dm_block *sblock;
+
+	r = dm_tm_create_with_sm(cmd->bm, CACHE_SUPERBLOCK_LOCATION,
+				 &sb_validator, &cmd->tm, &cmd->metadata_sm,
+				 &sblock);
+	if (r < 0) {
+		DMERR("tm_create_with_sm failed");
+		return r;
+	}
+
+	r = dm_tm_unlock(cmd->tm, sblock);
+	if (r < 0) {
+		DMERR("couldn't unlock superblock");
+		goto bad;
+	}
+
+	init_info(cmd);
+
+	r = dm_btree_empty(&cmd->info, &cmd->root);
+	if (r < 0)
+		goto bad;
+
+	cmd->cache_blocks = 0;
+	cmd->changed = true;
+	cmd->clean_when_opened = true;
+
+	r = __write_initial_superblock(cmd);
+	if (r)
+		goto bad;
+
+	return 0;
+
+bad:
+	dm_tm_destroy(cmd->tm);
+	dm_sm_destroy(cmd->metadata_sm);
+
+	return r;
+}
+
+static int __check_incompat_features(struct cache_disk_superblock *disk_super,
+				     struct dm_cache_metadata *cmd)
+{
+	uint32_t features;
+
+	features = le32_to_cpu(disk_super->incompat_flags) & ~DM_CACHE_FEATURE_INCOMPAT_SUPP;
+	if (features) {
+		DMERR("could not access metadata due to unsupported optional features (%lx).",
+		      (unsigned long)features);
+		return -EINVAL;
+	}
+
+	/*
+	 * Check for read-only metadata to skip the following RDWR checks.
+	 */
+	if (get_disk_ro(cmd->bdev->bd_disk))
+		return 0;
+
+	features = le32_to_cpu(disk_super->compat_ro_flags) & ~DM_CACHE_FEATURE_COMPAT_RO_SUPP;
+	if (features) {
+		DMERR("could not access metadata RDWR due to unsupported optional features (%lx).",
+		      (unsigned long)features);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int __open_metadata(struct dm_cache_metadata *cmd)
+{
+	int r;
+	struct dm_block *sblock;
+	struct cache_disk_superblock *disk_super;
+	unsigned long sb_flags;
+
+	r = dm_bm_read_lock(cmd->bm, CACHE_SUPERBLOCK_LOCATION,
+			    &sb_validator, &sblock);
+	if (r < 0) {
+		DMERR("couldn't read lock superblock");
+		return r;
+	}
+
+	disk_super = dm_block_data(sblock);
+
+	/* Verify the data block size hasn't changed */
+	if (le32_to_cpu(disk_super->data_block_size) != cmd->data_block_size) {
+		DMERR("changing the data block size (from %u to %llu) is not supported",
+		      le32_to_cpu(disk_super->data_block_size),
+		      (unsigned long long)cmd->data_block_size);
+		r = -EINVAL;
+	} else
+		r = __check_incompat_features(disk_super, cmd);
+
+	dm_bm_unlock(sblock);
+	if (r < 0)
+		return r;
+
+	r = dm_tm_open_with_sm(cmd->bm, CACHE_SUPERBLOCK_LOCATION,
+			       &sb_validator,
+			       offsetof(struct cache_disk_superblock, metadata_space_map_root),
+			       SPACE_MAP_ROOT_SIZE,
+			       &cmd->tm, &cmd->metadata_sm, &sblock);
+	if (r < 0) {
+		DMERR("tm_open_with_sm failed");
+		return r;
+	}
+
+	init_info(cmd);
+
+	disk_super = dm_block_data(sblock);
+	sb_flags = le32_to_cpu(disk_super->flags);
+	cmd->root = le64_to_cpu(disk_super->mapping_root);
+	cmd->cache_blocks = le32_to_cpu(disk_super->cache_blocks);
+	cmd->clean_when_opened = test_bit(CLEAN_SHUTDOWN, &sb_flags);
+	strncpy(cmd->policy_name, (const char *) disk_super->policy_name,
+		sizeof(cmd->policy_name) - 1);
+	cmd->policy_name[sizeof(cmd->policy_name) - 1] = '\0';
+	cmd->policy_hint_size = le32_to_cpu(disk_super->policy_hint_size);
+
+	cmd->stats.read_hits = le32_to_cpu(disk_super->read_hits);
+	cmd->stats.read_misses = le32_to_cpu(disk_super->read_misses);
+	cmd->stats.write_hits = le32_to_cpu(disk_super->write_hits);
+	cmd->stats.write_misses = le32_to_cpu(disk_super->write_misses);
+
+	cmd->changed = false;
+
+	r = dm_tm_unlock(cmd->tm, sblock);
+	if (r < 0) {
+		DMERR("couldn't unlock superblock");
+		dm_tm_destroy(cmd->tm);
+		dm_sm_destroy(cmd->metadata_sm);
+	}
+
+	return r;
+}
+
+static int __open_or_format_metadata(struct dm_cache_metadata *cmd)
+{
+	int r, unformatted;
+
+	r = superblock_all_zeroes(cmd->bm, &unformatted);
+	if (r)
+		return r;
+
+	if (unformatted)
+		return __format_metadata(cmd);
+
+	return __open_metadata(cmd);
+}
+
+static int __create_persistent_data_objects(struct dm_cache_metadata *cmd)
+{
+	int r;
+
+	cmd->bm = dm_block_manager_create(cmd->bdev, DM_CACHE_METADATA_BLOCK_SIZE,
+					  CACHE_METADATA_CACHE_SIZE,
+					  CACHE_MAX_CONCURRENT_LOCKS);
+	if (!cmd->bm) {
+		DMERR("could not create block manager");
+		return -ENOMEM;
+	}
+
+	r = __open_or_format_metadata(cmd);
+	if (r)
+		dm_block_manager_destroy(cmd->bm);
+
+	return r;
+}
+
+static void __destroy_persistent_data_objects(struct dm_cache_metadata *cmd)
+{
+	dm_tm_destroy(cmd->tm);
+	dm_block_manager_destroy(cmd->bm);
+	dm_sm_destroy(cmd->metadata_sm);
+}
+
+static int __commit_transaction(struct dm_cache_metadata *cmd,
+				bool clean_shutdown)
+{
+	int r;
+	size_t metadata_len;
+	unsigned long sb_flags = 0;
+	struct cache_disk_superblock *disk_super;
+	struct dm_block *sblock;
+
+	/*
+	 * We need to know if the cache_disk_superblock exceeds a 512-byte sector.
+	 */
+	BUILD_BUG_ON(sizeof(struct cache_disk_superblock) > 512);
+
+	r = dm_tm_pre_commit(cmd->tm);
+	if (r < 0)
+		return r;
+
+	r = dm_sm_root_size(cmd->metadata_sm, &metadata_len);
+	if (r < 0)
+		return r;
+
+	r = dm_bm_write_lock(cmd->bm, CACHE_SUPERBLOCK_LOCATION,
+			     &sb_validator, &sblock);
+	if (r)
+		return r;
+
+	disk_super = dm_block_data(sblock);
+
+	if (clean_shutdown)
+		set_bit(CLEAN_SHUTDOWN, &sb_flags);
+	disk_super->flags = cpu_to_le32(sb_flags);
+
+	disk_super->mapping_root = cpu_to_le64(cmd->root);
+	disk_super->cache_blocks = cpu_to_le32(cmd->cache_blocks);
+	strncpy((char *) disk_super->policy_name, cmd->policy_name,
+		sizeof(disk_super->policy_name));
+	disk_super->policy_hint_size = cpu_to_le32(cmd->policy_hint_size);
+
+	disk_super->read_hits = cpu_to_le32(cmd->stats.read_hits);
+	disk_super->read_misses = cpu_to_le32(cmd->stats.read_misses);
+	disk_super->write_hits = cpu_to_le32(cmd->stats.write_hits);
+	disk_super->write_misses = cpu_to_le32(cmd->stats.write_misses);
+
+	r = dm_sm_copy_root(cmd->metadata_sm, &disk_super->metadata_space_map_root,
+			    metadata_len);
+	if (r < 0) {
+		dm_bm_unlock(sblock);
+		return r;
+	}
+
+	r = dm_tm_commit(cmd->tm, sblock);
+	if (!r)
+		cmd->changed = false;
+
+	return r;
+}
+
+/*----------------------------------------------------------------*/
+
+struct dm_cache_metadata *dm_cache_metadata_open(struct block_device *bdev,
+						 sector_t data_block_size,
+						 size_t policy_hint_size)
+{
+	int r;
+	struct dm_cache_metadata *cmd;
+
+	cmd = kzalloc(sizeof(*cmd), GFP_KERNEL);
+	if (!cmd) {
+		DMERR("could not allocate metadata struct");
+		return ERR_PTR(-ENOMEM);
+	}
+
+	init_rwsem(&cmd->root_lock);
+	cmd->bdev = bdev;
+	cmd->data_block_size = data_block_size;
+	cmd->policy_hint_size = policy_hint_size;
+
+	r = __create_persistent_data_objects(cmd);
+	if (r) {
+		kfree(cmd);
+		return ERR_PTR(r);
+	}
+
+	return cmd;
+}
+
+void dm_cache_metadata_close(struct dm_cache_metadata *cmd)
+{
+	__destroy_persistent_data_objects(cmd);
+	kfree(cmd);
+}
+
+int dm_cache_resize(struct dm_cache_metadata *cmd, dm_cblock_t new_cache_size)
+{
+	int r = 0;
+	dm_cblock_t b;
+	uint64_t key;
+	struct disk_mapping value;
+
+	down_write(&cmd->root_lock);
+
+	/*
+	 * We can only shrink the cache if the blocks being lost are
+	 * unmapped; the core has no way of writing them back from here.
+	 */
+	for (b = new_cache_size; b < cmd->cache_blocks; b++) {
+		key = b;
+		r = dm_btree_lookup(&cmd->info, cmd->root, &key, &value);
+		if (!r) {
+			DMERR("unable to shrink cache; cache block %u is still mapped", b);
+			r = -EINVAL;
+			goto out;
+		}
+
+		if (r != -ENODATA)
+			goto out;
+	}
+
+	r = 0;
+	cmd->cache_blocks = new_cache_size;
+	cmd->changed = true;
+
+out:
+	up_write(&cmd->root_lock);
+
+	return r;
+}
+
+dm_cblock_t dm_cache_size(struct dm_cache_metadata *cmd)
+{
+	dm_cblock_t r;
+
+	down_read(&cmd->root_lock);
+	r = cmd->cache_blocks;
+	up_read(&cmd->root_lock);
+
+	return r;
+}
+
+static int __remove(struct dm_cache_metadata *cmd, dm_cblock_t cblock)
+{
+	int r;
+	uint64_t key = cblock;
+
+	r = dm_btree_remove(&cmd->info, cmd->root, &key, &cmd->root);
+	if (r)
+		return r;
+
+	cmd->changed = true;
+	return 0;
+}
+
+int dm_cache_remove_mapping(struct dm_cache_metadata *cmd, dm_cblock_t cblock)
+{
+	int r;
+
+	down_write(&cmd->root_lock);
+	r = __remove(cmd, cblock);
+	up_write(&cmd->root_lock);
+
+	return r;
+}
+
+static int __insert(struct dm_cache_metadata *cmd,
+		    dm_cblock_t cblock, dm_oblock_t oblock)
+{
+	int r;
+	uint64_t key = cblock;
+	struct disk_mapping value;
+
+	value.oblock_flags = pack_value(oblock, 0);
+	value.hint = cpu_to_le32(0);
+	__dm_bless_for_disk(&value);
+
+	r = dm_btree_insert(&cmd->info, cmd->root, &key, &value, &cmd->root);
+	if (r)
+		return r;
+
+	cmd->changed = true;
+	return 0;
+}
+
+int dm_cache_insert_mapping(struct dm_cache_metadata *cmd,
+			    dm_cblock_t cblock, dm_oblock_t oblock)
+{
+	int r;
+
+	down_write(&cmd->root_lock);
+	r = __insert(cmd, cblock, oblock);
+	up_write(&cmd->root_lock);
+
+	return r;
+}
+
+static bool policy_unchanged(struct dm_cache_metadata *cmd,
+			     const char *policy_name)
+{
+	/*
+	 * Ensure policy names match.
+	 */
+	if (strncmp(cmd->policy_name, policy_name, sizeof(cmd->policy_name)))
+		return false;
+
+	/*
+	 * Ensure policy hint sizes match.
+	 */
+	if (cmd->policy_hint_size != 4)
+		return false;
+
+	return true;
+}
+
+static int __load_mappings(struct dm_cache_metadata *cmd,
+			   const char *policy_name,
+			   load_mapping_fn fn, void *context)
+{
+	int r;
+	dm_cblock_t cblock;
+	uint64_t key;
+	struct disk_mapping value;
+	dm_oblock_t oblock;
+	unsigned flags;
+	bool hints_valid = policy_unchanged(cmd, policy_name);
+
+	for (cblock = 0; cblock < cmd->cache_blocks; cblock++) {
+		key = cblock;
+		r = dm_btree_lookup(&cmd->info, cmd->root, &key, &value);
+		if (r == -ENODATA)
+			continue;
+
+		if (r)
+			return r;
+
+		unpack_value(value.oblock_flags, &oblock, &flags);
+		r = fn(context, oblock, cblock,
+		       (flags & M_DIRTY) || !cmd->clean_when_opened,
+		       le32_to_cpu(value.hint), hints_valid);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+int dm_cache_load_mappings(struct dm_cache_metadata *cmd,
+			   const char *policy_name,
+			   load_mapping_fn fn, void *context)
+{
+	int r;
+
+	down_read(&cmd->root_lock);
+	r = __load_mappings(cmd, policy_name, fn, context);
+	up_read(&cmd->root_lock);
+
+	return r;
+}
+
+/*
+ * Updates the value for a mapped cache block, avoiding the btree
+ * insert (and so the shadowing of a path of metadata blocks) when
+ * nothing has actually changed.
+ */
+static int __update_mapping(struct dm_cache_metadata *cmd, dm_cblock_t cblock,
+			    int (*fn)(struct disk_mapping *value, void *context),
+			    void *context)
+{
+	int r;
+	uint64_t key = cblock;
+	struct disk_mapping value;
+
+	r = dm_btree_lookup(&cmd->info, cmd->root, &key, &value);
+	if (r)
+		return r;
+
+	if (!fn(&value, context))
+		return 0;
+
+	__dm_bless_for_disk(&value);
+	r = dm_btree_insert(&cmd->info, cmd->root, &key, &value, &cmd->root);
+	if (r)
+		return r;
+
+	cmd->changed = true;
+	return 0;
+}
+
+static int update_dirty(struct disk_mapping *value, void *context)
+{
+	bool dirty = *((bool *) context);
+	dm_oblock_t oblock;
+	unsigned flags, new_flags;
+
+	unpack_value(value->oblock_flags, &oblock, &flags);
+	new_flags = dirty ? (flags | M_DIRTY) : (flags & ~M_DIRTY);
+	if (new_flags == flags)
+		return 0;
+
+	value->oblock_flags = pack_value(oblock, new_flags);
+	return 1;
+}
+
+int dm_cache_set_dirty(struct dm_cache_metadata *cmd,
+		       dm_cblock_t cblock, bool dirty)
+{
+	int r;
+
+	down_write(&cmd->root_lock);
+	r = __update_mapping(cmd, cblock, update_dirty, &dirty);
+	up_write(&cmd->root_lock);
+
+	return r;
+}
+
+void dm_cache_metadata_get_stats(struct dm_cache_metadata *cmd,
+				 struct dm_cache_statistics *stats)
+{
+	down_read(&cmd->root_lock);
+	memcpy(stats, &cmd->stats, sizeof(*stats));
+	up_read(&cmd->root_lock);
+}
+
+void dm_cache_metadata_set_stats(struct dm_cache_metadata *cmd,
+				 struct dm_cache_statistics *stats)
+{
+	down_write(&cmd->root_lock);
+	memcpy(&cmd->stats, stats, sizeof(*stats));
+	up_write(&cmd->root_lock);
+}
+
+int dm_cache_commit(struct dm_cache_metadata *cmd, bool clean_shutdown)
+{
+	int r;
+
+	down_write(&cmd->root_lock);
+	r = __commit_transaction(cmd, clean_shutdown);
+	up_write(&cmd->root_lock);
+
+	return r;
+}
+
+int dm_cache_changed_this_transaction(struct dm_cache_metadata *cmd)
+{
+	int r;
+
+	down_read(&cmd->root_lock);
+	r = cmd->changed;
+	up_read(&cmd->root_lock);
+
+	return r;
+}
+
+int dm_cache_get_free_metadata_block_count(struct dm_cache_metadata *cmd,
+					   dm_block_t *result)
+{
+	int r;
+
+	down_read(&cmd->root_lock);
+	r = dm_sm_get_nr_free(cmd->metadata_sm, result);
+	up_read(&cmd->root_lock);
+
+	return r;
+}
+
+int dm_cache_get_metadata_dev_size(struct dm_cache_metadata *cmd,
+				   dm_block_t *result)
+{
+	int r;
+
+	down_read(&cmd->root_lock);
+	r = dm_sm_get_nr_blocks(cmd->metadata_sm, result);
+	up_read(&cmd->root_lock);
+
+	return r;
+}
+
+/*----------------------------------------------------------------*/
+
+int dm_cache_begin_hints(struct dm_cache_metadata *cmd, struct dm_cache_policy *policy)
+{
+	const char *policy_name = dm_cache_policy_get_name(policy);
+	size_t hint_size = dm_cache_policy_get_hint_size(policy);
+
+	if (!policy_name[0] ||
+	    (strlen(policy_name) > sizeof(cmd->policy_name) - 1))
+		return -EINVAL;
+
+	down_write(&cmd->root_lock);
+	if (strcmp(cmd->policy_name, policy_name) ||
+	    cmd->policy_hint_size != hint_size) {
+		strncpy(cmd->policy_name, policy_name, sizeof(cmd->policy_name));
+		cmd->policy_hint_size = hint_size;
+		cmd->changed = true;
+	}
+	up_write(&cmd->root_lock);
+
+	return 0;
+}
+
+static int update_hint(struct disk_mapping *value, void *context)
+{
+	__le32 hint_le = cpu_to_le32(*((uint32_t *) context));
+
+	if (value->hint == hint_le)
+		return 0;
+
+	value->hint = hint_le;
+	return 1;
+}
+
+int dm_cache_save_hint(struct dm_cache_metadata *cmd, dm_cblock_t cblock,
+		       uint32_t hint)
+{
+	int r;
+
+	down_write(&cmd->root_lock);
+	r = __update_mapping(cmd, cblock, update_hint, &hint);
+	up_write(&cmd->root_lock);
+
+	return r;
+}
@@ -0,0 +1,1172 @@
+/*
+ * Copyright (C) 2012 Red Hat. All rights reserved.
+ *
+ * This file is released under the GPL.
+ */
+
+#include "dm-cache-policy.h"
+
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache-policy-mq"
+
+static struct kmem_cache *mq_entry_cache;
+
+/*----------------------------------------------------------------*/
+
+static unsigned next_power(unsigned n, unsigned min)
+{
+	return roundup_pow_of_two(max(n, min));
+}
+
+/*----------------------------------------------------------------*/
+
+static unsigned long *alloc_bitset(unsigned nr_entries)
+{
+	size_t s = sizeof(unsigned long) * dm_div_up(nr_entries, BITS_PER_LONG);
+	return vzalloc(s);
+}
+
+static void free_bitset(unsigned long *bits)
+{
+	vfree(bits);
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Large, sequential ios are probably better left on the origin device since
+ * spindles tend to have good bandwidth.
+ *
+ * The io_tracker tries to spot when the io is in one of these sequential
+ * modes.
+ *
+ * Two thresholds to switch between random and sequential io mode are
+ * defaulting as follows and can be adjusted via the constructor and message
+ * interfaces.
+ */
+#define RANDOM_THRESHOLD_DEFAULT 4
+#define SEQUENTIAL_THRESHOLD_DEFAULT 512
+
+enum io_pattern {
+	PATTERN_SEQUENTIAL,
+	PATTERN_RANDOM
+};
+
+struct io_tracker {
+	enum io_pattern pattern;
+
+	unsigned nr_seq_samples;
+	unsigned nr_rand_samples;
+	unsigned thresholds[2];
+
+	sector_t last_end_sector;
+};
+
+static void iot_init(struct io_tracker *t,
+		     int sequential_threshold, int random_threshold)
+{
+	t->pattern = PATTERN_RANDOM;
+	t->nr_seq_samples = 0;
+	t->nr_rand_samples = 0;
+	t->last_end_sector = 0;
+	t->thresholds[PATTERN_RANDOM] = random_threshold;
+	t->thresholds[PATTERN_SEQUENTIAL] = sequential_threshold;
+}
+
+static enum io_pattern iot_pattern(struct io_tracker *t)
+{
+	return t->pattern;
+}
+
+static void iot_update_stats(struct io_tracker *t, struct bio *bio)
+{
+	if (bio->bi_sector == t->last_end_sector + 1)
+		t->nr_seq_samples++;
+	else {
+		/*
+		 * Just one non-sequential IO is enough to reset the
+		 * counters.
+		 */
+		if (t->nr_seq_samples) {
+			t->nr_seq_samples = 0;
+			t->nr_rand_samples = 0;
+		}
+
+		t->nr_rand_samples++;
+	}
+
+	t->last_end_sector = bio->bi_sector + bio_sectors(bio) - 1;
+}
+
+static void iot_check_for_pattern_switch(struct io_tracker *t)
+{
+	switch (t->pattern) {
+	case PATTERN_SEQUENTIAL:
+		if (t->nr_rand_samples >= t->thresholds[PATTERN_RANDOM]) {
+			t->pattern = PATTERN_RANDOM;
+			t->nr_seq_samples = t->nr_rand_samples = 0;
+		}
+		break;
+
+	case PATTERN_RANDOM:
+		if (t->nr_seq_samples >= t->thresholds[PATTERN_SEQUENTIAL]) {
+			t->pattern = PATTERN_SEQUENTIAL;
+			t->nr_seq_samples = t->nr_rand_samples = 0;
+		}
+		break;
+	}
+}
+
+static void iot_examine_bio(struct io_tracker *t, struct bio *bio)
+{
+	iot_update_stats(t, bio);
+	iot_check_for_pattern_switch(t);
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * This queue is divided up into different levels.  Allowing us to push
+ * entries to the back of any of the levels.  Think of it as a partially
+ * sorted queue.
+ */
+#define NR_QUEUE_LEVELS 16u
+
+struct queue {
+	struct list_head qs[NR_QUEUE_LEVELS];
+};
+
+static void queue_init(struct queue *q)
+{
+	unsigned i;
+
+	for (i = 0; i < NR_QUEUE_LEVELS; i++)
+		INIT_LIST_HEAD(q->qs + i);
+}
+
+/*
+ * Insert an entry to the back of the given level.
+ */
+static void queue_push(struct queue *q, unsigned level, struct list_head *elt)
+{
+	list_add_tail(elt, q->qs + level);
+}
+
+static void queue_remove(struct list_head *elt)
+{
+	list_del(elt);
+}
+
+/*
+ * Gives us the oldest entry of the lowest populated level.
+ */
+static struct list_head *queue_peek(struct queue *q)
+{
+	unsigned level;
+
+	for (level = 0; level < NR_QUEUE_LEVELS; level++)
+		if (!list_empty(q->qs + level))
+			return q->qs[level].next;
+
+	return NULL;
+}
+
+static struct list_head *queue_pop(struct queue *q)
+{
+	struct list_head *r = queue_peek(q);
+
+	if (r)
+		list_del(r);
+
+	return r;
+}
+
+static struct list_head *list_pop(struct list_head *lh)
+{
+	struct list_head *r = lh->next;
+
+	BUG_ON(!r);
+	list_del_init(r);
+
+	return r;
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Describes a cache entry.  Used in both the cache and the pre_cache.
+ */
+struct entry {
+	struct hlist_node hlist;
+	struct list_head list;
+	dm_oblock_t oblock;
+	dm_cblock_t cblock;	/* valid iff in_cache */
+
+	/*
+	 * FIXME: pack these better
+	 */
+	bool in_cache:1;
+	bool dirty:1;
+	unsigned hit_count;
+	unsigned tick;
+};
+
+struct mq_policy {
+	struct dm_cache_policy policy;
+
+	/* protects everything */
+	struct mutex lock;
+	dm_cblock_t cache_size;
+	struct io_tracker tracker;
+
+	/*
+	 * We maintain three queues of entries.  The cache proper,
+	 * consisting of a clean and dirty queue, contains the currently
+	 * active mappings.  Whereas the pre_cache tracks blocks that
+	 * are being hit frequently and potential candidates for promotion
+	 * to the cache.
+	 */
+	struct queue pre_cache;
+	struct queue cache_clean;
+	struct queue cache_dirty;
+
+	/*
+	 * Keeps track of time, incremented by the core.  We use this to
+	 * avoid attributing multiple hits within the same tick.
+	 */
+	unsigned tick;
+
+	/*
+	 * A count of the number of times the map function has been called
+	 * and found an entry in the pre_cache or cache.  Currently used to
+	 * calculate the generation.
+	 */
+	unsigned hit_count;
+
+	/*
+	 * A generation is a longish period that is used to trigger some
+	 * book keeping effects.  eg, decrementing hit counts on entries.
+	 * This is needed to allow the cache to evolve as io patterns
+	 * change.
+	 */
+	unsigned generation;
+	unsigned generation_period; /* in lookups (will probably change) */
+
+	/*
+	 * Entries in the pre_cache whose hit count passes the promotion
+	 * threshold move to the cache proper.  Working out the correct
+	 * value for the promotion_threshold is crucial to this policy.
+	 * It is the hit count of the coldest entry in the cache, plus an
+	 * adjustment that makes writes (which will also make the block
+	 * dirty) harder to promote than reads.
+	 */
+	unsigned promote_adjustment[2];
+
+	/*
+	 * The hash table allows us to quickly find an entry by origin
+	 * block.  Both pre_cache and cache entries are in here.
+	 */
+	unsigned nr_buckets;
+	dm_block_t hash_bits;
+	struct hlist_head *table;
+
+	/*
+	 * Free cache blocks.
+	 */
+	dm_cblock_t nr_cblocks_allocated;
+	unsigned find_free_nr_words;
+	unsigned find_free_last_word;
+	unsigned long *allocation_bitset;
+
+	/*
+	 * Free entries: there are enough for every cache block plus the
+	 * same number again for the pre_cache.
+	 */
+	unsigned nr_entries;
+	unsigned nr_entries_allocated;
+	struct list_head free;
+};
+
+#define READ_PROMOTE_ADJUSTMENT 4
+#define WRITE_PROMOTE_ADJUSTMENT 8
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Simple hash table implementation.  Should replace with the standard hash
+ * table that's making its way upstream.
+ */
+static void hash_insert(struct mq_policy *mq, struct entry *e)
+{
+	unsigned h = hash_64(e->oblock, mq->hash_bits);
+
+	hlist_add_head(&e->hlist, mq->table + h);
+}
+
+static struct entry *hash_lookup(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	unsigned h = hash_64(oblock, mq->hash_bits);
+	struct hlist_head *bucket = mq->table + h;
+	struct hlist_node *tmp;
+	struct entry *e;
+
+	hlist_for_each_entry(e, tmp, bucket, hlist)
+		if (e->oblock == oblock) {
+			hlist_del(&e->hlist);
+			hlist_add_head(&e->hlist, bucket);
+			return e;
+		}
+
+	return NULL;
+}
+
+static void hash_remove(struct entry *e)
+{
+	hlist_del(&e->hlist);
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Allocates a new entry structure.  The memory is allocated in one lump,
+ * so we're just handing it out here.  Returns NULL if all entries have
+ * already been allocated.  Cannot fail otherwise.
+ */
+static struct entry *alloc_entry(struct mq_policy *mq)
+{
+	struct entry *e;
+
+	if (mq->nr_entries_allocated >= mq->nr_entries) {
+		BUG_ON(!list_empty(&mq->free));
+		return NULL;
+	}
+
+	e = list_entry(list_pop(&mq->free), struct entry, list);
+	INIT_LIST_HEAD(&e->list);
+	INIT_HLIST_NODE(&e->hlist);
+
+	mq->nr_entries_allocated++;
+	return e;
+}
+
+static int alloc_entries(struct mq_policy *mq, unsigned elts)
+{
+	unsigned u = elts;
+
+	INIT_LIST_HEAD(&mq->free);
+	mq->nr_entries_allocated = 0;
+
+	while (u--) {
+		struct entry *e = kmem_cache_zalloc(mq_entry_cache, GFP_KERNEL);
+
+		if (!e)
+			return -ENOMEM;
+
+		list_add(&e->list, &mq->free);
+	}
+
+	return 0;
+}
+
+static void free_entries(struct mq_policy *mq)
+{
+	struct entry *e, *tmp;
+
+	list_for_each_entry_safe(e, tmp, &mq->free, list)
+		kmem_cache_free(mq_entry_cache, e);
+}
+
+/*----------------------------------------------------------------*/
+
+static bool any_free_cblocks(struct mq_policy *mq)
+{
+	return mq->nr_cblocks_allocated < mq->cache_size;
+}
+
+/*
+ * Fills result out with a cache block that isn't in use, or return
+ * -ENOSPC.  This does _not_ mark the cblock as allocated, the caller is
+ * responsible for that.
+ */
+static int __find_free_cblock(struct mq_policy *mq, unsigned begin, unsigned end,
+			      dm_cblock_t *result, unsigned *last_word)
+{
+	int r = -ENOSPC;
+	unsigned w;
+
+	for (w = begin; w < end; w++) {
+		/*
+		 * ffz is undefined if no zero exists
+		 */
+		if (mq->allocation_bitset[w] != ~0UL) {
+			*last_word = w;
+			*result = (w * BITS_PER_LONG) + ffz(mq->allocation_bitset[w]);
+			if (*result < mq->cache_size)
+				r = 0;
+
+			break;
+		}
+	}
+
+	return r;
+}
+
+static int find_free_cblock(struct mq_policy *mq, dm_cblock_t *result)
+{
+	int r;
+
+	if (!any_free_cblocks(mq))
+		return -ENOSPC;
+
+	r = __find_free_cblock(mq, mq->find_free_last_word, mq->find_free_nr_words, result, &mq->find_free_last_word);
+	if (r == -ENOSPC && mq->find_free_last_word)
+		r = __find_free_cblock(mq, 0, mq->find_free_last_word, result, &mq->find_free_last_word);
+
+	return r;
+}
+
+static void alloc_cblock(struct mq_policy *mq, dm_cblock_t cblock)
+{
+	BUG_ON(cblock >= mq->cache_size);
+	BUG_ON(test_bit(cblock, mq->allocation_bitset));
+
+	set_bit(cblock, mq->allocation_bitset);
+	mq->nr_cblocks_allocated++;
+}
+
+static void free_cblock(struct mq_policy *mq, dm_cblock_t cblock)
+{
+	BUG_ON(cblock >= mq->cache_size);
+	BUG_ON(!test_bit(cblock, mq->allocation_bitset));
+
+	clear_bit(cblock, mq->allocation_bitset);
+	mq->nr_cblocks_allocated--;
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * The queue level is based on the log2 of the hit count.
+ */
+static unsigned queue_level(struct entry *e)
+{
+	return min((unsigned) ilog2(e->hit_count + 1), NR_QUEUE_LEVELS - 1u);
+}
+
+static struct queue *entry_queue(struct mq_policy *mq, struct entry *e)
+{
+	if (!e->in_cache)
+		return &mq->pre_cache;
+
+	return e->dirty ? &mq->cache_dirty : &mq->cache_clean;
+}
+
+/*
+ * Inserts the entry into the pre_cache or the cache.  Ensures the cache
+ * block is marked as allocated if necc.  Inserts into the hash table.
+ * Sets the tick which records when the entry was last moved about.
+ */
+static void push(struct mq_policy *mq, struct entry *e)
+{
+	e->tick = mq->tick;
+	hash_insert(mq, e);
+
+	if (e->in_cache)
+		alloc_cblock(mq, e->cblock);
+
+	queue_push(entry_queue(mq, e), queue_level(e), &e->list);
+}
+
+/*
+ * Removes an entry from pre_cache or cache.  Removes from the hash table.
+ * Frees off the cache block if necc.
+ */
+static void del(struct mq_policy *mq, struct entry *e)
+{
+	queue_remove(&e->list);
+	hash_remove(e);
+	if (e->in_cache)
+		free_cblock(mq, e->cblock);
+}
+
+/*
+ * Like del, except it removes the first entry in the queue (ie. the LRU).
+ */
+static struct entry *pop(struct mq_policy *mq, struct queue *q)
+{
+	struct entry *e;
+	struct list_head *h = queue_pop(q);
+
+	if (!h)
+		return NULL;
+
+	e = container_of(h, struct entry, list);
+	hash_remove(e);
+
+	if (e->in_cache)
+		free_cblock(mq, e->cblock);
+
+	return e;
+}
+
+/*
+ * Moves an entry to the back of its level, or to a new level if its hit
+ * count has changed.
+ */
+static void requeue_and_update_tick(struct mq_policy *mq, struct entry *e)
+{
+	e->tick = mq->tick;
+	list_move_tail(&e->list, entry_queue(mq, e)->qs + queue_level(e));
+}
+
+/*
+ * Halves the hit counts of everything in a queue, re-levelling as we go.
+ */
+static void age_queue(struct queue *q)
+{
+	unsigned level;
+	struct entry *e, *tmp;
+	LIST_HEAD(all);
+
+	for (level = 0; level < NR_QUEUE_LEVELS; level++)
+		list_splice_tail_init(q->qs + level, &all);
+
+	list_for_each_entry_safe(e, tmp, &all, list) {
+		e->hit_count >>= 1;
+		list_move_tail(&e->list, q->qs + queue_level(e));
+	}
+}
+
+/*
+ * Each generation the hit counts are halved, so old hotspots cool down
+ * and make way for new ones.
+ */
+static void check_generation(struct mq_policy *mq)
+{
+	if (++mq->hit_count < mq->generation_period)
+		return;
+
+	mq->hit_count = 0;
+	mq->generation++;
+
+	age_queue(&mq->pre_cache);
+	age_queue(&mq->cache_clean);
+	age_queue(&mq->cache_dirty);
+}
+
+/*
+ * Whenever we use an entry we bump up its hit counter, and push it to the
+ * back of its current level.  Hits within the same tick only count once.
+ */
+static void hit(struct mq_policy *mq, struct entry *e)
+{
+	if (e->tick != mq->tick)
+		e->hit_count++;
+
+	requeue_and_update_tick(mq, e);
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * The promotion threshold is the hit count of the block we'd evict to
+ * make room, clean blocks being preferred as they need no writeback.
+ */
+static struct entry *peek_victim(struct mq_policy *mq)
+{
+	struct list_head *h = queue_peek(&mq->cache_clean);
+
+	if (!h)
+		h = queue_peek(&mq->cache_dirty);
+
+	return h ? container_of(h, struct entry, list) : NULL;
+}
+
+static bool should_promote(struct mq_policy *mq, struct entry *e,
+			   int data_dir)
+{
+	struct entry *victim;
+
+	if (any_free_cblocks(mq))
+		return true;
+
+	victim = peek_victim(mq);
+	if (!victim)
+		return false;
+
+	return e->hit_count >= victim->hit_count + mq->promote_adjustment[data_dir];
+}
+
+/*
+ * Demotes the coldest cache entry, turning it back into a pre_cache entry
+ * so its history is remembered.  Returns the demoted entry.
+ */
+static struct entry *demote_cblock(struct mq_policy *mq)
+{
+	struct entry *demoted = pop(mq, &mq->cache_clean);
+
+	if (!demoted)
+		demoted = pop(mq, &mq->cache_dirty);
+
+	if (!demoted)
+		return NULL;
+
+	demoted->in_cache = false;
+	demoted->dirty = false;
+	push(mq, demoted);
+
+	return demoted;
+}
+
+/*
+ * Moves a pre_cache entry into the cache, demoting something if needs be.
+ */
+static void promote(struct mq_policy *mq, struct entry *e,
+		    struct policy_result *result)
+{
+	int r;
+	dm_cblock_t cblock;
+
+	del(mq, e);
+
+	r = find_free_cblock(mq, &cblock);
+	if (!r)
+		result->op = POLICY_NEW;
+
+	else {
+		struct entry *demoted = demote_cblock(mq);
+
+		BUG_ON(!demoted);
+		result->op = POLICY_REPLACE;
+		result->old_oblock = demoted->oblock;
+		cblock = demoted->cblock;
+	}
+
+	e->in_cache = true;
+	e->dirty = false;
+	e->cblock = cblock;
+	push(mq, e);
+
+	result->cblock = cblock;
+}
+
+/*
+ * Gets an entry for a block we've never seen before, recycling the
+ * coldest pre_cache entry if they're all in use.
+ */
+static struct entry *new_pre_cache_entry(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	struct entry *e = alloc_entry(mq);
+
+	if (!e) {
+		e = pop(mq, &mq->pre_cache);
+		if (!e)
+			return NULL;
+	}
+
+	e->in_cache = false;
+	e->dirty = false;
+	e->oblock = oblock;
+	e->hit_count = 1;
+	push(mq, e);
+
+	return e;
+}
+
+/*
+ * Lookups that can't block only ever resolve hits; everything else is
+ * left untouched so the caller can retry from a context that may block.
+ */
+static int map(struct mq_policy *mq, dm_oblock_t oblock,
+	       bool can_block, bool can_migrate, struct bio *bio,
+	       struct policy_result *result)
+{
+	struct entry *e = hash_lookup(mq, oblock);
+
+	if (e && e->in_cache) {
+		iot_examine_bio(&mq->tracker, bio);
+		hit(mq, e);
+		check_generation(mq);
+		result->op = POLICY_HIT;
+		result->cblock = e->cblock;
+		return 0;
+	}
+
+	if (!can_block)
+		return -EWOULDBLOCK;
+
+	iot_examine_bio(&mq->tracker, bio);
+
+	/*
+	 * Don't let sequential io pollute the cache.
+	 */
+	if (iot_pattern(&mq->tracker) == PATTERN_SEQUENTIAL) {
+		result->op = POLICY_MISS;
+		return 0;
+	}
+
+	if (e) {
+		hit(mq, e);
+		check_generation(mq);
+	} else {
+		e = new_pre_cache_entry(mq, oblock);
+		if (!e) {
+			result->op = POLICY_MISS;
+			return 0;
+		}
+	}
+
+	/*
+	 * Without permission to migrate the block just stays on the
+	 * origin; its hit count carries on growing, so it'll be
+	 * considered again next time.
+	 */
+	if (!can_migrate || !should_promote(mq, e, bio_data_dir(bio))) {
+		result->op = POLICY_MISS;
+		return 0;
+	}
+
+	promote(mq, e, result);
+
+	return 0;
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Public interface, via the policy struct.  See dm-cache-policy.h for a
+ * description of these.
+ */
+
+static struct mq_policy *to_mq_policy(struct dm_cache_policy *p)
+{
+	return container_of(p, struct mq_policy, policy);
+}
+
+static void mq_destroy(struct dm_cache_policy *p)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	unsigned level;
+
+	for (level = 0; level < NR_QUEUE_LEVELS; level++) {
+		list_splice_init(mq->pre_cache.qs + level, &mq->free);
+		list_splice_init(mq->cache_clean.qs + level, &mq->free);
+		list_splice_init(mq->cache_dirty.qs + level, &mq->free);
+	}
+	free_entries(mq);
+
+	vfree(mq->table);
+	free_bitset(mq->allocation_bitset);
+	kfree(mq);
+}
+
+static int mq_map(struct dm_cache_policy *p, dm_oblock_t oblock,
+		  bool can_block, bool can_migrate, struct bio *bio,
+		  struct policy_result *result)
+{
+	int r;
+	struct mq_policy *mq = to_mq_policy(p);
+
+	result->op = POLICY_MISS;
+
+	if (can_block)
+		mutex_lock(&mq->lock);
+	else if (!mutex_trylock(&mq->lock))
+		return -EWOULDBLOCK;
+
+	r = map(mq, oblock, can_block, can_migrate, bio, result);
+
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+static int mq_lookup(struct dm_cache_policy *p, dm_oblock_t oblock, dm_cblock_t *cblock)
+{
+	int r;
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	if (!mutex_trylock(&mq->lock))
+		return -EWOULDBLOCK;
+
+	e = hash_lookup(mq, oblock);
+	if (e && e->in_cache) {
+		*cblock = e->cblock;
+		r = 0;
+	} else
+		r = -ENOENT;
+
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+/*
+ * The core target may race a dirty update against the demotion of the
+ * block (the demotion gets backed out again with force_mapping()), so an
+ * entry that isn't in the cache is silently ignored.
+ */
+static void __mq_set_clear_dirty(struct mq_policy *mq, dm_oblock_t oblock, bool set)
+{
+	struct entry *e;
+
+	e = hash_lookup(mq, oblock);
+	if (!e || !e->in_cache || e->dirty == set)
+		return;
+
+	del(mq, e);
+	e->dirty = set;
+	push(mq, e);
+}
+
+static void mq_set_dirty(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	mutex_lock(&mq->lock);
+	__mq_set_clear_dirty(mq, oblock, true);
+	mutex_unlock(&mq->lock);
+}
+
+static void mq_clear_dirty(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	mutex_lock(&mq->lock);
+	__mq_set_clear_dirty(mq, oblock, false);
+	mutex_unlock(&mq->lock);
+}
+
+static int mq_load_mapping(struct dm_cache_policy *p,
+			   dm_oblock_t oblock, dm_cblock_t cblock,
+			   uint32_t hint, bool hint_valid)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	e = alloc_entry(mq);
+	if (!e)
+		return -ENOMEM;
+
+	e->cblock = cblock;
+	e->oblock = oblock;
+	e->in_cache = true;
+	e->dirty = false;	/* this gets corrected in a minute */
+	e->hit_count = hint_valid ? hint : 1;
+	push(mq, e);
+
+	return 0;
+}
+
+static int mq_save_hints(struct mq_policy *mq, struct queue *q,
+			 policy_walk_fn fn, void *context)
+{
+	int r;
+	unsigned level;
+	struct entry *e;
+
+	for (level = 0; level < NR_QUEUE_LEVELS; level++)
+		list_for_each_entry(e, q->qs + level, list) {
+			r = fn(context, e->cblock, e->oblock, e->hit_count);
+			if (r)
+				return r;
+		}
+
+	return 0;
+}
+
+static int mq_walk_mappings(struct dm_cache_policy *p, policy_walk_fn fn,
+			    void *context)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	int r = 0;
+
+	mutex_lock(&mq->lock);
+
+	r = mq_save_hints(mq, &mq->cache_clean, fn, context);
+	if (!r)
+		r = mq_save_hints(mq, &mq->cache_dirty, fn, context);
+
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+static void mq_remove_mapping(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	mutex_lock(&mq->lock);
+
+	e = hash_lookup(mq, oblock);
+	BUG_ON(!e || !e->in_cache);
+
+	del(mq, e);
+	e->in_cache = false;
+	e->dirty = false;
+	push(mq, e);
+
+	mutex_unlock(&mq->lock);
+}
+
+/*
+ * Points the cache entry for @current_oblock at @new_oblock instead.  Used
+ * to undo a POLICY_REPLACE, so the pre_cache entry the demoted block was
+ * turned into is given back the promoted block's identity.
+ */
+static void mq_force_mapping(struct dm_cache_policy *p,
+			     dm_oblock_t current_oblock, dm_oblock_t new_oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e, *pe;
+
+	mutex_lock(&mq->lock);
+
+	e = hash_lookup(mq, current_oblock);
+	BUG_ON(!e || !e->in_cache);
+
+	pe = hash_lookup(mq, new_oblock);
+	if (pe) {
+		BUG_ON(pe->in_cache);
+		del(mq, pe);
+		pe->oblock = current_oblock;
+		push(mq, pe);
+	}
+
+	del(mq, e);
+	e->oblock = new_oblock;
+	e->dirty = false;
+	push(mq, e);
+
+	mutex_unlock(&mq->lock);
+}
+
+static int mq_writeback_work(struct dm_cache_policy *p, dm_oblock_t *oblock,
+			     dm_cblock_t *cblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+	int r = -ENODATA;
+
+	mutex_lock(&mq->lock);
+
+	e = pop(mq, &mq->cache_dirty);
+	if (e) {
+		*oblock = e->oblock;
+		*cblock = e->cblock;
+		e->dirty = false;
+		push(mq, e);
+		r = 0;
+	}
+
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+static dm_cblock_t mq_residency(struct dm_cache_policy *p)
+{
+	dm_cblock_t r;
+	struct mq_policy *mq = to_mq_policy(p);
+
+	mutex_lock(&mq->lock);
+	r = mq->nr_cblocks_allocated;
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+static void mq_tick(struct dm_cache_policy *p)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	mutex_lock(&mq->lock);
+	mq->tick++;
+	mutex_unlock(&mq->lock);
+}
+
+static int mq_set_config_value(struct dm_cache_policy *p,
+			       const char *key, const char *value)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	enum io_pattern pattern;
+	unsigned long tmp;
+
+	if (!strcasecmp(key, "random_threshold"))
+		pattern = PATTERN_RANDOM;
+	else if (!strcasecmp(key, "sequential_threshold"))
+		pattern = PATTERN_SEQUENTIAL;
+	else
+		return -EINVAL;
+
+	if (kstrtoul(value, 10, &tmp) || !tmp || tmp > UINT_MAX)
+		return -EINVAL;
+
+	mutex_lock(&mq->lock);
+	mq->tracker.thresholds[pattern] = tmp;
+	mutex_unlock(&mq->lock);
+
+	return 0;
+}
+
+static int mq_emit_config_values(struct dm_cache_policy *p, char *result, unsigned maxlen)
+{
+	unsigned sz = 0;
+	struct mq_policy *mq = to_mq_policy(p);
+
+	DMEMIT("4 random_threshold %u sequential_threshold %u",
+	       mq->tracker.thresholds[PATTERN_RANDOM],
+	       mq->tracker.thresholds[PATTERN_SEQUENTIAL]);
+
+	return 0;
+}
+
+/* Init the policy plugin interface function pointers. */
+static void init_policy_functions(struct mq_policy *mq)
+{
+	mq->policy.destroy = mq_destroy;
+	mq->policy.map = mq_map;
+	mq->policy.lookup = mq_lookup;
+	mq->policy.set_dirty = mq_set_dirty;
+	mq->policy.clear_dirty = mq_clear_dirty;
+	mq->policy.load_mapping = mq_load_mapping;
+	mq->policy.walk_mappings = mq_walk_mappings;
+	mq->policy.remove_mapping = mq_remove_mapping;
+	mq->policy.force_mapping = mq_force_mapping;
+	mq->policy.writeback_work = mq_writeback_work;
+	mq->policy.residency = mq_residency;
+	mq->policy.tick = mq_tick;
+	mq->policy.emit_config_values = mq_emit_config_values;
+	mq->policy.set_config_value = mq_set_config_value;
+}
+
+static struct dm_cache_policy *mq_create(dm_cblock_t cache_size,
+					 sector_t origin_size,
+					 sector_t cache_block_size)
+{
+	unsigned i;
+	struct mq_policy *mq = kzalloc(sizeof(*mq), GFP_KERNEL);
+
+	if (!mq)
+		return NULL;
+
+	init_policy_functions(mq);
+	iot_init(&mq->tracker, SEQUENTIAL_THRESHOLD_DEFAULT, RANDOM_THRESHOLD_DEFAULT);
+
+	mq->cache_size = cache_size;
+	mq->tick = 0;
+	mq->hit_count = 0;
+	mq->generation = 0;
+	mq->promote_adjustment[READ] = READ_PROMOTE_ADJUSTMENT;
+	mq->promote_adjustment[WRITE] = WRITE_PROMOTE_ADJUSTMENT;
+	mutex_init(&mq->lock);
+
+	queue_init(&mq->pre_cache);
+	queue_init(&mq->cache_clean);
+	queue_init(&mq->cache_dirty);
+
+	mq->generation_period = max((unsigned) cache_size, 1024U);
+
+	mq->nr_entries = 2 * cache_size;
+	if (alloc_entries(mq, mq->nr_entries))
+		goto bad_cache_alloc;
+
+	mq->nr_buckets = next_power(cache_size / 2, 16);
+	mq->hash_bits = ffs(mq->nr_buckets) - 1;
+	mq->table = vzalloc(sizeof(*mq->table) * mq->nr_buckets);
+	if (!mq->table)
+		goto bad_alloc_table;
+
+	for (i = 0; i < mq->nr_buckets; i++)
+		INIT_HLIST_HEAD(mq->table + i);
+
+	mq->find_free_nr_words = dm_div_up(cache_size, BITS_PER_LONG);
+	mq->find_free_last_word = 0;
+	mq->allocation_bitset = alloc_bitset(cache_size);
+	if (!mq->allocation_bitset)
+		goto bad_alloc_bitset;
+
+	return &mq->policy;
+
+bad_alloc_bitset:
+	vfree(mq->table);
+bad_alloc_table:
+bad_cache_alloc:
+	free_entries(mq);
+	kfree(mq);
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------*/
+
+static struct dm_cache_policy_type mq_policy_type = {
+	.name = "mq",
+	.hint_size = 4,
+	.owner = THIS_MODULE,
+	.create = mq_create
+};
+
+static struct dm_cache_policy_type default_policy_type = {
+	.name = "default",
+	.hint_size = 4,
+	.owner = THIS_MODULE,
+	.create = mq_create
+};
+
+static int __init mq_init(void)
+{
+	int r;
+
+	mq_entry_cache = kmem_cache_create("dm_mq_policy_cache_entry",
+					   sizeof(struct entry),
+					   __alignof__(struct entry),
+					   0, NULL);
+	if (!mq_entry_cache)
+		goto bad;
+
+	r = dm_cache_policy_register(&mq_policy_type);
+	if (r) {
+		DMERR("register failed %d", r);
+		goto bad_register_mq;
+	}
+
+	r = dm_cache_policy_register(&default_policy_type);
+	if (!r) {
+		DMINFO("version %u.%u.%u loaded", 1, 0, 0);
+		return 0;
+	}
+
+	DMERR("register failed (as default) %d", r);
+
+	dm_cache_policy_unregister(&mq_policy_type);
+bad_register_mq:
+	kmem_cache_destroy(mq_entry_cache);
+bad:
+	return -ENOMEM;
+}
+
+static void __exit mq_exit(void)
+{
+	dm_cache_policy_unregister(&mq_policy_type);
+	dm_cache_policy_unregister(&default_policy_type);
+
+	kmem_cache_destroy(mq_entry_cache);
+}
+
+module_init(mq_init);
+module_exit(mq_exit);
+
+MODULE_AUTHOR("Joe Thornber <dm-devel@redhat.com>");
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("mq cache policy");
+
+MODULE_ALIAS("dm-cache-default");
@@ -0,0 +1,2156 @@
+/*
+ * Copyright (C) 2012 Red Hat. All rights reserved.
+ *
+ * This file is released under the GPL.
+ */
+
+#include "dm.h"
+#include "dm-bio-prison.h"
+#include "dm-bio-record.h"
+#include "dm-cache-metadata.h"
+
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+#include <linux/init.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache"
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Glossary:
+ *
+ * oblock: index of an origin block
+ * cblock: index of a cache block
+ * promotion: movement of a block from origin to cache
+ * demotion: movement of a block from cache to origin
+ * migration: movement of a block between the origin and cache device,
+ *	      either direction
+ */
+
+/*
+ * Tunable constants
+ */
+#define ENDIO_HOOK_POOL_SIZE 1024
+#define MIGRATION_POOL_SIZE 128
+#define COMMIT_PERIOD HZ
+#define MIGRATION_COUNT_WINDOW 10
+
+/*
+ * The block size of the device holding cache data must be >= 32KB
+ */
+#define DATA_DEV_BLOCK_SIZE_MIN_SECTORS (32 * 1024 >> SECTOR_SHIFT)
+#define DATA_DEV_BLOCK_SIZE_MAX_SECTORS (1024 * 1024 * 1024 >> SECTOR_SHIFT)
+
+/*
+ * Sectors of copying allowed to be in flight at once, unless changed
+ * with the migration_threshold key.
+ */
+#define MIGRATION_THRESHOLD_DEFAULT 2048
+
+/*
+ * The cell size must be big enough to hold every bio that could be
+ * stalled behind a migration at once.
+ */
+#define PRISON_CELLS 1024
+
+struct cache_features {
+	bool write_through:1;
+};
+
+struct cache_stats {
+	atomic_t read_hit;
+	atomic_t read_miss;
+	atomic_t write_hit;
+	atomic_t write_miss;
+	atomic_t demotion;
+	atomic_t promotion;
+	atomic_t copies_avoided;
+	atomic_t cache_cell_clash;
+	atomic_t commit_count;
+};
+
+struct cache {
+	struct dm_target *ti;
+	struct dm_target_callbacks callbacks;
+
+	/*
+	 * Metadata is written to this device.
+	 */
+	struct dm_dev *metadata_dev;
+
+	/*
+	 * The slower of the two data devices.  Typically a spindle.
+	 */
+	struct dm_dev *origin_dev;
+
+	/*
+	 * The faster of the two data devices.  Typically an SSD.
+	 */
+	struct dm_dev *cache_dev;
+
+	/*
+	 * Cache features such as write-through.
+	 */
+	struct cache_features features;
+
+	/*
+	 * Size of the origin device in _complete_ blocks.  The partial
+	 * block at the end, if any, is never cached.
+	 */
+	dm_oblock_t origin_blocks;
+
+	/*
+	 * Size of the cache device in blocks.
+	 */
+	dm_cblock_t cache_size;
+
+	/*
+	 * Fields for converting from sectors to blocks.
+	 */
+	sector_t sectors_per_block;
+	int sectors_per_block_shift;
+
+	struct dm_cache_metadata *cmd;
+
+	spinlock_t lock;
+	struct bio_list deferred_bios;
+	struct bio_list deferred_flush_bios;
+	struct bio_list deferred_writethrough_bios;
+	struct list_head quiesced_migrations;
+	struct list_head completed_migrations;
+	struct list_head need_commit_migrations;
+	sector_t migration_threshold;
+	atomic_t nr_migrations;
+	wait_queue_head_t migration_wait;
+
+	/*
+	 * One bit per cache block; set while the block on the cache
+	 * device is newer than the one on the origin.
+	 */
+	unsigned long *dirty_bitset;
+	atomic_t nr_dirty;
+
+	struct dm_kcopyd_client *copier;
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+
+	struct delayed_work waker;
+	unsigned long last_commit_jiffies;
+
+	struct dm_bio_prison *prison;
+	struct dm_deferred_set *all_io_ds;
+
+	mempool_t *endio_hook_pool;
+	mempool_t *migration_pool;
+	struct dm_cache_migration *next_migration;
+
+	struct dm_cache_policy *policy;
+
+	bool loaded_mappings;
+	bool commit_requested;
+	bool quiescing;
+
+	struct cache_stats stats;
+};
+
+/*
+ * Every bio passing through the target carries one of these, via
+ * map_context->ptr, so the end_io method can drop its entry in the
+ * all_io deferred set.
+ */
+struct endio_hook {
+	struct cache *cache;
+	struct dm_deferred_entry *all_io_entry;
+
+	/*
+	 * Only used for writes in write-through mode.
+	 */
+	dm_cblock_t cblock;
+	bio_end_io_t *saved_bi_end_io;
+	void *saved_bi_private;
+	struct dm_bio_details bio_details;
+};
+
+struct dm_cache_migration {
+	struct list_head list;
+	struct cache *cache;
+
+	unsigned long start_jiffies;
+	dm_oblock_t old_oblock;
+	dm_oblock_t new_oblock;
+	dm_cblock_t cblock;
+
+	bool err:1;
+	bool writeback:1;
+	bool demote:1;
+	bool promote:1;
+
+	struct dm_bio_prison_cell *old_ocell;
+	struct dm_bio_prison_cell *new_ocell;
+};
+
+static void wake_worker(struct cache *cache)
+{
+	queue_work(cache->wq, &cache->worker);
+}
+
+/*----------------------------------------------------------------*/
+
+static struct kmem_cache *_endio_hook_cache;
+static struct kmem_cache *_migration_cache;
+
+static struct endio_hook *hook_bio(struct cache *cache, struct bio *bio,
+				   gfp_t gfp)
+{
+	struct endio_hook *h = mempool_alloc(cache->endio_hook_pool, gfp);
+
+	if (h) {
+		h->cache = cache;
+		h->all_io_entry = NULL;
+	}
+
+	return h;
+}
+
+static struct dm_cache_migration *alloc_migration(struct cache *cache)
+{
+	/* FIXME: change to use a local slab. */
+	return mempool_alloc(cache->migration_pool, GFP_NOWAIT);
+}
+
+static void free_migration(struct dm_cache_migration *mg)
+{
+	mempool_free(mg, mg->cache->migration_pool);
+}
+
+/*
+ * Migrations are allocated ahead of time, in the worker, so that
+ * processing a bio never has to back out half way through because it
+ * couldn't get one.
+ */
+static int ensure_next_migration(struct cache *cache)
+{
+	if (cache->next_migration)
+		return 0;
+
+	cache->next_migration = alloc_migration(cache);
+	return cache->next_migration ? 0 : -ENOMEM;
+}
+
+static struct dm_cache_migration *get_next_migration(struct cache *cache)
+{
+	struct dm_cache_migration *mg = cache->next_migration;
+
+	BUG_ON(!mg);
+	cache->next_migration = NULL;
+
+	memset(mg, 0, sizeof(*mg));
+	mg->cache = cache;
+	mg->start_jiffies = jiffies;
+
+	return mg;
+}
+
+/*----------------------------------------------------------------*/
+
+static void build_key(dm_oblock_t oblock, struct dm_cell_key *key)
+{
+	key->virtual = 0;
+	key->dev = 0;
+	key->block = oblock;
+}
+
+/*
+ * Locks the cell for @oblock, placing @bio in it.  A NULL @bio just locks
+ * the cell; it's used to hold off io to a block that's being demoted or
+ * written back.  Returns 1 if the cell was already held.
+ */
+static int bio_detain(struct cache *cache, dm_oblock_t oblock,
+		      struct bio *bio, struct dm_bio_prison_cell **result)
+{
+	struct dm_cell_key key;
+
+	build_key(oblock, &key);
+	return dm_bio_detain(cache->prison, &key, bio, result);
+}
+
+/*
+ * Releases a cell, queueing any bios that were waiting on it for the
+ * worker to look at again.  @holder says whether the bio holding the cell
+ * should be requeued too, or has already been dealt with.
+ */
+static void cell_defer(struct cache *cache, struct dm_bio_prison_cell *cell,
+		       bool holder)
+{
+	unsigned long flags;
+	struct bio_list bios;
+
+	bio_list_init(&bios);
+	if (holder)
+		dm_cell_release(cell, &bios);
+	else
+		dm_cell_release_no_holder(cell, &bios);
+
+	if (bio_list_empty(&bios))
+		return;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&cache->deferred_bios, &bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+/*----------------------------------------------------------------*/
+
+static bool is_dirty(struct cache *cache, dm_cblock_t b)
+{
+	return test_bit(b, cache->dirty_bitset);
+}
+
+static void set_dirty(struct cache *cache, dm_oblock_t oblock, dm_cblock_t cblock)
+{
+	if (!test_and_set_bit(cblock, cache->dirty_bitset)) {
+		atomic_inc(&cache->nr_dirty);
+		policy_set_dirty(cache->policy, oblock);
+	}
+}
+
+static void clear_dirty(struct cache *cache, dm_oblock_t oblock, dm_cblock_t cblock)
+{
+	if (test_and_clear_bit(cblock, cache->dirty_bitset)) {
+		policy_clear_dirty(cache->policy, oblock);
+		atomic_dec(&cache->nr_dirty);
+	}
+}
+
+/*
+ * Undoes a POLICY_REPLACE, putting @old_oblock back in @cblock.
+ * force_mapping() leaves the entry clean, so the dirty state has to be
+ * restored from our bitset.
+ */
+static void revert_replace(struct cache *cache, dm_oblock_t new_oblock,
+			   dm_oblock_t old_oblock, dm_cblock_t cblock)
+{
+	policy_force_mapping(cache->policy, new_oblock, old_oblock);
+	if (is_dirty(cache, cblock))
+		policy_set_dirty(cache->policy, old_oblock);
+}
+
+/*----------------------------------------------------------------*/
+
+static bool writethrough_mode(struct cache_features *f)
+{
+	return f->write_through;
+}
+
+static dm_oblock_t get_bio_block(struct cache *cache, struct bio *bio)
+{
+	return bio->bi_sector >> cache->sectors_per_block_shift;
+}
+
+static void remap_to_origin(struct cache *cache, struct bio *bio)
+{
+	bio->bi_bdev = cache->origin_dev->bdev;
+}
+
+static void remap_to_cache(struct cache *cache, struct bio *bio,
+			   dm_cblock_t cblock)
+{
+	sector_t bi_sector = bio->bi_sector;
+
+	bio->bi_bdev = cache->cache_dev->bdev;
+	bio->bi_sector = ((sector_t) cblock << cache->sectors_per_block_shift) |
+		(bi_sector & (cache->sectors_per_block - 1));
+}
+
+static void inc_hit_counter(struct cache *cache, struct bio *bio)
+{
+	atomic_inc(bio_data_dir(bio) == READ ?
+		   &cache->stats.read_hit : &cache->stats.write_hit);
+}
+
+static void inc_miss_counter(struct cache *cache, struct bio *bio)
+{
+	atomic_inc(bio_data_dir(bio) == READ ?
+		   &cache->stats.read_miss : &cache->stats.write_miss);
+}
+
+/*
+ * In write-through mode a write to a cached block goes to the origin
+ * first.  When that completes writethrough_endio() sends the same bio on
+ * to the cache device, via the worker, before completing it.
+ */
+static void writethrough_endio(struct bio *bio, int err)
+{
+	unsigned long flags;
+	struct endio_hook *h = bio->bi_private;
+	struct cache *cache = h->cache;
+
+	bio->bi_end_io = h->saved_bi_end_io;
+	bio->bi_private = h->saved_bi_private;
+
+	if (err) {
+		bio_endio(bio, err);
+		return;
+	}
+
+	dm_bio_restore(&h->bio_details, bio);
+	remap_to_cache(cache, bio, h->cblock);
+
+	/*
+	 * We can't issue this bio directly, since we're in interrupt
+	 * context.  So it gets put on a bio list for processing by the
+	 * worker thread.
+	 */
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_add(&cache->deferred_writethrough_bios, bio);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+static void remap_to_origin_then_cache(struct cache *cache, struct bio *bio,
+				       struct endio_hook *h, dm_cblock_t cblock)
+{
+	h->cblock = cblock;
+	h->saved_bi_end_io = bio->bi_end_io;
+	h->saved_bi_private = bio->bi_private;
+	dm_bio_record(&h->bio_details, bio);
+
+	bio->bi_end_io = writethrough_endio;
+	bio->bi_private = h;
+	remap_to_origin(cache, bio);
+}
+
+/*
+ * Remaps a bio that hit the cache.  The caller must hold the cell for
+ * the block, so the dirty bit can't race with a writeback of it.
+ */
+static void remap_hit(struct cache *cache, struct bio *bio,
+		      struct endio_hook *h, dm_oblock_t oblock,
+		      dm_cblock_t cblock)
+{
+	if (bio_data_dir(bio) == WRITE) {
+		if (writethrough_mode(&cache->features)) {
+			remap_to_origin_then_cache(cache, bio, h, cblock);
+			return;
+		}
+
+		set_dirty(cache, oblock, cblock);
+	}
+
+	remap_to_cache(cache, bio, cblock);
+}
+
+/*
+ * Flushes and FUA writes are held back until the metadata has been
+ * committed.
+ */
+static void issue(struct cache *cache, struct bio *bio)
+{
+	unsigned long flags;
+
+	if (!(bio->bi_rw & (REQ_FLUSH | REQ_FUA))) {
+		generic_make_request(bio);
+		return;
+	}
+
+	/*
+	 * Batch together any bios that trigger commits and then issue a
+	 * single commit for them in do_worker().
+	 */
+	spin_lock_irqsave(&cache->lock, flags);
+	cache->commit_requested = true;
+	bio_list_add(&cache->deferred_flush_bios, bio);
+	spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+static void defer_bio(struct cache *cache, struct bio *bio)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_add(&cache->deferred_bios, bio);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+/*----------------------------------------------------------------
+ * Migration processing
+ *
+ * Migration covers moving data from the origin device to the cache, or
+ * vice versa.  A migration goes through these stages:
+ *
+ * - quiescing: waiting for all io in flight to the cache to complete,
+ *   using the all_io deferred set.
+ * - copying: kcopyd moves the block.  Skipped when demoting or writing
+ *   back a clean block.
+ * - pre-commit: the new mapping is recorded in the metadata.
+ * - post-commit: once the metadata has been committed the cells are
+ *   released.
+ *--------------------------------------------------------------*/
+static void inc_nr_migrations(struct cache *cache)
+{
+	atomic_inc(&cache->nr_migrations);
+}
+
+static void dec_nr_migrations(struct cache *cache)
+{
+	atomic_dec(&cache->nr_migrations);
+
+	/*
+	 * Wake the worker in case we're suspending the target.
+	 */
+	wake_up(&cache->migration_wait);
+}
+
+static void cleanup_migration(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	free_migration(mg);
+	dec_nr_migrations(cache);
+}
+
+static void migration_failure(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	if (mg->writeback) {
+		/*
+		 * The policy marked the block clean when it handed it
+		 * out; our dirty bit is still set.
+		 */
+		policy_set_dirty(cache->policy, mg->old_oblock);
+		cell_defer(cache, mg->old_ocell, false);
+
+	} else if (mg->demote) {
+		revert_replace(cache, mg->new_oblock, mg->old_oblock, mg->cblock);
+		cell_defer(cache, mg->old_ocell, false);
+		if (mg->promote)
+			cell_defer(cache, mg->new_ocell, true);
+
+	} else {
+		policy_remove_mapping(cache->policy, mg->new_oblock);
+		cell_defer(cache, mg->new_ocell, true);
+	}
+
+	cleanup_migration(mg);
+}
+
+static void migration_success_pre_commit(struct dm_cache_migration *mg)
+{
+	unsigned long flags;
+	struct cache *cache = mg->cache;
+
+	if (mg->writeback) {
+		clear_dirty(cache, mg->old_oblock, mg->cblock);
+		cell_defer(cache, mg->old_ocell, false);
+		cleanup_migration(mg);
+		return;
+
+	} else if (mg->demote) {
+		if (dm_cache_remove_mapping(cache->cmd, mg->cblock)) {
+			DMWARN_LIMIT("demotion failed; couldn't update on disk metadata");
+			migration_failure(mg);
+			return;
+		}
+
+		/*
+		 * The origin is now up to date, and the policy has
+		 * already given the cblock to the new block.
+		 */
+		if (test_and_clear_bit(mg->cblock, cache->dirty_bitset))
+			atomic_dec(&cache->nr_dirty);
+
+	} else {
+		if (dm_cache_insert_mapping(cache->cmd, mg->cblock, mg->new_oblock)) {
+			DMWARN_LIMIT("promotion failed; couldn't update on disk metadata");
+			migration_failure(mg);
+			return;
+		}
+	}
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_add_tail(&mg->list, &cache->need_commit_migrations);
+	cache->commit_requested = true;
+	spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+static void migration_success_post_commit(struct dm_cache_migration *mg)
+{
+	unsigned long flags;
+	struct cache *cache = mg->cache;
+
+	if (mg->writeback) {
+		DMWARN("writeback unexpectedly triggered commit");
+		return;
+
+	} else if (mg->demote) {
+		cell_defer(cache, mg->old_ocell, false);
+
+		if (mg->promote) {
+			mg->demote = false;
+
+			spin_lock_irqsave(&cache->lock, flags);
+			list_add_tail(&mg->list, &cache->quiesced_migrations);
+			spin_unlock_irqrestore(&cache->lock, flags);
+
+		} else
+			cleanup_migration(mg);
+
+	} else {
+		cell_defer(cache, mg->new_ocell, true);
+		cleanup_migration(mg);
+	}
+}
+
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	unsigned long flags;
+	struct dm_cache_migration *mg = (struct dm_cache_migration *) context;
+	struct cache *cache = mg->cache;
+
+	if (read_err || write_err)
+		mg->err = true;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_add_tail(&mg->list, &cache->completed_migrations);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+static void issue_copy_real(struct dm_cache_migration *mg)
+{
+	int r;
+	struct dm_io_region o_region, c_region;
+	struct cache *cache = mg->cache;
+
+	o_region.bdev = cache->origin_dev->bdev;
+	o_region.count = cache->sectors_per_block;
+
+	c_region.bdev = cache->cache_dev->bdev;
+	c_region.sector = (sector_t) mg->cblock * cache->sectors_per_block;
+	c_region.count = cache->sectors_per_block;
+
+	if (mg->writeback || mg->demote) {
+		/* demote */
+		o_region.sector = mg->old_oblock * cache->sectors_per_block;
+		r = dm_kcopyd_copy(cache->copier, &c_region, 1, &o_region, 0, copy_complete, mg);
+	} else {
+		/* promote */
+		o_region.sector = mg->new_oblock * cache->sectors_per_block;
+		r = dm_kcopyd_copy(cache->copier, &o_region, 1, &c_region, 0, copy_complete, mg);
+	}
+
+	if (r < 0) {
+		DMERR_LIMIT("issuing migration failed");
+		migration_failure(mg);
+	}
+}
+
+static void issue_copy(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	/*
+	 * A clean block doesn't need copying back to the origin.
+	 */
+	if ((mg->writeback || mg->demote) && !is_dirty(cache, mg->cblock)) {
+		atomic_inc(&cache->stats.copies_avoided);
+		migration_success_pre_commit(mg);
+	} else
+		issue_copy_real(mg);
+}
+
+static void complete_migration(struct dm_cache_migration *mg)
+{
+	if (mg->err) {
+		DMWARN_LIMIT("migration failed; couldn't copy block");
+		migration_failure(mg);
+	} else
+		migration_success_pre_commit(mg);
+}
+
+static void process_migrations(struct cache *cache, struct list_head *head,
+			       void (*fn)(struct dm_cache_migration *))
+{
+	unsigned long flags;
+	struct list_head list;
+	struct dm_cache_migration *mg, *tmp;
+
+	INIT_LIST_HEAD(&list);
+	spin_lock_irqsave(&cache->lock, flags);
+	list_splice_init(head, &list);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	list_for_each_entry_safe(mg, tmp, &list, list)
+		fn(mg);
+}
+
+static void queue_quiesced_migration(struct dm_cache_migration *mg)
+{
+	unsigned long flags;
+	struct cache *cache = mg->cache;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_add_tail(&mg->list, &cache->quiesced_migrations);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+/*
+ * The copy mustn't start until all io already mapped to the blocks
+ * involved has completed.  Rather than tracking that per block we wait
+ * for all io that was in flight when the migration was set up.
+ */
+static void quiesce_migration(struct dm_cache_migration *mg)
+{
+	if (!dm_deferred_set_add_work(mg->cache->all_io_ds, &mg->list))
+		queue_quiesced_migration(mg);
+}
+
+static void promote(struct cache *cache, dm_oblock_t oblock, dm_cblock_t cblock,
+		    struct dm_bio_prison_cell *cell)
+{
+	struct dm_cache_migration *mg = get_next_migration(cache);
+
+	mg->promote = true;
+	mg->new_oblock = oblock;
+	mg->cblock = cblock;
+	mg->new_ocell = cell;
+
+	inc_nr_migrations(cache);
+	quiesce_migration(mg);
+}
+
+static void writeback(struct cache *cache, dm_oblock_t oblock, dm_cblock_t cblock,
+		      struct dm_bio_prison_cell *cell)
+{
+	struct dm_cache_migration *mg = get_next_migration(cache);
+
+	mg->writeback = true;
+	mg->old_oblock = oblock;
+	mg->cblock = cblock;
+	mg->old_ocell = cell;
+
+	inc_nr_migrations(cache);
+	quiesce_migration(mg);
+}
+
+static void demote_then_promote(struct cache *cache, dm_oblock_t old_oblock,
+				dm_oblock_t new_oblock, dm_cblock_t cblock,
+				struct dm_bio_prison_cell *old_ocell,
+				struct dm_bio_prison_cell *new_ocell)
+{
+	struct dm_cache_migration *mg = get_next_migration(cache);
+
+	mg->demote = true;
+	mg->promote = true;
+	mg->old_oblock = old_oblock;
+	mg->new_oblock = new_oblock;
+	mg->cblock = cblock;
+	mg->old_ocell = old_ocell;
+	mg->new_ocell = new_ocell;
+
+	inc_nr_migrations(cache);
+	quiesce_migration(mg);
+}
+
+/*----------------------------------------------------------------
+ * bio processing
+ *--------------------------------------------------------------*/
+static bool spare_migration_bandwidth(struct cache *cache)
+{
+	sector_t current_volume = (atomic_read(&cache->nr_migrations) + 1) *
+		cache->sectors_per_block;
+
+	return current_volume < cache->migration_threshold;
+}
+
+static bool is_quiescing(struct cache *cache)
+{
+	int r;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	r = cache->quiescing;
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	return r;
+}
+
+static void process_bio(struct cache *cache, struct bio *bio)
+{
+	int r;
+	bool release_cell = true;
+	dm_oblock_t block = get_bio_block(cache, bio);
+	struct dm_bio_prison_cell *old_ocell, *new_ocell;
+	struct policy_result lookup_result;
+	struct endio_hook *h = dm_get_mapinfo(bio)->ptr;
+
+	/*
+	 * Check to see if that block is currently migrating.
+	 */
+	if (bio_detain(cache, block, bio, &new_ocell) > 0)
+		return;
+
+	r = policy_map(cache->policy, block, true,
+		       spare_migration_bandwidth(cache), bio, &lookup_result);
+	if (r) {
+		DMERR_LIMIT("unexpected return from cache replacement policy: %d", r);
+		lookup_result.op = POLICY_MISS;
+	}
+
+	switch (lookup_result.op) {
+	case POLICY_HIT:
+		inc_hit_counter(cache, bio);
+		h->all_io_entry = dm_deferred_entry_inc(cache->all_io_ds);
+		remap_hit(cache, bio, h, block, lookup_result.cblock);
+		issue(cache, bio);
+		break;
+
+	case POLICY_MISS:
+		inc_miss_counter(cache, bio);
+		h->all_io_entry = dm_deferred_entry_inc(cache->all_io_ds);
+		remap_to_origin(cache, bio);
+		issue(cache, bio);
+		break;
+
+	case POLICY_NEW:
+		atomic_inc(&cache->stats.promotion);
+		promote(cache, block, lookup_result.cblock, new_ocell);
+		release_cell = false;
+		break;
+
+	case POLICY_REPLACE:
+		r = bio_detain(cache, lookup_result.old_oblock, NULL, &old_ocell);
+		if (r > 0) {
+			/*
+			 * The block being demoted is busy.  Waiting for it
+			 * while holding our own cell risks an inversion, so
+			 * back the policy out and let this bio go to the
+			 * origin.
+			 */
+			revert_replace(cache, block, lookup_result.old_oblock,
+				       lookup_result.cblock);
+			atomic_inc(&cache->stats.cache_cell_clash);
+
+			inc_miss_counter(cache, bio);
+			h->all_io_entry = dm_deferred_entry_inc(cache->all_io_ds);
+			remap_to_origin(cache, bio);
+			issue(cache, bio);
+			break;
+		}
+
+		atomic_inc(&cache->stats.demotion);
+		atomic_inc(&cache->stats.promotion);
+		demote_then_promote(cache, lookup_result.old_oblock, block,
+				    lookup_result.cblock, old_ocell, new_ocell);
+		release_cell = false;
+		break;
+
+	default:
+		DMERR_LIMIT("%s: erroring bio, unknown policy op: %u", __func__,
+			    (unsigned) lookup_result.op);
+		bio_io_error(bio);
+	}
+
+	if (release_cell)
+		cell_defer(cache, new_ocell, false);
+}
+
+static int need_commit_due_to_time(struct cache *cache)
+{
+	return jiffies < cache->last_commit_jiffies ||
+	       jiffies > cache->last_commit_jiffies + COMMIT_PERIOD;
+}
+
+static int commit_if_needed(struct cache *cache)
+{
+	int r = 0;
+
+	if (!cache->commit_requested && !need_commit_due_to_time(cache))
+		return 0;
+
+	cache->commit_requested = false;
+	cache->last_commit_jiffies = jiffies;
+
+	if (dm_cache_changed_this_transaction(cache->cmd)) {
+		atomic_inc(&cache->stats.commit_count);
+		r = dm_cache_commit(cache->cmd, false);
+		if (r)
+			DMERR("%s: dm_cache_commit() failed: error = %d",
+			      __func__, r);
+	}
+
+	return r;
+}
+
+static void process_deferred_bios(struct cache *cache)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->deferred_bios);
+	bio_list_init(&cache->deferred_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios))) {
+		/*
+		 * If we've got no free migration structs, and processing
+		 * this bio might require one, we pause until there are
+		 * some completed migrations to free one up.
+		 */
+		if (ensure_next_migration(cache)) {
+			bio_list_add_head(&bios, bio);
+			spin_lock_irqsave(&cache->lock, flags);
+			bio_list_merge(&bios, &cache->deferred_bios);
+			bio_list_init(&cache->deferred_bios);
+			bio_list_merge(&cache->deferred_bios, &bios);
+			spin_unlock_irqrestore(&cache->lock, flags);
+			break;
+		}
+
+		if (bio->bi_rw & REQ_FLUSH)
+			issue(cache, bio);
+		else
+			process_bio(cache, bio);
+	}
+}
+
+static void process_deferred_flush_bios(struct cache *cache, bool submit_bios)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->deferred_flush_bios);
+	bio_list_init(&cache->deferred_flush_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios)))
+		submit_bios ? generic_make_request(bio) : bio_io_error(bio);
+}
+
+static void process_deferred_writethrough_bios(struct cache *cache)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->deferred_writethrough_bios);
+	bio_list_init(&cache->deferred_writethrough_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios)))
+		generic_make_request(bio);
+}
+
+/*
+ * Starts background writeback of dirty blocks, as long as it fits in the
+ * migration bandwidth left over from promotions.
+ */
+static void writeback_some_dirty_blocks(struct cache *cache)
+{
+	dm_oblock_t oblock;
+	dm_cblock_t cblock;
+	struct dm_bio_prison_cell *old_ocell;
+
+	while (spare_migration_bandwidth(cache)) {
+		if (ensure_next_migration(cache))
+			break;
+
+		if (policy_writeback_work(cache->policy, &oblock, &cblock))
+			break; /* no work to do */
+
+		if (bio_detain(cache, oblock, NULL, &old_ocell) > 0) {
+			policy_set_dirty(cache->policy, oblock);
+			break;
+		}
+
+		writeback(cache, oblock, cblock, old_ocell);
+	}
+}
+
+/*----------------------------------------------------------------
+ * Main worker loop
+ *--------------------------------------------------------------*/
+static void start_quiescing(struct cache *cache)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	cache->quiescing = true;
+	spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+static void stop_quiescing(struct cache *cache)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	cache->quiescing = false;
+	spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+static void wait_for_migrations(struct cache *cache)
+{
+	wait_event(cache->migration_wait, !atomic_read(&cache->nr_migrations));
+}
+
+static void stop_worker(struct cache *cache)
+{
+	cancel_delayed_work(&cache->waker);
+	flush_workqueue(cache->wq);
+}
+
+static bool more_work(struct cache *cache)
+{
+	bool r;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	r = !list_empty(&cache->quiesced_migrations) ||
+	    !list_empty(&cache->completed_migrations) ||
+	    (!list_empty(&cache->need_commit_migrations) && cache->commit_requested) ||
+	    !bio_list_empty(&cache->deferred_writethrough_bios);
+
+	if (!cache->quiescing)
+		r = r || !bio_list_empty(&cache->deferred_flush_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	/*
+	 * Deferred bios only count if there's a migration struct available
+	 * to process them with; otherwise we'd spin.
+	 */
+	if (!r && !is_quiescing(cache)) {
+		spin_lock_irqsave(&cache->lock, flags);
+		r = !bio_list_empty(&cache->deferred_bios);
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		if (r)
+			r = !ensure_next_migration(cache);
+	}
+
+	return r;
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(ws, struct cache, worker);
+
+	do {
+		if (!is_quiescing(cache))
+			process_deferred_bios(cache);
+
+		process_migrations(cache, &cache->quiesced_migrations, issue_copy);
+		process_migrations(cache, &cache->completed_migrations, complete_migration);
+		process_deferred_writethrough_bios(cache);
+
+		if (!is_quiescing(cache))
+			writeback_some_dirty_blocks(cache);
+
+		if (commit_if_needed(cache)) {
+			process_deferred_flush_bios(cache, false);
+
+			/*
+			 * FIXME: rollback metadata or just go into a
+			 * failure mode and error everything
+			 */
+			process_migrations(cache, &cache->need_commit_migrations,
+					   migration_failure);
+		} else {
+			process_deferred_flush_bios(cache, true);
+			process_migrations(cache, &cache->need_commit_migrations,
+					   migration_success_post_commit);
+		}
+	} while (more_work(cache));
+}
+
+/*
+ * We want to commit periodically so that not too much
+ * unwritten metadata builds up.
+ */
+static void do_waker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(to_delayed_work(ws), struct cache, waker);
+
+	policy_tick(cache->policy);
+	wake_worker(cache);
+	queue_delayed_work(cache->wq, &cache->waker, COMMIT_PERIOD);
+}
+
+/*----------------------------------------------------------------*/
+
+static int is_congested(struct dm_dev *dev, int bdi_bits)
+{
+	struct request_queue *q = bdev_get_queue(dev->bdev);
+	return bdi_congested(&q->backing_dev_info, bdi_bits);
+}
+
+static int cache_is_congested(struct dm_target_callbacks *cb, int bdi_bits)
+{
+	struct cache *cache = container_of(cb, struct cache, callbacks);
+
+	return is_congested(cache->origin_dev, bdi_bits) ||
+		is_congested(cache->cache_dev, bdi_bits);
+}
+
+/*----------------------------------------------------------------
+ * Target methods
+ *--------------------------------------------------------------*/
+
+/*
+ * This function gets called on the error paths of the constructor, so we
+ * have to cope with a partially initialised struct.
+ */
+static void destroy(struct cache *cache)
+{
+	if (cache->next_migration)
+		mempool_free(cache->next_migration, cache->migration_pool);
+
+	if (cache->migration_pool)
+		mempool_destroy(cache->migration_pool);
+
+	if (cache->endio_hook_pool)
+		mempool_destroy(cache->endio_hook_pool);
+
+	if (cache->all_io_ds)
+		dm_deferred_set_destroy(cache->all_io_ds);
+
+	if (cache->prison)
+		dm_bio_prison_destroy(cache->prison);
+
+	if (cache->wq)
+		destroy_workqueue(cache->wq);
+
+	if (cache->dirty_bitset)
+		vfree(cache->dirty_bitset);
+
+	if (cache->copier)
+		dm_kcopyd_client_destroy(cache->copier);
+
+	if (cache->cmd)
+		dm_cache_metadata_close(cache->cmd);
+
+	if (cache->metadata_dev)
+		dm_put_device(cache->ti, cache->metadata_dev);
+
+	if (cache->origin_dev)
+		dm_put_device(cache->ti, cache->origin_dev);
+
+	if (cache->cache_dev)
+		dm_put_device(cache->ti, cache->cache_dev);
+
+	if (cache->policy)
+		dm_cache_policy_destroy(cache->policy);
+
+	kfree(cache);
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	destroy(cache);
+}
+
+static sector_t get_dev_size(struct dm_dev *dev)
+{
+	return i_size_read(dev->bdev->bd_inode) >> SECTOR_SHIFT;
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Construct a cache device mapping.
+ *
+ * cache <metadata dev> <cache dev> <origin dev> <block size>
+ *       <#feature args> [<feature arg>]*
+ *       <policy> <#policy args> [<policy arg>]*
+ *
+ * metadata dev    : fast device holding the persistent metadata
+ * cache dev	   : fast device holding cached data blocks
+ * origin dev	   : slow device holding original data blocks
+ * block size	   : cache unit size in sectors
+ *
+ * #feature args   : number of feature arguments passed
+ * feature args    : writethrough.  (The default is writeback.)
+ *
+ * policy	   : the replacement policy to use
+ * #policy args    : an even number of policy arguments corresponding
+ *		     to key/value pairs passed to the policy
+ * policy args	   : key/value pairs passed to the policy
+ *		     E.g. 'sequential_threshold 1024'
+ *		     See cache-policies.txt for details.
+ *
+ * Optional feature arguments are:
+ *   writethrough  : write through caching that prohibits cache block
+ *		     content from being different from origin block content.
+ *		     Without this argument, the default behaviour is to write
+ *		     back cache block contents later for performance reasons,
+ *		     so they may differ from the corresponding origin blocks.
+ */
+struct cache_args {
+	struct dm_target *ti;
+
+	struct dm_dev *metadata_dev;
+
+	struct dm_dev *cache_dev;
+	sector_t cache_sectors;
+
+	struct dm_dev *origin_dev;
+	sector_t origin_sectors;
+
+	uint32_t block_size;
+
+	const char *policy_name;
+	unsigned policy_argc;
+	const char **policy_argv;
+
+	struct cache_features features;
+};
+
+static void destroy_cache_args(struct cache_args *ca)
+{
+	if (ca->metadata_dev)
+		dm_put_device(ca->ti, ca->metadata_dev);
+
+	if (ca->cache_dev)
+		dm_put_device(ca->ti, ca->cache_dev);
+
+	if (ca->origin_dev)
+		dm_put_device(ca->ti, ca->origin_dev);
+
+	kfree(ca);
+}
+
+static bool at_least_one_arg(struct dm_arg_set *as, char **error)
+{
+	if (!as->argc) {
+		*error = "Insufficient args";
+		return false;
+	}
+
+	return true;
+}
+
+static int parse_metadata_dev(struct cache_args *ca, struct dm_arg_set *as,
+			      char **error)
+{
+	int r;
+	sector_t metadata_dev_size;
+	char b[BDEVNAME_SIZE];
+
+	if (!at_least_one_arg(as, error))
+		return -EINVAL;
+
+	r = dm_get_device(ca->ti, dm_shift_arg(as), FMODE_READ | FMODE_WRITE,
+			  &ca->metadata_dev);
+	if (r) {
+		*error = "Error opening metadata device";
+		return r;
+	}
+
+	metadata_dev_size = get_dev_size(ca->metadata_dev);
+	if (metadata_dev_size > DM_CACHE_METADATA_MAX_SECTORS_WARNING)
+		DMWARN("Metadata device %s is larger than %u sectors: excess space will not be used.",
+		       bdevname(ca->metadata_dev->bdev, b), DM_CACHE_METADATA_MAX_SECTORS);
+
+	return 0;
+}
+
+static int parse_cache_dev(struct cache_args *ca, struct dm_arg_set *as,
+			   char **error)
+{
+	int r;
+
+	if (!at_least_one_arg(as, error))
+		return -EINVAL;
+
+	r = dm_get_device(ca->ti, dm_shift_arg(as), FMODE_READ | FMODE_WRITE,
+			  &ca->cache_dev);
+	if (r) {
+		*error = "Error opening cache device";
+		return r;
+	}
+	ca->cache_sectors = get_dev_size(ca->cache_dev);
+
+	return 0;
+}
+
+static int parse_origin_dev(struct cache_args *ca, struct dm_arg_set *as,
+			    char **error)
+{
+	int r;
+
+	if (!at_least_one_arg(as, error))
+		return -EINVAL;
+
+	r = dm_get_device(ca->ti, dm_shift_arg(as), FMODE_READ | FMODE_WRITE,
+			  &ca->origin_dev);
+	if (r) {
+		*error = "Error opening origin device";
+		return r;
+	}
+
+	ca->origin_sectors = get_dev_size(ca->origin_dev);
+	if (ca->ti->len > ca->origin_sectors) {
+		*error = "Device size larger than cached device";
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int parse_block_size(struct cache_args *ca, struct dm_arg_set *as,
+			    char **error)
+{
+	unsigned long tmp;
+
+	if (!at_least_one_arg(as, error))
+		return -EINVAL;
+
+	if (kstrtoul(dm_shift_arg(as), 10, &tmp) || !tmp ||
+	    tmp < DATA_DEV_BLOCK_SIZE_MIN_SECTORS ||
+	    tmp > DATA_DEV_BLOCK_SIZE_MAX_SECTORS ||
+	    !is_power_of_2(tmp)) {
+		*error = "Invalid data block size";
+		return -EINVAL;
+	}
+
+	if (tmp > ca->cache_sectors) {
+		*error = "Data block size is larger than the cache device";
+		return -EINVAL;
+	}
+
+	ca->block_size = tmp;
+
+	return 0;
+}
+
+static void init_features(struct cache_features *cf)
+{
+	cf->write_through = false;
+}
+
+static int parse_features(struct cache_args *ca, struct dm_arg_set *as,
+			  char **error)
+{
+	static struct dm_arg _args[] = {
+		{0, 1, "Invalid number of cache feature arguments"},
+	};
+
+	int r;
+	unsigned argc;
+	const char *arg;
+	struct cache_features *cf = &ca->features;
+
+	init_features(cf);
+
+	r = dm_read_arg_group(_args, as, &argc, error);
+	if (r)
+		return -EINVAL;
+
+	while (argc--) {
+		arg = dm_shift_arg(as);
+
+		if (!strcasecmp(arg, "writeback"))
+			cf->write_through = false;
+
+		else if (!strcasecmp(arg, "writethrough"))
+			cf->write_through = true;
+
+		else {
+			*error = "Unrecognised cache feature requested";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int parse_policy(struct cache_args *ca, struct dm_arg_set *as,
+			char **error)
+{
+	static struct dm_arg _args[] = {
+		{0, 1024, "Invalid number of policy arguments"},
+	};
+
+	int r;
+
+	if (!at_least_one_arg(as, error))
+		return -EINVAL;
+
+	ca->policy_name = dm_shift_arg(as);
+
+	r = dm_read_arg_group(_args, as, &ca->policy_argc, error);
+	if (r)
+		return -EINVAL;
+
+	ca->policy_argv = (const char **)as->argv;
+	dm_consume_args(as, ca->policy_argc);
+
+	return 0;
+}
+
+static int parse_cache_args(struct cache_args *ca, int argc, char **argv,
+			    char **error)
+{
+	int r;
+	struct dm_arg_set as;
+
+	as.argc = argc;
+	as.argv = argv;
+
+	r = parse_metadata_dev(ca, &as, error);
+	if (r)
+		return r;
+
+	r = parse_cache_dev(ca, &as, error);
+	if (r)
+		return r;
+
+	r = parse_origin_dev(ca, &as, error);
+	if (r)
+		return r;
+
+	r = parse_block_size(ca, &as, error);
+	if (r)
+		return r;
+
+	r = parse_features(ca, &as, error);
+	if (r)
+		return r;
+
+	r = parse_policy(ca, &as, error);
+	if (r)
+		return r;
+
+	return 0;
+}
+
+/*----------------------------------------------------------------*/
+
+static int process_config_option(struct cache *cache, const char *key,
+				 const char *value)
+{
+	unsigned long tmp;
+
+	if (!strcasecmp(key, "migration_threshold")) {
+		if (kstrtoul(value, 10, &tmp))
+			return -EINVAL;
+
+		cache->migration_threshold = tmp;
+		return 0;
+	}
+
+	return policy_set_config_value(cache->policy, key, value);
+}
+
+static int set_config_values(struct cache *cache, int argc, const char **argv)
+{
+	int r = 0;
+
+	if (argc & 1) {
+		DMWARN("Odd number of policy arguments given but they should be <key> <value> pairs.");
+		return -EINVAL;
+	}
+
+	while (argc) {
+		r = process_config_option(cache, argv[0], argv[1]);
+		if (r) {
+			DMWARN("couldn't set config value '%s' to '%s'",
+			       argv[0], argv[1]);
+			break;
+		}
+
+		argc -= 2;
+		argv += 2;
+	}
+
+	return r;
+}
+
+static int create_cache_policy(struct cache *cache, struct cache_args *ca,
+			       char **error)
+{
+	cache->policy = dm_cache_policy_create(ca->policy_name,
+					       cache->cache_size,
+					       cache->origin_blocks,
+					       cache->sectors_per_block);
+	if (!cache->policy) {
+		*error = "Error creating cache's policy";
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void load_stats(struct cache *cache)
+{
+	struct dm_cache_statistics stats;
+
+	dm_cache_metadata_get_stats(cache->cmd, &stats);
+	atomic_set(&cache->stats.read_hit, stats.read_hits);
+	atomic_set(&cache->stats.read_miss, stats.read_misses);
+	atomic_set(&cache->stats.write_hit, stats.write_hits);
+	atomic_set(&cache->stats.write_miss, stats.write_misses);
+}
+
+static void save_stats(struct cache *cache)
+{
+	struct dm_cache_statistics stats;
+
+	stats.read_hits = atomic_read(&cache->stats.read_hit);
+	stats.read_misses = atomic_read(&cache->stats.read_miss);
+	stats.write_hits = atomic_read(&cache->stats.write_hit);
+	stats.write_misses = atomic_read(&cache->stats.write_miss);
+
+	dm_cache_metadata_set_stats(cache->cmd, &stats);
+}
+
+static int cache_create(struct cache_args *ca, struct cache **result)
+{
+	int r = 0;
+	char **error = &ca->ti->error;
+	struct cache *cache;
+	struct dm_target *ti = ca->ti;
+	sector_t origin_blocks, cache_blocks;
+	struct dm_cache_metadata *cmd;
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache)
+		return -ENOMEM;
+
+	cache->ti = ca->ti;
+	ti->private = cache;
+	ti->split_io = ca->block_size;
+	ti->num_flush_requests = 2;
+
+	cache->features = ca->features;
+
+	cache->metadata_dev = ca->metadata_dev;
+	cache->origin_dev = ca->origin_dev;
+	cache->cache_dev = ca->cache_dev;
+
+	ca->metadata_dev = ca->origin_dev = ca->cache_dev = NULL;
+
+	cache->sectors_per_block = ca->block_size;
+	cache->sectors_per_block_shift = __ffs(ca->block_size);
+
+	origin_blocks = ti->len >> cache->sectors_per_block_shift;
+	cache->origin_blocks = origin_blocks;
+
+	cache_blocks = ca->cache_sectors >> cache->sectors_per_block_shift;
+	if (cache_blocks > (dm_cblock_t) -1) {
+		*error = "Cache device is too large for the block size";
+		r = -EINVAL;
+		goto bad;
+	}
+	cache->cache_size = cache_blocks;
+
+	r = create_cache_policy(cache, ca, error);
+	if (r)
+		goto bad;
+
+	cache->migration_threshold = MIGRATION_THRESHOLD_DEFAULT;
+
+	r = set_config_values(cache, ca->policy_argc, ca->policy_argv);
+	if (r) {
+		*error = "Error setting cache policy's config values";
+		goto bad;
+	}
+
+	cmd = dm_cache_metadata_open(cache->metadata_dev->bdev,
+				     ca->block_size,
+				     dm_cache_policy_get_hint_size(cache->policy));
+	if (IS_ERR(cmd)) {
+		*error = "Error creating metadata object";
+		r = PTR_ERR(cmd);
+		goto bad;
+	}
+	cache->cmd = cmd;
+
+	if (dm_cache_size(cmd) != cache->cache_size) {
+		r = dm_cache_resize(cmd, cache->cache_size);
+		if (r) {
+			*error = "Couldn't resize cache metadata";
+			goto bad;
+		}
+	}
+
+	spin_lock_init(&cache->lock);
+	bio_list_init(&cache->deferred_bios);
+	bio_list_init(&cache->deferred_flush_bios);
+	bio_list_init(&cache->deferred_writethrough_bios);
+	INIT_LIST_HEAD(&cache->quiesced_migrations);
+	INIT_LIST_HEAD(&cache->completed_migrations);
+	INIT_LIST_HEAD(&cache->need_commit_migrations);
+	atomic_set(&cache->nr_migrations, 0);
+	init_waitqueue_head(&cache->migration_wait);
+
+	cache->dirty_bitset = vzalloc(BITS_TO_LONGS(cache->cache_size) *
+				      sizeof(unsigned long));
+	if (!cache->dirty_bitset) {
+		*error = "could not allocate dirty bitset";
+		r = -ENOMEM;
+		goto bad;
+	}
+	atomic_set(&cache->nr_dirty, 0);
+
+	cache->copier = dm_kcopyd_client_create();
+	if (IS_ERR(cache->copier)) {
+		*error = "could not create kcopyd client";
+		r = PTR_ERR(cache->copier);
+		cache->copier = NULL;
+		goto bad;
+	}
+
+	cache->wq = alloc_ordered_workqueue("dm-" DM_MSG_PREFIX, WQ_MEM_RECLAIM);
+	if (!cache->wq) {
+		*error = "could not create workqueue for metadata object";
+		r = -ENOMEM;
+		goto bad;
+	}
+	INIT_WORK(&cache->worker, do_worker);
+	INIT_DELAYED_WORK(&cache->waker, do_waker);
+	cache->last_commit_jiffies = jiffies;
+
+	cache->prison = dm_bio_prison_create(PRISON_CELLS);
+	if (!cache->prison) {
+		*error = "could not create bio prison";
+		r = -ENOMEM;
+		goto bad;
+	}
+
+	cache->all_io_ds = dm_deferred_set_create();
+	if (!cache->all_io_ds) {
+		*error = "could not create all_io deferred set";
+		r = -ENOMEM;
+		goto bad;
+	}
+
+	cache->endio_hook_pool = mempool_create_slab_pool(ENDIO_HOOK_POOL_SIZE,
+							  _endio_hook_cache);
+	if (!cache->endio_hook_pool) {
+		*error = "Error creating cache's endio_hook mempool";
+		r = -ENOMEM;
+		goto bad;
+	}
+
+	cache->migration_pool = mempool_create_slab_pool(MIGRATION_POOL_SIZE,
+							 _migration_cache);
+	if (!cache->migration_pool) {
+		*error = "Error creating cache's migration mempool";
+		r = -ENOMEM;
+		goto bad;
+	}
+
+	cache->next_migration = NULL;
+
+	cache->loaded_mappings = false;
+	cache->commit_requested = false;
+	cache->quiescing = false;
+
+	load_stats(cache);
+	atomic_set(&cache->stats.demotion, 0);
+	atomic_set(&cache->stats.promotion, 0);
+	atomic_set(&cache->stats.copies_avoided, 0);
+	atomic_set(&cache->stats.cache_cell_clash, 0);
+	atomic_set(&cache->stats.commit_count, 0);
+
+	cache->callbacks.congested_fn = cache_is_congested;
+	dm_table_add_target_callbacks(ti->table, &cache->callbacks);
+
+	*result = cache;
+	return 0;
+
+bad:
+	destroy(cache);
+	return r;
+}
+
+static int cache_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	int r = -EINVAL;
+	struct cache_args *ca;
+	struct cache *cache = NULL;
+
+	ca = kzalloc(sizeof(*ca), GFP_KERNEL);
+	if (!ca) {
+		ti->error = "Error allocating memory for cache";
+		return -ENOMEM;
+	}
+	ca->ti = ti;
+
+	r = parse_cache_args(ca, argc, argv, &ti->error);
+	if (r)
+		goto out;
+
+	r = cache_create(ca, &cache);
+	if (r)
+		goto out;
+
+	ti->private = cache;
+
+out:
+	destroy_cache_args(ca);
+	return r;
+}
+
+/*----------------------------------------------------------------*/
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct cache *cache = ti->private;
+
+	int r;
+	dm_oblock_t block;
+	struct dm_cell_key key;
+	struct dm_bio_prison_cell *cell;
+	struct policy_result lookup_result;
+	struct endio_hook *h;
+
+	/*
+	 * dm core only ever sends us empty flushes; target_request_nr
+	 * tells us which of the two devices this one is for.  It shares
+	 * storage with map_context->ptr, so read it before hooking the
+	 * bio.
+	 */
+	if (bio->bi_rw & REQ_FLUSH) {
+		BUG_ON(bio->bi_size);
+
+		if (map_context->target_request_nr)
+			bio->bi_bdev = cache->cache_dev->bdev;
+		else
+			remap_to_origin(cache, bio);
+
+		map_context->ptr = hook_bio(cache, bio, GFP_NOIO);
+		defer_bio(cache, bio);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	bio->bi_sector = dm_target_offset(ti, bio->bi_sector);
+	block = get_bio_block(cache, bio);
+	map_context->ptr = h = hook_bio(cache, bio, GFP_NOIO);
+
+	if (unlikely(block >= cache->origin_blocks)) {
+		/*
+		 * This can only occur if the io goes to a partial block at
+		 * the end of the origin device.  We don't cache these.
+		 * Just remap to the origin and carry on.
+		 */
+		remap_to_origin(cache, bio);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	if (bio->bi_rw & REQ_FUA) {
+		defer_bio(cache, bio);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	/*
+	 * Check to see if that block is currently migrating.
+	 */
+	build_key(block, &key);
+	r = dm_bio_detain_nowait(cache->prison, &key, bio, &cell);
+	if (r > 0)
+		return DM_MAPIO_SUBMITTED;
+
+	if (r < 0) {
+		defer_bio(cache, bio);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	/*
+	 * Only hits are handled here; anything that needs a decision from
+	 * the policy, or a migration, is left to the worker.
+	 */
+	r = policy_map(cache->policy, block, false, false, bio, &lookup_result);
+	if (r || lookup_result.op != POLICY_HIT) {
+		cell_defer(cache, cell, true);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	inc_hit_counter(cache, bio);
+	h->all_io_entry = dm_deferred_entry_inc(cache->all_io_ds);
+	remap_hit(cache, bio, h, block, lookup_result.cblock);
+	cell_defer(cache, cell, false);
+
+	return DM_MAPIO_REMAPPED;
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio, int error,
+			union map_info *map_context)
+{
+	unsigned long flags;
+	struct cache *cache = ti->private;
+	struct endio_hook *h = map_context->ptr;
+	struct list_head work;
+
+	if (h->all_io_entry) {
+		INIT_LIST_HEAD(&work);
+		dm_deferred_entry_dec(h->all_io_entry, &work);
+
+		if (!list_empty(&work)) {
+			spin_lock_irqsave(&cache->lock, flags);
+			list_splice(&work, &cache->quiesced_migrations);
+			spin_unlock_irqrestore(&cache->lock, flags);
+			wake_worker(cache);
+		}
+	}
+
+	mempool_free(h, cache->endio_hook_pool);
+	return 0;
+}
+
+/*
+ * Writes the dirty flags and the policy's hint for every mapped block.
+ * Both are only trusted on the next load if this is followed by a clean
+ * shutdown commit.
+ */
+static int write_mapping_state(void *context, dm_cblock_t cblock,
+			       dm_oblock_t oblock, uint32_t hint)
+{
+	int r;
+	struct cache *cache = context;
+
+	r = dm_cache_set_dirty(cache->cmd, cblock, is_dirty(cache, cblock));
+	if (r)
+		return r;
+
+	return dm_cache_save_hint(cache->cmd, cblock, hint);
+}
+
+static bool sync_metadata(struct cache *cache)
+{
+	int r;
+
+	r = dm_cache_begin_hints(cache->cmd, cache->policy);
+	if (r)
+		DMERR("could not begin writing hints");
+	else {
+		r = policy_walk_mappings(cache->policy, write_mapping_state, cache);
+		if (r)
+			DMERR("could not write dirty bits and hints");
+	}
+
+	save_stats(cache);
+
+	r = dm_cache_commit(cache->cmd, !r);
+	if (r)
+		DMERR("could not write cache metadata.  Data loss may occur.");
+
+	return !r;
+}
+
+static void cache_postsuspend(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	start_quiescing(cache);
+	wait_for_migrations(cache);
+	stop_worker(cache);
+	stop_quiescing(cache);
+
+	(void) sync_metadata(cache);
+}
+
+static int load_mapping(void *context, dm_oblock_t oblock, dm_cblock_t cblock,
+			bool dirty, uint32_t hint, bool hint_valid)
+{
+	int r;
+	struct cache *cache = context;
+
+	if (oblock >= cache->origin_blocks) {
+		DMERR("cache block %u maps beyond the end of the origin",
+		      (unsigned) cblock);
+		return -EINVAL;
+	}
+
+	r = policy_load_mapping(cache->policy, oblock, cblock, hint, hint_valid);
+	if (r)
+		return r;
+
+	if (dirty)
+		set_dirty(cache, oblock, cblock);
+	else
+		clear_dirty(cache, oblock, cblock);
+
+	return 0;
+}
+
+static int cache_preresume(struct dm_target *ti)
+{
+	int r;
+	struct cache *cache = ti->private;
+
+	if (!cache->loaded_mappings) {
+		r = dm_cache_load_mappings(cache->cmd,
+					   dm_cache_policy_get_name(cache->policy),
+					   load_mapping, cache);
+		if (r) {
+			DMERR("could not load cache mappings");
+			return r;
+		}
+
+		cache->loaded_mappings = true;
+	}
+
+	/*
+	 * The dirty flags on disk go stale as soon as io starts, so the
+	 * metadata is marked as not cleanly shut down first.
+	 */
+	r = dm_cache_commit(cache->cmd, false);
+	if (r)
+		DMERR("could not commit cache metadata");
+
+	return r;
+}
+
+static void cache_resume(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	do_waker(&cache->waker.work);
+}
+
+/*
+ * Status format:
+ *
+ * <#used metadata blocks>/<#total metadata blocks>
+ * <#read hits> <#read misses> <#write hits> <#write misses>
+ * <#demotions> <#promotions> <#blocks in cache> <#dirty>
+ * <#features> <features>*
+ * <#core args> <core args>
+ * <policy name> <#policy args> <policy args>*
+ */
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned maxlen)
+{
+	int r = 0;
+	unsigned sz = 0;
+	dm_block_t nr_free_blocks_metadata = 0;
+	dm_block_t nr_blocks_metadata = 0;
+	char buf[BDEVNAME_SIZE];
+	struct cache *cache = ti->private;
+	dm_cblock_t residency;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		r = dm_cache_get_free_metadata_block_count(cache->cmd,
+							   &nr_free_blocks_metadata);
+		if (r) {
+			DMERR("could not get metadata free block count");
+			goto err;
+		}
+
+		r = dm_cache_get_metadata_dev_size(cache->cmd, &nr_blocks_metadata);
+		if (r) {
+			DMERR("could not get metadata device size");
+			goto err;
+		}
+
+		residency = policy_residency(cache->policy);
+
+		DMEMIT("%llu/%llu %u %u %u %u %u %u %llu %u ",
+		       (unsigned long long)(nr_blocks_metadata - nr_free_blocks_metadata),
+		       (unsigned long long)nr_blocks_metadata,
+		       (unsigned) atomic_read(&cache->stats.read_hit),
+		       (unsigned) atomic_read(&cache->stats.read_miss),
+		       (unsigned) atomic_read(&cache->stats.write_hit),
+		       (unsigned) atomic_read(&cache->stats.write_miss),
+		       (unsigned) atomic_read(&cache->stats.demotion),
+		       (unsigned) atomic_read(&cache->stats.promotion),
+		       (unsigned long long) residency,
+		       (unsigned) atomic_read(&cache->nr_dirty));
+
+		if (writethrough_mode(&cache->features))
+			DMEMIT("1 writethrough ");
+		else
+			DMEMIT("1 writeback ");
+
+		DMEMIT("2 migration_threshold %llu ",
+		       (unsigned long long) cache->migration_threshold);
+
+		DMEMIT("%s ", dm_cache_policy_get_name(cache->policy));
+		if (sz < maxlen) {
+			r = policy_emit_config_values(cache->policy, result + sz, maxlen - sz);
+			if (r)
+				DMERR("policy_emit_config_values returned %d", r);
+		}
+
+		break;
+
+	case STATUSTYPE_TABLE:
+		format_dev_t(buf, cache->metadata_dev->bdev->bd_dev);
+		DMEMIT("%s ", buf);
+		format_dev_t(buf, cache->cache_dev->bdev->bd_dev);
+		DMEMIT("%s ", buf);
+		format_dev_t(buf, cache->origin_dev->bdev->bd_dev);
+		DMEMIT("%s %llu ", buf,
+		       (unsigned long long) cache->sectors_per_block);
+
+		if (writethrough_mode(&cache->features))
+			DMEMIT("1 writethrough ");
+		else
+			DMEMIT("0 ");
+
+		DMEMIT("%s ", dm_cache_policy_get_name(cache->policy));
+		if (sz < maxlen) {
+			r = policy_emit_config_values(cache->policy, result + sz, maxlen - sz);
+			if (r)
+				DMERR("policy_emit_config_values returned %d", r);
+		}
+		break;
+	}
+
+	return 0;
+
+err:
+	DMEMIT("Error");
+	return 0;
+}
+
+/*
+ * Supports <key> <value>.
+ *
+ * The key migration_threshold is supported by the cache target core.
+ */
+static int cache_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct cache *cache = ti->private;
+
+	if (argc != 2)
+		return -EINVAL;
+
+	return process_config_option(cache, argv[0], argv[1]);
+}
+
+static int cache_iterate_devices(struct dm_target *ti,
+				 iterate_devices_callout_fn fn, void *data)
+{
+	int r = 0;
+	struct cache *cache = ti->private;
+
+	r = fn(ti, cache->cache_dev, 0, get_dev_size(cache->cache_dev), data);
+	if (!r)
+		r = fn(ti, cache->origin_dev, 0, ti->len, data);
+
+	return r;
+}
+
+/*
+ * We assume I/O is going to the origin (which is the volume
+ * more likely to have restrictions e.g. by being striped).
+ * (Looking up the exact location of the data would be expensive
+ * and could always be out of date by the time the bio is submitted.)
+ */
+static int cache_bvec_merge(struct dm_target *ti,
+			    struct bvec_merge_data *bvm,
+			    struct bio_vec *biovec, int max_size)
+{
+	struct cache *cache = ti->private;
+	struct request_queue *q = bdev_get_queue(cache->origin_dev->bdev);
+
+	if (!q->merge_bvec_fn)
+		return max_size;
+
+	bvm->bi_bdev = cache->origin_dev->bdev;
+	bvm->bi_sector = dm_target_offset(ti, bvm->bi_sector);
+	return min(max_size, q->merge_bvec_fn(q, bvm, biovec));
+}
+
+static void cache_io_hints(struct dm_target *ti, struct queue_limits *limits)
+{
+	struct cache *cache = ti->private;
+
+	blk_limits_io_min(limits, 0);
+	blk_limits_io_opt(limits, cache->sectors_per_block << SECTOR_SHIFT);
+}
+
+/*----------------------------------------------------------------*/
+
+static struct target_type cache_target = {
+	.name = "cache",
+	.version = {1, 0, 0},
+	.module = THIS_MODULE,
+	.ctr = cache_ctr,
+	.dtr = cache_dtr,
+	.map = cache_map,
+	.end_io = cache_end_io,
+	.postsuspend = cache_postsuspend,
+	.preresume = cache_preresume,
+	.resume = cache_resume,
+	.status = cache_status,
+	.message = cache_message,
+	.iterate_devices = cache_iterate_devices,
+	.merge = cache_bvec_merge,
+	.io_hints = cache_io_hints,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r;
+
+	r = dm_register_target(&cache_target);
+	if (r) {
+		DMERR("cache target registration failed: %d", r);
+		return r;
+	}
+
+	r = -ENOMEM;
+
+	_endio_hook_cache = KMEM_CACHE(endio_hook, 0);
+	if (!_endio_hook_cache)
+		goto bad_endio_hook_cache;
+
+	_migration_cache = KMEM_CACHE(dm_cache_migration, 0);
+	if (!_migration_cache)
+		goto bad_migration_cache;
+
+	return 0;
+
+bad_migration_cache:
+	kmem_cache_destroy(_endio_hook_cache);
+bad_endio_hook_cache:
+	dm_unregister_target(&cache_target);
+
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+	kmem_cache_destroy(_endio_hook_cache);
+	kmem_cache_destroy(_migration_cache);
+}
+
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache target");
+MODULE_AUTHOR("Joe Thornber <dm-devel@redhat.com>");
+MODULE_LICENSE("GPL");
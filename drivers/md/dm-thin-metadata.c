@@ -12,6 +12,9 @@
 
 #include <linux/list.h>
 #include <linux/device-mapper.h>
+#include <linux/hash.h>
+#include <linux/seqlock.h>
+#include <linux/srcu.h>
 #include <linux/workqueue.h>
 
 /*--------------------------------------------------------------------------
@@ -80,6 +83,12 @@
 #define THIN_METADATA_CACHE_SIZE 64
 #define SECTOR_TO_BLOCK_SHIFT 3
 
+/*
+ * Size of the hash of (device, block) pairs whose mappings have changed
+ * since the last commit.
+ */
+#define CHANGED_BLOCKS_BITS 16
+
 /* This should be plenty */
 #define SPACE_MAP_ROOT_SIZE 128
 
@@ -174,6 +183,20 @@ struct dm_pool_metadata {
 	uint32_t time;
 	int need_commit;
 	dm_block_t root;
+
+	/*
+	 * The mapping tree as of the last commit.  Nothing reachable from
+	 * it gets changed in place, or reused, until the next commit, so
+	 * dm_thin_find_block() can walk it without root_lock as long as
+	 * the mapping it wants hasn't changed since (changed_blocks).
+	 * Commits wait for these lookups with committed_srcu.
+	 */
+	struct srcu_struct committed_srcu;
+	seqcount_t committed_seq;
+	dm_block_t committed_root;
+	int committed_root_valid;
+	unsigned long *changed_blocks;
+
 	dm_block_t details_root;
 	struct list_head thin_devices;
 	uint64_t trans_id;
@@ -430,6 +453,23 @@ static int init_pmd(struct dm_pool_metadata *pmd,
 		goto bad_data_sm;
 	}
 
+	pmd->changed_blocks = kzalloc(BITS_TO_LONGS(1 << CHANGED_BLOCKS_BITS) *
+				      sizeof(unsigned long), GFP_KERNEL);
+	if (!pmd->changed_blocks) {
+		DMERR("could not allocate changed blocks bitset");
+		r = -ENOMEM;
+		goto bad_nb_tm;
+	}
+
+	r = init_srcu_struct(&pmd->committed_srcu);
+	if (r) {
+		DMERR("could not initialise srcu");
+		goto bad_changed_blocks;
+	}
+	seqcount_init(&pmd->committed_seq);
+	pmd->committed_root = 0;
+	pmd->committed_root_valid = 0;
+
 	pmd->info.tm = tm;
 	pmd->info.levels = 2;
 	pmd->info.value_type.context = pmd->data_sm;
@@ -477,6 +517,10 @@ static int init_pmd(struct dm_pool_metadata *pmd,
 
 	return 0;
 
+bad_changed_blocks:
+	kfree(pmd->changed_blocks);
+bad_nb_tm:
+	dm_tm_destroy(pmd->nb_tm);
 bad_data_sm:
 	dm_sm_destroy(data_sm);
 bad:
@@ -580,6 +624,38 @@ static int __write_changed_details(struct dm_pool_metadata *pmd)
 	return 0;
 }
 
+static unsigned changed_block_bit(dm_thin_id dev, dm_block_t block)
+{
+	return hash_64(((uint64_t) dev << 40) ^ block, CHANGED_BLOCKS_BITS);
+}
+
+static void __mark_changed(struct dm_thin_device *td, dm_block_t block)
+{
+	set_bit(changed_block_bit(td->id, block), td->pmd->changed_blocks);
+}
+
+/*
+ * Makes the mapping tree that has just been committed the one that
+ * lockless lookups walk.
+ */
+static void __publish_committed_root(struct dm_pool_metadata *pmd)
+{
+	if (pmd->committed_root_valid && pmd->committed_root == pmd->root)
+		return;
+
+	write_seqcount_begin(&pmd->committed_seq);
+	pmd->committed_root = pmd->root;
+	pmd->committed_root_valid = 1;
+	bitmap_zero(pmd->changed_blocks, 1 << CHANGED_BLOCKS_BITS);
+	write_seqcount_end(&pmd->committed_seq);
+
+	/*
+	 * Blocks only reachable from the previous root may be reused by
+	 * the next transaction, so wait for lookups still walking it.
+	 */
+	synchronize_srcu_expedited(&pmd->committed_srcu);
+}
+
 static int __commit_transaction(struct dm_pool_metadata *pmd)
 {
 	/*
@@ -702,6 +778,7 @@ struct dm_pool_metadata *dm_pool_metadata_open(struct block_device *bdev,
 		r = __begin_transaction(pmd);
 		if (r < 0)
 			goto bad;
+		__publish_committed_root(pmd);
 		return pmd;
 	}
 
@@ -788,6 +865,8 @@ int dm_pool_metadata_close(struct dm_pool_metadata *pmd)
 	dm_block_manager_destroy(pmd->bm);
 	dm_sm_destroy(pmd->metadata_sm);
 	dm_sm_destroy(pmd->data_sm);
+	cleanup_srcu_struct(&pmd->committed_srcu);
+	kfree(pmd->changed_blocks);
 	kfree(pmd);
 
 	return 0;
@@ -977,6 +1056,7 @@ static int __create_snap(struct dm_pool_metadata *pmd,
 	}
 
 	pmd->time++;
+	pmd->committed_root_valid = 0;
 
 	r = __open_device(pmd, dev, 1, &td);
 	if (r)
@@ -1033,6 +1113,7 @@ static int __delete_device(struct dm_pool_metadata *pmd, dm_thin_id dev)
 	if (r)
 		return r;
 
+	pmd->committed_root_valid = 0;
 	r = dm_btree_remove(&pmd->tl_info, pmd->root, &key, &pmd->root);
 	if (r)
 		return r;
@@ -1143,6 +1224,44 @@ static int __snapshotted_since(struct dm_thin_device *td, uint32_t time)
 	return td->snapshotted_time > time;
 }
 
+/*
+ * Looks the block up in the mapping tree as of the last commit, without
+ * taking root_lock.  Returns -EAGAIN if the mapping may have changed
+ * since then, in which case the live tree has to be used.
+ */
+static int find_committed_block(struct dm_thin_device *td, dm_block_t block,
+				int can_block, uint64_t *block_time)
+{
+	int r, idx, valid;
+	unsigned seq;
+	dm_block_t root;
+	__le64 value;
+	struct dm_pool_metadata *pmd = td->pmd;
+	dm_block_t keys[2] = { td->id, block };
+	unsigned bit = changed_block_bit(td->id, block);
+
+	idx = srcu_read_lock(&pmd->committed_srcu);
+
+	do {
+		seq = read_seqcount_begin(&pmd->committed_seq);
+		root = pmd->committed_root;
+		valid = pmd->committed_root_valid &&
+			!test_bit(bit, pmd->changed_blocks);
+	} while (read_seqcount_retry(&pmd->committed_seq, seq));
+
+	if (valid) {
+		r = dm_btree_lookup(can_block ? &pmd->info : &pmd->nb_info,
+				    root, keys, &value);
+		if (!r)
+			*block_time = le64_to_cpu(value);
+	} else
+		r = -EAGAIN;
+
+	srcu_read_unlock(&pmd->committed_srcu, idx);
+
+	return r;
+}
+
 int dm_thin_find_block(struct dm_thin_device *td, dm_block_t block,
 		       int can_block, struct dm_thin_lookup_result *result)
 {
@@ -1152,6 +1271,10 @@ int dm_thin_find_block(struct dm_thin_device *td, dm_block_t block,
 	struct dm_pool_metadata *pmd = td->pmd;
 	dm_block_t keys[2] = { td->id, block };
 
+	r = find_committed_block(td, block, can_block, &block_time);
+	if (r != -EAGAIN)
+		goto out;
+
 	if (can_block) {
 		down_read(&pmd->root_lock);
 		r = dm_btree_lookup(&pmd->info, pmd->root, keys, &value);
@@ -1168,6 +1291,7 @@ int dm_thin_find_block(struct dm_thin_device *td, dm_block_t block,
 	} else
 		return -EWOULDBLOCK;
 
+out:
 	if (!r) {
 		dm_block_t exception_block;
 		uint32_t exception_time;
@@ -1189,6 +1313,7 @@ static int __insert(struct dm_thin_device *td, dm_block_t block,
 	dm_block_t keys[2] = { td->id, block };
 
 	pmd->need_commit = 1;
+	__mark_changed(td, block);
 	value = cpu_to_le64(pack_block_time(data_block, pmd->time));
 	__dm_bless_for_disk(&value);
 
@@ -1223,6 +1348,7 @@ static int __remove(struct dm_thin_device *td, dm_block_t block)
 	struct dm_pool_metadata *pmd = td->pmd;
 	dm_block_t keys[2] = { td->id, block };
 
+	__mark_changed(td, block);
 	r = dm_btree_remove(&pmd->info, pmd->root, keys, &pmd->root);
 	if (r)
 		return r;
@@ -1234,6 +1360,18 @@ static int __remove(struct dm_thin_device *td, dm_block_t block)
 	return 0;
 }
 
+void dm_thin_insert_blocks(struct dm_pool_metadata *pmd,
+			   struct dm_thin_mapping **mappings, unsigned count)
+{
+	unsigned i;
+
+	down_write(&pmd->root_lock);
+	for (i = 0; i < count; i++)
+		mappings[i]->r = __insert(mappings[i]->td, mappings[i]->virt_block,
+					  mappings[i]->data_block);
+	up_write(&pmd->root_lock);
+}
+
 int dm_thin_remove_block(struct dm_thin_device *td, dm_block_t block)
 {
 	int r;
@@ -1266,6 +1404,8 @@ int dm_pool_commit_metadata(struct dm_pool_metadata *pmd)
 	down_write(&pmd->root_lock);
 
 	r = __commit_transaction(pmd);
+	if (!r)
+		__publish_committed_root(pmd);
 	if (r <= 0)
 		goto out;
 
@@ -116,8 +116,11 @@ struct dm_thin_lookup_result {
 };
 
 /*
+ * Mappings that haven't changed since the last commit are looked up
+ * without taking the metadata lock, so many callers may do this at once.
+ *
  * Returns:
- *   -EWOULDBLOCK iff @can_block is set and would block.
+ *   -EWOULDBLOCK iff @can_block is not set and would block.
  *   -ENODATA iff that mapping is not present.
  *   0 success
  */
@@ -135,6 +138,20 @@ int dm_pool_alloc_data_block(struct dm_pool_metadata *pmd, dm_block_t *result);
 int dm_thin_insert_block(struct dm_thin_device *td, dm_block_t block,
 			 dm_block_t data_block);
 
+/*
+ * Inserts several mappings under a single acquisition of the metadata
+ * lock.  The result of each insertion is left in its r field.
+ */
+struct dm_thin_mapping {
+	struct dm_thin_device *td;
+	dm_block_t virt_block;
+	dm_block_t data_block;
+	int r;
+};
+
+void dm_thin_insert_blocks(struct dm_pool_metadata *pmd,
+			   struct dm_thin_mapping **mappings, unsigned count);
+
 int dm_thin_remove_block(struct dm_thin_device *td, dm_block_t block);
 
 /*
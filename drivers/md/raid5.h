@@ -208,6 +208,10 @@ struct stripe_head {
 	atomic_t		count;	      /* nr of active thread/requests */
 	int			bm_seq;	/* sequence number for bitmap flushes */
 	int			disks;		/* disks in stripe */
+	int			cpu;		/* cpu that last asked for the
+						 * stripe; picks the worker group */
+	struct r5worker_group	*group;		/* group whose handle_list
+						 * holds the stripe, if any */
 	enum check_states	check_state;
 	enum reconstruct_states reconstruct_state;
 	/**
@@ -360,6 +364,27 @@ struct disk_info {
 	struct md_rdev	*rdev, *replacement;
 };
 
+/*
+ * Stripe handling can be spread over worker threads, as well as being done
+ * by raid5d.  There is one group of workers per NUMA node; a stripe that
+ * needs handling is queued to the group of the node where it was last
+ * requested, and as many of the group's workers are kicked as there is
+ * work for.
+ */
+struct r5worker {
+	struct work_struct	work;
+	struct r5worker_group	*group;
+	int			cpu;		/* where the worker runs */
+	bool			working;
+};
+
+struct r5worker_group {
+	struct list_head	handle_list;	/* stripes needing handling */
+	struct r5conf		*conf;
+	struct r5worker		*workers;
+	int			stripes_cnt;	/* stripes on handle_list */
+};
+
 struct r5conf {
 	struct hlist_head	*stripe_hashtbl;
 	struct mddev		*mddev;
@@ -449,6 +474,9 @@ struct r5conf {
 	 * the new thread here until we fully activate the array.
 	 */
 	struct md_thread	*thread;
+	struct r5worker_group	*worker_groups;	/* indexed by node */
+	int			group_cnt;
+	int			worker_cnt_per_group; /* 0: raid5d only */
 };
 
 /*
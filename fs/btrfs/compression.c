@@ -160,6 +160,7 @@ static void end_compressed_bio_read(struct bio *bio, int err)
 	struct page *page;
 	unsigned long index;
 	int ret;
+	ktime_t start;
 
 	if (err)
 		cb->errors = 1;
@@ -178,12 +179,15 @@ static void end_compressed_bio_read(struct bio *bio, int err)
 	/* ok, we're the last bio for this extent, lets start
 	 * the decompression.
 	 */
+	start = ktime_get();
 	ret = btrfs_decompress_biovec(cb->compress_type,
 				      cb->compressed_pages,
 				      cb->start,
 				      cb->orig_bio->bi_io_vec,
 				      cb->orig_bio->bi_vcnt,
 				      cb->compressed_len);
+	atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)),
+		     &BTRFS_I(inode)->root->fs_info->decompress_ns);
 csum_failed:
 	if (ret)
 		cb->errors = 1;
@@ -19,6 +19,13 @@
 #ifndef __BTRFS_COMPRESSION_
 #define __BTRFS_COMPRESSION_
 
+/*
+ * delalloc ranges are handed to the compression workers in chunks of
+ * this size, one compressed extent each, so that a large write gets
+ * compressed on as many cpus as it has chunks
+ */
+#define BTRFS_COMPRESS_CHUNK (128 * 1024)
+
 void btrfs_init_compress(void);
 void btrfs_exit_compress(void);
 
@@ -1652,6 +1652,118 @@ done:
 	return ret;
 }
 
+/*
+ * helper function for btrfs_search_slot.  This walks down the nodes above
+ * stop_level without taking any tree locks.  Each node is read under its
+ * lock sequence (see btrfs_tree_read_seq_begin) and a block pointer is
+ * only followed once we know no writer touched the node while we read
+ * it.  The child must be in cache and match the generation in the
+ * pointer.  When we get to stop_level that block is locked the usual way
+ * and the parent is checked one more time, which proves the block was
+ * still in the tree when we locked it.
+ *
+ * The search must not need to change any of the nodes we walk through,
+ * so a block that needs cowing, splitting or balancing, or a slot zero
+ * whose key might change, makes us give up.
+ *
+ * Returns the locked block at stop_level with the path above it filled
+ * in but unlocked, or NULL with the path released if the caller should
+ * do a locked search.
+ */
+static struct extent_buffer *
+search_unlocked(struct btrfs_trans_handle *trans, struct btrfs_root *root,
+		struct btrfs_key *key, struct btrfs_path *p, int ins_len,
+		int cow, int stop_level, int write_lock_level, int *lock_ret)
+{
+	struct extent_buffer *b;
+	struct extent_buffer *child;
+	unsigned seq;
+	unsigned child_seq;
+	u64 blocknr;
+	u64 gen;
+	u32 nritems;
+	int level;
+	int slot;
+	int ret;
+
+	b = btrfs_root_node(root);
+	level = btrfs_header_level(b);
+	if (level <= stop_level || level >= BTRFS_MAX_LEVEL ||
+	    !btrfs_tree_read_seq_begin(b, &seq)) {
+		free_extent_buffer(b);
+		return NULL;
+	}
+	p->nodes[level] = b;
+
+	while (1) {
+		nritems = btrfs_header_nritems(b);
+		if (nritems == 0 || nritems > BTRFS_NODEPTRS_PER_BLOCK(root))
+			goto fail;
+
+		if (cow && should_cow_block(trans, root, b))
+			goto fail;
+		if ((p->search_for_split || ins_len > 0) &&
+		    nritems >= BTRFS_NODEPTRS_PER_BLOCK(root) - 3)
+			goto fail;
+		if (ins_len < 0 && nritems < BTRFS_NODEPTRS_PER_BLOCK(root) / 2)
+			goto fail;
+
+		ret = bin_search(b, key, level, &slot);
+		if (ret && slot > 0)
+			slot--;
+		if (cow && slot == 0)
+			goto fail;
+
+		blocknr = btrfs_node_blockptr(b, slot);
+		gen = btrfs_node_ptr_generation(b, slot);
+		if (btrfs_tree_read_seq_retry(b, seq))
+			goto fail;
+		p->slots[level] = slot;
+
+		child = btrfs_find_tree_block(root, blocknr,
+					      btrfs_level_size(root, level - 1));
+		if (!child)
+			goto fail;
+		if (btrfs_buffer_uptodate(child, gen, 1) <= 0) {
+			free_extent_buffer(child);
+			goto fail;
+		}
+
+		level--;
+		if (level == stop_level)
+			break;
+
+		if (!btrfs_tree_read_seq_begin(child, &child_seq) ||
+		    btrfs_tree_read_seq_retry(b, seq) ||
+		    btrfs_header_level(child) != level) {
+			free_extent_buffer(child);
+			goto fail;
+		}
+		b = child;
+		seq = child_seq;
+		p->nodes[level] = b;
+	}
+
+	if (stop_level <= write_lock_level) {
+		btrfs_tree_lock(child);
+		*lock_ret = BTRFS_WRITE_LOCK;
+	} else {
+		btrfs_tree_read_lock(child);
+		*lock_ret = BTRFS_READ_LOCK;
+	}
+	if (btrfs_tree_read_seq_retry(b, seq) ||
+	    btrfs_header_level(child) != stop_level) {
+		btrfs_tree_unlock_rw(child, *lock_ret);
+		free_extent_buffer(child);
+		goto fail;
+	}
+	return child;
+
+fail:
+	btrfs_release_path(p);
+	return NULL;
+}
+
 /*
  * look for key in the tree.  path is filled in with nodes along the way
  * if key is found, we return zero and you can find the item in the leaf
@@ -1715,7 +1827,16 @@ again:
 	 */
 	root_lock = BTRFS_READ_LOCK;
 	level = 0;
-	if (p->search_commit_root) {
+	b = NULL;
+	if (!p->search_commit_root && !p->skip_locking && !p->keep_locks &&
+	    write_lock_level < BTRFS_MAX_LEVEL)
+		b = search_unlocked(trans, root, key, p, ins_len, cow,
+				    max_t(int, write_lock_level, lowest_level),
+				    write_lock_level, &root_lock);
+	if (b) {
+		/* the levels above b were walked without locks */
+		level = btrfs_header_level(b);
+	} else if (p->search_commit_root) {
 		/*
 		 * the commit roots are read only
 		 * so we always do read locks
@@ -1195,8 +1195,21 @@ struct btrfs_fs_info {
 	struct task_struct *cleaner_kthread;
 	int thread_pool_size;
 
+	/* /sys/fs/btrfs/<fsid> */
 	struct kobject super_kobj;
 	struct completion kobj_unregister;
+
+	/*
+	 * compression stats for sysfs.  bytes_in is what was handed to
+	 * the compressor and bytes_out is what we stored for it, which is
+	 * bytes_in again when compression didn't pay off.  The times are
+	 * the cpu time spent in the compressors, in nanoseconds.
+	 */
+	atomic64_t compress_bytes_in;
+	atomic64_t compress_bytes_out;
+	atomic64_t compress_ns;
+	atomic64_t decompress_ns;
+
 	int do_barriers;
 	int closing;
 	int log_root_recovering;
@@ -1541,6 +1554,7 @@ struct btrfs_ioctl_defrag_range_args {
 #define BTRFS_MOUNT_CHECK_INTEGRITY	(1 << 20)
 #define BTRFS_MOUNT_CHECK_INTEGRITY_INCLUDING_EXTENT_DATA (1 << 21)
 #define BTRFS_MOUNT_PANIC_ON_FATAL_ERROR	(1 << 22)
+#define BTRFS_MOUNT_THREAD_POOL		(1 << 23)
 
 #define btrfs_clear_opt(o, opt)		((o) &= ~BTRFS_MOUNT_##opt)
 #define btrfs_set_opt(o, opt)		((o) |= BTRFS_MOUNT_##opt)
@@ -2474,6 +2488,8 @@ static inline u64 btrfs_calc_trunc_metadata_size(struct btrfs_root *root,
 void btrfs_put_block_group(struct btrfs_block_group_cache *cache);
 int btrfs_run_delayed_refs(struct btrfs_trans_handle *trans,
 			   struct btrfs_root *root, unsigned long count);
+int btrfs_run_delayed_refs_batched(struct btrfs_trans_handle *trans,
+				   struct btrfs_root *root, unsigned long count);
 int btrfs_lookup_extent(struct btrfs_root *root, u64 start, u64 len);
 int btrfs_lookup_extent_info(struct btrfs_trans_handle *trans,
 			     struct btrfs_root *root, u64 bytenr,
@@ -2988,6 +3004,8 @@ int btrfs_defrag_leaves(struct btrfs_trans_handle *trans,
 /* sysfs.c */
 int btrfs_init_sysfs(void);
 void btrfs_exit_sysfs(void);
+int btrfs_sysfs_add_fs(struct btrfs_fs_info *fs_info);
+void btrfs_sysfs_remove_fs(struct btrfs_fs_info *fs_info);
 
 /* xattr.c */
 ssize_t btrfs_listxattr(struct dentry *dentry, char *buffer, size_t size);
@@ -24,6 +24,12 @@
 #define BTRFS_ADD_DELAYED_EXTENT 3 /* record a full extent allocation */
 #define BTRFS_UPDATE_DELAYED_HEAD 4 /* not changing ref count on head ref */
 
+/*
+ * the smallest number of refs a handle runs when it ends, see
+ * btrfs_run_delayed_refs_batched
+ */
+#define BTRFS_DELAYED_REF_BATCH 128
+
 struct btrfs_delayed_ref_node {
 	struct rb_node rb_node;
 
@@ -138,6 +144,13 @@ struct btrfs_delayed_ref_root {
 	 */
 	int flushing;
 
+	/*
+	 * set while a transaction handle is running delayed refs on
+	 * behalf of everyone, so the others don't pile in on the extent
+	 * root as well
+	 */
+	atomic_t procs_running_refs;
+
 	u64 run_delayed_start;
 
 	/*
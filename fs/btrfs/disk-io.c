@@ -1866,6 +1866,7 @@ int open_ctree(struct super_block *sb,
 	int err = -EINVAL;
 	int num_backups_tried = 0;
 	int backup_index = 0;
+	int cpu_pool_size;
 
 	tree_root = fs_info->tree_root = btrfs_alloc_root(fs_info);
 	extent_root = fs_info->extent_root = btrfs_alloc_root(fs_info);
@@ -1917,6 +1918,10 @@ int open_ctree(struct super_block *sb,
 	mutex_init(&fs_info->reloc_mutex);
 
 	init_completion(&fs_info->kobj_unregister);
+	atomic64_set(&fs_info->compress_bytes_in, 0);
+	atomic64_set(&fs_info->compress_bytes_out, 0);
+	atomic64_set(&fs_info->compress_ns, 0);
+	atomic64_set(&fs_info->decompress_ns, 0);
 	INIT_LIST_HEAD(&fs_info->dirty_cowonly_roots);
 	INIT_LIST_HEAD(&fs_info->space_info);
 	btrfs_mapping_init(&fs_info->mapping_tree);
@@ -2157,13 +2162,20 @@ int open_ctree(struct super_block *sb,
 	btrfs_init_workers(&fs_info->generic_worker,
 			   "genwork", 1, NULL);
 
+	/*
+	 * checksumming and compression are cpu bound.  Unless the admin
+	 * picked a pool size, the workers doing them may use every cpu
+	 * instead of the small default the other pools get.
+	 */
+	cpu_pool_size = fs_info->thread_pool_size;
+	if (!btrfs_test_opt(tree_root, THREAD_POOL))
+		cpu_pool_size = max_t(int, cpu_pool_size, num_online_cpus());
+
 	btrfs_init_workers(&fs_info->workers, "worker",
-			   fs_info->thread_pool_size,
-			   &fs_info->generic_worker);
+			   cpu_pool_size, &fs_info->generic_worker);
 
 	btrfs_init_workers(&fs_info->delalloc_workers, "delalloc",
-			   fs_info->thread_pool_size,
-			   &fs_info->generic_worker);
+			   cpu_pool_size, &fs_info->generic_worker);
 
 	btrfs_init_workers(&fs_info->submit_workers, "submit",
 			   min_t(u64, fs_devices->num_devices,
@@ -2188,8 +2200,7 @@ int open_ctree(struct super_block *sb,
 	btrfs_init_workers(&fs_info->fixup_workers, "fixup", 1,
 			   &fs_info->generic_worker);
 	btrfs_init_workers(&fs_info->endio_workers, "endio",
-			   fs_info->thread_pool_size,
-			   &fs_info->generic_worker);
+			   cpu_pool_size, &fs_info->generic_worker);
 	btrfs_init_workers(&fs_info->endio_meta_workers, "endio-meta",
 			   fs_info->thread_pool_size,
 			   &fs_info->generic_worker);
@@ -2504,6 +2504,30 @@ out:
 	return 0;
 }
 
+/*
+ * called as transaction handles end.  When lots of handles end at once
+ * they would all run delayed refs at the same time and fight over the
+ * same extent tree blocks.  Instead, the first one in runs at least
+ * BTRFS_DELAYED_REF_BATCH refs for everybody and the others just go
+ * on their way.  Anything left is run at commit time.
+ */
+int btrfs_run_delayed_refs_batched(struct btrfs_trans_handle *trans,
+				   struct btrfs_root *root, unsigned long count)
+{
+	struct btrfs_delayed_ref_root *delayed_refs;
+	int ret;
+
+	delayed_refs = &trans->transaction->delayed_refs;
+	if (atomic_read(&delayed_refs->procs_running_refs) ||
+	    atomic_xchg(&delayed_refs->procs_running_refs, 1))
+		return 0;
+
+	ret = btrfs_run_delayed_refs(trans, root,
+			max_t(unsigned long, count, BTRFS_DELAYED_REF_BATCH));
+	atomic_set(&delayed_refs->procs_running_refs, 0);
+	return ret;
+}
+
 int btrfs_set_disk_extent_flags(struct btrfs_trans_handle *trans,
 				struct btrfs_root *root,
 				u64 bytenr, u64 num_bytes, u64 flags,
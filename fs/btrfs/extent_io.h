@@ -2,6 +2,7 @@
 #define __EXTENTIO__
 
 #include <linux/rbtree.h>
+#include <linux/seqlock.h>
 
 /* bits for the extent state */
 #define EXTENT_DIRTY 1
@@ -152,6 +153,9 @@ struct extent_buffer {
 	/* protects write locks */
 	rwlock_t lock;
 
+	/* odd while a writer holds the lock, see btrfs_tree_read_seq_begin */
+	seqcount_t lock_seq;
+
 	/* readers use lock_wq while they wait for the write
 	 * lock holders to unlock
 	 */
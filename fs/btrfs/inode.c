@@ -330,6 +330,7 @@ static noinline int compress_file_range(struct inode *inode,
 					int *num_added)
 {
 	struct btrfs_root *root = BTRFS_I(inode)->root;
+	struct btrfs_fs_info *fs_info = root->fs_info;
 	struct btrfs_trans_handle *trans;
 	u64 num_bytes;
 	u64 blocksize = root->sectorsize;
@@ -341,6 +342,8 @@ static noinline int compress_file_range(struct inode *inode,
 	unsigned long nr_pages_ret = 0;
 	unsigned long total_compressed = 0;
 	unsigned long total_in = 0;
+	unsigned long compress_len = 0;
+	ktime_t compress_start;
 	unsigned long max_compressed = 128 * 1024;
 	unsigned long max_uncompressed = 128 * 1024;
 	int i;
@@ -408,6 +411,8 @@ again:
 		if (BTRFS_I(inode)->force_compress)
 			compress_type = BTRFS_I(inode)->force_compress;
 
+		compress_len = total_compressed;
+		compress_start = ktime_get();
 		ret = btrfs_compress_pages(compress_type,
 					   inode->i_mapping, start,
 					   total_compressed, pages,
@@ -415,6 +420,8 @@ again:
 					   &total_in,
 					   &total_compressed,
 					   max_compressed);
+		atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), compress_start)),
+			     &fs_info->compress_ns);
 
 		if (!ret) {
 			unsigned long offset = total_compressed &
@@ -496,9 +503,15 @@ cont:
 			will_compress = 0;
 		} else {
 			num_bytes = total_in;
+			atomic64_add(total_in, &fs_info->compress_bytes_in);
+			atomic64_add(total_compressed,
+				     &fs_info->compress_bytes_out);
 		}
 	}
 	if (!will_compress && pages) {
+		atomic64_add(compress_len, &fs_info->compress_bytes_in);
+		atomic64_add(compress_len, &fs_info->compress_bytes_out);
+
 		/*
 		 * the compression code ran but failed to make things smaller,
 		 * free any pages it allocated and our page pointer array
@@ -1043,7 +1056,7 @@ static int cow_file_range_async(struct inode *inode, struct page *locked_page,
 		if (BTRFS_I(inode)->flags & BTRFS_INODE_NOCOMPRESS)
 			cur_end = end;
 		else
-			cur_end = min(end, start + 512 * 1024 - 1);
+			cur_end = min(end, start + BTRFS_COMPRESS_CHUNK - 1);
 
 		async_cow->end = cur_end;
 		INIT_LIST_HEAD(&async_cow->extents);
@@ -5062,6 +5075,7 @@ static noinline int uncompress_inline(struct btrfs_path *path,
 	unsigned long inline_size;
 	unsigned long ptr;
 	int compress_type;
+	ktime_t start;
 
 	WARN_ON(pg_offset != 0);
 	compress_type = btrfs_file_extent_compression(leaf, item);
@@ -5076,8 +5090,11 @@ static noinline int uncompress_inline(struct btrfs_path *path,
 	read_extent_buffer(leaf, tmp, ptr, inline_size);
 
 	max_size = min_t(unsigned long, PAGE_CACHE_SIZE, max_size);
+	start = ktime_get();
 	ret = btrfs_decompress(compress_type, tmp, page,
 			       extent_offset, inline_size, max_size);
+	atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)),
+		     &BTRFS_I(inode)->root->fs_info->decompress_ns);
 	if (ret) {
 		char *kaddr = kmap_atomic(page);
 		unsigned long copy_size = min_t(u64,
@@ -26,6 +26,31 @@
 
 void btrfs_assert_tree_read_locked(struct extent_buffer *eb);
 
+/*
+ * how many times to poll a blocking lock holder before we give up
+ * and sleep on the waitqueue
+ */
+#define BTRFS_LOCK_SPIN_LOOPS 1024
+
+/*
+ * blocking holders often drop their lock again before the cost of a
+ * sleep and a wakeup has been paid back.  Poll @blocking for a little
+ * while, which is all the waiter needs when the lock is handed back
+ * quickly.  The caller still has to wait_event() in case it wasn't.
+ */
+static void btrfs_spin_on_blocking(atomic_t *blocking)
+{
+#ifdef CONFIG_SMP
+	int i;
+
+	for (i = 0; i < BTRFS_LOCK_SPIN_LOOPS; i++) {
+		if (!atomic_read(blocking) || need_resched())
+			return;
+		cpu_relax();
+	}
+#endif
+}
+
 /*
  * if we currently have a spinning reader or writer lock
  * (indicated by the rw flag) this will bump the count
@@ -112,6 +137,7 @@ again:
 		return;
 	}
 	read_unlock(&eb->lock);
+	btrfs_spin_on_blocking(&eb->blocking_writers);
 	wait_event(eb->write_lock_wq, atomic_read(&eb->blocking_writers) == 0);
 	read_lock(&eb->lock);
 	if (atomic_read(&eb->blocking_writers)) {
@@ -156,6 +182,7 @@ int btrfs_try_tree_write_lock(struct extent_buffer *eb)
 		write_unlock(&eb->lock);
 		return 0;
 	}
+	write_seqcount_begin(&eb->lock_seq);
 	atomic_inc(&eb->write_locks);
 	atomic_inc(&eb->spinning_writers);
 	eb->lock_owner = current->pid;
@@ -211,7 +238,9 @@ void btrfs_tree_read_unlock_blocking(struct extent_buffer *eb)
 void btrfs_tree_lock(struct extent_buffer *eb)
 {
 again:
+	btrfs_spin_on_blocking(&eb->blocking_readers);
 	wait_event(eb->read_lock_wq, atomic_read(&eb->blocking_readers) == 0);
+	btrfs_spin_on_blocking(&eb->blocking_writers);
 	wait_event(eb->write_lock_wq, atomic_read(&eb->blocking_writers) == 0);
 	write_lock(&eb->lock);
 	if (atomic_read(&eb->blocking_readers)) {
@@ -227,6 +256,7 @@ again:
 		goto again;
 	}
 	WARN_ON(atomic_read(&eb->spinning_writers));
+	write_seqcount_begin(&eb->lock_seq);
 	atomic_inc(&eb->spinning_writers);
 	atomic_inc(&eb->write_locks);
 	eb->lock_owner = current->pid;
@@ -243,6 +273,7 @@ void btrfs_tree_unlock(struct extent_buffer *eb)
 
 	btrfs_assert_tree_locked(eb);
 	atomic_dec(&eb->write_locks);
+	write_seqcount_end(&eb->lock_seq);
 
 	if (blockers) {
 		WARN_ON(atomic_read(&eb->spinning_writers));
@@ -37,6 +37,31 @@ void btrfs_assert_tree_locked(struct extent_buffer *eb);
 int btrfs_try_tree_read_lock(struct extent_buffer *eb);
 int btrfs_try_tree_write_lock(struct extent_buffer *eb);
 
+/*
+ * Unlocked readers of a tree block.  Every write lock holder bumps
+ * eb->lock_seq when it takes the lock and again when it drops it, so
+ * anything read from the buffer between a successful
+ * btrfs_tree_read_seq_begin() and a btrfs_tree_read_seq_retry() that
+ * returns zero was not being changed meanwhile.
+ *
+ * btrfs_tree_read_seq_begin returns 0 if the block is write locked
+ * right now.  Writers can hold the lock for a long time, so the caller
+ * should take the lock properly rather than wait for them.
+ */
+static inline int btrfs_tree_read_seq_begin(struct extent_buffer *eb,
+					    unsigned *seq)
+{
+	*seq = ACCESS_ONCE(eb->lock_seq.sequence);
+	smp_rmb();
+	return !(*seq & 1);
+}
+
+static inline int btrfs_tree_read_seq_retry(struct extent_buffer *eb,
+					    unsigned seq)
+{
+	return read_seqcount_retry(&eb->lock_seq, seq);
+}
+
 static inline void btrfs_tree_unlock_rw(struct extent_buffer *eb, int rw)
 {
 	if (rw == BTRFS_WRITE_LOCK || rw == BTRFS_WRITE_LOCK_BLOCKING)
@@ -259,6 +259,7 @@ void __btrfs_panic(struct btrfs_fs_info *fs_info, const char *function,
 
 static void btrfs_put_super(struct super_block *sb)
 {
+	btrfs_sysfs_remove_fs(btrfs_sb(sb));
 	(void)close_ctree(btrfs_sb(sb)->tree_root);
 	/* FIXME: need to fix VFS to return error? */
 	/* AV: return it _where_?  ->put_super() can be triggered by any number
@@ -437,6 +438,7 @@ int btrfs_parse_options(struct btrfs_root *root, char *options)
 			match_int(&args[0], &intarg);
 			if (intarg) {
 				info->thread_pool_size = intarg;
+				btrfs_set_opt(info->mount_opt, THREAD_POOL);
 				printk(KERN_INFO "btrfs: thread pool %d\n",
 				       info->thread_pool_size);
 			}
@@ -776,19 +778,23 @@ static int btrfs_fill_super(struct super_block *sb,
 		return err;
 	}
 
+	err = btrfs_sysfs_add_fs(fs_info);
+	if (err)
+		goto fail_close;
+
 	key.objectid = BTRFS_FIRST_FREE_OBJECTID;
 	key.type = BTRFS_INODE_ITEM_KEY;
 	key.offset = 0;
 	inode = btrfs_iget(sb, &key, fs_info->fs_root, NULL);
 	if (IS_ERR(inode)) {
 		err = PTR_ERR(inode);
-		goto fail_close;
+		goto fail_sysfs;
 	}
 
 	sb->s_root = d_make_root(inode);
 	if (!sb->s_root) {
 		err = -ENOMEM;
-		goto fail_close;
+		goto fail_sysfs;
 	}
 
 	save_mount_options(sb, data);
@@ -796,6 +802,8 @@ static int btrfs_fill_super(struct super_block *sb,
 	sb->s_flags |= MS_ACTIVE;
 	return 0;
 
+fail_sysfs:
+	btrfs_sysfs_remove_fs(fs_info);
 fail_close:
 	close_ctree(fs_info->tree_root);
 	return err;
@@ -844,8 +852,7 @@ static int btrfs_show_options(struct seq_file *seq, struct dentry *dentry)
 	if (info->alloc_start != 0)
 		seq_printf(seq, ",alloc_start=%llu",
 			   (unsigned long long)info->alloc_start);
-	if (info->thread_pool_size !=  min_t(unsigned long,
-					     num_online_cpus() + 2, 8))
+	if (btrfs_test_opt(root, THREAD_POOL))
 		seq_printf(seq, ",thread_pool=%d", info->thread_pool_size);
 	if (btrfs_test_opt(root, COMPRESS)) {
 		if (info->compress_type == BTRFS_COMPRESS_ZLIB)
@@ -31,6 +31,116 @@
 /* /sys/fs/btrfs/ entry */
 static struct kset *btrfs_kset;
 
+struct btrfs_fs_attr {
+	struct attribute attr;
+	u64 (*show)(struct btrfs_fs_info *fs_info);
+};
+
+static u64 compress_bytes_in_show(struct btrfs_fs_info *fs_info)
+{
+	return atomic64_read(&fs_info->compress_bytes_in);
+}
+
+static u64 compress_bytes_out_show(struct btrfs_fs_info *fs_info)
+{
+	return atomic64_read(&fs_info->compress_bytes_out);
+}
+
+/* what we stored as a percentage of what went into the compressor */
+static u64 compress_ratio_show(struct btrfs_fs_info *fs_info)
+{
+	u64 in = atomic64_read(&fs_info->compress_bytes_in);
+	u64 out = atomic64_read(&fs_info->compress_bytes_out);
+
+	if (!in)
+		return 100;
+	return div64_u64(out * 100, in);
+}
+
+static u64 compress_time_ms_show(struct btrfs_fs_info *fs_info)
+{
+	return div_u64(atomic64_read(&fs_info->compress_ns), NSEC_PER_MSEC);
+}
+
+static u64 decompress_time_ms_show(struct btrfs_fs_info *fs_info)
+{
+	return div_u64(atomic64_read(&fs_info->decompress_ns), NSEC_PER_MSEC);
+}
+
+#define BTRFS_FS_ATTR(_name)						\
+static struct btrfs_fs_attr btrfs_fs_attr_##_name = {			\
+	.attr = { .name = __stringify(_name), .mode = S_IRUGO },	\
+	.show = _name##_show,						\
+}
+
+BTRFS_FS_ATTR(compress_bytes_in);
+BTRFS_FS_ATTR(compress_bytes_out);
+BTRFS_FS_ATTR(compress_ratio);
+BTRFS_FS_ATTR(compress_time_ms);
+BTRFS_FS_ATTR(decompress_time_ms);
+
+static struct attribute *btrfs_fs_attrs[] = {
+	&btrfs_fs_attr_compress_bytes_in.attr,
+	&btrfs_fs_attr_compress_bytes_out.attr,
+	&btrfs_fs_attr_compress_ratio.attr,
+	&btrfs_fs_attr_compress_time_ms.attr,
+	&btrfs_fs_attr_decompress_time_ms.attr,
+	NULL,
+};
+
+static ssize_t btrfs_fs_attr_show(struct kobject *kobj,
+				  struct attribute *attr, char *buf)
+{
+	struct btrfs_fs_info *fs_info = container_of(kobj,
+						     struct btrfs_fs_info,
+						     super_kobj);
+	struct btrfs_fs_attr *a = container_of(attr, struct btrfs_fs_attr,
+					       attr);
+
+	return snprintf(buf, PAGE_SIZE, "%llu\n",
+			(unsigned long long)a->show(fs_info));
+}
+
+static const struct sysfs_ops btrfs_fs_attr_ops = {
+	.show	= btrfs_fs_attr_show,
+};
+
+static void btrfs_fs_release(struct kobject *kobj)
+{
+	struct btrfs_fs_info *fs_info = container_of(kobj,
+						     struct btrfs_fs_info,
+						     super_kobj);
+	complete(&fs_info->kobj_unregister);
+}
+
+static struct kobj_type btrfs_fs_ktype = {
+	.default_attrs	= btrfs_fs_attrs,
+	.sysfs_ops	= &btrfs_fs_attr_ops,
+	.release	= btrfs_fs_release,
+};
+
+/* /sys/fs/btrfs/<fsid>/ */
+int btrfs_sysfs_add_fs(struct btrfs_fs_info *fs_info)
+{
+	int ret;
+
+	fs_info->super_kobj.kset = btrfs_kset;
+	ret = kobject_init_and_add(&fs_info->super_kobj, &btrfs_fs_ktype,
+				   NULL, "%pU", fs_info->fsid);
+	if (ret) {
+		kobject_put(&fs_info->super_kobj);
+		wait_for_completion(&fs_info->kobj_unregister);
+	}
+	return ret;
+}
+
+void btrfs_sysfs_remove_fs(struct btrfs_fs_info *fs_info)
+{
+	kobject_del(&fs_info->super_kobj);
+	kobject_put(&fs_info->super_kobj);
+	wait_for_completion(&fs_info->kobj_unregister);
+}
+
 int btrfs_init_sysfs(void)
 {
 	btrfs_kset = kset_create_and_add("btrfs", NULL, fs_kobj);
@@ -119,6 +119,7 @@ loop:
 	cur_trans->delayed_refs.num_heads_ready = 0;
 	cur_trans->delayed_refs.num_heads = 0;
 	cur_trans->delayed_refs.flushing = 0;
+	atomic_set(&cur_trans->delayed_refs.procs_running_refs, 0);
 	cur_trans->delayed_refs.run_delayed_start = 0;
 	cur_trans->delayed_refs.seq = 1;
 	init_waitqueue_head(&cur_trans->delayed_refs.seq_wait);
@@ -466,7 +467,7 @@ int btrfs_should_end_transaction(struct btrfs_trans_handle *trans,
 	updates = trans->delayed_ref_updates;
 	trans->delayed_ref_updates = 0;
 	if (updates) {
-		err = btrfs_run_delayed_refs(trans, root, updates);
+		err = btrfs_run_delayed_refs_batched(trans, root, updates);
 		if (err) /* Error code will also eval true */
 			return err;
 	}
@@ -497,7 +498,7 @@ static int __btrfs_end_transaction(struct btrfs_trans_handle *trans,
 		if (cur &&
 		    trans->transaction->delayed_refs.num_heads_ready > 64) {
 			trans->delayed_ref_updates = 0;
-			btrfs_run_delayed_refs(trans, root, cur);
+			btrfs_run_delayed_refs_batched(trans, root, cur);
 		} else {
 			break;
 		}
@@ -426,6 +426,8 @@ void __d_drop(struct dentry *dentry)
 	if (!d_unhashed(dentry)) {
 		__d_shrink(dentry);
 		dentry_rcuwalk_barrier(dentry);
+		if (unlikely(dentry->d_flags & DCACHE_PATH_CACHED))
+			path_cache_forget(dentry);
 	}
 }
 EXPORT_SYMBOL(__d_drop);
@@ -532,13 +534,11 @@ void dput(struct dentry *dentry)
 repeat:
 	if (dentry->d_count == 1)
 		might_sleep();
-	spin_lock(&dentry->d_lock);
-	BUG_ON(!dentry->d_count);
-	if (dentry->d_count > 1) {
-		dentry->d_count--;
-		spin_unlock(&dentry->d_lock);
+	if (lockref_put_or_lock(&dentry->d_lockref))
 		return;
-	}
+
+	/* d_lock is held and this is the last reference */
+	BUG_ON(!dentry->d_count);
 
 	if (dentry->d_flags & DCACHE_OP_DELETE) {
 		if (dentry->d_op->d_delete(dentry))
@@ -569,6 +569,31 @@ kill_it:
 }
 EXPORT_SYMBOL(dput);
 
+#ifdef CONFIG_PATH_LOOKUP_CACHE
+/*
+ * Drop a reference to @dentry if that can be done without blocking: it
+ * isn't the last one, or the dentry is merely kept on the LRU after it.
+ * Returns false if the caller has to dput() it instead.  Called with
+ * @dentry->d_lock held.
+ */
+bool __dput_nonblock(struct dentry *dentry)
+{
+	if (dentry->d_count == 1) {
+		if (dentry->d_flags & DCACHE_OP_DELETE) {
+			if (dentry->d_op->d_delete(dentry))
+				return false;
+		}
+		if (d_unhashed(dentry))
+			return false;
+		if (!d_need_lookup(dentry))
+			dentry->d_flags |= DCACHE_REFERENCED;
+		dentry_lru_add(dentry);
+	}
+	dentry->d_count--;
+	return true;
+}
+#endif
+
 /**
  * d_invalidate - invalidate a dentry
  * @dentry: dentry to invalidate
@@ -634,14 +659,28 @@ static inline void __dget_dlock(struct dentry *dentry)
 
 static inline void __dget(struct dentry *dentry)
 {
-	spin_lock(&dentry->d_lock);
-	__dget_dlock(dentry);
-	spin_unlock(&dentry->d_lock);
+	lockref_get(&dentry->d_lockref);
 }
 
 struct dentry *dget_parent(struct dentry *dentry)
 {
 	struct dentry *ret;
+	int gotref;
+
+	/*
+	 * Try to take the reference without d_lock first.  The parent is
+	 * held by the child, so the count can only be zero if we raced
+	 * with a rename; the recheck of d_parent catches that as well.
+	 */
+	rcu_read_lock();
+	ret = ACCESS_ONCE(dentry->d_parent);
+	gotref = lockref_get_not_zero(&ret->d_lockref);
+	rcu_read_unlock();
+	if (likely(gotref)) {
+		if (likely(ret == ACCESS_ONCE(dentry->d_parent)))
+			return ret;
+		dput(ret);
+	}
 
 repeat:
 	/*
@@ -210,6 +210,9 @@ void ext4_init_block_bitmap(struct super_block *sb, struct buffer_head *bh,
 	 */
 	ext4_mark_bitmap_end(num_clusters_in_group(sb, block_group),
 			     sb->s_blocksize * 8, bh->b_data);
+	ext4_block_bitmap_csum_set(sb, block_group, gdp, bh,
+				   EXT4_CLUSTERS_PER_GROUP(sb) / 8);
+	gdp->bg_checksum = ext4_group_desc_csum(sbi, block_group, gdp);
 }
 
 /* Return the number of free blocks in a block group.  It is used when
@@ -325,6 +328,36 @@ err_out:
 			block_group, bitmap_blk);
 	return 0;
 }
+
+/*
+ * Check a block bitmap that was just read from disk.  Once a bitmap has
+ * passed it is marked verified, so it is not checked again for as long as
+ * it stays in memory.
+ */
+static void ext4_validate_block_bitmap(struct super_block *sb,
+				       struct ext4_group_desc *desc,
+				       unsigned int block_group,
+				       struct buffer_head *bh)
+{
+	int csum_ok;
+
+	if (buffer_verified(bh))
+		return;
+
+	/* Writers update the bitmap and its checksum under the group lock */
+	ext4_lock_group(sb, block_group);
+	csum_ok = ext4_block_bitmap_csum_verify(sb, block_group, desc, bh,
+					EXT4_CLUSTERS_PER_GROUP(sb) / 8);
+	ext4_unlock_group(sb, block_group);
+	if (unlikely(!csum_ok)) {
+		ext4_error(sb, "bg %u: bad block bitmap checksum",
+			   block_group);
+		return;
+	}
+	/* Panic or remount fs read-only if block bitmap is invalid */
+	if (likely(ext4_valid_block_bitmap(sb, desc, block_group, bh)))
+		set_buffer_verified(bh);
+}
 /**
  * ext4_read_block_bitmap()
  * @sb:			super block
@@ -367,6 +400,7 @@ ext4_read_block_bitmap_nowait(struct super_block *sb, ext4_group_t block_group)
 		ext4_init_block_bitmap(sb, bh, block_group, desc);
 		set_bitmap_uptodate(bh);
 		set_buffer_uptodate(bh);
+		set_buffer_verified(bh);
 		ext4_unlock_group(sb, block_group);
 		unlock_buffer(bh);
 		return bh;
@@ -411,9 +445,9 @@ int ext4_wait_block_bitmap(struct super_block *sb, ext4_group_t block_group,
 		return 1;
 	}
 	clear_buffer_new(bh);
-	/* Panic or remount fs read-only if block bitmap is invalid */
-	ext4_valid_block_bitmap(sb, desc, block_group, bh);
-	return 0;
+	ext4_validate_block_bitmap(sb, desc, block_group, bh);
+	/* ...but refuse to use it if errors=continue */
+	return !buffer_verified(bh);
 }
 
 struct buffer_head *
@@ -0,0 +1,1220 @@
+/*
+ * linux/fs/ext4/inline.c
+ *
+ * Inline data: small files and directories stored in the inode itself.
+ *
+ * The first EXT4_MIN_INLINE_DATA_SIZE bytes live in i_block, anything
+ * beyond that in the value of the in-inode "system.data" extended
+ * attribute, so the limit is i_block plus whatever the in-inode xattr
+ * area has free.  The attribute exists, possibly empty, for as long as
+ * the inode carries EXT4_INLINE_DATA_FL.  Once data no longer fits it is
+ * moved to a regular block and the inode goes back to extents (or
+ * indirect blocks).
+ *
+ * Inline directories only use i_block: the parent's inode number in the
+ * first four bytes, then ordinary directory entries.  "." and ".." are
+ * synthesized.
+ *
+ * The xattr area is protected by xattr_sem; system.data can move when
+ * other in-inode attributes change, so its entry is looked up again under
+ * the lock each time rather than remembered.
+ */
+
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/buffer_head.h>
+#include <linux/fiemap.h>
+#include <linux/slab.h>
+
+#include "ext4_jbd2.h"
+#include "ext4.h"
+#include "xattr.h"
+
+#define EXT4_INLINE_DIR_SIZE \
+	(EXT4_MIN_INLINE_DATA_SIZE - EXT4_INLINE_DOTDOT_SIZE)
+
+/*
+ * Look up system.data in the inode body.  @is->iloc must be valid; on
+ * return is->s.here points at the entry unless is->s.not_found is set.
+ * Called with xattr_sem held.
+ */
+static int ext4_find_inline_xattr(struct inode *inode,
+				  struct ext4_xattr_ibody_find *is)
+{
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM_DATA,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+	};
+
+	is->s.not_found = -ENODATA;
+	return ext4_xattr_ibody_find(inode, &i, is);
+}
+
+static unsigned int ext4_inline_xattr_len(struct ext4_xattr_ibody_find *is)
+{
+	if (is->s.not_found)
+		return 0;
+	return le32_to_cpu(is->s.here->e_value_size);
+}
+
+static void *ext4_inline_xattr_value(struct ext4_xattr_ibody_find *is)
+{
+	return is->s.base + le16_to_cpu(is->s.here->e_value_offs);
+}
+
+/* Number of bytes currently held inline */
+static unsigned int ext4_inline_size(struct ext4_xattr_ibody_find *is)
+{
+	return EXT4_MIN_INLINE_DATA_SIZE + ext4_inline_xattr_len(is);
+}
+
+/*
+ * How large the system.data value could grow if it were given all the
+ * free space of the in-inode xattr area.
+ */
+static unsigned int ext4_max_inline_xattr_len(struct inode *inode,
+					      struct ext4_xattr_ibody_find *is)
+{
+	struct ext4_xattr_entry *entry;
+	size_t min_offs, free;
+	size_t name_len = EXT4_XATTR_LEN(strlen(EXT4_XATTR_SYSTEM_DATA));
+
+	if (!EXT4_I(inode)->i_extra_isize)
+		return 0;
+
+	min_offs = is->s.end - is->s.base;
+	entry = is->s.first;
+	if (ext4_test_inode_state(inode, EXT4_STATE_XATTR)) {
+		for (; !IS_LAST_ENTRY(entry); entry = EXT4_XATTR_NEXT(entry)) {
+			if (!entry->e_value_block && entry->e_value_size) {
+				size_t offs = le16_to_cpu(entry->e_value_offs);
+				if (offs < min_offs)
+					min_offs = offs;
+			}
+		}
+	}
+	free = min_offs - ((void *)entry - is->s.base) - sizeof(__u32);
+
+	if (!is->s.not_found) {
+		free += EXT4_XATTR_SIZE(ext4_inline_xattr_len(is));
+	} else {
+		if (free < name_len)
+			return 0;
+		free -= name_len;
+	}
+	return free & ~EXT4_XATTR_ROUND;
+}
+
+/**
+ * ext4_get_max_inline_size - how many bytes of data the inode can hold
+ * @inode: the inode
+ *
+ * Returns 0 if the inode has no room for the system.data attribute.
+ */
+int ext4_get_max_inline_size(struct inode *inode)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	int max_size = 0;
+
+	if (!EXT4_I(inode)->i_extra_isize)
+		return 0;
+	if (ext4_get_inode_loc(inode, &is.iloc))
+		return 0;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_find_inline_xattr(inode, &is))
+		max_size = EXT4_MIN_INLINE_DATA_SIZE +
+			   ext4_max_inline_xattr_len(inode, &is);
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	brelse(is.iloc.bh);
+	return max_size;
+}
+
+/* Copy up to @len bytes of inline data into @buffer */
+static int ext4_read_inline_data(struct inode *inode, void *buffer,
+				 unsigned int len,
+				 struct ext4_xattr_ibody_find *is)
+{
+	struct ext4_inode *raw_inode = ext4_raw_inode(&is->iloc);
+	unsigned int cp_len;
+
+	len = min(len, ext4_inline_size(is));
+	cp_len = min_t(unsigned int, len, EXT4_MIN_INLINE_DATA_SIZE);
+	memcpy(buffer, (void *)raw_inode->i_block, cp_len);
+	if (len > cp_len)
+		memcpy(buffer + cp_len, ext4_inline_xattr_value(is),
+		       len - cp_len);
+	return len;
+}
+
+/*
+ * Store @len bytes at @pos.  The system.data value must already be large
+ * enough and the caller must have write access to the inode buffer.
+ */
+static void ext4_write_inline_data(struct inode *inode,
+				   struct ext4_xattr_ibody_find *is,
+				   void *buffer, loff_t pos, unsigned int len)
+{
+	struct ext4_inode *raw_inode = ext4_raw_inode(&is->iloc);
+	unsigned int cp_len;
+
+	if (pos < EXT4_MIN_INLINE_DATA_SIZE) {
+		cp_len = min_t(unsigned int, len,
+			       EXT4_MIN_INLINE_DATA_SIZE - pos);
+		memcpy((void *)raw_inode->i_block + pos, buffer, cp_len);
+		buffer += cp_len;
+		pos += cp_len;
+		len -= cp_len;
+	}
+	if (!len)
+		return;
+
+	pos -= EXT4_MIN_INLINE_DATA_SIZE;
+	BUG_ON(pos + len > ext4_inline_xattr_len(is));
+	memcpy(ext4_inline_xattr_value(is) + pos, buffer, len);
+}
+
+/*
+ * Resize the system.data value to @len bytes, creating it if needed.
+ * The old contents are kept and any new bytes are zeroed.
+ */
+static int ext4_set_inline_xattr_len(handle_t *handle, struct inode *inode,
+				     struct ext4_xattr_ibody_find *is,
+				     unsigned int len)
+{
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM_DATA,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+		.value = "",
+		.value_len = 0,
+	};
+	unsigned int old_len = ext4_inline_xattr_len(is);
+	void *value = NULL;
+	int error;
+
+	if (!is->s.not_found && len == old_len)
+		return 0;
+
+	if (len) {
+		value = kzalloc(len, GFP_NOFS);
+		if (!value)
+			return -ENOMEM;
+		if (old_len)
+			memcpy(value, ext4_inline_xattr_value(is),
+			       min(len, old_len));
+		i.value = value;
+		i.value_len = len;
+	}
+
+	error = ext4_xattr_ibody_set(handle, inode, &i, is);
+	kfree(value);
+	if (!error)
+		is->s.not_found = 0;
+	return error;
+}
+
+/*
+ * Turn an inode without data into an inline one able to hold @len bytes.
+ * Called with xattr_sem held for writing and write access to the inode
+ * buffer.
+ */
+static int ext4_create_inline_data(handle_t *handle, struct inode *inode,
+				   struct ext4_xattr_ibody_find *is,
+				   unsigned int len)
+{
+	struct ext4_inode *raw_inode = ext4_raw_inode(&is->iloc);
+	int error;
+
+	if (!EXT4_I(inode)->i_extra_isize)
+		return -ENOSPC;
+
+	/* Nothing in the xattr area yet: make sure it reads as empty */
+	if (!ext4_test_inode_state(inode, EXT4_STATE_XATTR))
+		memset(is->s.base, 0, is->s.end - is->s.base);
+
+	if (len > EXT4_MIN_INLINE_DATA_SIZE)
+		len -= EXT4_MIN_INLINE_DATA_SIZE;
+	else
+		len = 0;
+	error = ext4_set_inline_xattr_len(handle, inode, is, len);
+	if (error)
+		return error;
+
+	memset((void *)raw_inode->i_block, 0, EXT4_MIN_INLINE_DATA_SIZE);
+	memset(EXT4_I(inode)->i_data, 0, sizeof(EXT4_I(inode)->i_data));
+	ext4_clear_inode_flag(inode, EXT4_INODE_EXTENTS);
+	ext4_set_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+	ext4_set_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+	return 0;
+}
+
+/* Make sure the inline data can hold @len bytes */
+static int ext4_update_inline_data(handle_t *handle, struct inode *inode,
+				   struct ext4_xattr_ibody_find *is,
+				   unsigned int len)
+{
+	if (len <= ext4_inline_size(is))
+		return 0;
+	return ext4_set_inline_xattr_len(handle, inode, is,
+					 len - EXT4_MIN_INLINE_DATA_SIZE);
+}
+
+/*
+ * Drop the inline data and set the inode up for block mapped data.  Called
+ * with xattr_sem held for writing and write access to the inode buffer.
+ */
+static int ext4_destroy_inline_data_nolock(handle_t *handle,
+					   struct inode *inode,
+					   struct ext4_xattr_ibody_find *is)
+{
+	struct ext4_inode *raw_inode = ext4_raw_inode(&is->iloc);
+	struct ext4_xattr_info i = {
+		.name_index = EXT4_XATTR_INDEX_SYSTEM_DATA,
+		.name = EXT4_XATTR_SYSTEM_DATA,
+		.value = NULL,
+		.value_len = 0,
+	};
+	int error;
+
+	if (!is->s.not_found) {
+		error = ext4_xattr_ibody_set(handle, inode, &i, is);
+		if (error)
+			return error;
+		is->s.not_found = -ENODATA;
+	}
+
+	memset((void *)raw_inode->i_block, 0, EXT4_MIN_INLINE_DATA_SIZE);
+	memset(EXT4_I(inode)->i_data, 0, sizeof(EXT4_I(inode)->i_data));
+	ext4_clear_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+
+	if (EXT4_HAS_INCOMPAT_FEATURE(inode->i_sb,
+				      EXT4_FEATURE_INCOMPAT_EXTENTS)) {
+		ext4_set_inode_flag(inode, EXT4_INODE_EXTENTS);
+		ext4_ext_tree_init(handle, inode);
+	}
+	return 0;
+}
+
+/* Fill page 0 from the inline data.  Called with xattr_sem held. */
+static int ext4_read_inline_page(struct inode *inode, struct page *page)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	void *kaddr;
+	unsigned int len;
+	int ret;
+
+	BUG_ON(page->index);
+
+	ret = ext4_get_inode_loc(inode, &is.iloc);
+	if (ret)
+		return ret;
+	ret = ext4_find_inline_xattr(inode, &is);
+	if (ret)
+		goto out;
+
+	len = min_t(loff_t, ext4_inline_size(&is), i_size_read(inode));
+	kaddr = kmap_atomic(page);
+	ret = ext4_read_inline_data(inode, kaddr, len, &is);
+	memset(kaddr + ret, 0, PAGE_CACHE_SIZE - ret);
+	flush_dcache_page(page);
+	kunmap_atomic(kaddr);
+	SetPageUptodate(page);
+out:
+	brelse(is.iloc.bh);
+	return ret;
+}
+
+/**
+ * ext4_readpage_inline - ->readpage() for an inode with inline data
+ * @inode: the inode
+ * @page: locked page to fill
+ *
+ * Returns -EAGAIN if the data has moved to a block in the meantime.
+ */
+int ext4_readpage_inline(struct inode *inode, struct page *page)
+{
+	int ret = 0;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		return -EAGAIN;
+	}
+
+	/* Everything past the inline data is a hole */
+	if (!page->index) {
+		ret = ext4_read_inline_page(inode, page);
+	} else if (!PageUptodate(page)) {
+		zero_user_segment(page, 0, PAGE_CACHE_SIZE);
+		SetPageUptodate(page);
+	}
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	unlock_page(page);
+	return ret >= 0 ? 0 : ret;
+}
+
+/* Put the inline data back after a failed conversion */
+static int ext4_restore_inline_data(handle_t *handle, struct inode *inode,
+				    struct ext4_xattr_ibody_find *is,
+				    void *buffer, unsigned int len)
+{
+	int ret;
+
+	ret = ext4_find_inline_xattr(inode, is);
+	if (!ret)
+		ret = ext4_create_inline_data(handle, inode, is, len);
+	if (ret) {
+		ext4_warning(inode->i_sb,
+			     "inode %lu: unable to restore inline data: %d",
+			     inode->i_ino, ret);
+		return ret;
+	}
+	ext4_write_inline_data(inode, is, buffer, 0, len);
+	return 0;
+}
+
+/**
+ * ext4_convert_inline_data - move the inline data of a file to a block
+ * @inode: a regular file
+ *
+ * Also makes sure the file is never inlined again.  Must not be called
+ * with a transaction open.
+ */
+int ext4_convert_inline_data(struct inode *inode)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	struct address_space *mapping = inode->i_mapping;
+	handle_t *handle;
+	struct page *page;
+	unsigned int len;
+	void *kaddr;
+	int ret, retries = 0, no_expand;
+
+	if (!ext4_has_inline_data(inode)) {
+		ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+		return 0;
+	}
+
+retry:
+	handle = ext4_journal_start(inode, ext4_writepage_trans_blocks(inode));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	page = grab_cache_page_write_begin(mapping, 0, AOP_FLAG_NOFS);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out_stop;
+	}
+
+	ret = ext4_reserve_inode_write(handle, inode, &is.iloc);
+	if (ret)
+		goto out_page;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	if (!ext4_has_inline_data(inode)) {
+		ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+		goto out_unlock;
+	}
+	ret = ext4_find_inline_xattr(inode, &is);
+	if (ret)
+		goto out_unlock;
+
+	len = min_t(loff_t, ext4_inline_size(&is), i_size_read(inode));
+	if (!PageUptodate(page)) {
+		kaddr = kmap_atomic(page);
+		ext4_read_inline_data(inode, kaddr, len, &is);
+		memset(kaddr + len, 0, PAGE_CACHE_SIZE - len);
+		flush_dcache_page(page);
+		kunmap_atomic(kaddr);
+		SetPageUptodate(page);
+	}
+
+	ret = ext4_destroy_inline_data_nolock(handle, inode, &is);
+	if (ret)
+		goto out_unlock;
+
+	if (len) {
+		ret = __block_write_begin(page, 0, len, ext4_get_block);
+		if (!ret) {
+			block_commit_write(page, 0, len);
+			if (ext4_should_order_data(inode))
+				ret = ext4_jbd2_file_inode(handle, inode);
+		} else {
+			kaddr = kmap_atomic(page);
+			ext4_restore_inline_data(handle, inode, &is, kaddr,
+						 len);
+			kunmap_atomic(kaddr);
+		}
+	}
+
+	ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+	is.iloc.bh = NULL;
+out_unlock:
+	ext4_write_unlock_xattr(inode, &no_expand);
+	brelse(is.iloc.bh);
+out_page:
+	unlock_page(page);
+	page_cache_release(page);
+out_stop:
+	ext4_journal_stop(handle);
+	if (ret == -ENOSPC && ext4_should_retry_alloc(inode->i_sb, &retries))
+		goto retry;
+	return ret;
+}
+
+/* Create or grow the inline data so that it can hold @len bytes */
+static int ext4_prepare_inline_data(handle_t *handle, struct inode *inode,
+				    unsigned int len)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	int ret, no_expand;
+
+	ret = ext4_reserve_inode_write(handle, inode, &is.iloc);
+	if (ret)
+		return ret;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	ret = ext4_find_inline_xattr(inode, &is);
+	if (ret)
+		goto out;
+	if (len > EXT4_MIN_INLINE_DATA_SIZE +
+		  ext4_max_inline_xattr_len(inode, &is)) {
+		ret = -ENOSPC;
+		goto out;
+	}
+	if (ext4_has_inline_data(inode))
+		ret = ext4_update_inline_data(handle, inode, &is, len);
+	else
+		ret = ext4_create_inline_data(handle, inode, &is, len);
+out:
+	ext4_write_unlock_xattr(inode, &no_expand);
+	if (!ret)
+		return ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+	brelse(is.iloc.bh);
+	return ret;
+}
+
+/**
+ * ext4_try_to_write_inline_data - ->write_begin() for inline capable files
+ * @mapping: the file's mapping
+ * @inode: the file
+ * @pos: start of the write
+ * @len: length of the write
+ * @flags: AOP_FLAG_* from the caller
+ * @pagep: returns the locked page
+ *
+ * Returns 1 with a transaction started and page 0 locked and up to date
+ * if the write goes to the inode, 0 if the caller should fall back to
+ * the block path (the data has been converted if needed), or an error.
+ */
+int ext4_try_to_write_inline_data(struct address_space *mapping,
+				  struct inode *inode,
+				  loff_t pos, unsigned len,
+				  unsigned flags,
+				  struct page **pagep)
+{
+	handle_t *handle;
+	struct page *page;
+	int ret;
+
+	/* Files that already have data elsewhere are never inlined */
+	if (!ext4_has_inline_data(inode) && inode->i_size)
+		goto convert;
+	if (pos + len > ext4_get_max_inline_size(inode))
+		goto convert;
+
+	handle = ext4_journal_start(inode, 1);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	ret = ext4_prepare_inline_data(handle, inode, pos + len);
+	if (ret == -ENOSPC) {
+		ext4_journal_stop(handle);
+		goto convert;
+	}
+	if (ret)
+		goto out_stop;
+
+	flags |= AOP_FLAG_NOFS;
+	page = grab_cache_page_write_begin(mapping, 0, flags);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out_stop;
+	}
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	/* A page fault may have converted the file under us */
+	if (!ext4_has_inline_data(inode)) {
+		ret = 0;
+		goto out_release;
+	}
+	if (!PageUptodate(page)) {
+		ret = ext4_read_inline_page(inode, page);
+		if (ret < 0)
+			goto out_release;
+	}
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	*pagep = page;
+	return 1;
+
+out_release:
+	up_read(&EXT4_I(inode)->xattr_sem);
+	unlock_page(page);
+	page_cache_release(page);
+out_stop:
+	ext4_journal_stop(handle);
+	return ret;
+convert:
+	return ext4_convert_inline_data(inode);
+}
+
+/**
+ * ext4_write_inline_data_end - copy a written page back into the inode
+ * @inode: the file
+ * @pos: start of the write
+ * @len: length asked for in ->write_begin()
+ * @copied: bytes actually copied into the page
+ * @page: the page returned by ext4_try_to_write_inline_data()
+ *
+ * Updates the file size and unlocks and releases the page.  The caller
+ * stops the transaction.  Returns @copied or an error.
+ */
+int ext4_write_inline_data_end(struct inode *inode, loff_t pos, unsigned len,
+			       unsigned copied, struct page *page)
+{
+	handle_t *handle = ext4_journal_current_handle();
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	void *kaddr;
+	int ret, no_expand;
+
+	ret = ext4_reserve_inode_write(handle, inode, &is.iloc);
+	if (ret)
+		goto out_page;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	BUG_ON(!ext4_has_inline_data(inode));
+	ret = ext4_find_inline_xattr(inode, &is);
+	if (ret) {
+		ext4_write_unlock_xattr(inode, &no_expand);
+		brelse(is.iloc.bh);
+		goto out_page;
+	}
+	kaddr = kmap_atomic(page);
+	ext4_write_inline_data(inode, &is, kaddr + pos, pos, copied);
+	kunmap_atomic(kaddr);
+	ext4_write_unlock_xattr(inode, &no_expand);
+
+	/*
+	 * The page is only a copy of the inline data, so it is never
+	 * dirtied and never written back.
+	 */
+	SetPageUptodate(page);
+
+	if (pos + copied > inode->i_size)
+		i_size_write(inode, pos + copied);
+	if (pos + copied > EXT4_I(inode)->i_disksize)
+		ext4_update_i_disksize(inode, pos + copied);
+	unlock_page(page);
+	page_cache_release(page);
+
+	ret = ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+	return ret ? ret : copied;
+
+out_page:
+	unlock_page(page);
+	page_cache_release(page);
+	return ret;
+}
+
+/**
+ * ext4_inline_data_truncate - ->truncate() for an inode with inline data
+ * @inode: the inode, with i_size already set to the new size
+ *
+ * Sizes the inline data to i_size.  Growing beyond what the inode can
+ * hold has to go through ext4_convert_inline_data() first.
+ */
+void ext4_inline_data_truncate(struct inode *inode)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	struct ext4_inode *raw_inode;
+	handle_t *handle;
+	loff_t size = inode->i_size;
+	int err, no_expand;
+
+	handle = ext4_journal_start(inode, 3);
+	if (IS_ERR(handle))
+		return;
+
+	err = ext4_reserve_inode_write(handle, inode, &is.iloc);
+	if (err)
+		goto out_stop;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	if (!ext4_has_inline_data(inode)) {
+		ext4_write_unlock_xattr(inode, &no_expand);
+		brelse(is.iloc.bh);
+		goto out_stop;
+	}
+	err = ext4_find_inline_xattr(inode, &is);
+	if (!err) {
+		raw_inode = ext4_raw_inode(&is.iloc);
+		if (size < EXT4_MIN_INLINE_DATA_SIZE) {
+			memset((void *)raw_inode->i_block + size, 0,
+			       EXT4_MIN_INLINE_DATA_SIZE - size);
+			err = ext4_set_inline_xattr_len(handle, inode, &is, 0);
+		} else {
+			err = ext4_set_inline_xattr_len(handle, inode, &is,
+					size - EXT4_MIN_INLINE_DATA_SIZE);
+		}
+	}
+	ext4_write_unlock_xattr(inode, &no_expand);
+	if (err) {
+		brelse(is.iloc.bh);
+		goto out_stop;
+	}
+
+	EXT4_I(inode)->i_disksize = size;
+	inode->i_mtime = inode->i_ctime = ext4_current_time(inode);
+	err = ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+
+	if (inode->i_nlink)
+		ext4_orphan_del(handle, inode);
+	if (IS_SYNC(inode))
+		ext4_handle_sync(handle);
+out_stop:
+	ext4_std_error(inode->i_sb, err);
+	ext4_journal_stop(handle);
+}
+
+/**
+ * ext4_inline_data_fiemap - report inline data as a single extent
+ * @inode: the inode
+ * @fieinfo: fiemap request
+ * @has_inline: cleared if the inode turns out not to have inline data
+ */
+int ext4_inline_data_fiemap(struct inode *inode,
+			    struct fiemap_extent_info *fieinfo,
+			    int *has_inline)
+{
+	__u32 flags = FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_NOT_ALIGNED |
+		      FIEMAP_EXTENT_LAST;
+	struct ext4_iloc iloc;
+	__u64 physical = 0, length;
+	int error;
+
+	error = ext4_get_inode_loc(inode, &iloc);
+	if (error)
+		return error;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		*has_inline = 0;
+		goto out;
+	}
+	physical = (__u64)iloc.bh->b_blocknr << inode->i_sb->s_blocksize_bits;
+	physical += (char *)ext4_raw_inode(&iloc) - iloc.bh->b_data;
+	physical += offsetof(struct ext4_inode, i_block);
+out:
+	up_read(&EXT4_I(inode)->xattr_sem);
+	brelse(iloc.bh);
+
+	length = i_size_read(inode);
+	if (!*has_inline || !length)
+		return 0;
+	error = fiemap_fill_next_extent(fieinfo, 0, physical, length, flags);
+	return error < 0 ? error : 0;
+}
+
+/**
+ * ext4_try_create_inline_dir - set a new directory up inline
+ * @handle: transaction handle
+ * @parent: the parent directory
+ * @inode: the new directory
+ *
+ * Returns -ENOSPC if the inode has no room for inline data, in which case
+ * the caller creates a regular directory block instead.
+ */
+int ext4_try_create_inline_dir(handle_t *handle, struct inode *parent,
+			       struct inode *inode)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	struct ext4_inode *raw_inode;
+	struct ext4_dir_entry_2 *de;
+	int ret, no_expand;
+
+	ret = ext4_reserve_inode_write(handle, inode, &is.iloc);
+	if (ret)
+		return ret;
+
+	ext4_write_lock_xattr(inode, &no_expand);
+	ret = ext4_find_inline_xattr(inode, &is);
+	if (!ret)
+		ret = ext4_create_inline_data(handle, inode, &is,
+					      EXT4_MIN_INLINE_DATA_SIZE);
+	if (ret) {
+		ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+		ext4_write_unlock_xattr(inode, &no_expand);
+		brelse(is.iloc.bh);
+		return ret;
+	}
+
+	raw_inode = ext4_raw_inode(&is.iloc);
+	raw_inode->i_block[0] = cpu_to_le32(parent->i_ino);
+	de = (struct ext4_dir_entry_2 *)
+		((void *)raw_inode->i_block + EXT4_INLINE_DOTDOT_SIZE);
+	de->inode = 0;
+	de->rec_len = ext4_rec_len_to_disk(EXT4_INLINE_DIR_SIZE,
+					   inode->i_sb->s_blocksize);
+	ext4_write_unlock_xattr(inode, &no_expand);
+
+	set_nlink(inode, 2);
+	inode->i_size = EXT4_I(inode)->i_disksize = EXT4_MIN_INLINE_DATA_SIZE;
+	return ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+}
+
+static void *ext4_inline_dir_start(struct ext4_iloc *iloc)
+{
+	return (void *)ext4_raw_inode(iloc)->i_block + EXT4_INLINE_DOTDOT_SIZE;
+}
+
+/**
+ * ext4_find_inline_entry - look a name up in an inline directory
+ * @dir: the directory
+ * @d_name: the name
+ * @res_dir: returns the entry
+ * @has_inline_data: cleared if @dir turns out not to be inline
+ *
+ * Returns the inode table buffer holding the entry, like ext4_find_entry().
+ */
+struct buffer_head *ext4_find_inline_entry(struct inode *dir,
+					   const struct qstr *d_name,
+					   struct ext4_dir_entry_2 **res_dir,
+					   int *has_inline_data)
+{
+	struct ext4_iloc iloc;
+	int ret;
+
+	if (ext4_get_inode_loc(dir, &iloc))
+		return NULL;
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+	ret = search_dir(iloc.bh, ext4_inline_dir_start(&iloc),
+			 EXT4_INLINE_DIR_SIZE, dir, d_name, 0, res_dir);
+	if (ret == 1) {
+		up_read(&EXT4_I(dir)->xattr_sem);
+		return iloc.bh;
+	}
+out:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	brelse(iloc.bh);
+	return NULL;
+}
+
+/*
+ * Move the entries of an inline directory into a newly allocated block.
+ * Called with xattr_sem held for writing.
+ */
+static int ext4_convert_inline_dir(handle_t *handle, struct inode *dir,
+				   struct ext4_iloc *iloc)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	unsigned int csum_size = ext4_dir_csum_size(dir);
+	struct ext4_dir_entry_2 *de, *next;
+	struct buffer_head *dir_block;
+	unsigned int offset = 0;
+	char *buf, *top;
+	int err;
+
+	buf = kmalloc(EXT4_MIN_INLINE_DATA_SIZE, GFP_NOFS);
+	if (!buf)
+		return -ENOMEM;
+	memcpy(buf, ext4_raw_inode(iloc)->i_block, EXT4_MIN_INLINE_DATA_SIZE);
+
+	/* Check the entries before anything is torn down */
+	while (offset < EXT4_INLINE_DIR_SIZE) {
+		de = (struct ext4_dir_entry_2 *)
+			(buf + EXT4_INLINE_DOTDOT_SIZE + offset);
+		if (ext4_check_dir_entry(dir, NULL, de, iloc->bh,
+					 buf + EXT4_INLINE_DOTDOT_SIZE,
+					 EXT4_INLINE_DIR_SIZE, offset)) {
+			err = -EIO;
+			goto out;
+		}
+		offset += ext4_rec_len_from_disk(de->rec_len, blocksize);
+	}
+
+	err = ext4_journal_get_write_access(handle, iloc->bh);
+	if (err)
+		goto out;
+	is.iloc = *iloc;
+	err = ext4_find_inline_xattr(dir, &is);
+	if (err)
+		goto out;
+	err = ext4_destroy_inline_data_nolock(handle, dir, &is);
+	if (err)
+		goto out;
+
+	dir_block = ext4_bread(handle, dir, 0, 1, &err);
+	if (!dir_block)
+		goto out_restore;
+	err = ext4_journal_get_write_access(handle, dir_block);
+	if (err) {
+		brelse(dir_block);
+		goto out_restore;
+	}
+
+	de = ext4_init_dot_dotdot(dir,
+			(struct ext4_dir_entry_2 *)dir_block->b_data,
+			blocksize, csum_size, le32_to_cpu(*(__le32 *)buf), 1);
+	memcpy(de, buf + EXT4_INLINE_DOTDOT_SIZE, EXT4_INLINE_DIR_SIZE);
+
+	/* Stretch the last entry to the end of the block */
+	top = (char *)de + EXT4_INLINE_DIR_SIZE;
+	while ((char *)(next = ext4_next_entry(de, blocksize)) < top)
+		de = next;
+	de->rec_len = ext4_rec_len_to_disk(dir_block->b_data +
+					   (blocksize - csum_size) - (char *)de,
+					   blocksize);
+	if (csum_size)
+		initialize_dirent_tail(EXT4_DIRENT_TAIL(dir_block->b_data,
+							blocksize), blocksize);
+	set_buffer_uptodate(dir_block);
+	err = ext4_handle_dirty_dirent_node(handle, dir, dir_block);
+	brelse(dir_block);
+	if (err)
+		goto out;
+
+	dir->i_size = EXT4_I(dir)->i_disksize = blocksize;
+	get_bh(iloc->bh);
+	err = ext4_mark_iloc_dirty(handle, dir, iloc);
+	goto out;
+
+out_restore:
+	if (!ext4_restore_inline_data(handle, dir, &is, buf,
+				      EXT4_MIN_INLINE_DATA_SIZE)) {
+		get_bh(iloc->bh);
+		ext4_mark_iloc_dirty(handle, dir, iloc);
+	}
+out:
+	kfree(buf);
+	return err;
+}
+
+static int ext4_add_dirent_to_inline(handle_t *handle, struct dentry *dentry,
+				     struct inode *inode,
+				     struct ext4_iloc *iloc)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	const char *name = dentry->d_name.name;
+	int namelen = dentry->d_name.len;
+	struct ext4_dir_entry_2 *de;
+	int err;
+
+	err = ext4_find_dest_de(dir, inode, iloc->bh,
+				ext4_inline_dir_start(iloc),
+				EXT4_INLINE_DIR_SIZE, name, namelen, &de);
+	if (err)
+		return err;
+
+	BUFFER_TRACE(iloc->bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, iloc->bh);
+	if (err)
+		return err;
+	ext4_insert_dentry(dir, inode, de, EXT4_INLINE_DIR_SIZE,
+			   name, namelen);
+
+	dir->i_mtime = dir->i_ctime = ext4_current_time(dir);
+	dir->i_version++;
+	get_bh(iloc->bh);
+	return ext4_mark_iloc_dirty(handle, dir, iloc);
+}
+
+/**
+ * ext4_try_add_inline_entry - add a name to an inline directory
+ * @handle: transaction handle
+ * @dentry: the new name
+ * @inode: the inode it refers to
+ *
+ * Returns 0 once the entry is added, or 1 if the directory is (now)
+ * block based and the caller has to add the entry itself.
+ */
+int ext4_try_add_inline_entry(handle_t *handle, struct dentry *dentry,
+			      struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	struct ext4_iloc iloc;
+	int ret, no_expand;
+
+	ret = ext4_get_inode_loc(dir, &iloc);
+	if (ret)
+		return ret;
+
+	ext4_write_lock_xattr(dir, &no_expand);
+	if (!ext4_has_inline_data(dir)) {
+		ret = 1;
+		goto out;
+	}
+	ret = ext4_add_dirent_to_inline(handle, dentry, inode, &iloc);
+	if (ret != -ENOSPC)
+		goto out;
+
+	ret = ext4_convert_inline_dir(handle, dir, &iloc);
+	if (!ret)
+		ret = 1;
+out:
+	ext4_write_unlock_xattr(dir, &no_expand);
+	brelse(iloc.bh);
+	return ret;
+}
+
+/**
+ * ext4_delete_inline_entry - remove an entry from an inline directory
+ * @handle: transaction handle
+ * @dir: the directory
+ * @de_del: the entry, as found by ext4_find_inline_entry()
+ * @bh: the buffer it was found in
+ * @has_inline_data: cleared if @dir turns out not to be inline
+ */
+int ext4_delete_inline_entry(handle_t *handle, struct inode *dir,
+			     struct ext4_dir_entry_2 *de_del,
+			     struct buffer_head *bh,
+			     int *has_inline_data)
+{
+	struct ext4_iloc iloc;
+	int err, no_expand;
+
+	err = ext4_get_inode_loc(dir, &iloc);
+	if (err)
+		return err;
+
+	ext4_write_lock_xattr(dir, &no_expand);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	BUFFER_TRACE(iloc.bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, iloc.bh);
+	if (err)
+		goto out;
+	err = ext4_generic_delete_entry(dir, de_del, iloc.bh,
+					ext4_inline_dir_start(&iloc),
+					EXT4_INLINE_DIR_SIZE, 0);
+	if (err)
+		goto out;
+
+	err = ext4_mark_iloc_dirty(handle, dir, &iloc);
+	iloc.bh = NULL;
+out:
+	ext4_write_unlock_xattr(dir, &no_expand);
+	brelse(iloc.bh);
+	if (err && err != -ENOENT)
+		ext4_std_error(dir->i_sb, err);
+	return err;
+}
+
+/**
+ * empty_inline_dir - check whether an inline directory has no entries
+ * @dir: the directory
+ * @has_inline_data: cleared if @dir turns out not to be inline
+ *
+ * Returns 1 if the directory is empty, like empty_dir().
+ */
+int empty_inline_dir(struct inode *dir, int *has_inline_data)
+{
+	struct ext4_dir_entry_2 *de;
+	struct ext4_iloc iloc;
+	unsigned int offset = 0;
+	void *inline_start;
+	int ret = 1;
+
+	if (ext4_get_inode_loc(dir, &iloc)) {
+		EXT4_ERROR_INODE(dir, "error reading inline directory");
+		return 1;
+	}
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	if (!le32_to_cpu(ext4_raw_inode(&iloc)->i_block[0])) {
+		ext4_warning(dir->i_sb,
+			     "bad inline directory (dir #%lu) - no `..'",
+			     dir->i_ino);
+		goto out;
+	}
+
+	inline_start = ext4_inline_dir_start(&iloc);
+	while (offset < EXT4_INLINE_DIR_SIZE) {
+		de = (struct ext4_dir_entry_2 *)(inline_start + offset);
+		if (ext4_check_dir_entry(dir, NULL, de, iloc.bh, inline_start,
+					 EXT4_INLINE_DIR_SIZE, offset))
+			break;
+		if (le32_to_cpu(de->inode)) {
+			ret = 0;
+			break;
+		}
+		offset += ext4_rec_len_from_disk(de->rec_len,
+						 dir->i_sb->s_blocksize);
+	}
+out:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	brelse(iloc.bh);
+	return ret;
+}
+
+/**
+ * ext4_read_inline_dir - ->readdir() for an inline directory
+ * @filp: the open directory
+ * @dirent: opaque filldir cookie
+ * @filldir: callback
+ * @has_inline_data: cleared if the directory turns out not to be inline
+ *
+ * f_pos 0 and 1 stand for "." and "..", real entries are at their offset
+ * in i_block, which starts after the parent inode number.
+ */
+int ext4_read_inline_dir(struct file *filp, void *dirent, filldir_t filldir,
+			 int *has_inline_data)
+{
+	struct inode *inode = filp->f_path.dentry->d_inode;
+	struct super_block *sb = inode->i_sb;
+	struct ext4_dir_entry_2 *de;
+	struct ext4_iloc iloc;
+	unsigned int offset, parent_ino, rlen;
+	char *dir_buf;
+	int ret, i;
+
+	ret = ext4_get_inode_loc(inode, &iloc);
+	if (ret)
+		return ret;
+
+	dir_buf = kmalloc(EXT4_MIN_INLINE_DATA_SIZE, GFP_NOFS);
+	if (!dir_buf) {
+		brelse(iloc.bh);
+		return -ENOMEM;
+	}
+
+	/* filldir may fault, so work on a copy without xattr_sem held */
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		*has_inline_data = 0;
+		goto out;
+	}
+	memcpy(dir_buf, ext4_raw_inode(&iloc)->i_block,
+	       EXT4_MIN_INLINE_DATA_SIZE);
+	up_read(&EXT4_I(inode)->xattr_sem);
+	parent_ino = le32_to_cpu(*(__le32 *)dir_buf);
+
+	if (filp->f_pos == 0) {
+		if (filldir(dirent, ".", 1, 0, inode->i_ino, DT_DIR) < 0)
+			goto out;
+		filp->f_pos = 1;
+	}
+	if (filp->f_pos == 1) {
+		if (filldir(dirent, "..", 2, 1, parent_ino, DT_DIR) < 0)
+			goto out;
+		filp->f_pos = EXT4_INLINE_DOTDOT_SIZE;
+	}
+	if (filp->f_pos < EXT4_INLINE_DOTDOT_SIZE)
+		filp->f_pos = EXT4_INLINE_DOTDOT_SIZE;
+	offset = filp->f_pos - EXT4_INLINE_DOTDOT_SIZE;
+
+revalidate:
+	/*
+	 * If the directory changed since the last call, f_pos may point
+	 * into the middle of an entry: rescan from the start.
+	 */
+	if (filp->f_version != inode->i_version) {
+		for (i = 0; i < EXT4_INLINE_DIR_SIZE && i < offset; ) {
+			de = (struct ext4_dir_entry_2 *)
+				(dir_buf + EXT4_INLINE_DOTDOT_SIZE + i);
+			rlen = ext4_rec_len_from_disk(de->rec_len,
+						      sb->s_blocksize);
+			if (rlen < EXT4_DIR_REC_LEN(1))
+				break;
+			i += rlen;
+		}
+		offset = i;
+		filp->f_pos = offset + EXT4_INLINE_DOTDOT_SIZE;
+		filp->f_version = inode->i_version;
+	}
+
+	while (offset < EXT4_INLINE_DIR_SIZE) {
+		de = (struct ext4_dir_entry_2 *)
+			(dir_buf + EXT4_INLINE_DOTDOT_SIZE + offset);
+		if (ext4_check_dir_entry(inode, filp, de, iloc.bh,
+					 dir_buf + EXT4_INLINE_DOTDOT_SIZE,
+					 EXT4_INLINE_DIR_SIZE, offset)) {
+			filp->f_pos = EXT4_MIN_INLINE_DATA_SIZE;
+			goto out;
+		}
+		rlen = ext4_rec_len_from_disk(de->rec_len, sb->s_blocksize);
+		if (le32_to_cpu(de->inode)) {
+			u64 version = filp->f_version;
+
+			if (filldir(dirent, de->name, de->name_len,
+				    filp->f_pos, le32_to_cpu(de->inode),
+				    get_dtype(sb, de->file_type)))
+				goto out;
+			if (version != filp->f_version)
+				goto revalidate;
+		}
+		offset += rlen;
+		filp->f_pos += rlen;
+	}
+out:
+	kfree(dir_buf);
+	brelse(iloc.bh);
+	return ret;
+}
+
+/**
+ * ext4_get_first_inline_block - find ".." of an inline directory
+ * @inode: the directory
+ * @parent_de: returns a pointer whose ->inode is the parent's number
+ * @retval: error code if %NULL is returned
+ *
+ * Only ->inode of *@parent_de may be used.  Returns the buffer holding it.
+ */
+struct buffer_head *ext4_get_first_inline_block(struct inode *inode,
+					struct ext4_dir_entry_2 **parent_de,
+					int *retval)
+{
+	struct ext4_iloc iloc;
+
+	*retval = ext4_get_inode_loc(inode, &iloc);
+	if (*retval)
+		return NULL;
+
+	*parent_de = (struct ext4_dir_entry_2 *)ext4_raw_inode(&iloc)->i_block;
+	return iloc.bh;
+}
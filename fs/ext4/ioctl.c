@@ -175,6 +175,7 @@ flags_out:
 		if (err == 0) {
 			inode->i_ctime = ext4_current_time(inode);
 			inode->i_generation = generation;
+			ext4_inode_csum_seed(inode);
 			err = ext4_mark_iloc_dirty(handle, inode, &iloc);
 		}
 		ext4_journal_stop(handle);
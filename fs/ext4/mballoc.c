@@ -684,23 +684,40 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the matching s_mb_largest_free_orders list.
+ * Called with the group lock held.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
 	int i;
 	int bits;
-
-	grp->bb_largest_free_order = -1; /* uninit */
+	int new_order = -1; /* uninit */
 
 	bits = sb->s_blocksize_bits + 1;
 	for (i = bits; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
-			grp->bb_largest_free_order = i;
+			new_order = i;
 			break;
 		}
 	}
+	if (new_order == grp->bb_largest_free_order)
+		return;
+
+	if (grp->bb_largest_free_order >= 0) {
+		i = grp->bb_largest_free_order;
+		write_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+	grp->bb_largest_free_order = new_order;
+	if (new_order >= 0) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[new_order]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[new_order]);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[new_order]);
+	}
 }
 
 static noinline_for_stack
@@ -1505,12 +1522,16 @@ static void ext4_mb_use_best_found(struct ext4_allocation_context *ac,
 	get_page(ac->ac_bitmap_page);
 	ac->ac_buddy_page = e4b->bd_buddy_page;
 	get_page(ac->ac_buddy_page);
-	/* store last allocated for subsequent stream allocation */
+	/*
+	 * store last allocated for subsequent stream allocation; the goal
+	 * is only a hint, so we don't care if we were moved to another
+	 * CPU in the meantime
+	 */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		spin_lock(&sbi->s_md_lock);
-		sbi->s_mb_last_group = ac->ac_f_ex.fe_group;
-		sbi->s_mb_last_start = ac->ac_f_ex.fe_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_stream *ms = __this_cpu_ptr(sbi->s_mb_streams);
+
+		ms->ms_group = ac->ac_f_ex.fe_group;
+		ms->ms_start = ac->ac_f_ex.fe_start;
 	}
 }
 
@@ -1908,6 +1929,96 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Find a group whose largest free extent is at least 2^order clusters in
+ * the s_mb_largest_free_orders index.  Orders are tried from the smallest
+ * that fits upwards.  Within an order the first suitable group at or
+ * after @start is preferred, so that allocations with different goals
+ * (and CPUs with different stream goals) end up in different groups.
+ */
+static int ext4_mb_find_group_by_order(struct ext4_allocation_context *ac,
+				       int order, int cr, ext4_group_t start,
+				       ext4_group_t ngroups,
+				       ext4_group_t *group)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+	struct ext4_group_info *grp;
+	int found = 0;
+
+	for (; order < MB_NUM_ORDERS(ac->ac_sb) && !found; order++) {
+		if (list_empty(&sbi->s_mb_largest_free_orders[order]))
+			continue;
+
+		read_lock(&sbi->s_mb_largest_free_orders_locks[order]);
+		list_for_each_entry(grp, &sbi->s_mb_largest_free_orders[order],
+				    bb_largest_free_order_node) {
+			/* beyond s_blockfile_groups, or being set up */
+			if (grp->bb_group >= ngroups ||
+			    EXT4_MB_GRP_NEED_INIT(grp))
+				continue;
+			if (found && grp->bb_group < start)
+				continue;
+			if (!ext4_mb_good_group(ac, grp->bb_group, cr))
+				continue;
+			*group = grp->bb_group;
+			found = 1;
+			if (grp->bb_group >= start)
+				break;
+		}
+		read_unlock(&sbi->s_mb_largest_free_orders_locks[order]);
+	}
+	return found;
+}
+
+/*
+ * cr 0 and 1 through the free extent index: only groups that are known
+ * to have a free extent covering the whole request are loaded, instead
+ * of walking the groups one by one from the goal.
+ */
+static noinline_for_stack int
+ext4_mb_scan_by_order(struct ext4_allocation_context *ac, int cr,
+		      ext4_group_t ngroups, struct ext4_buddy *e4b)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_group_t group, start = ac->ac_g_ex.fe_group;
+	ext4_group_t i;
+	int order, err;
+
+	if (cr == 0)
+		order = ac->ac_2order;
+	else
+		order = fls(ac->ac_g_ex.fe_len - 1);
+
+	for (i = 0; i < ngroups && ac->ac_status == AC_STATUS_CONTINUE; i++) {
+		if (!ext4_mb_find_group_by_order(ac, order, cr, start,
+						 ngroups, &group))
+			break;
+
+		err = ext4_mb_load_buddy(sb, group, e4b);
+		if (err)
+			return err;
+
+		ext4_lock_group(sb, group);
+		/* the group may have changed since we looked it up */
+		if (ext4_mb_good_group(ac, group, cr)) {
+			ac->ac_groups_scanned++;
+			if (cr == 0)
+				ext4_mb_simple_scan_group(ac, e4b);
+			else if (sbi->s_stripe &&
+				 !(ac->ac_g_ex.fe_len % sbi->s_stripe))
+				ext4_mb_scan_aligned(ac, e4b);
+			else
+				ext4_mb_complex_scan_group(ac, e4b);
+		}
+		ext4_unlock_group(sb, group);
+		ext4_mb_unload_buddy(e4b);
+
+		start = group + 1 < ngroups ? group + 1 : 0;
+	}
+	return 0;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
@@ -1955,13 +2066,15 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 			ac->ac_2order = i - 1;
 	}
 
-	/* if stream allocation is enabled, use global goal */
+	/* if stream allocation is enabled, use this CPU's stream goal */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		/* TBD: may be hot point */
-		spin_lock(&sbi->s_md_lock);
-		ac->ac_g_ex.fe_group = sbi->s_mb_last_group;
-		ac->ac_g_ex.fe_start = sbi->s_mb_last_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_stream *ms = __this_cpu_ptr(sbi->s_mb_streams);
+		ext4_group_t last_group = ACCESS_ONCE(ms->ms_group);
+
+		if (last_group < ngroups) {
+			ac->ac_g_ex.fe_group = last_group;
+			ac->ac_g_ex.fe_start = ACCESS_ONCE(ms->ms_start);
+		}
 	}
 
 	/* Let's just scan groups to find more-less suitable blocks */
@@ -1973,6 +2086,15 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 repeat:
 	for (; cr < 4 && ac->ac_status == AC_STATUS_CONTINUE; cr++) {
 		ac->ac_criteria = cr;
+
+		if (cr < 2 && sbi->s_mb_optimize_scan) {
+			err = ext4_mb_scan_by_order(ac, cr, ngroups, &e4b);
+			if (err)
+				goto out;
+			if (ac->ac_status != AC_STATUS_CONTINUE)
+				break;
+		}
+
 		/*
 		 * searching for the right group start
 		 * from the goal value specified
@@ -1983,6 +2105,16 @@ repeat:
 			if (group == ngroups)
 				group = 0;
 
+			/*
+			 * The index already covered every initialized group
+			 * that could satisfy cr 0; only groups whose buddy
+			 * has never been loaded are left to look at.
+			 */
+			if (cr == 0 && sbi->s_mb_optimize_scan &&
+			    !EXT4_MB_GRP_NEED_INIT(ext4_get_group_info(sb,
+								       group)))
+				continue;
+
 			/* This now checks without needing the buddy page */
 			if (!ext4_mb_good_group(ac, group, cr))
 				continue;
@@ -1991,7 +2123,18 @@ repeat:
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
+			/*
+			 * On the first passes, don't wait for a group
+			 * somebody else is allocating from: there are
+			 * others to try, and cr 2 and 3 will come back.
+			 */
+			if (cr < 2) {
+				if (!ext4_try_lock_group(sb, group)) {
+					ext4_mb_unload_buddy(&e4b);
+					continue;
+				}
+			} else
+				ext4_lock_group(sb, group);
 
 			/*
 			 * We need to check again after locking the
@@ -2211,9 +2354,11 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	}
 
 	INIT_LIST_HEAD(&meta_group_info[i]->bb_prealloc_list);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2417,6 +2562,23 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 		i++;
 	} while (i <= sb->s_blocksize_bits + 1);
 
+	i = MB_NUM_ORDERS(sb) * sizeof(struct list_head);
+	sbi->s_mb_largest_free_orders = kmalloc(i, GFP_KERNEL);
+	if (sbi->s_mb_largest_free_orders == NULL) {
+		ret = -ENOMEM;
+		goto out_free_groupinfo_slab;
+	}
+	i = MB_NUM_ORDERS(sb) * sizeof(rwlock_t);
+	sbi->s_mb_largest_free_orders_locks = kmalloc(i, GFP_KERNEL);
+	if (sbi->s_mb_largest_free_orders_locks == NULL) {
+		ret = -ENOMEM;
+		goto out_free_orders;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+
 	spin_lock_init(&sbi->s_md_lock);
 	spin_lock_init(&sbi->s_bal_lock);
 
@@ -2425,6 +2587,7 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2455,7 +2618,7 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 	sbi->s_locality_groups = alloc_percpu(struct ext4_locality_group);
 	if (sbi->s_locality_groups == NULL) {
 		ret = -ENOMEM;
-		goto out_free_groupinfo_slab;
+		goto out_free_orders_locks;
 	}
 	for_each_possible_cpu(i) {
 		struct ext4_locality_group *lg;
@@ -2466,10 +2629,29 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 		spin_lock_init(&lg->lg_prealloc_lock);
 	}
 
+	/*
+	 * Spread the CPUs' stream goals evenly over the filesystem, so
+	 * that streaming writers on different CPUs start out in disjoint
+	 * ranges of groups.
+	 */
+	sbi->s_mb_streams = alloc_percpu(struct ext4_mb_stream);
+	if (sbi->s_mb_streams == NULL) {
+		ret = -ENOMEM;
+		goto out_free_locality_groups;
+	}
+	j = 0;
+	for_each_possible_cpu(i) {
+		struct ext4_mb_stream *ms;
+		ms = per_cpu_ptr(sbi->s_mb_streams, i);
+		ms->ms_group = div_u64((u64)ext4_get_groups_count(sb) * j++,
+				       num_possible_cpus());
+		ms->ms_start = 0;
+	}
+
 	/* init file for buddy data */
 	ret = ext4_mb_init_backend(sb);
 	if (ret != 0)
-		goto out_free_locality_groups;
+		goto out_free_streams;
 
 	if (sbi->s_proc)
 		proc_create_data("mb_groups", S_IRUGO, sbi->s_proc,
@@ -2477,9 +2659,18 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 
 	return 0;
 
+out_free_streams:
+	free_percpu(sbi->s_mb_streams);
+	sbi->s_mb_streams = NULL;
 out_free_locality_groups:
 	free_percpu(sbi->s_locality_groups);
 	sbi->s_locality_groups = NULL;
+out_free_orders_locks:
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
+out_free_orders:
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
 out_free_groupinfo_slab:
 	ext4_groupinfo_destroy_slabs();
 out:
@@ -2540,6 +2731,8 @@ int ext4_mb_release(struct super_block *sb)
 	}
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
 	if (sbi->s_buddy_cache)
 		iput(sbi->s_buddy_cache);
 	if (sbi->s_mb_stats) {
@@ -2567,6 +2760,7 @@ int ext4_mb_release(struct super_block *sb)
 	}
 
 	free_percpu(sbi->s_locality_groups);
+	free_percpu(sbi->s_mb_streams);
 
 	return 0;
 }
@@ -2771,8 +2965,15 @@ ext4_mb_mark_diskspace_used(struct ext4_allocation_context *ac,
 		ext4_lock_group(sb, ac->ac_b_ex.fe_group);
 		ext4_set_bits(bitmap_bh->b_data, ac->ac_b_ex.fe_start,
 			      ac->ac_b_ex.fe_len);
+		ext4_block_bitmap_csum_set(sb, ac->ac_b_ex.fe_group, gdp,
+					   bitmap_bh,
+					   EXT4_CLUSTERS_PER_GROUP(sb) / 8);
+		gdp->bg_checksum = ext4_group_desc_csum(sbi,
+						ac->ac_b_ex.fe_group, gdp);
 		ext4_unlock_group(sb, ac->ac_b_ex.fe_group);
 		err = ext4_handle_dirty_metadata(handle, NULL, bitmap_bh);
+		if (!err)
+			err = ext4_handle_dirty_metadata(handle, NULL, gdp_bh);
 		if (!err)
 			err = -EAGAIN;
 		goto out_err;
@@ -2798,6 +2999,8 @@ ext4_mb_mark_diskspace_used(struct ext4_allocation_context *ac,
 	}
 	len = ext4_free_group_clusters(sb, gdp) - ac->ac_b_ex.fe_len;
 	ext4_free_group_clusters_set(sb, gdp, len);
+	ext4_block_bitmap_csum_set(sb, ac->ac_b_ex.fe_group, gdp, bitmap_bh,
+				   EXT4_CLUSTERS_PER_GROUP(sb) / 8);
 	gdp->bg_checksum = ext4_group_desc_csum(sbi, ac->ac_b_ex.fe_group, gdp);
 
 	ext4_unlock_group(sb, ac->ac_b_ex.fe_group);
@@ -4661,6 +4864,8 @@ do_more:
 
 	ret = ext4_free_group_clusters(sb, gdp) + count_clusters;
 	ext4_free_group_clusters_set(sb, gdp, ret);
+	ext4_block_bitmap_csum_set(sb, block_group, gdp, bitmap_bh,
+				   EXT4_CLUSTERS_PER_GROUP(sb) / 8);
 	gdp->bg_checksum = ext4_group_desc_csum(sbi, block_group, gdp);
 	ext4_unlock_group(sb, block_group);
 	percpu_counter_add(&sbi->s_freeclusters_counter, count_clusters);
@@ -4805,6 +5010,8 @@ int ext4_group_add_blocks(handle_t *handle, struct super_block *sb,
 	mb_free_blocks(NULL, &e4b, bit, count);
 	blk_free_count = blocks_freed + ext4_free_group_clusters(sb, desc);
 	ext4_free_group_clusters_set(sb, desc, blk_free_count);
+	ext4_block_bitmap_csum_set(sb, block_group, desc, bitmap_bh,
+				   EXT4_CLUSTERS_PER_GROUP(sb) / 8);
 	desc->bg_checksum = ext4_group_desc_csum(sbi, block_group, desc);
 	ext4_unlock_group(sb, block_group);
 	percpu_counter_add(&sbi->s_freeclusters_counter,
@@ -94,6 +94,15 @@ extern u8 mb_enable_debug;
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * use the largest free order index to pick groups for the first
+ * allocation passes instead of scanning groups in order
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/* Number of buddy orders, order 0 being the bitmap itself */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* MUST be the first member */
@@ -164,6 +173,16 @@ struct ext4_locality_group {
 	spinlock_t		lg_prealloc_lock;
 };
 
+/*
+ * Stream allocation goal.  Each CPU keeps its own so that concurrent
+ * streaming writers on different CPUs start from different groups
+ * instead of all chasing a single global goal.
+ */
+struct ext4_mb_stream {
+	ext4_group_t		ms_group;	/* group of last allocation */
+	ext4_grpblk_t		ms_start;	/* and where it ended */
+};
+
 struct ext4_allocation_context {
 	struct inode *ac_inode;
 	struct super_block *ac_sb;
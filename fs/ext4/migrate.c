@@ -442,11 +442,12 @@ int ext4_ext_migrate(struct inode *inode)
 
 	/*
 	 * If the filesystem does not support extents, or the inode
-	 * already is extent-based, error out.
+	 * already is extent-based or has no blocks at all, error out.
 	 */
 	if (!EXT4_HAS_INCOMPAT_FEATURE(inode->i_sb,
 				       EXT4_FEATURE_INCOMPAT_EXTENTS) ||
-	    (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)))
+	    (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) ||
+	    ext4_has_inline_data(inode))
 		return -EINVAL;
 
 	if (S_ISLNK(inode->i_mode) && inode->i_blocks == 0)
@@ -22,10 +22,17 @@
 #include <linux/rbtree.h>
 #include <linux/poll.h>
 #include <linux/workqueue.h>
+#include <linux/idr.h>
 
-/** Max number of pages that can be used in a single read request */
+#define FUSE_SUPER_MAGIC 0x65735546
+
+/** Default max number of pages that can be used in a single request,
+    also the number of page pointers embedded in struct fuse_req */
 #define FUSE_MAX_PAGES_PER_REQ 32
 
+/** Upper limit for the max number of pages negotiated in INIT */
+#define FUSE_MAX_MAX_PAGES 256
+
 /** Bias for fi->writectr, meaning new writepages must not be sent */
 #define FUSE_NOWRITE INT_MIN
 
@@ -44,6 +51,10 @@
     doing the mount will be allowed to access the filesystem */
 #define FUSE_ALLOW_OTHER         (1 << 1)
 
+/** Number of buckets in the hash of requests being processed */
+#define FUSE_PQ_HASH_BITS 8
+#define FUSE_PQ_HASH_SIZE (1 << FUSE_PQ_HASH_BITS)
+
 /** List of active connections */
 extern struct list_head fuse_conn_list;
 
@@ -136,6 +147,9 @@ struct fuse_file {
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
 
+	/** Backing file for FOPEN_PASSTHROUGH, or NULL */
+	struct file *passthrough;
+
 	/** Has flock been performed on this file? */
 	bool flock:1;
 };
@@ -288,7 +302,13 @@ struct fuse_req {
 	} misc;
 
 	/** page vector */
-	struct page *pages[FUSE_MAX_PAGES_PER_REQ];
+	struct page **pages;
+
+	/** size of the page vector */
+	unsigned max_pages;
+
+	/** inline page vector, used unless more pages were requested */
+	struct page *inline_pages[FUSE_MAX_PAGES_PER_REQ];
 
 	/** number of pages in vector */
 	unsigned num_pages;
@@ -312,6 +332,38 @@ struct fuse_req {
 	struct file *stolen_file;
 };
 
+/**
+ * A per-CPU request queue.
+ *
+ * Requests issued on a CPU that has devices bound to it are queued
+ * here instead of on the shared pending list, and only the readers of
+ * those devices are woken up.
+ */
+struct fuse_queue {
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** Readers bound to this queue are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** Number of devices bound to this queue */
+	unsigned nr_devs;
+};
+
+/**
+ * An open /dev/fuse file attached to a connection.
+ *
+ * A connection may have several devices, created by cloning the one
+ * passed to mount with FUSE_DEV_IOC_CLONE.
+ */
+struct fuse_dev {
+	/** The connection this device belongs to */
+	struct fuse_conn *fc;
+
+	/** Per-CPU queue this device is bound to, or NULL */
+	struct fuse_queue *fq;
+};
+
 /**
  * A Fuse connection.
  *
@@ -344,14 +396,24 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
+	/** Maximum number of pages in a request */
+	unsigned max_pages;
+
 	/** Readers of the connection are waiting on this */
 	wait_queue_head_t waitq;
 
 	/** The list of pending requests */
 	struct list_head pending;
 
-	/** The list of requests being processed */
-	struct list_head processing;
+	/** Per-CPU request queues, allocated when the first device is
+	    bound to a CPU (nr_cpu_ids entries) */
+	struct fuse_queue *queues;
+
+	/** Number of open devices attached to the connection */
+	unsigned nr_devs;
+
+	/** The requests being processed, hashed by unique ID */
+	struct list_head processing[FUSE_PQ_HASH_SIZE];
 
 	/** The list of requests under I/O */
 	struct list_head io;
@@ -419,12 +481,19 @@ struct fuse_conn {
 	/** Do not send separate SETATTR request before open(O_TRUNC)  */
 	unsigned atomic_o_trunc:1;
 
+	/** Cache buffered writes in the page cache.  Only set in INIT */
+	unsigned writeback_cache:1;
+
 	/** Filesystem supports NFS exporting.  Only set in INIT */
 	unsigned export_support:1;
 
 	/** Set if bdi is valid */
 	unsigned bdi_initialized:1;
 
+	/** File I/O may be passed through to backing files.  Only set in
+	    INIT */
+	unsigned passthrough:1;
+
 	/*
 	 * The following bitfields are only for optimization purposes
 	 * and hence races in setting them will not cause malfunction
@@ -519,6 +588,9 @@ struct fuse_conn {
 
 	/** Read/write semaphore to hold when accessing sb. */
 	struct rw_semaphore killsb;
+
+	/** Backing files registered by the daemon.  Protected by fc->lock */
+	struct idr backing_files;
 };
 
 static inline struct fuse_conn *get_fuse_conn_super(struct super_block *sb)
@@ -544,6 +616,11 @@ static inline u64 get_node_id(struct inode *inode)
 /** Device operations */
 extern const struct file_operations fuse_dev_operations;
 
+/**
+ * Allocate a device for a connection
+ */
+struct fuse_dev *fuse_dev_alloc(struct fuse_conn *fc);
+
 extern const struct dentry_operations fuse_dentry_operations;
 
 /**
@@ -651,7 +728,7 @@ void fuse_ctl_cleanup(void);
  */
 struct fuse_req *fuse_request_alloc(void);
 
-struct fuse_req *fuse_request_alloc_nofs(void);
+struct fuse_req *fuse_request_alloc_nofs(unsigned npages);
 
 /**
  * Free a request
@@ -663,6 +740,11 @@ void fuse_request_free(struct fuse_req *req);
  */
 struct fuse_req *fuse_get_req(struct fuse_conn *fc);
 
+/**
+ * Get a request with room for @npages pages, may fail with -ENOMEM
+ */
+struct fuse_req *fuse_get_req_pages(struct fuse_conn *fc, unsigned npages);
+
 /**
  * Gets a requests for a file operation, always succeeds
  */
@@ -744,6 +826,8 @@ void fuse_flush_writepages(struct inode *inode);
 void fuse_set_nowrite(struct inode *inode);
 void fuse_release_nowrite(struct inode *inode);
 
+int fuse_flush_mtime(struct inode *inode);
+
 u64 fuse_get_attr_version(struct fuse_conn *fc);
 
 /**
@@ -778,4 +862,19 @@ int fuse_dev_release(struct inode *inode, struct file *file);
 
 void fuse_write_update_size(struct inode *inode, loff_t pos);
 
+/* passthrough.c */
+int fuse_backing_open(struct fuse_conn *fc, int fd);
+int fuse_backing_close(struct fuse_conn *fc, int backing_id);
+void fuse_backing_files_free(struct fuse_conn *fc);
+int fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			   struct fuse_open_out *openarg);
+void fuse_passthrough_release(struct fuse_file *ff);
+ssize_t fuse_passthrough_read(struct file *file, char __user *buf,
+			      size_t count, loff_t *ppos);
+ssize_t fuse_passthrough_write(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+int fuse_passthrough_fsync(struct file *file, loff_t start, loff_t end,
+			   int datasync);
+
 #endif /* _FS_FUSE_I_H */
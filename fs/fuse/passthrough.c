@@ -0,0 +1,266 @@
+/*
+  FUSE: Filesystem in Userspace
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/cred.h>
+#include <linux/sched.h>
+#include <linux/capability.h>
+
+/*
+ * Passthrough lets the daemon hand the kernel an open file on another
+ * filesystem, whose data the FUSE file is a view of.  The daemon
+ * registers the backing file with FUSE_DEV_IOC_BACKING_OPEN, and
+ * returns the backing id in the reply to OPEN or CREATE, together with
+ * FOPEN_PASSTHROUGH.  read, write and mmap on such a file then go to
+ * the backing file, without the data crossing the device.  Everything
+ * else, including attributes, is still handled by the daemon.
+ *
+ * I/O on the backing file is done with the credentials of the process
+ * that opened it, i.e. the daemon.
+ */
+
+int fuse_backing_open(struct fuse_conn *fc, int fd)
+{
+	struct file *file;
+	int id;
+	int err;
+
+	/* The daemon could otherwise export files the mounter can't see */
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (!fc->passthrough)
+		return -EOPNOTSUPP;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	err = -EINVAL;
+	if (!S_ISREG(file->f_path.dentry->d_inode->i_mode))
+		goto out_fput;
+
+	/* No stacking of one passthrough on top of another */
+	if (file->f_path.dentry->d_sb->s_magic == FUSE_SUPER_MAGIC)
+		goto out_fput;
+
+	do {
+		err = -ENOMEM;
+		if (!idr_pre_get(&fc->backing_files, GFP_KERNEL))
+			goto out_fput;
+
+		spin_lock(&fc->lock);
+		err = idr_get_new_above(&fc->backing_files, file, 1, &id);
+		spin_unlock(&fc->lock);
+	} while (err == -EAGAIN);
+
+	if (err)
+		goto out_fput;
+
+	return id;
+
+ out_fput:
+	fput(file);
+	return err;
+}
+
+static struct file *fuse_backing_lookup(struct fuse_conn *fc, int backing_id,
+					bool remove)
+{
+	struct file *file;
+
+	if (backing_id <= 0)
+		return NULL;
+
+	spin_lock(&fc->lock);
+	file = idr_find(&fc->backing_files, backing_id);
+	if (file) {
+		if (remove)
+			idr_remove(&fc->backing_files, backing_id);
+		else
+			get_file(file);
+	}
+	spin_unlock(&fc->lock);
+
+	return file;
+}
+
+int fuse_backing_close(struct fuse_conn *fc, int backing_id)
+{
+	struct file *file;
+
+	file = fuse_backing_lookup(fc, backing_id, true);
+	if (!file)
+		return -ENOENT;
+
+	fput(file);
+	return 0;
+}
+
+static int fuse_backing_file_put(int id, void *p, void *data)
+{
+	fput(p);
+	return 0;
+}
+
+/*
+ * Drop the backing files the daemon didn't close itself
+ */
+void fuse_backing_files_free(struct fuse_conn *fc)
+{
+	idr_for_each(&fc->backing_files, fuse_backing_file_put, NULL);
+	idr_remove_all(&fc->backing_files);
+	idr_destroy(&fc->backing_files);
+}
+
+/*
+ * Attach the backing file named in the OPEN or CREATE reply.  Files
+ * opened with FOPEN_PASSTHROUGH keep a reference to it until release,
+ * so the daemon may close the backing id right after the open.
+ */
+int fuse_passthrough_setup(struct fuse_conn *fc, struct fuse_file *ff,
+			   struct fuse_open_out *openarg)
+{
+	struct file *backing;
+
+	if (!(openarg->open_flags & FOPEN_PASSTHROUGH))
+		return 0;
+
+	if (!fc->passthrough)
+		return -EIO;
+
+	backing = fuse_backing_lookup(fc, openarg->backing_id, false);
+	if (!backing)
+		return -EIO;
+
+	ff->passthrough = backing;
+	return 0;
+}
+
+void fuse_passthrough_release(struct fuse_file *ff)
+{
+	if (ff->passthrough) {
+		fput(ff->passthrough);
+		ff->passthrough = NULL;
+	}
+}
+
+ssize_t fuse_passthrough_read(struct file *file, char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough;
+	const struct cred *old_cred;
+	ssize_t res;
+
+	old_cred = override_creds(backing->f_cred);
+	res = vfs_read(backing, buf, count, ppos);
+	revert_creds(old_cred);
+
+	if (res >= 0)
+		file_accessed(file);
+
+	return res;
+}
+
+ssize_t fuse_passthrough_write(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct inode *inode = file->f_dentry->d_inode;
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough;
+	const struct cred *old_cred;
+	loff_t pos = *ppos;
+	ssize_t res;
+
+	if (is_bad_inode(inode))
+		return -EIO;
+
+	/* Serialize appends and i_size updates against each other */
+	mutex_lock(&inode->i_mutex);
+	if (file->f_flags & O_APPEND)
+		pos = i_size_read(backing->f_mapping->host);
+
+	old_cred = override_creds(backing->f_cred);
+	res = vfs_write(backing, buf, count, &pos);
+	revert_creds(old_cred);
+
+	if (res > 0) {
+		fuse_write_update_size(inode, pos);
+		file_update_time(file);
+		*ppos = pos;
+	}
+	mutex_unlock(&inode->i_mutex);
+
+	fuse_invalidate_attr(inode);
+
+	return res;
+}
+
+/*
+ * The mapping is set up by the backing file and refers to it from now
+ * on, so page faults never reach FUSE.
+ */
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough;
+	const struct cred *old_cred;
+	int err;
+
+	if (WARN_ON(file != vma->vm_file))
+		return -EIO;
+
+	if (!backing->f_op || !backing->f_op->mmap)
+		return -ENODEV;
+
+	if ((vma->vm_flags & VM_MAYREAD) && !(backing->f_mode & FMODE_READ))
+		return -EACCES;
+
+	if ((vma->vm_flags & VM_SHARED) && (vma->vm_flags & VM_MAYWRITE) &&
+	    !(backing->f_mode & FMODE_WRITE))
+		return -EACCES;
+
+	get_file(backing);
+	vma->vm_file = backing;
+
+	old_cred = override_creds(backing->f_cred);
+	err = backing->f_op->mmap(backing, vma);
+	revert_creds(old_cred);
+
+	if (err) {
+		vma->vm_file = file;
+		fput(backing);
+		return err;
+	}
+
+	/* Drop the reference mmap_region() took for the vma */
+	fput(file);
+	file_accessed(file);
+
+	return 0;
+}
+
+int fuse_passthrough_fsync(struct file *file, loff_t start, loff_t end,
+			   int datasync)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *backing = ff->passthrough;
+	const struct cred *old_cred;
+	int err;
+
+	old_cred = override_creds(backing->f_cred);
+	err = vfs_fsync_range(backing, start, end, datasync);
+	revert_creds(old_cred);
+	if (err)
+		return err;
+
+	/* Let the daemon sync whatever metadata it keeps */
+	return fuse_fsync_common(file, start, end, datasync, 0);
+}
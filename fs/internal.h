@@ -16,6 +16,7 @@ struct file_system_type;
 struct linux_binprm;
 struct path;
 struct mount;
+struct nameidata;
 
 /*
  * block_dev.c
@@ -104,7 +105,7 @@ extern long do_handle_open(int mountdirfd,
 /*
  * inode.c
  */
-extern spinlock_t inode_sb_list_lock;
+extern bool sb_inodes_empty(struct super_block *);
 
 /*
  * fs-writeback.c
@@ -119,3 +120,83 @@ extern int invalidate_inodes(struct super_block *, bool);
  * dcache.c
  */
 extern struct dentry *__d_alloc(struct super_block *, const struct qstr *);
+#ifdef CONFIG_PATH_LOOKUP_CACHE
+extern bool __dput_nonblock(struct dentry *);
+#endif
+
+/*
+ * path_cache.c
+ */
+#ifdef CONFIG_PATH_LOOKUP_CACHE
+#define PATH_CACHE_DEPTH	16
+#define PATH_CACHE_NAME_LEN	256
+
+/*
+ * Per-walk state on the walker's stack; what the walk has seen of its
+ * prefix is kept per cpu, as rcu-walk runs with preemption disabled.
+ */
+struct path_cache_rec {
+	int			state;
+	struct dentry		*old;	/* displaced from the cache, to dput */
+};
+
+extern unsigned int path_cache_mount_gen;
+
+/* vfsmount lock must be held for write */
+static inline void path_cache_mounts_changed(void)
+{
+	path_cache_mount_gen++;
+}
+
+extern void path_cache_begin(struct nameidata *, struct path_cache_rec *,
+			     unsigned int);
+extern int path_cache_lookup(struct nameidata *, const char **);
+extern void path_cache_step(struct nameidata *, int);
+extern void path_cache_negative(struct nameidata *);
+extern void path_cache_complete(struct nameidata *, int);
+extern void path_cache_end(struct path_cache_rec *);
+extern void path_cache_shrink_sb(struct super_block *);
+extern void path_cache_forget(struct dentry *);
+#else
+struct path_cache_rec {
+};
+
+static inline void path_cache_mounts_changed(void)
+{
+}
+
+static inline void path_cache_begin(struct nameidata *nd,
+				    struct path_cache_rec *rec,
+				    unsigned int flags)
+{
+}
+
+static inline int path_cache_lookup(struct nameidata *nd, const char **name)
+{
+	return 0;
+}
+
+static inline void path_cache_step(struct nameidata *nd, int type)
+{
+}
+
+static inline void path_cache_negative(struct nameidata *nd)
+{
+}
+
+static inline void path_cache_complete(struct nameidata *nd, int error)
+{
+}
+
+static inline void path_cache_end(struct path_cache_rec *rec)
+{
+}
+
+static inline void path_cache_shrink_sb(struct super_block *sb)
+{
+}
+
+static inline void path_cache_forget(struct dentry *dentry)
+{
+}
+#endif
@@ -0,0 +1,1422 @@
+/*
+ *	Shared application/kernel submission and completion ring pairs, for
+ *	supporting fast/efficient IO.
+ *
+ *	Submission and completion queues are memory the application mmap()s
+ *	from the ring file descriptor. The application fills submission
+ *	queue entries (sqes) and advances the SQ tail; the kernel consumes
+ *	them on io_uring_enter(2), or continuously from a kernel thread with
+ *	IORING_SETUP_SQPOLL, and posts completion queue entries (cqes) at the
+ *	CQ tail for the application to reap without entering the kernel.
+ *
+ *	There is no non-blocking read/write path in this kernel to try a
+ *	request inline first, so everything that may block (reads, writes,
+ *	fsync) is executed by an unbound workqueue attached to the ring,
+ *	running with the submitter's mm and credentials. When the ring is
+ *	torn down, requests that haven't started are completed with
+ *	-ECANCELED, and the workers running the others are sent SIGINT so
+ *	that interruptible waits (an empty pipe or socket, say) end too.
+ *
+ *	Files and buffers can be registered up front (io_uring_register(2)):
+ *	registered files are referenced once rather than per request, and
+ *	registered buffers are pinned and mapped into the kernel once, so
+ *	buffered IO to them needs neither get_user_pages() nor the
+ *	submitter's mm.
+ *
+ *	Memory ordering: the head of each ring is only written by the
+ *	consumer and the tail only by the producer. A producer fills the
+ *	entry and issues a write barrier before storing the tail; a consumer
+ *	loads the tail, issues a read barrier, and then reads the entry.
+ *	The kernel issues a full barrier before publishing the SQ head, so
+ *	that it is done reading an sqe before the application may reuse it.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/syscalls.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/mmu_context.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/poll.h>
+#include <linux/anon_inodes.h>
+#include <linux/uio.h>
+#include <linux/log2.h>
+#include <linux/cred.h>
+#include <linux/io_uring.h>
+
+#include <asm/uaccess.h>
+
+#define IORING_MAX_ENTRIES	4096
+#define IORING_MAX_FIXED_FILES	1024
+
+struct io_uring {
+	u32 head ____cacheline_aligned_in_smp;
+	u32 tail ____cacheline_aligned_in_smp;
+};
+
+struct io_sq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			dropped;
+	u32			flags;
+	u32			array[];
+};
+
+struct io_cq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			overflow;
+	struct io_uring_cqe	cqes[];
+};
+
+struct io_mapped_ubuf {
+	u64		ubuf;
+	size_t		len;
+	unsigned int	nr_pages;
+	struct page	**pages;
+	void		*kaddr;		/* vmap() of pages, from ubuf & PAGE_MASK */
+};
+
+struct io_ring_ctx {
+	/* submission side, serialized by uring_lock */
+	struct {
+		struct io_sq_ring	*sq_ring;
+		unsigned		cached_sq_head;
+		unsigned		sq_entries;
+		unsigned		sq_mask;
+		unsigned		sq_thread_idle;
+		struct io_uring_sqe	*sq_sqes;
+	} ____cacheline_aligned_in_smp;
+
+	unsigned int		flags;
+	bool			account_mem;	/* charge RLIMIT_MEMLOCK */
+	struct mm_struct	*sqo_mm;
+	const struct cred	*creds;
+	struct user_struct	*user;
+	struct task_struct	*sqo_thread;	/* if using sq thread polling */
+	wait_queue_head_t	sqo_wait;
+	struct workqueue_struct	*sqo_wq;	/* executes blocking requests */
+
+	/* requests handed to sqo_wq, protected by task_lock */
+	spinlock_t		task_lock;
+	struct list_head	task_list;
+	bool			dying;		/* cancel instead of running */
+
+	/*
+	 * Registered files and buffers. Only changed with uring_lock held
+	 * and the workqueue flushed, so requests can use them unlocked.
+	 */
+	struct file		**user_files;
+	unsigned		nr_user_files;
+	struct io_mapped_ubuf	*user_bufs;
+	unsigned		nr_user_bufs;
+
+	/* completion side, serialized by completion_lock */
+	struct {
+		struct io_cq_ring	*cq_ring;
+		unsigned		cached_cq_tail;
+		unsigned		cq_entries;
+		unsigned		cq_mask;
+		atomic_t		inflight;
+		wait_queue_head_t	cq_wait;	/* io_uring_enter() */
+		wait_queue_head_t	poll_wait;	/* poll(2) on the fd */
+	} ____cacheline_aligned_in_smp;
+
+	spinlock_t		completion_lock ____cacheline_aligned_in_smp;
+
+	struct mutex		uring_lock;
+};
+
+struct io_kiocb {
+	struct work_struct	work;
+	struct list_head	list;		/* on ctx->task_list */
+	struct task_struct	*task;		/* worker running the request */
+	struct io_ring_ctx	*ctx;
+	struct file		*file;
+	struct io_uring_sqe	sqe;		/* private copy of the sqe */
+	unsigned int		flags;
+#define REQ_F_FIXED_FILE	1	/* ctx owns the file reference */
+};
+
+static struct kmem_cache *req_cachep;
+
+static const struct file_operations io_uring_fops;
+
+static unsigned io_cqring_events(struct io_cq_ring *ring)
+{
+	return ACCESS_ONCE(ring->r.tail) - ACCESS_ONCE(ring->r.head);
+}
+
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 user_data,
+				 long res)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	struct io_uring_cqe *cqe;
+	unsigned tail = ctx->cached_cq_tail;
+
+	/*
+	 * Submission keeps inflight + unreaped events within the CQ size,
+	 * but the application owns the head and may not play along: if
+	 * the ring is full, account the event as lost.
+	 */
+	if (tail - ACCESS_ONCE(ring->r.head) == ctx->cq_entries) {
+		ACCESS_ONCE(ring->overflow) = ring->overflow + 1;
+		return;
+	}
+
+	cqe = &ring->cqes[tail & ctx->cq_mask];
+	cqe->user_data = user_data;
+	cqe->res = res;
+	cqe->flags = 0;
+
+	ctx->cached_cq_tail++;
+	/* order the cqe contents before the tail update */
+	smp_wmb();
+	ACCESS_ONCE(ring->r.tail) = ctx->cached_cq_tail;
+}
+
+static void io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
+				long res)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	io_cqring_fill_event(ctx, user_data, res);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	smp_mb();
+	if (waitqueue_active(&ctx->cq_wait))
+		wake_up(&ctx->cq_wait);
+	if (waitqueue_active(&ctx->poll_wait))
+		wake_up_interruptible(&ctx->poll_wait);
+}
+
+static struct io_kiocb *io_get_req(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	req = kmem_cache_alloc(req_cachep, GFP_KERNEL);
+	if (!req)
+		return NULL;
+
+	req->ctx = ctx;
+	req->file = NULL;
+	req->task = NULL;
+	req->flags = 0;
+	atomic_inc(&ctx->inflight);
+	return req;
+}
+
+static void io_free_req(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (req->file && !(req->flags & REQ_F_FIXED_FILE))
+		fput(req->file);
+	kmem_cache_free(req_cachep, req);
+	atomic_dec(&ctx->inflight);
+}
+
+static int io_import_fixed(struct io_ring_ctx *ctx, struct io_kiocb *req,
+			   void **kaddr)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct io_mapped_ubuf *imu;
+	u64 buf_addr = sqe->addr;
+	size_t len = sqe->len;
+	unsigned index = sqe->buf_index;
+
+	if (unlikely(!ctx->user_bufs))
+		return -EFAULT;
+	if (unlikely(index >= ctx->nr_user_bufs))
+		return -EFAULT;
+
+	imu = &ctx->user_bufs[index];
+	if (buf_addr + len < buf_addr)
+		return -EFAULT;
+	/* not inside the mapped region */
+	if (buf_addr < imu->ubuf || buf_addr + len > imu->ubuf + imu->len)
+		return -EFAULT;
+
+	*kaddr = imu->kaddr + (buf_addr - (imu->ubuf & PAGE_MASK));
+	return 0;
+}
+
+static ssize_t io_read_write_fixed(struct io_ring_ctx *ctx,
+				   struct io_kiocb *req, loff_t *pos,
+				   bool write)
+{
+	struct file *file = req->file;
+	size_t len = req->sqe.len;
+	mm_segment_t old_fs;
+	void *kaddr;
+	ssize_t ret;
+
+	ret = io_import_fixed(ctx, req, &kaddr);
+	if (ret)
+		return ret;
+
+	/*
+	 * Direct IO pins the pages itself and can't be pointed at kernel
+	 * addresses; use the application address, whose pages are already
+	 * resident, with the submitter's mm attached by the caller.
+	 */
+	if (file->f_flags & O_DIRECT) {
+		char __user *ubuf = (char __user *)(unsigned long)req->sqe.addr;
+
+		if (write)
+			return vfs_write(file, ubuf, len, pos);
+		return vfs_read(file, ubuf, len, pos);
+	}
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	if (write) {
+		invalidate_kernel_vmap_range(kaddr, len);
+		ret = vfs_write(file, (const char __user *)kaddr, len, pos);
+	} else {
+		ret = vfs_read(file, (char __user *)kaddr, len, pos);
+		if (ret > 0)
+			flush_kernel_vmap_range(kaddr, ret);
+	}
+	set_fs(old_fs);
+
+	return ret;
+}
+
+static ssize_t io_read_write(struct io_ring_ctx *ctx, struct io_kiocb *req,
+			     bool write)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct file *file = req->file;
+	const struct iovec __user *uvec;
+	loff_t pos = sqe->off;
+
+	if (unlikely(sqe->rw_flags))
+		return -EINVAL;
+
+	if (sqe->opcode == IORING_OP_READ_FIXED ||
+	    sqe->opcode == IORING_OP_WRITE_FIXED)
+		return io_read_write_fixed(ctx, req, &pos, write);
+
+	if (unlikely(sqe->buf_index))
+		return -EINVAL;
+
+	uvec = (const struct iovec __user *)(unsigned long)sqe->addr;
+	if (write)
+		return vfs_writev(file, uvec, sqe->len, &pos);
+	return vfs_readv(file, uvec, sqe->len, &pos);
+}
+
+static int io_fsync(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	loff_t sqe_off = sqe->off;
+	loff_t sqe_len = sqe->len;
+	loff_t end = sqe_off + sqe_len;
+
+	if (unlikely(sqe->addr || sqe->buf_index))
+		return -EINVAL;
+	if (unlikely(sqe->fsync_flags & ~IORING_FSYNC_DATASYNC))
+		return -EINVAL;
+	if (sqe_off < 0 || end < sqe_off)
+		return -EINVAL;
+
+	return vfs_fsync_range(req->file, sqe_off,
+			       sqe_len ? end - 1 : LLONG_MAX,
+			       sqe->fsync_flags & IORING_FSYNC_DATASYNC);
+}
+
+static bool io_op_needs_mm(struct io_kiocb *req)
+{
+	switch (req->sqe.opcode) {
+	case IORING_OP_READV:
+	case IORING_OP_WRITEV:
+		return true;
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_WRITE_FIXED:
+		return req->file->f_flags & O_DIRECT;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Makes the worker running @req interruptible by io_cancel_requests(),
+ * unless the ring is already going away. Returns false in that case.
+ */
+static bool io_req_start(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	bool dying;
+
+	/* pool workers ignore signals, accept the one we cancel with */
+	allow_signal(SIGINT);
+
+	spin_lock(&ctx->task_lock);
+	dying = ctx->dying;
+	if (!dying)
+		req->task = current;
+	spin_unlock(&ctx->task_lock);
+
+	return !dying;
+}
+
+static void io_req_finish(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	spin_lock(&ctx->task_lock);
+	req->task = NULL;
+	list_del(&req->list);
+	spin_unlock(&ctx->task_lock);
+
+	/* leave the pool worker as we found it */
+	disallow_signal(SIGINT);
+	flush_signals(current);
+}
+
+/*
+ * Runs a request to completion from the ring's workqueue, on behalf of
+ * the task that set the ring up.
+ */
+static void io_sq_wq_submit_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_ring_ctx *ctx = req->ctx;
+	struct mm_struct *mm = NULL;
+	const struct cred *old_cred;
+	long ret;
+
+	if (!io_req_start(ctx, req)) {
+		ret = -ECANCELED;
+		goto done;
+	}
+
+	old_cred = override_creds(ctx->creds);
+
+	if (io_op_needs_mm(req)) {
+		/* the submitter may have exited, leaving an empty mm */
+		if (!atomic_inc_not_zero(&ctx->sqo_mm->mm_users)) {
+			ret = -EFAULT;
+			goto out;
+		}
+		mm = ctx->sqo_mm;
+		use_mm(mm);
+	}
+
+	switch (req->sqe.opcode) {
+	case IORING_OP_READV:
+	case IORING_OP_READ_FIXED:
+		ret = io_read_write(ctx, req, false);
+		break;
+	case IORING_OP_WRITEV:
+	case IORING_OP_WRITE_FIXED:
+		ret = io_read_write(ctx, req, true);
+		break;
+	case IORING_OP_FSYNC:
+		ret = io_fsync(req);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	if (mm) {
+		unuse_mm(mm);
+		mmput(mm);
+	}
+out:
+	revert_creds(old_cred);
+
+	/* interrupted by io_cancel_requests() */
+	if (signal_pending(current) && ACCESS_ONCE(ctx->dying) &&
+	    (ret == -EINTR || ret == -ERESTARTSYS || ret == -ERESTARTNOINTR ||
+	     ret == -ERESTARTNOHAND || ret == -ERESTART_RESTARTBLOCK))
+		ret = -ECANCELED;
+done:
+	io_req_finish(ctx, req);
+	io_cqring_add_event(ctx, req->sqe.user_data, ret);
+	io_free_req(req);
+}
+
+static int io_req_set_file(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct file *file;
+
+	if (sqe->flags & IOSQE_FIXED_FILE) {
+		if (unlikely(!ctx->user_files ||
+			     (unsigned)sqe->fd >= ctx->nr_user_files))
+			return -EBADF;
+		req->file = ctx->user_files[sqe->fd];
+		req->flags |= REQ_F_FIXED_FILE;
+		return 0;
+	}
+
+	/* the SQ thread doesn't share the application's file table */
+	if (ctx->flags & IORING_SETUP_SQPOLL)
+		return -EBADF;
+
+	file = fget(sqe->fd);
+	if (unlikely(!file))
+		return -EBADF;
+
+	/*
+	 * A request holding the last reference to its own ring would have
+	 * to tear the ring down from the ring's own workqueue.
+	 */
+	if (file->f_op == &io_uring_fops) {
+		fput(file);
+		return -EBADF;
+	}
+
+	req->file = file;
+	return 0;
+}
+
+/*
+ * Consumes and starts one sqe. Errors specific to the sqe are reported
+ * through the CQ like any other result; only a failure to allocate the
+ * request is returned, leaving the sqe in place for a later attempt.
+ */
+static int io_submit_sqe(struct io_ring_ctx *ctx,
+			 const struct io_uring_sqe *sqe)
+{
+	struct io_kiocb *req;
+	int ret;
+
+	req = io_get_req(ctx);
+	if (unlikely(!req))
+		return -EAGAIN;
+
+	memcpy(&req->sqe, sqe, sizeof(*sqe));
+	/* the sqe may be reused as soon as the SQ head moves past it */
+	ctx->cached_sq_head++;
+
+	if (unlikely(req->sqe.flags & ~IOSQE_FIXED_FILE)) {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	switch (req->sqe.opcode) {
+	case IORING_OP_NOP:
+		io_cqring_add_event(ctx, req->sqe.user_data, 0);
+		io_free_req(req);
+		return 0;
+	case IORING_OP_READV:
+	case IORING_OP_WRITEV:
+	case IORING_OP_FSYNC:
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_WRITE_FIXED:
+		break;
+	default:
+		ret = -EINVAL;
+		goto err;
+	}
+
+	ret = io_req_set_file(ctx, req);
+	if (ret)
+		goto err;
+
+	spin_lock(&ctx->task_lock);
+	list_add_tail(&req->list, &ctx->task_list);
+	spin_unlock(&ctx->task_lock);
+
+	INIT_WORK(&req->work, io_sq_wq_submit_work);
+	queue_work(ctx->sqo_wq, &req->work);
+	return 0;
+
+err:
+	io_cqring_add_event(ctx, req->sqe.user_data, ret);
+	io_free_req(req);
+	return 0;
+}
+
+/*
+ * Returns the sqe at the cached SQ head, or NULL if the ring is empty.
+ * Entries with an out of range index are skipped and counted as dropped.
+ */
+static const struct io_uring_sqe *io_peek_sqring(struct io_ring_ctx *ctx)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+	unsigned head;
+
+	for (;;) {
+		head = ctx->cached_sq_head;
+		if (head == ACCESS_ONCE(ring->r.tail))
+			return NULL;
+		/* read the sq array only after seeing the tail */
+		smp_rmb();
+
+		head = ACCESS_ONCE(ring->array[head & ctx->sq_mask]);
+		if (likely(head < ctx->sq_entries))
+			return &ctx->sq_sqes[head];
+
+		ctx->cached_sq_head++;
+		ACCESS_ONCE(ring->dropped) = ring->dropped + 1;
+	}
+}
+
+static void io_commit_sqring(struct io_ring_ctx *ctx)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+
+	if (ring->r.head != ctx->cached_sq_head) {
+		/* finish reading the sqes before they can be reused */
+		smp_mb();
+		ACCESS_ONCE(ring->r.head) = ctx->cached_sq_head;
+	}
+}
+
+static bool io_cqring_full(struct io_ring_ctx *ctx)
+{
+	unsigned pending;
+
+	pending = ctx->cached_cq_tail - ACCESS_ONCE(ctx->cq_ring->r.head);
+	return pending + atomic_read(&ctx->inflight) >= ctx->cq_entries;
+}
+
+/*
+ * Submits up to @to_submit sqes. Returns the number consumed, or -EBUSY
+ * if none could be because the CQ could not hold their completions.
+ * Called with uring_lock held.
+ */
+static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int to_submit)
+{
+	const struct io_uring_sqe *sqe;
+	int submitted = 0, ret = 0;
+
+	while (submitted < to_submit) {
+		sqe = io_peek_sqring(ctx);
+		if (!sqe)
+			break;
+		if (io_cqring_full(ctx)) {
+			ret = -EBUSY;
+			break;
+		}
+		ret = io_submit_sqe(ctx, sqe);
+		if (ret)
+			break;
+		submitted++;
+	}
+	io_commit_sqring(ctx);
+
+	return submitted ? submitted : ret;
+}
+
+static bool io_sqring_empty(struct io_ring_ctx *ctx)
+{
+	return ctx->cached_sq_head == ACCESS_ONCE(ctx->sq_ring->r.tail);
+}
+
+static int io_sq_thread(void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	unsigned long timeout;
+	DEFINE_WAIT(wait);
+	int ret;
+
+	timeout = jiffies + ctx->sq_thread_idle;
+	while (!kthread_should_stop()) {
+		mutex_lock(&ctx->uring_lock);
+		ret = io_submit_sqes(ctx, ctx->sq_entries);
+		mutex_unlock(&ctx->uring_lock);
+
+		if (ret > 0) {
+			timeout = jiffies + ctx->sq_thread_idle;
+			cond_resched();
+			continue;
+		}
+
+		/*
+		 * Keep polling for a while after the last submission, then
+		 * ask the application to wake us up through io_uring_enter().
+		 */
+		if (ret != -EBUSY && !time_after(jiffies, timeout)) {
+			cond_resched();
+			continue;
+		}
+
+		prepare_to_wait(&ctx->sqo_wait, &wait, TASK_INTERRUPTIBLE);
+
+		ACCESS_ONCE(ctx->sq_ring->flags) |= IORING_SQ_NEED_WAKEUP;
+		/* the flag must be visible before we recheck the tail */
+		smp_mb();
+
+		if (ret != -EBUSY && !io_sqring_empty(ctx)) {
+			ACCESS_ONCE(ctx->sq_ring->flags) &= ~IORING_SQ_NEED_WAKEUP;
+			finish_wait(&ctx->sqo_wait, &wait);
+			continue;
+		}
+
+		if (!kthread_should_stop())
+			schedule();
+		finish_wait(&ctx->sqo_wait, &wait);
+
+		ACCESS_ONCE(ctx->sq_ring->flags) &= ~IORING_SQ_NEED_WAKEUP;
+		timeout = jiffies + ctx->sq_thread_idle;
+	}
+
+	return 0;
+}
+
+/*
+ * Wait until at least @min_events completions are available in the CQ,
+ * optionally with a temporary signal mask as in ppoll(2).
+ */
+static int io_cqring_wait(struct io_ring_ctx *ctx, unsigned min_events,
+			  const sigset_t __user *sig, size_t sigsz)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	sigset_t ksigmask, sigsaved;
+	int ret;
+
+	if (io_cqring_events(ring) >= min_events)
+		return 0;
+
+	if (sig) {
+		if (sigsz != sizeof(sigset_t))
+			return -EINVAL;
+		if (copy_from_user(&ksigmask, sig, sizeof(ksigmask)))
+			return -EFAULT;
+		sigdelsetmask(&ksigmask, sigmask(SIGKILL) | sigmask(SIGSTOP));
+		sigprocmask(SIG_SETMASK, &ksigmask, &sigsaved);
+	}
+
+	ret = wait_event_interruptible(ctx->cq_wait,
+				       io_cqring_events(ring) >= min_events);
+
+	if (sig) {
+		if (ret == -ERESTARTSYS) {
+			/*
+			 * Don't restore the signal mask yet: let the
+			 * signal be delivered with the temporary one.
+			 */
+			memcpy(&current->saved_sigmask, &sigsaved,
+			       sizeof(sigsaved));
+			set_restore_sigmask();
+		} else
+			sigprocmask(SIG_SETMASK, &sigsaved, NULL);
+	}
+
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+	return ret;
+}
+
+static void io_sqe_files_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < ctx->nr_user_files; i++)
+		if (ctx->user_files[i])
+			fput(ctx->user_files[i]);
+
+	kfree(ctx->user_files);
+	ctx->user_files = NULL;
+	ctx->nr_user_files = 0;
+}
+
+static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
+				 unsigned nr_args)
+{
+	__s32 __user *fds = (__s32 __user *)arg;
+	struct file *file;
+	unsigned i;
+	int ret;
+
+	if (ctx->user_files)
+		return -EBUSY;
+	if (!nr_args || nr_args > IORING_MAX_FIXED_FILES)
+		return -EINVAL;
+
+	ctx->user_files = kcalloc(nr_args, sizeof(struct file *), GFP_KERNEL);
+	if (!ctx->user_files)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		__s32 fd;
+
+		ret = -EFAULT;
+		if (get_user(fd, &fds[i]))
+			break;
+
+		ret = -EBADF;
+		file = fget(fd);
+		if (!file)
+			break;
+		/* a ring can't own a reference to itself, or any ring */
+		if (file->f_op == &io_uring_fops) {
+			fput(file);
+			break;
+		}
+		ctx->user_files[i] = file;
+		ctx->nr_user_files++;
+		ret = 0;
+	}
+
+	if (ret)
+		io_sqe_files_unregister(ctx);
+
+	return ret;
+}
+
+static int io_account_mem(struct io_ring_ctx *ctx, unsigned long nr_pages)
+{
+	struct user_struct *user = ctx->user;
+	unsigned long limit;
+
+	if (!ctx->account_mem)
+		return 0;
+
+	limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	if (atomic_long_add_return(nr_pages, &user->locked_vm) > limit) {
+		atomic_long_sub(nr_pages, &user->locked_vm);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void io_unaccount_mem(struct io_ring_ctx *ctx, unsigned long nr_pages)
+{
+	if (ctx->account_mem)
+		atomic_long_sub(nr_pages, &ctx->user->locked_vm);
+}
+
+static void io_release_pages(struct page **pages, unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		set_page_dirty_lock(pages[i]);
+		put_page(pages[i]);
+	}
+}
+
+static void io_sqe_buffer_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < ctx->nr_user_bufs; i++) {
+		struct io_mapped_ubuf *imu = &ctx->user_bufs[i];
+
+		vunmap(imu->kaddr);
+		io_release_pages(imu->pages, imu->nr_pages);
+		io_unaccount_mem(ctx, imu->nr_pages);
+		kfree(imu->pages);
+	}
+
+	kfree(ctx->user_bufs);
+	ctx->user_bufs = NULL;
+	ctx->nr_user_bufs = 0;
+}
+
+static int io_sqe_buffer_map(struct io_ring_ctx *ctx,
+			     struct io_mapped_ubuf *imu,
+			     const struct iovec *iov)
+{
+	unsigned long ubuf = (unsigned long)iov->iov_base;
+	unsigned long start, end, nr_pages, i;
+	struct vm_area_struct **vmas;
+	struct page **pages;
+	int pret, ret;
+
+	/* arbitrary limit, but we need something */
+	if (!iov->iov_len || iov->iov_len > (1UL << 30))
+		return -EFAULT;
+	if (ubuf + iov->iov_len < ubuf)
+		return -EFAULT;
+
+	start = ubuf >> PAGE_SHIFT;
+	end = (ubuf + iov->iov_len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	nr_pages = end - start;
+
+	ret = io_account_mem(ctx, nr_pages);
+	if (ret)
+		return ret;
+
+	ret = -ENOMEM;
+	pages = kmalloc(nr_pages * sizeof(struct page *), GFP_KERNEL);
+	vmas = kmalloc(nr_pages * sizeof(struct vm_area_struct *), GFP_KERNEL);
+	if (!pages || !vmas)
+		goto err;
+
+	ret = 0;
+	down_read(&current->mm->mmap_sem);
+	pret = get_user_pages(current, current->mm, ubuf & PAGE_MASK, nr_pages,
+			      1, 0, pages, vmas);
+	if (pret == nr_pages) {
+		/* don't support file backed memory */
+		for (i = 0; i < nr_pages; i++)
+			if (vmas[i]->vm_file) {
+				ret = -EOPNOTSUPP;
+				break;
+			}
+	} else
+		ret = pret < 0 ? pret : -EFAULT;
+	up_read(&current->mm->mmap_sem);
+
+	if (ret) {
+		if (pret > 0)
+			io_release_pages(pages, pret);
+		goto err;
+	}
+
+	imu->kaddr = vmap(pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!imu->kaddr) {
+		io_release_pages(pages, nr_pages);
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	kfree(vmas);
+	imu->pages = pages;
+	imu->nr_pages = nr_pages;
+	imu->ubuf = ubuf;
+	imu->len = iov->iov_len;
+	return 0;
+
+err:
+	kfree(vmas);
+	kfree(pages);
+	io_unaccount_mem(ctx, nr_pages);
+	return ret;
+}
+
+static int io_sqe_buffer_register(struct io_ring_ctx *ctx, void __user *arg,
+				  unsigned nr_args)
+{
+	struct iovec __user *uiov = arg;
+	struct iovec iov;
+	unsigned i;
+	int ret = 0;
+
+	if (ctx->user_bufs)
+		return -EBUSY;
+	if (!nr_args || nr_args > UIO_MAXIOV)
+		return -EINVAL;
+
+	ctx->user_bufs = kcalloc(nr_args, sizeof(struct io_mapped_ubuf),
+				 GFP_KERNEL);
+	if (!ctx->user_bufs)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		ret = -EFAULT;
+		if (copy_from_user(&iov, &uiov[i], sizeof(iov)))
+			break;
+
+		ret = io_sqe_buffer_map(ctx, &ctx->user_bufs[i], &iov);
+		if (ret)
+			break;
+		ctx->nr_user_bufs++;
+	}
+
+	if (ret)
+		io_sqe_buffer_unregister(ctx);
+
+	return ret;
+}
+
+static int io_sq_offload_start(struct io_ring_ctx *ctx,
+			       struct io_uring_params *p)
+{
+	int ret;
+
+	init_waitqueue_head(&ctx->sqo_wait);
+	ctx->sqo_mm = current->mm;
+	atomic_inc(&ctx->sqo_mm->mm_count);
+
+	ctx->sqo_wq = alloc_workqueue("io_ring-wq", WQ_UNBOUND | WQ_FREEZABLE,
+			min(ctx->sq_entries, 2 * num_online_cpus()));
+	if (!ctx->sqo_wq) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		ret = -EPERM;
+		if (!capable(CAP_SYS_ADMIN))
+			goto err;
+
+		ctx->sq_thread_idle = msecs_to_jiffies(p->sq_thread_idle);
+		if (!ctx->sq_thread_idle)
+			ctx->sq_thread_idle = HZ;
+
+		if (p->flags & IORING_SETUP_SQ_AFF) {
+			int cpu = p->sq_thread_cpu;
+
+			ret = -EINVAL;
+			if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+				goto err;
+
+			ctx->sqo_thread = kthread_create_on_node(io_sq_thread,
+							ctx, cpu_to_node(cpu),
+							"io_uring-sq");
+			if (!IS_ERR(ctx->sqo_thread))
+				kthread_bind(ctx->sqo_thread, cpu);
+		} else {
+			ctx->sqo_thread = kthread_create(io_sq_thread, ctx,
+							"io_uring-sq");
+		}
+		if (IS_ERR(ctx->sqo_thread)) {
+			ret = PTR_ERR(ctx->sqo_thread);
+			ctx->sqo_thread = NULL;
+			goto err;
+		}
+		wake_up_process(ctx->sqo_thread);
+	} else if (p->flags & IORING_SETUP_SQ_AFF) {
+		/* Can't have SQ_AFF without SQPOLL */
+		ret = -EINVAL;
+		goto err;
+	}
+
+	return 0;
+
+err:
+	if (ctx->sqo_wq) {
+		destroy_workqueue(ctx->sqo_wq);
+		ctx->sqo_wq = NULL;
+	}
+	mmdrop(ctx->sqo_mm);
+	ctx->sqo_mm = NULL;
+	return ret;
+}
+
+/*
+ * Nothing queued on sqo_wq may be left waiting for data that never
+ * comes, or destroying the workqueue would hang. Requests that haven't
+ * started see ->dying and complete with -ECANCELED; the workers of
+ * running ones are signalled so that interruptible waits return.
+ */
+static void io_cancel_requests(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	spin_lock(&ctx->task_lock);
+	ctx->dying = true;
+	list_for_each_entry(req, &ctx->task_list, list) {
+		if (req->task)
+			send_sig(SIGINT, req->task, 1);
+	}
+	spin_unlock(&ctx->task_lock);
+}
+
+static void io_sq_offload_stop(struct io_ring_ctx *ctx)
+{
+	if (ctx->sqo_thread) {
+		kthread_stop(ctx->sqo_thread);
+		ctx->sqo_thread = NULL;
+	}
+	if (ctx->sqo_wq) {
+		io_cancel_requests(ctx);
+		destroy_workqueue(ctx->sqo_wq);
+		ctx->sqo_wq = NULL;
+	}
+	if (ctx->sqo_mm) {
+		mmdrop(ctx->sqo_mm);
+		ctx->sqo_mm = NULL;
+	}
+}
+
+static void *io_mem_alloc(size_t size)
+{
+	gfp_t gfp_flags = GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN | __GFP_COMP |
+				__GFP_REPEAT;
+
+	return (void *) __get_free_pages(gfp_flags, get_order(size));
+}
+
+static void io_mem_free(void *ptr)
+{
+	struct page *page;
+
+	if (!ptr)
+		return;
+
+	page = virt_to_head_page(ptr);
+	__free_pages(page, compound_order(page));
+}
+
+static int io_allocate_rings(struct io_ring_ctx *ctx,
+			     struct io_uring_params *p)
+{
+	struct io_sq_ring *sq_ring;
+	struct io_cq_ring *cq_ring;
+	size_t size;
+
+	size = sizeof(struct io_sq_ring) + p->sq_entries * sizeof(u32);
+	sq_ring = io_mem_alloc(size);
+	if (!sq_ring)
+		return -ENOMEM;
+
+	ctx->sq_ring = sq_ring;
+	sq_ring->ring_mask = p->sq_entries - 1;
+	sq_ring->ring_entries = p->sq_entries;
+	ctx->sq_mask = sq_ring->ring_mask;
+	ctx->sq_entries = sq_ring->ring_entries;
+
+	size = sizeof(struct io_uring_sqe) * p->sq_entries;
+	ctx->sq_sqes = io_mem_alloc(size);
+	if (!ctx->sq_sqes)
+		return -ENOMEM;
+
+	size = sizeof(struct io_cq_ring) +
+		p->cq_entries * sizeof(struct io_uring_cqe);
+	cq_ring = io_mem_alloc(size);
+	if (!cq_ring)
+		return -ENOMEM;
+
+	ctx->cq_ring = cq_ring;
+	cq_ring->ring_mask = p->cq_entries - 1;
+	cq_ring->ring_entries = p->cq_entries;
+	ctx->cq_mask = cq_ring->ring_mask;
+	ctx->cq_entries = cq_ring->ring_entries;
+	return 0;
+}
+
+static void io_ring_ctx_free(struct io_ring_ctx *ctx)
+{
+	/* no new submissions can come in: stop and drain the executors */
+	io_sq_offload_stop(ctx);
+	io_sqe_buffer_unregister(ctx);
+	io_sqe_files_unregister(ctx);
+
+	io_mem_free(ctx->sq_ring);
+	io_mem_free(ctx->sq_sqes);
+	io_mem_free(ctx->cq_ring);
+
+	if (ctx->creds)
+		put_cred(ctx->creds);
+	free_uid(ctx->user);
+	kfree(ctx);
+}
+
+static int io_uring_release(struct inode *inode, struct file *file)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+
+	file->private_data = NULL;
+	io_ring_ctx_free(ctx);
+	return 0;
+}
+
+static unsigned int io_uring_poll(struct file *file, poll_table *wait)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &ctx->poll_wait, wait);
+	/* see the barrier in io_cqring_add_event() */
+	smp_rmb();
+	if (ACCESS_ONCE(ctx->sq_ring->r.tail) - ctx->cached_sq_head !=
+	    ctx->sq_entries)
+		mask |= POLLOUT | POLLWRNORM;
+	if (io_cqring_events(ctx->cq_ring))
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
+static int io_uring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	loff_t offset = (loff_t) vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long sz = vma->vm_end - vma->vm_start;
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned long pfn;
+	struct page *page;
+	void *ptr;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ptr = ctx->sq_ring;
+		break;
+	case IORING_OFF_SQES:
+		ptr = ctx->sq_sqes;
+		break;
+	case IORING_OFF_CQ_RING:
+		ptr = ctx->cq_ring;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	page = virt_to_head_page(ptr);
+	if (sz > (PAGE_SIZE << compound_order(page)))
+		return -EINVAL;
+
+	pfn = virt_to_phys(ptr) >> PAGE_SHIFT;
+	return remap_pfn_range(vma, vma->vm_start, pfn, sz, vma->vm_page_prot);
+}
+
+SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
+		u32, min_complete, u32, flags, const sigset_t __user *, sig,
+		size_t, sigsz)
+{
+	struct io_ring_ctx *ctx;
+	long ret = -EBADF;
+	int submitted = 0;
+	struct file *f;
+
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+		return -EINVAL;
+
+	f = fget(fd);
+	if (!f)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (f->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = f->private_data;
+	ret = 0;
+
+	/*
+	 * For SQ polling, the thread will do all submissions and
+	 * completions. Just return the requested submit count, and wake
+	 * the thread if we were asked to.
+	 */
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		if (flags & IORING_ENTER_SQ_WAKEUP)
+			wake_up(&ctx->sqo_wait);
+		submitted = to_submit;
+	} else if (to_submit) {
+		to_submit = min(to_submit, ctx->sq_entries);
+
+		mutex_lock(&ctx->uring_lock);
+		submitted = io_submit_sqes(ctx, to_submit);
+		mutex_unlock(&ctx->uring_lock);
+
+		if (submitted < 0) {
+			ret = submitted;
+			submitted = 0;
+			goto out_fput;
+		}
+	}
+	if (flags & IORING_ENTER_GETEVENTS) {
+		min_complete = min(min_complete, ctx->cq_entries);
+		ret = io_cqring_wait(ctx, min_complete, sig, sigsz);
+	}
+
+out_fput:
+	fput(f);
+	return submitted ? submitted : ret;
+}
+
+static const struct file_operations io_uring_fops = {
+	.release	= io_uring_release,
+	.mmap		= io_uring_mmap,
+	.poll		= io_uring_poll,
+	.llseek		= noop_llseek,
+};
+
+static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
+{
+	struct io_ring_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return NULL;
+
+	ctx->flags = p->flags;
+	atomic_set(&ctx->inflight, 0);
+	init_waitqueue_head(&ctx->cq_wait);
+	init_waitqueue_head(&ctx->poll_wait);
+	spin_lock_init(&ctx->completion_lock);
+	mutex_init(&ctx->uring_lock);
+	spin_lock_init(&ctx->task_lock);
+	INIT_LIST_HEAD(&ctx->task_list);
+	return ctx;
+}
+
+static void io_fill_offsets(struct io_uring_params *p)
+{
+	memset(&p->sq_off, 0, sizeof(p->sq_off));
+	p->sq_off.head = offsetof(struct io_sq_ring, r.head);
+	p->sq_off.tail = offsetof(struct io_sq_ring, r.tail);
+	p->sq_off.ring_mask = offsetof(struct io_sq_ring, ring_mask);
+	p->sq_off.ring_entries = offsetof(struct io_sq_ring, ring_entries);
+	p->sq_off.flags = offsetof(struct io_sq_ring, flags);
+	p->sq_off.dropped = offsetof(struct io_sq_ring, dropped);
+	p->sq_off.array = offsetof(struct io_sq_ring, array);
+
+	memset(&p->cq_off, 0, sizeof(p->cq_off));
+	p->cq_off.head = offsetof(struct io_cq_ring, r.head);
+	p->cq_off.tail = offsetof(struct io_cq_ring, r.tail);
+	p->cq_off.ring_mask = offsetof(struct io_cq_ring, ring_mask);
+	p->cq_off.ring_entries = offsetof(struct io_cq_ring, ring_entries);
+	p->cq_off.overflow = offsetof(struct io_cq_ring, overflow);
+	p->cq_off.cqes = offsetof(struct io_cq_ring, cqes);
+}
+
+static long io_uring_setup(u32 entries, struct io_uring_params __user *params)
+{
+	struct io_uring_params p;
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	long ret;
+	int fd, i;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++) {
+		if (p.resv[i])
+			return -EINVAL;
+	}
+
+	if (p.flags & ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF))
+		return -EINVAL;
+
+	if (!entries || entries > IORING_MAX_ENTRIES)
+		return -EINVAL;
+
+	/*
+	 * Use twice as many entries for the CQ ring. It's possible for the
+	 * application to drive a higher depth than the size of the SQ ring,
+	 * since the sqes are only used at submission time.
+	 */
+	p.sq_entries = roundup_pow_of_two(entries);
+	p.cq_entries = 2 * p.sq_entries;
+
+	ctx = io_ring_ctx_alloc(&p);
+	if (!ctx)
+		return -ENOMEM;
+	ctx->user = get_uid(current_user());
+	ctx->account_mem = !capable(CAP_IPC_LOCK);
+	ctx->creds = get_current_cred();
+
+	ret = io_allocate_rings(ctx, &p);
+	if (ret)
+		goto err;
+
+	ret = io_sq_offload_start(ctx, &p);
+	if (ret)
+		goto err;
+
+	io_fill_offsets(&p);
+	if (copy_to_user(params, &p, sizeof(p))) {
+		ret = -EFAULT;
+		goto err;
+	}
+
+	fd = get_unused_fd_flags(O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		ret = fd;
+		goto err;
+	}
+
+	file = anon_inode_getfile("[io_uring]", &io_uring_fops, ctx,
+				  O_RDWR | O_CLOEXEC);
+	if (IS_ERR(file)) {
+		put_unused_fd(fd);
+		ret = PTR_ERR(file);
+		goto err;
+	}
+
+	fd_install(fd, file);
+	return fd;
+
+err:
+	io_ring_ctx_free(ctx);
+	return ret;
+}
+
+/*
+ * Sets up an aio uring context, and returns the fd. Applications asks for a
+ * ring size, we return the actual sq/cq ring sizes (among other things) in
+ * the params structure passed in.
+ */
+SYSCALL_DEFINE2(io_uring_setup, u32, entries,
+		struct io_uring_params __user *, params)
+{
+	return io_uring_setup(entries, params);
+}
+
+static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
+			       void __user *arg, unsigned nr_args)
+{
+	int ret;
+
+	/*
+	 * Requests use the registered files and buffers without taking
+	 * references: new submissions are held off by uring_lock, wait
+	 * for the ones in flight before changing the tables.
+	 */
+	flush_workqueue(ctx->sqo_wq);
+
+	switch (opcode) {
+	case IORING_REGISTER_BUFFERS:
+		ret = io_sqe_buffer_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_BUFFERS:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_bufs)
+			break;
+		io_sqe_buffer_unregister(ctx);
+		ret = 0;
+		break;
+	case IORING_REGISTER_FILES:
+		ret = io_sqe_files_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_FILES:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_files)
+			break;
+		io_sqe_files_unregister(ctx);
+		ret = 0;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	return ret;
+}
+
+SYSCALL_DEFINE4(io_uring_register, unsigned int, fd, unsigned int, opcode,
+		void __user *, arg, unsigned int, nr_args)
+{
+	struct io_ring_ctx *ctx;
+	long ret = -EBADF;
+	struct file *f;
+
+	f = fget(fd);
+	if (!f)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (f->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = f->private_data;
+
+	mutex_lock(&ctx->uring_lock);
+	ret = __io_uring_register(ctx, opcode, arg, nr_args);
+	mutex_unlock(&ctx->uring_lock);
+out_fput:
+	fput(f);
+	return ret;
+}
+
+static int __init io_uring_init(void)
+{
+	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
+	return 0;
+}
+__initcall(io_uring_init);
@@ -85,6 +85,26 @@ nope:
 	__brelse(bh);
 }
 
+static int jbd2_commit_block_csum_set(journal_t *j,
+				      struct journal_head *descriptor)
+{
+	struct commit_header *h;
+	__u32 csum = j->j_csum_seed;
+	int err;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return 0;
+
+	h = (struct commit_header *)(jh2bh(descriptor)->b_data);
+	h->h_chksum_type = 0;
+	h->h_chksum_size = 0;
+	h->h_chksum[0] = 0;
+	err = jbd2_chksum(j, &csum, jh2bh(descriptor)->b_data,
+			  j->j_blocksize);
+	h->h_chksum[0] = cpu_to_be32(csum);
+	return err;
+}
+
 /*
  * Done it all: now submit the commit record.  We should have
  * cleaned up our previous buffers by now, so if we are in abort
@@ -128,6 +148,11 @@ static int journal_submit_commit_record(journal_t *journal,
 		tmp->h_chksum_size 	= JBD2_CRC32_CHKSUM_SIZE;
 		tmp->h_chksum[0] 	= cpu_to_be32(crc32_sum);
 	}
+	if (jbd2_commit_block_csum_set(journal, descriptor)) {
+		put_bh(bh);
+		jbd2_journal_put_journal_head(descriptor);
+		return 1;
+	}
 
 	JBUFFER_TRACE(descriptor, "submit commit block");
 	lock_buffer(bh);
@@ -301,6 +326,77 @@ static void write_tag_block(int tag_bytes, journal_block_tag_t *tag,
 		tag->t_blocknr_high = cpu_to_be32((block >> 31) >> 1);
 }
 
+/*
+ * The tag checksum covers the copy of the block that goes to the log.
+ */
+static int jbd2_block_tag_csum_set(journal_t *j, journal_block_tag_t *tag,
+				   struct buffer_head *bh, __u32 sequence)
+{
+	struct page *page = bh->b_page;
+	__u8 *addr;
+	__u32 csum = j->j_csum_seed;
+	__be32 seq;
+	int err;
+
+	seq = cpu_to_be32(sequence);
+	addr = kmap_atomic(page);
+	err = jbd2_chksum(j, &csum, (__u8 *)&seq, sizeof(seq));
+	if (!err)
+		err = jbd2_chksum(j, &csum, addr + offset_in_page(bh->b_data),
+				  bh->b_size);
+	kunmap_atomic(addr);
+
+	tag->t_checksum = cpu_to_be16(csum);
+	return err;
+}
+
+/*
+ * Checksum the blocks of one descriptor: wbuf[0] is the descriptor
+ * itself, the log copies of the blocks it tags follow in tag order.
+ * The tags get their block checksums first, so that the checksum in
+ * the descriptor tail covers them.
+ */
+static int jbd2_descr_block_csum_set(journal_t *j, struct buffer_head **wbuf,
+				     int bufs, __u32 sequence)
+{
+	struct buffer_head *bh = wbuf[0];
+	struct jbd2_journal_block_tail *tail;
+	int tag_bytes = journal_tag_bytes(j);
+	char *tagp = &bh->b_data[sizeof(journal_header_t)];
+	__u32 csum = j->j_csum_seed;
+	int i, err;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return 0;
+
+	for (i = 1; i < bufs; i++) {
+		err = jbd2_block_tag_csum_set(j, (journal_block_tag_t *)tagp,
+					      wbuf[i], sequence);
+		if (err)
+			return err;
+		tagp += tag_bytes;
+		if (i == 1)
+			tagp += 16;	/* UUID after the first tag */
+	}
+
+	tail = (struct jbd2_journal_block_tail *)
+			(bh->b_data + j->j_blocksize -
+			sizeof(struct jbd2_journal_block_tail));
+	tail->t_checksum = 0;
+	err = jbd2_chksum(j, &csum, bh->b_data, j->j_blocksize);
+	tail->t_checksum = cpu_to_be32(csum);
+	return err;
+}
+
+static void journal_submit_log_buffer(struct buffer_head *bh)
+{
+	lock_buffer(bh);
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	bh->b_end_io = journal_end_buffer_io_sync;
+	submit_bh(WRITE_SYNC, bh);
+}
+
 /*
  * jbd2_journal_commit_transaction
  *
@@ -328,6 +424,8 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	int i, to_free = 0;
 	int tag_bytes = journal_tag_bytes(journal);
 	struct buffer_head *cbh = NULL; /* For transactional checksums */
+	int csum_size = 0;
+	int csum_batch;
 	__u32 crc32_sum = ~0;
 	struct blk_plug plug;
 	/* Tail of the journal */
@@ -335,6 +433,11 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	tid_t first_tid;
 	int update_tail;
 
+	if (jbd2_journal_has_csum_v2(journal))
+		csum_size = sizeof(struct jbd2_journal_block_tail);
+	csum_batch = csum_size || JBD2_HAS_COMPAT_FEATURE(journal,
+					JBD2_FEATURE_COMPAT_CHECKSUM);
+
 	/*
 	 * First job: lock down the current transaction and wait for
 	 * all outstanding updates to complete.
@@ -559,7 +662,8 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 			header->h_sequence  = cpu_to_be32(commit_transaction->t_tid);
 
 			tagp = &bh->b_data[sizeof(journal_header_t)];
-			space_left = bh->b_size - sizeof(journal_header_t);
+			space_left = bh->b_size - sizeof(journal_header_t) -
+				     csum_size;
 			first_tag = 1;
 			set_buffer_jwrite(bh);
 			set_buffer_dirty(bh);
@@ -627,7 +731,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 
 		tag = (journal_block_tag_t *) tagp;
 		write_tag_block(tag_bytes, tag, jh2bh(jh)->b_blocknr);
-		tag->t_flags = cpu_to_be32(tag_flag);
+		tag->t_flags = cpu_to_be16(tag_flag);
 		tagp += tag_bytes;
 		space_left -= tag_bytes;
 
@@ -651,25 +755,33 @@ void jbd2_journal_commit_transaction(journal_t *journal)
                            submitting the IOs.  "tag" still points to
                            the last tag we set up. */
 
-			tag->t_flags |= cpu_to_be32(JBD2_FLAG_LAST_TAG);
+			tag->t_flags |= cpu_to_be16(JBD2_FLAG_LAST_TAG);
 
 start_journal_io:
-			for (i = 0; i < bufs; i++) {
-				struct buffer_head *bh = wbuf[i];
-				/*
-				 * Compute checksum.
-				 */
-				if (JBD2_HAS_COMPAT_FEATURE(journal,
+			/*
+			 * The log copies don't change any more once they
+			 * are tagged.  Send them off first and checksum
+			 * them, in log order, while they are being written;
+			 * the descriptor follows once its tags and tail
+			 * carry their checksums.
+			 */
+			for (i = 1; i < bufs; i++)
+				journal_submit_log_buffer(wbuf[i]);
+			if (bufs > 1 && csum_batch)
+				blk_flush_plug(current);
+
+			if (JBD2_HAS_COMPAT_FEATURE(journal,
 					JBD2_FEATURE_COMPAT_CHECKSUM)) {
-					crc32_sum =
-					    jbd2_checksum_data(crc32_sum, bh);
-				}
-
-				lock_buffer(bh);
-				clear_buffer_dirty(bh);
-				set_buffer_uptodate(bh);
-				bh->b_end_io = journal_end_buffer_io_sync;
-				submit_bh(WRITE_SYNC, bh);
+				for (i = 0; i < bufs; i++)
+					crc32_sum = jbd2_checksum_data(
+							crc32_sum, wbuf[i]);
+			}
+			if (bufs) {
+				err = jbd2_descr_block_csum_set(journal, wbuf,
+						bufs, commit_transaction->t_tid);
+				if (err)
+					jbd2_journal_abort(journal, err);
+				journal_submit_log_buffer(wbuf[0]);
 			}
 			cond_resched();
 			stats.run.rs_blocks_logged += bufs;
@@ -44,6 +44,7 @@
 #include <linux/backing-dev.h>
 #include <linux/bitops.h>
 #include <linux/ratelimit.h>
+#include <linux/err.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/jbd2.h>
@@ -1233,6 +1234,86 @@ static int journal_reset(journal_t *journal)
 	return jbd2_journal_start_thread(journal);
 }
 
+static int jbd2_superblock_csum(journal_t *j, journal_superblock_t *sb,
+				__be32 *csum)
+{
+	__be32 old_csum;
+	__u32 crc = ~0;
+	int err;
+
+	old_csum = sb->s_checksum;
+	sb->s_checksum = 0;
+	err = jbd2_chksum(j, &crc, (char *)sb, sizeof(journal_superblock_t));
+	sb->s_checksum = old_csum;
+
+	*csum = cpu_to_be32(crc);
+	return err;
+}
+
+static int jbd2_superblock_csum_verify(journal_t *j, journal_superblock_t *sb)
+{
+	__be32 csum;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return 1;
+
+	if (jbd2_superblock_csum(j, sb, &csum))
+		return 0;
+	return sb->s_checksum == csum;
+}
+
+static void jbd2_superblock_csum_set(journal_t *j, journal_superblock_t *sb)
+{
+	__be32 csum;
+	int err;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return;
+
+	err = jbd2_superblock_csum(j, sb, &csum);
+	if (err) {
+		printk(KERN_ERR "JBD2: Cannot checksum superblock of %s "
+		       "(error %d)\n", j->j_devname, err);
+		return;
+	}
+	sb->s_checksum = csum;
+}
+
+/*
+ * Look up the crc32c driver and seed the per-journal checksum with the
+ * journal UUID.  Called when CSUM_V2 is found on, or set in, the journal.
+ * A driver whose state is not the bare crc is refused here, so that
+ * jbd2_chksum() doesn't fail later on in the middle of a commit.
+ */
+static int jbd2_journal_init_csum(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	u32 seed = ~0;
+	int err;
+
+	if (!journal->j_chksum_driver) {
+		struct crypto_shash *tfm;
+
+		tfm = crypto_alloc_shash("crc32c", 0, 0);
+		if (IS_ERR(tfm)) {
+			printk(KERN_ERR "JBD2: Cannot load crc32c driver.\n");
+			return PTR_ERR(tfm);
+		}
+		journal->j_chksum_driver = tfm;
+	}
+
+	err = jbd2_chksum(journal, &seed, sb->s_uuid, sizeof(sb->s_uuid));
+	if (err) {
+		printk(KERN_ERR "JBD2: Unusable crc32c driver (error %d)\n",
+		       err);
+		crypto_free_shash(journal->j_chksum_driver);
+		journal->j_chksum_driver = NULL;
+		return err;
+	}
+	journal->j_csum_seed = seed;
+	return 0;
+}
+
 static void jbd2_write_superblock(journal_t *journal, int write_op)
 {
 	struct buffer_head *bh = journal->j_sb_buffer;
@@ -1257,6 +1338,7 @@ static void jbd2_write_superblock(journal_t *journal, int write_op)
 		clear_buffer_write_io_error(bh);
 		set_buffer_uptodate(bh);
 	}
+	jbd2_superblock_csum_set(journal, journal->j_superblock);
 	get_bh(bh);
 	bh->b_end_io = end_buffer_write_sync;
 	ret = submit_bh(write_op, bh);
@@ -1413,6 +1495,31 @@ static int journal_get_superblock(journal_t *journal)
 		goto out;
 	}
 
+	if (JBD2_HAS_COMPAT_FEATURE(journal, JBD2_FEATURE_COMPAT_CHECKSUM) &&
+	    jbd2_journal_has_csum_v2(journal)) {
+		/* Can't have checksum v1 and v2 on at the same time! */
+		printk(KERN_ERR "JBD2: Can't enable checksumming v1 and v2 "
+		       "at the same time!\n");
+		goto out;
+	}
+
+	if (jbd2_journal_has_csum_v2(journal)) {
+		if (sb->s_checksum_type != JBD2_CRC32C_CHKSUM) {
+			printk(KERN_ERR "JBD2: Unknown checksum type\n");
+			goto out;
+		}
+
+		err = jbd2_journal_init_csum(journal);
+		if (err)
+			goto out;
+
+		err = -EINVAL;
+		if (!jbd2_superblock_csum_verify(journal, sb)) {
+			printk(KERN_ERR "JBD2: journal checksum error\n");
+			goto out;
+		}
+	}
+
 	return 0;
 
 out:
@@ -1558,6 +1665,8 @@ int jbd2_journal_destroy(journal_t *journal)
 		brelse(journal->j_sb_buffer);
 	}
 
+	if (journal->j_chksum_driver)
+		crypto_free_shash(journal->j_chksum_driver);
 	if (journal->j_proc_entry)
 		jbd2_stats_proc_exit(journal);
 	if (journal->j_inode)
@@ -1647,6 +1756,8 @@ int jbd2_journal_check_available_features (journal_t *journal, unsigned long com
  *
  * Mark a given journal feature as present on the
  * superblock.  Returns true if the requested features could be set.
+ * Checksum v1 (COMPAT_CHECKSUM) and v2 (INCOMPAT_CSUM_V2) exclude each
+ * other: asking for v1 together with, or on top of, v2 fails.
  *
  */
 
@@ -1666,6 +1777,23 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 
 	sb = journal->j_superblock;
 
+	/* Checksum v2 replaces v1, the two can't be on at once */
+	if (((incompat & JBD2_FEATURE_INCOMPAT_CSUM_V2) ||
+	     jbd2_journal_has_csum_v2(journal)) &&
+	    (compat & JBD2_FEATURE_COMPAT_CHECKSUM)) {
+		printk(KERN_ERR "JBD2: Can't enable checksumming v1 and v2 "
+		       "at the same time!\n");
+		return 0;
+	}
+
+	if (incompat & JBD2_FEATURE_INCOMPAT_CSUM_V2) {
+		if (jbd2_journal_init_csum(journal))
+			return 0;
+		sb->s_checksum_type = JBD2_CRC32C_CHKSUM;
+		sb->s_feature_compat &=
+			~cpu_to_be32(JBD2_FEATURE_COMPAT_CHECKSUM);
+	}
+
 	sb->s_feature_compat    |= cpu_to_be32(compat);
 	sb->s_feature_ro_compat |= cpu_to_be32(ro);
 	sb->s_feature_incompat  |= cpu_to_be32(incompat);
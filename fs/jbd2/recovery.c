@@ -174,6 +174,25 @@ static int jread(struct buffer_head **bhp, journal_t *journal,
 	return 0;
 }
 
+static int jbd2_descr_block_csum_verify(journal_t *j, void *buf)
+{
+	struct jbd2_journal_block_tail *tail;
+	__be32 provided;
+	__u32 calculated;
+	int err;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return 1;
+
+	tail = buf + j->j_blocksize - sizeof(struct jbd2_journal_block_tail);
+	provided = tail->t_checksum;
+	tail->t_checksum = 0;
+	calculated = j->j_csum_seed;
+	err = jbd2_chksum(j, &calculated, buf, j->j_blocksize);
+	tail->t_checksum = provided;
+
+	return !err && provided == cpu_to_be32(calculated);
+}
 
 /*
  * Count the number of in-use tags in a journal descriptor block.
@@ -186,6 +205,9 @@ static int count_tags(journal_t *journal, struct buffer_head *bh)
 	int			nr = 0, size = journal->j_blocksize;
 	int			tag_bytes = journal_tag_bytes(journal);
 
+	if (jbd2_journal_has_csum_v2(journal))
+		size -= sizeof(struct jbd2_journal_block_tail);
+
 	tagp = &bh->b_data[sizeof(journal_header_t)];
 
 	while ((tagp - bh->b_data + tag_bytes) <= size) {
@@ -193,10 +215,10 @@ static int count_tags(journal_t *journal, struct buffer_head *bh)
 
 		nr++;
 		tagp += tag_bytes;
-		if (!(tag->t_flags & cpu_to_be32(JBD2_FLAG_SAME_UUID)))
+		if (!(tag->t_flags & cpu_to_be16(JBD2_FLAG_SAME_UUID)))
 			tagp += 16;
 
-		if (tag->t_flags & cpu_to_be32(JBD2_FLAG_LAST_TAG))
+		if (tag->t_flags & cpu_to_be16(JBD2_FLAG_LAST_TAG))
 			break;
 	}
 
@@ -353,6 +375,43 @@ static int calc_chksums(journal_t *journal, struct buffer_head *bh,
 	return 0;
 }
 
+static int jbd2_commit_block_csum_verify(journal_t *j, void *buf)
+{
+	struct commit_header *h;
+	__be32 provided;
+	__u32 calculated;
+	int err;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return 1;
+
+	h = buf;
+	provided = h->h_chksum[0];
+	h->h_chksum[0] = 0;
+	calculated = j->j_csum_seed;
+	err = jbd2_chksum(j, &calculated, buf, j->j_blocksize);
+	h->h_chksum[0] = provided;
+
+	return !err && provided == cpu_to_be32(calculated);
+}
+
+static int jbd2_block_tag_csum_verify(journal_t *j, journal_block_tag_t *tag,
+				      void *buf, __u32 sequence)
+{
+	__u32 csum32 = j->j_csum_seed;
+	__be32 seq;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return 1;
+
+	seq = cpu_to_be32(sequence);
+	if (jbd2_chksum(j, &csum32, (__u8 *)&seq, sizeof(seq)) ||
+	    jbd2_chksum(j, &csum32, buf, j->j_blocksize))
+		return 0;
+
+	return tag->t_checksum == cpu_to_be16(csum32);
+}
+
 static int do_one_pass(journal_t *journal,
 			struct recovery_info *info, enum passtype pass)
 {
@@ -366,6 +425,7 @@ static int do_one_pass(journal_t *journal,
 	int			blocktype;
 	int			tag_bytes = journal_tag_bytes(journal);
 	__u32			crc32_sum = ~0; /* Transactional Checksums */
+	int			descr_csum_size = 0;
 
 	/*
 	 * First thing is to establish what we expect to find in the log
@@ -381,6 +441,9 @@ static int do_one_pass(journal_t *journal,
 	if (pass == PASS_SCAN)
 		info->start_transaction = first_commit_ID;
 
+	if (jbd2_journal_has_csum_v2(journal))
+		descr_csum_size = sizeof(struct jbd2_journal_block_tail);
+
 	jbd_debug(1, "Starting recovery pass %d\n", pass);
 
 	/*
@@ -451,6 +514,16 @@ static int do_one_pass(journal_t *journal,
 
 		switch(blocktype) {
 		case JBD2_DESCRIPTOR_BLOCK:
+			/* Verify checksum first */
+			if (!jbd2_descr_block_csum_verify(journal, bh->b_data)) {
+				printk(KERN_ERR "JBD2: Invalid checksum in "
+				       "descriptor block %ld\n",
+				       next_log_block - 1);
+				err = -EIO;
+				brelse(bh);
+				goto failed;
+			}
+
 			/* If it is a valid descriptor block, replay it
 			 * in pass REPLAY; if journal_checksums enabled, then
 			 * calculate checksums in PASS_SCAN, otherwise,
@@ -481,11 +554,11 @@ static int do_one_pass(journal_t *journal,
 
 			tagp = &bh->b_data[sizeof(journal_header_t)];
 			while ((tagp - bh->b_data + tag_bytes)
-			       <= journal->j_blocksize) {
+			       <= journal->j_blocksize - descr_csum_size) {
 				unsigned long io_block;
 
 				tag = (journal_block_tag_t *) tagp;
-				flags = be32_to_cpu(tag->t_flags);
+				flags = be16_to_cpu(tag->t_flags);
 
 				io_block = next_log_block++;
 				wrap(journal, next_log_block);
@@ -516,6 +589,19 @@ static int do_one_pass(journal_t *journal,
 						goto skip_write;
 					}
 
+					/* Look for block corruption */
+					if (!jbd2_block_tag_csum_verify(
+						journal, tag, obh->b_data,
+						sequence)) {
+						brelse(obh);
+						success = -EIO;
+						printk(KERN_ERR "JBD2: Invalid "
+						       "checksum recovering "
+						       "block %llu in log\n",
+						       blocknr);
+						goto skip_write;
+					}
+
 					/* Find a buffer for the new
 					 * data being restored */
 					nbh = __getblk(journal->j_fs_dev,
@@ -650,6 +736,19 @@ static int do_one_pass(journal_t *journal,
 				}
 				crc32_sum = ~0;
 			}
+			if (pass == PASS_SCAN &&
+			    !jbd2_commit_block_csum_verify(journal,
+							   bh->b_data)) {
+				info->end_transaction = next_commit_ID;
+
+				if (!JBD2_HAS_INCOMPAT_FEATURE(journal,
+				     JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
+					journal->j_failed_commit =
+						next_commit_ID;
+					brelse(bh);
+					break;
+				}
+			}
 			brelse(bh);
 			next_commit_ID++;
 			continue;
@@ -707,6 +806,26 @@ static int do_one_pass(journal_t *journal,
 }
 
 
+static int jbd2_revoke_block_csum_verify(journal_t *j, void *buf)
+{
+	struct jbd2_journal_revoke_tail *tail;
+	__be32 provided;
+	__u32 calculated;
+	int err;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return 1;
+
+	tail = buf + j->j_blocksize - sizeof(struct jbd2_journal_revoke_tail);
+	provided = tail->r_checksum;
+	tail->r_checksum = 0;
+	calculated = j->j_csum_seed;
+	err = jbd2_chksum(j, &calculated, buf, j->j_blocksize);
+	tail->r_checksum = provided;
+
+	return !err && provided == cpu_to_be32(calculated);
+}
+
 /* Scan a revoke record, marking all blocks mentioned as revoked. */
 
 static int scan_revoke_records(journal_t *journal, struct buffer_head *bh,
@@ -716,6 +835,9 @@ static int scan_revoke_records(journal_t *journal, struct buffer_head *bh,
 	int offset, max;
 	int record_len = 4;
 
+	if (!jbd2_revoke_block_csum_verify(journal, bh->b_data))
+		return -EINVAL;
+
 	header = (jbd2_journal_revoke_header_t *) bh->b_data;
 	offset = sizeof(jbd2_journal_revoke_header_t);
 	max = be32_to_cpu(header->r_count);
@@ -579,7 +579,7 @@ static void write_one_revoke_record(journal_t *journal,
 				    int write_op)
 {
 	struct journal_head *descriptor;
-	int offset;
+	int offset, record_len = 4, csum_size = 0;
 	journal_header_t *header;
 
 	/* If we are already aborting, this all becomes a noop.  We
@@ -592,9 +592,14 @@ static void write_one_revoke_record(journal_t *journal,
 	descriptor = *descriptorp;
 	offset = *offsetp;
 
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal, JBD2_FEATURE_INCOMPAT_64BIT))
+		record_len = 8;
+	if (jbd2_journal_has_csum_v2(journal))
+		csum_size = sizeof(struct jbd2_journal_revoke_tail);
+
 	/* Make sure we have a descriptor with space left for the record */
 	if (descriptor) {
-		if (offset == journal->j_blocksize) {
+		if (offset + record_len > journal->j_blocksize - csum_size) {
 			flush_descriptor(journal, descriptor, offset, write_op);
 			descriptor = NULL;
 		}
@@ -617,7 +622,7 @@ static void write_one_revoke_record(journal_t *journal,
 		*descriptorp = descriptor;
 	}
 
-	if (JBD2_HAS_INCOMPAT_FEATURE(journal, JBD2_FEATURE_INCOMPAT_64BIT)) {
+	if (record_len == 8) {
 		* ((__be64 *)(&jh2bh(descriptor)->b_data[offset])) =
 			cpu_to_be64(record->blocknr);
 		offset += 8;
@@ -631,6 +636,26 @@ static void write_one_revoke_record(journal_t *journal,
 	*offsetp = offset;
 }
 
+static int jbd2_revoke_csum_set(journal_t *j,
+				struct journal_head *descriptor)
+{
+	struct jbd2_journal_revoke_tail *tail;
+	__u32 csum = j->j_csum_seed;
+	int err;
+
+	if (!jbd2_journal_has_csum_v2(j))
+		return 0;
+
+	tail = (struct jbd2_journal_revoke_tail *)
+			(jh2bh(descriptor)->b_data + j->j_blocksize -
+			sizeof(struct jbd2_journal_revoke_tail));
+	tail->r_checksum = 0;
+	err = jbd2_chksum(j, &csum, jh2bh(descriptor)->b_data,
+			  j->j_blocksize);
+	tail->r_checksum = cpu_to_be32(csum);
+	return err;
+}
+
 /*
  * Flush a revoke descriptor out to the journal.  If we are aborting,
  * this is a noop; otherwise we are generating a buffer which needs to
@@ -644,6 +669,7 @@ static void flush_descriptor(journal_t *journal,
 {
 	jbd2_journal_revoke_header_t *header;
 	struct buffer_head *bh = jh2bh(descriptor);
+	int err;
 
 	if (is_journal_aborted(journal)) {
 		put_bh(bh);
@@ -652,6 +678,12 @@ static void flush_descriptor(journal_t *journal,
 
 	header = (jbd2_journal_revoke_header_t *) jh2bh(descriptor)->b_data;
 	header->r_count = cpu_to_be32(offset);
+	err = jbd2_revoke_csum_set(journal, descriptor);
+	if (err) {
+		jbd2_journal_abort(journal, err);
+		put_bh(bh);
+		return;
+	}
 	set_buffer_jwrite(bh);
 	BUFFER_TRACE(bh, "write");
 	set_buffer_dirty(bh);
@@ -1308,6 +1308,7 @@ static inline int walk_component(struct nameidata *nd, struct path *path,
 	}
 	if (!inode) {
 		path_to_nameidata(path, nd);
+		path_cache_negative(nd);
 		terminate_walk(nd);
 		return -ENOENT;
 	}
@@ -1523,6 +1524,12 @@ static int link_path_walk(const char *name, struct nameidata *nd)
 	if (!*name)
 		return 0;
 
+	err = path_cache_lookup(nd, &name);
+	if (unlikely(err < 0)) {
+		terminate_walk(nd);
+		return err;
+	}
+
 	/* At this point we know we have a real path component. */
 	for(;;) {
 		struct qstr this;
@@ -1581,13 +1588,16 @@ static int link_path_walk(const char *name, struct nameidata *nd)
 			if (err)
 				return err;
 		}
+		path_cache_step(nd, type);
 		if (can_lookup(nd->inode))
 			continue;
+		path_cache_complete(nd, -ENOTDIR);
 		err = -ENOTDIR; 
 		break;
 		/* here ends the main loop */
 
 last_component:
+		path_cache_complete(nd, 0);
 		nd->last = this;
 		nd->last_type = type;
 		return 0;
@@ -1711,6 +1721,7 @@ static inline int lookup_last(struct nameidata *nd, struct path *path)
 static int path_lookupat(int dfd, const char *name,
 				unsigned int flags, struct nameidata *nd)
 {
+	struct path_cache_rec pcr;
 	struct file *base = NULL;
 	struct path path;
 	int err;
@@ -1729,6 +1740,7 @@ static int path_lookupat(int dfd, const char *name,
 	 * be handled by restarting a traditional ref-walk (which will always
 	 * be able to complete).
 	 */
+	path_cache_begin(nd, &pcr, flags);
 	err = path_init(dfd, name, flags | LOOKUP_PARENT, nd, &base);
 
 	if (unlikely(err))
@@ -1767,6 +1779,7 @@ static int path_lookupat(int dfd, const char *name,
 		path_put(&nd->root);
 		nd->root.mnt = NULL;
 	}
+	path_cache_end(&pcr);
 	return err;
 }
 
@@ -2369,6 +2382,7 @@ exit:
 static struct file *path_openat(int dfd, const char *pathname,
 		struct nameidata *nd, const struct open_flags *op, int flags)
 {
+	struct path_cache_rec pcr;
 	struct file *base = NULL;
 	struct file *filp;
 	struct path path;
@@ -2383,6 +2397,7 @@ static struct file *path_openat(int dfd, const char *pathname,
 	nd->intent.open.flags = open_to_namei_flags(op->open_flag);
 	nd->intent.open.create_mode = op->mode;
 
+	path_cache_begin(nd, &pcr, flags);
 	error = path_init(dfd, pathname, flags | LOOKUP_PARENT, nd, &base);
 	if (unlikely(error))
 		goto out_filp;
@@ -2417,6 +2432,7 @@ out:
 	if (base)
 		fput(base);
 	release_open_intent(nd);
+	path_cache_end(&pcr);
 	return filp;
 
 out_filp:
@@ -594,6 +594,7 @@ static void detach_mnt(struct mount *mnt, struct path *old_path)
 	list_del_init(&mnt->mnt_child);
 	list_del_init(&mnt->mnt_hash);
 	dentry_reset_mounted(old_path->dentry);
+	path_cache_mounts_changed();
 }
 
 /*
@@ -608,6 +609,7 @@ void mnt_set_mountpoint(struct mount *mnt, struct dentry *dentry,
 	spin_lock(&dentry->d_lock);
 	dentry->d_flags |= DCACHE_MOUNTED;
 	spin_unlock(&dentry->d_lock);
+	path_cache_mounts_changed();
 }
 
 /*
@@ -660,6 +662,7 @@ static void commit_tree(struct mount *mnt)
 				hash(&parent->mnt, mnt->mnt_mountpoint));
 	list_add_tail(&mnt->mnt_child, &parent->mnt_mounts);
 	touch_mnt_namespace(n);
+	path_cache_mounts_changed();
 }
 
 static struct mount *next_mnt(struct mount *p, struct mount *root)
@@ -1084,6 +1087,7 @@ void umount_tree(struct mount *mnt, int propagate, struct list_head *kill)
 		change_mnt_propagation(p, MS_PRIVATE);
 	}
 	list_splice(&tmp_list, kill);
+	path_cache_mounts_changed();
 }
 
 static void shrink_submounts(struct mount *mnt, struct list_head *umounts);
@@ -234,18 +234,16 @@ out:
 	return ret;
 }
 
-/**
- * fsnotify_unmount_inodes - an sb is unmounting.  handle any watched inodes.
- * @list: list of inodes being unmounted (sb->s_inodes)
- *
- * Called during unmount with no locks held, so needs to be safe against
- * concurrent modifiers. We temporarily drop inode_sb_list_lock and CAN block.
+/*
+ * Handle the watched inodes on one per-cpu slice of an unmounting sb's
+ * inode list.  We temporarily drop the slice lock and CAN block.
  */
-void fsnotify_unmount_inodes(struct list_head *list)
+static void fsnotify_unmount_inode_list(struct sb_inode_list *l)
 {
+	struct list_head *list = &l->list;
 	struct inode *inode, *next_i, *need_iput = NULL;
 
-	spin_lock(&inode_sb_list_lock);
+	spin_lock(&l->lock);
 	list_for_each_entry_safe(inode, next_i, list, i_sb_list) {
 		struct inode *need_iput_tmp;
 
@@ -293,11 +291,11 @@ void fsnotify_unmount_inodes(struct list_head *list)
 		}
 
 		/*
-		 * We can safely drop inode_sb_list_lock here because we hold
+		 * We can safely drop the slice lock here because we hold
 		 * references on both inode and next_i.  Also no new inodes
 		 * will be added since the umount has begun.
 		 */
-		spin_unlock(&inode_sb_list_lock);
+		spin_unlock(&l->lock);
 
 		if (need_iput_tmp)
 			iput(need_iput_tmp);
@@ -309,7 +307,22 @@ void fsnotify_unmount_inodes(struct list_head *list)
 
 		iput(inode);
 
-		spin_lock(&inode_sb_list_lock);
+		spin_lock(&l->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
+	spin_unlock(&l->lock);
+}
+
+/**
+ * fsnotify_unmount_inodes - an sb is unmounting.  handle any watched inodes.
+ * @sb: superblock being unmounted
+ *
+ * Called during unmount with no locks held, so needs to be safe against
+ * concurrent modifiers.
+ */
+void fsnotify_unmount_inodes(struct super_block *sb)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		fsnotify_unmount_inode_list(sb_inode_list(sb, cpu));
 }
@@ -0,0 +1,512 @@
+/*
+ * fs/path_cache.c
+ *
+ * Cache of resolved pathname prefixes for rcu-walk.
+ *
+ * link_path_walk() looks every component of a pathname up in the dcache
+ * hash, so a deep name costs one hash lookup per directory on every open
+ * or stat.  This cache remembers where the directory part of a name
+ * resolved to, keyed by the starting point of the walk and the prefix
+ * string, so that a later walk of a name sharing that prefix can go
+ * straight to its last component.  Prefixes that failed with -ENOENT or
+ * -ENOTDIR are remembered the same way.
+ *
+ * An entry holds a reference to the dentry the prefix ended on and the
+ * d_seq of every dentry crossed on the way.  A hit is only trusted if,
+ * going back up from that dentry through d_parent and the mount tree,
+ * every dentry is still the one the walk saw, with an unchanged d_seq, no
+ * mount has been attached or detached since, and the caller may still
+ * search every directory crossed.  Anything else falls back to the normal
+ * walk, which refills the entry.  A pinned dentry is marked
+ * DCACHE_PATH_CACHED, and __d_drop() gives the reference back so that
+ * an unlinked or invalidated directory is not kept around by the cache.
+ *
+ * The walk is recorded in a per-cpu buffer rather than on the stack of
+ * path_lookupat(); recording only happens in rcu-walk, which runs with
+ * preemption disabled, and the entry is installed before leaving it.
+ *
+ * Walks through "..", symlinks or dentries that need revalidation or
+ * automounting are never cached.
+ */
+
+#include <linux/fs.h>
+#include <linux/namei.h>
+#include <linux/mount.h>
+#include <linux/dcache.h>
+#include <linux/hash.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/vmalloc.h>
+#include <linux/sysctl.h>
+#include <linux/init.h>
+#include "mount.h"
+#include "internal.h"
+
+#define PATH_CACHE_BITS		10
+#define PATH_CACHE_SIZE		(1 << PATH_CACHE_BITS)
+
+#define DCACHE_PATH_UNCACHED	(DCACHE_OP_REVALIDATE | \
+				 DCACHE_NEED_AUTOMOUNT | \
+				 DCACHE_MANAGE_TRANSIT)
+
+enum { PC_DONE, PC_RECORDING };
+
+struct path_cache_step {
+	struct vfsmount		*mnt;
+	struct dentry		*dentry;
+	unsigned		seq;
+};
+
+struct path_cache_entry {
+	seqcount_t		seq;
+	spinlock_t		lock;
+	struct dentry		*dentry;	/* pinned, NULL if unused */
+	struct vfsmount		*start_mnt;
+	struct dentry		*start;
+	unsigned int		hash;
+	unsigned int		len;
+	unsigned int		mount_gen;
+	unsigned int		depth;
+	int			error;
+	unsigned int		flags;
+	struct path_cache_step	steps[PATH_CACHE_DEPTH];
+	char			name[PATH_CACHE_NAME_LEN];
+};
+
+/*
+ * What the current rcu-walk on this cpu has seen of its pathname prefix.
+ */
+struct path_cache_walk {
+	const char		*name;
+	unsigned int		len;
+	unsigned int		hash;
+	struct vfsmount		*start_mnt;
+	struct dentry		*start;
+	unsigned int		mount_gen;
+	unsigned int		depth;
+	struct path_cache_step	steps[PATH_CACHE_DEPTH];
+};
+
+static DEFINE_PER_CPU(struct path_cache_walk, path_cache_walk);
+
+static struct path_cache_entry *path_cache_table __read_mostly;
+
+/* Dentries taken out of the cache that still have to be dput() */
+static atomic_t path_cache_deferred = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(path_cache_wait);
+
+int sysctl_path_cache __read_mostly;
+
+/* Bumped under the vfsmount lock whenever the mount tree changes. */
+unsigned int path_cache_mount_gen;
+
+enum { PC_STAT_HIT, PC_STAT_MISS, PC_STAT_STALE, PC_STAT_FILL };
+
+static DEFINE_PER_CPU(unsigned long [4], path_cache_counts);
+
+unsigned long path_cache_stat[4];
+
+static inline struct path_cache_entry *path_cache_bucket(struct dentry *start,
+							 unsigned int hash)
+{
+	hash += (unsigned long)start / L1_CACHE_BYTES;
+	return path_cache_table + hash_32(hash, PATH_CACHE_BITS);
+}
+
+/*
+ * Length of everything up to the last component of @name, trailing
+ * slashes of the directory part included.
+ */
+static unsigned int path_cache_prefix_len(const char *name)
+{
+	const char *end = name + strlen(name);
+
+	while (end > name && end[-1] == '/')
+		end--;
+	while (end > name && end[-1] != '/')
+		end--;
+	return end - name;
+}
+
+void path_cache_begin(struct nameidata *nd, struct path_cache_rec *rec,
+		      unsigned int flags)
+{
+	rec->state = PC_DONE;
+	rec->old = NULL;
+	nd->pc = NULL;
+	if ((flags & LOOKUP_RCU) && sysctl_path_cache && path_cache_table)
+		nd->pc = rec;
+}
+
+/*
+ * Check the chain recorded in @e against the dcache as it is now, from
+ * @dentry, which the entry pins, back up to the start of the walk.  Only
+ * pointers found by following d_parent and the mount tree from @dentry are
+ * dereferenced, so a concurrently rewritten entry can make us fail but
+ * never makes us look at freed memory.
+ */
+static bool path_cache_chain_valid(struct path_cache_entry *e,
+				   struct vfsmount *mnt, struct dentry *dentry,
+				   unsigned int depth, struct inode **last)
+{
+	int i;
+
+	for (i = depth - 1; i >= 0; i--) {
+		struct path_cache_step *step = &e->steps[i];
+		struct vfsmount *pmnt = i ? e->steps[i - 1].mnt : e->start_mnt;
+		struct dentry *parent = i ? e->steps[i - 1].dentry : e->start;
+		struct inode *inode;
+
+		if (step->mnt != mnt || step->dentry != dentry)
+			return false;
+		inode = ACCESS_ONCE(dentry->d_inode);
+
+		if (dentry != parent || mnt != pmnt) {
+			struct mount *m = real_mount(mnt);
+			struct dentry *d = dentry;
+
+			while (d == m->mnt.mnt_root && mnt_has_parent(m)) {
+				d = m->mnt_mountpoint;
+				m = m->mnt_parent;
+			}
+			if (&m->mnt != pmnt || ACCESS_ONCE(d->d_parent) != parent)
+				return false;
+		}
+		if (read_seqcount_retry(&dentry->d_seq, step->seq))
+			return false;
+
+		if (i == depth - 1)
+			*last = inode;
+		else if (!inode ||
+			 inode_permission(inode, MAY_EXEC|MAY_NOT_BLOCK))
+			return false;
+
+		mnt = pmnt;
+		dentry = parent;
+	}
+	return true;
+}
+
+/*
+ * Called by link_path_walk() in rcu-walk mode before it looks at the first
+ * component.  On a hit @nd is moved to the directory the prefix of *@name
+ * resolved to and *@name to the last component, and 1 is returned; if the
+ * prefix is known to fail the error is returned.  Otherwise 0 is returned
+ * and the walk is recorded so that path_cache_end() can fill the entry.
+ */
+int path_cache_lookup(struct nameidata *nd, const char **name)
+{
+	struct path_cache_rec *rec = nd->pc;
+	struct path_cache_walk *w;
+	struct path_cache_entry *e;
+	struct vfsmount *mnt;
+	struct dentry *dentry;
+	struct inode *inode = NULL;
+	unsigned int len, depth, seq, dseq, flags;
+	int error;
+
+	if (!rec || rec->state != PC_DONE || rec->old ||
+	    !(nd->flags & LOOKUP_RCU))
+		return 0;
+	nd->pc = NULL;
+
+	len = path_cache_prefix_len(*name);
+	if (!len || len > PATH_CACHE_NAME_LEN)
+		return 0;
+
+	w = this_cpu_ptr(&path_cache_walk);
+	w->name = *name;
+	w->len = len;
+	w->hash = full_name_hash((const unsigned char *)*name, len);
+	w->start_mnt = nd->path.mnt;
+	w->start = nd->path.dentry;
+	w->mount_gen = path_cache_mount_gen;
+	w->depth = 0;
+
+	e = path_cache_bucket(w->start, w->hash);
+	seq = read_seqcount_begin(&e->seq);
+	depth = e->depth;
+	if (!depth || e->start != w->start || e->start_mnt != w->start_mnt ||
+	    e->hash != w->hash || e->len != len ||
+	    memcmp(e->name, *name, len))
+		goto miss;
+	if (e->mount_gen != w->mount_gen || depth > PATH_CACHE_DEPTH)
+		goto stale;
+	mnt = e->steps[depth - 1].mnt;
+	dentry = e->steps[depth - 1].dentry;
+	dseq = e->steps[depth - 1].seq;
+	error = e->error;
+	flags = e->flags;
+	if (read_seqcount_retry(&e->seq, seq))
+		goto miss;
+
+	if (!path_cache_chain_valid(e, mnt, dentry, depth, &inode) ||
+	    inode_permission(nd->inode, MAY_EXEC|MAY_NOT_BLOCK) ||
+	    read_seqcount_retry(&e->seq, seq))
+		goto stale;
+
+	this_cpu_inc(path_cache_counts[PC_STAT_HIT]);
+	nd->path.mnt = mnt;
+	nd->path.dentry = dentry;
+	if (error)
+		return error;
+	nd->inode = inode;
+	nd->seq = dseq;
+	nd->flags = (nd->flags & ~LOOKUP_JUMPED) | flags;
+	*name += len;
+	return 1;
+
+stale:
+	this_cpu_inc(path_cache_counts[PC_STAT_STALE]);
+	goto record;
+miss:
+	this_cpu_inc(path_cache_counts[PC_STAT_MISS]);
+record:
+	rec->state = PC_RECORDING;
+	nd->pc = rec;
+	return 0;
+}
+
+/*
+ * Called after each component of the prefix has been walked.
+ */
+void path_cache_step(struct nameidata *nd, int type)
+{
+	struct path_cache_rec *rec = nd->pc;
+	struct path_cache_walk *w;
+	struct path_cache_step *step;
+
+	if (!rec || rec->state != PC_RECORDING)
+		return;
+	if (!(nd->flags & LOOKUP_RCU) || type == LAST_DOTDOT) {
+		rec->state = PC_DONE;
+		return;
+	}
+	w = this_cpu_ptr(&path_cache_walk);
+	if (w->depth == PATH_CACHE_DEPTH ||
+	    (nd->path.dentry->d_flags & DCACHE_PATH_UNCACHED)) {
+		rec->state = PC_DONE;
+		return;
+	}
+	step = &w->steps[w->depth++];
+	step->mnt = nd->path.mnt;
+	step->dentry = nd->path.dentry;
+	step->seq = nd->seq;
+}
+
+/*
+ * A component of the prefix turned out to be negative.
+ */
+void path_cache_negative(struct nameidata *nd)
+{
+	path_cache_step(nd, LAST_NORM);
+	path_cache_complete(nd, -ENOENT);
+}
+
+static void path_cache_put_deferred(void)
+{
+	if (atomic_dec_and_test(&path_cache_deferred))
+		wake_up_all(&path_cache_wait);
+}
+
+/*
+ * Give back the reference an entry held on @dentry.  If that cannot be
+ * done without blocking it is left for path_cache_end() in *@old.
+ */
+static void path_cache_put(struct dentry *dentry, struct dentry **old)
+{
+	bool done;
+
+	spin_lock(&dentry->d_lock);
+	done = __dput_nonblock(dentry);
+	spin_unlock(&dentry->d_lock);
+	if (done)
+		path_cache_put_deferred();
+	else
+		*old = dentry;
+}
+
+/*
+ * The walk has reached the last component, or failed on the prefix with
+ * @error.  Pin the dentry it ended on and install the entry while rcu-walk
+ * still guarantees that it is the one recorded.
+ */
+void path_cache_complete(struct nameidata *nd, int error)
+{
+	struct path_cache_rec *rec = nd->pc;
+	struct dentry *dentry = nd->path.dentry;
+	struct path_cache_walk *w;
+	struct path_cache_entry *e;
+	struct dentry *old;
+
+	if (!rec || rec->state != PC_RECORDING)
+		return;
+	rec->state = PC_DONE;
+	if (!(nd->flags & LOOKUP_RCU))
+		return;
+	w = this_cpu_ptr(&path_cache_walk);
+	if (!w->depth)
+		return;
+
+	spin_lock(&dentry->d_lock);
+	if (read_seqcount_retry(&dentry->d_seq, nd->seq)) {
+		spin_unlock(&dentry->d_lock);
+		return;
+	}
+	dentry->d_count++;
+	dentry->d_flags |= DCACHE_PATH_CACHED;
+
+	e = path_cache_bucket(w->start, w->hash);
+	spin_lock(&e->lock);
+	write_seqcount_begin(&e->seq);
+	old = e->dentry;
+	e->dentry = dentry;
+	e->start_mnt = w->start_mnt;
+	e->start = w->start;
+	e->hash = w->hash;
+	e->len = w->len;
+	e->mount_gen = w->mount_gen;
+	e->depth = w->depth;
+	e->error = error;
+	e->flags = nd->flags & LOOKUP_JUMPED;
+	memcpy(e->steps, w->steps, w->depth * sizeof(*w->steps));
+	memcpy(e->name, w->name, w->len);
+	write_seqcount_end(&e->seq);
+	/* counted before unlocking so that path_cache_shrink_sb() waits */
+	if (old && old != dentry)
+		atomic_inc(&path_cache_deferred);
+	spin_unlock(&e->lock);
+	if (old == dentry)
+		dentry->d_count--;
+	spin_unlock(&dentry->d_lock);
+
+	this_cpu_inc(path_cache_counts[PC_STAT_FILL]);
+	if (old && old != dentry)
+		path_cache_put(old, &rec->old);
+}
+
+/*
+ * Called once the walk is over and we may sleep again.
+ */
+void path_cache_end(struct path_cache_rec *rec)
+{
+	if (rec->old) {
+		dput(rec->old);
+		rec->old = NULL;
+		path_cache_put_deferred();
+	}
+}
+
+/*
+ * @dentry is being unhashed: give back the references the cache holds on
+ * it, unless one is the last one left, which is then dropped when the
+ * entry is refilled or pruned.  Called with @dentry->d_lock held.
+ */
+void path_cache_forget(struct dentry *dentry)
+{
+	bool left = false;
+	int i;
+
+	for (i = 0; i < PATH_CACHE_SIZE; i++) {
+		struct path_cache_entry *e = &path_cache_table[i];
+
+		if (ACCESS_ONCE(e->dentry) != dentry)
+			continue;
+		spin_lock(&e->lock);
+		if (e->dentry == dentry) {
+			if (dentry->d_count > 1) {
+				write_seqcount_begin(&e->seq);
+				e->dentry = NULL;
+				e->depth = 0;
+				write_seqcount_end(&e->seq);
+				dentry->d_count--;
+			} else {
+				left = true;
+			}
+		}
+		spin_unlock(&e->lock);
+	}
+	if (!left)
+		dentry->d_flags &= ~DCACHE_PATH_CACHED;
+}
+
+/*
+ * Drop the entries pinning dentries of @sb, or all entries if @sb is NULL.
+ */
+static void path_cache_prune(struct super_block *sb)
+{
+	int i;
+
+	if (!path_cache_table)
+		return;
+
+	for (i = 0; i < PATH_CACHE_SIZE; i++) {
+		struct path_cache_entry *e = &path_cache_table[i];
+		struct dentry *dentry = NULL;
+
+		spin_lock(&e->lock);
+		if (e->dentry && (!sb || e->dentry->d_sb == sb)) {
+			dentry = e->dentry;
+			write_seqcount_begin(&e->seq);
+			e->dentry = NULL;
+			e->depth = 0;
+			write_seqcount_end(&e->seq);
+		}
+		spin_unlock(&e->lock);
+		dput(dentry);
+	}
+}
+
+/*
+ * Called before a superblock is shut down, which wants all of its
+ * dentries unused.  A walker may have just taken one out of the cache
+ * and not yet dropped it, so wait for those as well.
+ */
+void path_cache_shrink_sb(struct super_block *sb)
+{
+	path_cache_prune(sb);
+	wait_event(path_cache_wait, !atomic_read(&path_cache_deferred));
+}
+
+int proc_path_cache(struct ctl_table *table, int write,
+		    void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+	if (!ret && write && !sysctl_path_cache)
+		path_cache_prune(NULL);
+	return ret;
+}
+
+int proc_path_cache_state(struct ctl_table *table, int write,
+			  void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int cpu, i;
+
+	for (i = 0; i < ARRAY_SIZE(path_cache_stat); i++) {
+		unsigned long sum = 0;
+
+		for_each_possible_cpu(cpu)
+			sum += per_cpu(path_cache_counts, cpu)[i];
+		path_cache_stat[i] = sum;
+	}
+	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
+}
+
+static int __init path_cache_init(void)
+{
+	int i;
+
+	path_cache_table = vzalloc(PATH_CACHE_SIZE * sizeof(*path_cache_table));
+	if (!path_cache_table) {
+		pr_warning("path_cache: unable to allocate table\n");
+		return -ENOMEM;
+	}
+	for (i = 0; i < PATH_CACHE_SIZE; i++) {
+		seqcount_init(&path_cache_table[i].seq);
+		spin_lock_init(&path_cache_table[i].lock);
+	}
+	return 0;
+}
+fs_initcall(path_cache_init);
@@ -2147,14 +2147,19 @@ static void yaffs_flush_inodes(struct super_block *sb)
 {
 	struct inode *iptr;
 	struct yaffs_obj *obj;
-
-	list_for_each_entry(iptr, &sb->s_inodes, i_sb_list) {
-		obj = yaffs_inode_to_obj(iptr);
-		if (obj) {
-			yaffs_trace(YAFFS_TRACE_OS,
-				"flushing obj %d",
-				obj->obj_id);
-			yaffs_flush_file(obj, 1, 0);
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct sb_inode_list *l = sb_inode_list(sb, cpu);
+
+		list_for_each_entry(iptr, &l->list, i_sb_list) {
+			obj = yaffs_inode_to_obj(iptr);
+			if (obj) {
+				yaffs_trace(YAFFS_TRACE_OS,
+					"flushing obj %d",
+					obj->obj_id);
+				yaffs_flush_file(obj, 1, 0);
+			}
 		}
 	}
 }
@@ -3,6 +3,7 @@
 
 #include <linux/list.h>
 #include <linux/workqueue.h>
+#include <linux/wait.h>
 #include <linux/aio_abi.h>
 #include <linux/uio.h>
 #include <linux/rcupdate.h>
@@ -77,12 +78,13 @@ struct kioctx;
  *
  * If ki_retry returns -EIOCBRETRY it has made a promise that kick_iocb()
  * will be called on the kiocb pointer in the future.  This may happen
- * through generic helpers that associate kiocb->ki_wait with a wait
- * queue head that ki_retry uses via current->io_wait.  It can also happen
- * with custom tracking and manual calls to kick_iocb(), though that is
- * discouraged.  In either case, kick_iocb() must be called once and only
- * once.  ki_retry must ensure forward progress, the AIO core will wait
- * indefinitely for kick_iocb() to be called.
+ * through generic helpers that hook kiocb->ki_wait onto a wait queue,
+ * as buffered reads do with the page lock when the data is not yet in
+ * the page cache.  It can also happen with custom tracking and manual
+ * calls to kick_iocb(), though that is discouraged.  In either case,
+ * kick_iocb() must be called once and only once.  ki_retry must ensure
+ * forward progress, the AIO core will wait indefinitely for kick_iocb()
+ * to be called.
  */
 struct kiocb {
 	struct list_head	ki_run_list;
@@ -119,6 +121,12 @@ struct kiocb {
 						 * for cancellation */
 	struct list_head	ki_batch;	/* batch allocation */
 
+	/*
+	 * Wait queue entry for a retry that is waiting on a page bit;
+	 * its wake function kicks the iocb.
+	 */
+	struct wait_bit_queue	ki_wait;
+
 	/*
 	 * If the aio_resfd field of the userspace iocb is not zero,
 	 * this is the underlying eventfd context to deliver events to.
@@ -814,6 +814,7 @@ struct inode {
 	struct list_head	i_wb_list;	/* backing dev IO list */
 	struct list_head	i_lru;		/* inode LRU list */
 	struct list_head	i_sb_list;
+	struct sb_inode_list	*i_sb_list_head;	/* slice i_sb_list is on */
 	union {
 		struct list_head	i_dentry;
 		struct rcu_head		i_rcu;
@@ -1415,6 +1416,20 @@ extern int send_sigurg(struct fown_struct *fown);
 extern struct list_head super_blocks;
 extern spinlock_t sb_lock;
 
+/*
+ * A superblock's inode list is split per cpu: an inode is added to the
+ * slice of the cpu that instantiated it and removed from the slice it
+ * recorded in ->i_sb_list_head, so creating and evicting inodes only
+ * contends on one slice's lock.  Code that walks every inode of a
+ * superblock (sync, drop_caches, quota, umount) goes over all slices.
+ */
+struct sb_inode_list {
+	spinlock_t		lock;
+	struct list_head	list;
+};
+
+#define sb_inode_list(sb, cpu)	per_cpu_ptr((sb)->s_inodes, (cpu))
+
 struct super_block {
 	struct list_head	s_list;		/* Keep this first */
 	dev_t			s_dev;		/* search index; _not_ kdev_t */
@@ -1439,7 +1454,7 @@ struct super_block {
 #endif
 	const struct xattr_handler **s_xattr;
 
-	struct list_head	s_inodes;	/* all inodes */
+	struct sb_inode_list __percpu *s_inodes;	/* all inodes */
 	struct hlist_bl_head	s_anon;		/* anonymous dentries for (nfs) exporting */
 #ifdef CONFIG_SMP
 	struct list_head __percpu *s_files;
@@ -2652,6 +2667,14 @@ int proc_nr_dentry(struct ctl_table *table, int write,
 		  void __user *buffer, size_t *lenp, loff_t *ppos);
 int proc_nr_inodes(struct ctl_table *table, int write,
 		   void __user *buffer, size_t *lenp, loff_t *ppos);
+#ifdef CONFIG_PATH_LOOKUP_CACHE
+extern int sysctl_path_cache;
+extern unsigned long path_cache_stat[4];
+int proc_path_cache(struct ctl_table *table, int write,
+		    void __user *buffer, size_t *lenp, loff_t *ppos);
+int proc_path_cache_state(struct ctl_table *table, int write,
+			  void __user *buffer, size_t *lenp, loff_t *ppos);
+#endif
 int __init get_filesystem_list(char *buf);
 
 #define __FMODE_EXEC		((__force int) FMODE_EXEC)
@@ -0,0 +1,34 @@
+#ifndef __LINUX_LOCKREF_H
+#define __LINUX_LOCKREF_H
+
+/*
+ * Locked reference counts.
+ *
+ * A lockref is a spinlock and a reference count that live in the same
+ * 64-bit word.  The count is protected by the lock, but where the
+ * architecture allows it the common get/put operations update the count
+ * with a single cmpxchg on the whole word, provided the lock is seen
+ * unlocked.  Such an update is therefore atomic with respect to anybody
+ * holding the lock, and code that does take the lock can keep treating
+ * the count as stable while it holds it.
+ */
+
+#include <linux/spinlock.h>
+
+struct lockref {
+	union {
+#ifdef CONFIG_CMPXCHG_LOCKREF
+		aligned_u64 lock_count;
+#endif
+		struct {
+			spinlock_t lock;
+			int count;
+		};
+	};
+};
+
+extern void lockref_get(struct lockref *);
+extern int lockref_get_not_zero(struct lockref *);
+extern int lockref_put_or_lock(struct lockref *);
+
+#endif /* __LINUX_LOCKREF_H */
@@ -6,6 +6,7 @@
 #include <linux/path.h>
 
 struct vfsmount;
+struct path_cache_rec;
 
 struct open_intent {
 	int	flags;
@@ -25,6 +26,9 @@ struct nameidata {
 	int		last_type;
 	unsigned	depth;
 	char *saved_names[MAX_NESTED_LINKS + 1];
+#ifdef CONFIG_PATH_LOOKUP_CACHE
+	struct path_cache_rec *pc;
+#endif
 
 	/* Intent data */
 	union {
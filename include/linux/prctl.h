@@ -124,4 +124,14 @@
 #define PR_SET_CHILD_SUBREAPER 36
 #define PR_GET_CHILD_SUBREAPER 37
 
+/*
+ * Control the futex hash of the calling process.  SET_SLOTS switches
+ * private futexes to a per-process hash with the given number of
+ * buckets (a power of two, 0 to go back to the global hash) and is
+ * only allowed while the process is single threaded.
+ */
+#define PR_FUTEX_HASH		78
+# define PR_FUTEX_HASH_SET_SLOTS	1
+# define PR_FUTEX_HASH_GET_SLOTS	2
+
 #endif /* _LINUX_PRCTL_H */
@@ -0,0 +1,121 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM wbt
+
+#if !defined(_TRACE_WBT_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_WBT_H
+
+#include <linux/tracepoint.h>
+#include <linux/backing-dev.h>
+
+#define wbt_bdi_name(bdi)						\
+	dev_name((bdi)->dev ? (bdi)->dev : default_backing_dev_info.dev)
+
+/**
+ * wbt_stat - statistics of a writeback throttling window
+ * @bdi: device the window was sampled on
+ * @min_lat: lowest read completion latency in the window, in nsec
+ * @reads: number of reads completed in the window
+ * @writes: number of throttled writes completed in the window
+ * @inflight: throttled writes currently allocated
+ */
+TRACE_EVENT(wbt_stat,
+
+	TP_PROTO(struct backing_dev_info *bdi, u64 min_lat,
+		 unsigned int reads, unsigned int writes,
+		 unsigned int inflight),
+
+	TP_ARGS(bdi, min_lat, reads, writes, inflight),
+
+	TP_STRUCT__entry(
+		__array(char, name, 32)
+		__field(u64, min_lat)
+		__field(unsigned int, reads)
+		__field(unsigned int, writes)
+		__field(unsigned int, inflight)
+	),
+
+	TP_fast_assign(
+		strncpy(__entry->name, wbt_bdi_name(bdi), 32);
+		__entry->min_lat	= min_lat;
+		__entry->reads		= reads;
+		__entry->writes		= writes;
+		__entry->inflight	= inflight;
+	),
+
+	TP_printk("bdi %s: min_lat=%llu reads=%u writes=%u inflight=%u",
+		  __entry->name, (unsigned long long)__entry->min_lat,
+		  __entry->reads, __entry->writes, __entry->inflight)
+);
+
+/**
+ * wbt_step - writeback throttling limits changed
+ * @bdi: device the limits apply to
+ * @msg: why they changed
+ * @step: scale step, 0 being the full queue depth
+ * @bg: limit while reads are going on
+ * @normal: limit for other writeback
+ * @max: limit for kswapd
+ */
+TRACE_EVENT(wbt_step,
+
+	TP_PROTO(struct backing_dev_info *bdi, const char *msg, int step,
+		 unsigned int bg, unsigned int normal, unsigned int max),
+
+	TP_ARGS(bdi, msg, step, bg, normal, max),
+
+	TP_STRUCT__entry(
+		__array(char, name, 32)
+		__field(const char *, msg)
+		__field(int, step)
+		__field(unsigned int, bg)
+		__field(unsigned int, normal)
+		__field(unsigned int, max)
+	),
+
+	TP_fast_assign(
+		strncpy(__entry->name, wbt_bdi_name(bdi), 32);
+		__entry->msg	= msg;
+		__entry->step	= step;
+		__entry->bg	= bg;
+		__entry->normal	= normal;
+		__entry->max	= max;
+	),
+
+	TP_printk("bdi %s: %s: step=%d bg=%u normal=%u max=%u",
+		  __entry->name, __entry->msg, __entry->step,
+		  __entry->bg, __entry->normal, __entry->max)
+);
+
+/**
+ * wbt_sleep - a writer waits for a writeback slot
+ * @bdi: device the writer waits on
+ * @inflight: throttled writes currently allocated
+ * @limit: limit that applies to the writer
+ */
+TRACE_EVENT(wbt_sleep,
+
+	TP_PROTO(struct backing_dev_info *bdi, unsigned int inflight,
+		 unsigned int limit),
+
+	TP_ARGS(bdi, inflight, limit),
+
+	TP_STRUCT__entry(
+		__array(char, name, 32)
+		__field(unsigned int, inflight)
+		__field(unsigned int, limit)
+	),
+
+	TP_fast_assign(
+		strncpy(__entry->name, wbt_bdi_name(bdi), 32);
+		__entry->inflight	= inflight;
+		__entry->limit		= limit;
+	),
+
+	TP_printk("bdi %s: inflight=%u limit=%u",
+		  __entry->name, __entry->inflight, __entry->limit)
+);
+
+#endif /* _TRACE_WBT_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -60,6 +60,9 @@
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
 #include <linux/ptrace.h>
+#include <linux/bootmem.h>
+#include <linux/vmalloc.h>
+#include <linux/prctl.h>
 
 #include <asm/futex.h>
 
@@ -67,7 +70,10 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
+/*
+ * Per-process private futex hashes are limited to this many buckets.
+ */
+#define FUTEX_PRIVATE_HASH_MAX	(1 << 16)
 
 /*
  * Futex flags used to encode options to functions and preserve them across
@@ -142,23 +148,107 @@ static const struct futex_q futex_q_init = {
  * Hash buckets are shared by all the futex_keys that hash to the same
  * location.  Each key may have multiple futex_q structures, one for each task
  * waiting on a futex.
+ *
+ * @waiters counts the tasks queued on @chain plus those about to queue
+ * themselves, so that futex_wake() can return without taking @lock when
+ * there is nobody to wake.  The ordering this relies upon:
+ *
+ * CPU 0 (waiter)                        CPU 1 (waker)
+ *
+ * waiters++; (A)                        *futex = newval;
+ * smp_mb();                             sys_futex(WAKE, futex);
+ * lock(hash_bucket(futex));               smp_mb(); (B)
+ * uval = *futex;                          if (!waiters)
+ * if (uval == val)                          return;
+ *     queue();                            lock(hash_bucket(futex));
+ * unlock(hash_bucket(futex));             wake_waiters(futex);
+ * schedule();                             unlock(hash_bucket(futex));
+ *
+ * Barrier (A) orders the increment before the read of the futex value
+ * and (B) orders the userspace store before the read of @waiters.
+ * Either the waiter sees the new value and doesn't sleep, or the waker
+ * sees the waiter and takes the lock.  The count only drops once the
+ * futex_q is off the chain (__unqueue_futex()) or the waiter backs out
+ * (queue_unlock()).
  */
 struct futex_hash_bucket {
+	atomic_t waiters;
 	spinlock_t lock;
 	struct plist_head chain;
 };
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+/*
+ * The global hash, sized according to the number of possible CPUs at
+ * boot.  Both are set once in futex_init().
+ */
+static unsigned long __read_mostly futex_hashsize;
+static struct futex_hash_bucket __read_mostly *futex_queues;
+
+/*
+ * A process may switch its private futexes over to a hash of its own
+ * with prctl(PR_FUTEX_HASH) so that they don't share buckets with the
+ * rest of the system.  Hung off mm->futex_phash.
+ */
+struct futex_private_hash {
+	unsigned int		hashsize;
+	struct futex_hash_bucket queues[0];
+};
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
+ *
+ * Private keys always belong to current->mm.  mm->futex_phash is only
+ * changed while the mm has a single user, so no other task can be
+ * looking at it.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))) {
+		struct futex_private_hash *fph = key->private.mm->futex_phash;
+
+		if (fph)
+			return &fph->queues[hash & (fph->hashsize - 1)];
+	}
+	return &futex_queues[hash & (futex_hashsize - 1)];
+}
+
+static inline void hb_waiters_inc(struct futex_hash_bucket *hb)
+{
+#ifdef CONFIG_SMP
+	atomic_inc(&hb->waiters);
+	/*
+	 * Full barrier (A), see the ordering comment above.
+	 */
+	smp_mb__after_atomic_inc();
+#endif
+}
+
+/*
+ * Reflects a waiter being removed from the waitqueue by wakeup
+ * paths.
+ */
+static inline void hb_waiters_dec(struct futex_hash_bucket *hb)
+{
+#ifdef CONFIG_SMP
+	atomic_dec(&hb->waiters);
+#endif
+}
+
+static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
+{
+#ifdef CONFIG_SMP
+	/*
+	 * Full barrier (B), see the ordering comment above.
+	 */
+	smp_mb();
+	return atomic_read(&hb->waiters);
+#else
+	return 1;
+#endif
 }
 
 /*
@@ -830,6 +920,7 @@ static void __unqueue_futex(struct futex_q *q)
 
 	hb = container_of(q->lock_ptr, struct futex_hash_bucket, lock);
 	plist_del(&q->list, &hb->chain);
+	hb_waiters_dec(hb);
 }
 
 /*
@@ -987,6 +1078,11 @@ futex_wake(u32 __user *uaddr, unsigned int flags, int nr_wake, u32 bitset)
 		goto out;
 
 	hb = hash_futex(&key);
+
+	/* Make sure we really have tasks to wakeup */
+	if (!hb_waiters_pending(hb))
+		goto out_put_key;
+
 	spin_lock(&hb->lock);
 	head = &hb->chain;
 
@@ -1008,6 +1104,7 @@ futex_wake(u32 __user *uaddr, unsigned int flags, int nr_wake, u32 bitset)
 	}
 
 	spin_unlock(&hb->lock);
+out_put_key:
 	put_futex_key(&key);
 out:
 	return ret;
@@ -1122,7 +1219,9 @@ void requeue_futex(struct futex_q *q, struct futex_hash_bucket *hb1,
 	 */
 	if (likely(&hb1->chain != &hb2->chain)) {
 		plist_del(&q->list, &hb1->chain);
+		hb_waiters_dec(hb1);
 		plist_add(&q->list, &hb2->chain);
+		hb_waiters_inc(hb2);
 		q->lock_ptr = &hb2->lock;
 	}
 	get_futex_key_refs(key2);
@@ -1297,6 +1396,11 @@ retry:
 	hb2 = hash_futex(&key2);
 
 retry_private:
+	/*
+	 * Waiters may be moved onto hb2 below.  Account for them up front
+	 * so that a concurrent futex_wake() on uaddr2 doesn't skip hb2.
+	 */
+	hb_waiters_inc(hb2);
 	double_lock_hb(hb1, hb2);
 
 	if (likely(cmpval != NULL)) {
@@ -1306,6 +1410,7 @@ retry_private:
 
 		if (unlikely(ret)) {
 			double_unlock_hb(hb1, hb2);
+			hb_waiters_dec(hb2);
 
 			ret = get_user(curval, uaddr1);
 			if (ret)
@@ -1355,6 +1460,7 @@ retry_private:
 			break;
 		case -EFAULT:
 			double_unlock_hb(hb1, hb2);
+			hb_waiters_dec(hb2);
 			put_futex_key(&key2);
 			put_futex_key(&key1);
 			ret = fault_in_user_writeable(uaddr2);
@@ -1364,6 +1470,7 @@ retry_private:
 		case -EAGAIN:
 			/* The owner was exiting, try again. */
 			double_unlock_hb(hb1, hb2);
+			hb_waiters_dec(hb2);
 			put_futex_key(&key2);
 			put_futex_key(&key1);
 			cond_resched();
@@ -1436,6 +1543,7 @@ retry_private:
 
 out_unlock:
 	double_unlock_hb(hb1, hb2);
+	hb_waiters_dec(hb2);
 
 	/*
 	 * drop_futex_key_refs() must be called outside the spinlocks. During
@@ -1463,6 +1571,17 @@ static inline struct futex_hash_bucket *queue_lock(struct futex_q *q)
 	struct futex_hash_bucket *hb;
 
 	hb = hash_futex(&q->key);
+
+	/*
+	 * Increment the counter before taking the lock so that
+	 * a potential waker won't miss a to-be-slept task that is
+	 * waiting for the spinlock.  This is safe as all queue_lock()
+	 * users end up calling queue_me().  Similarly, for housekeeping,
+	 * decrement the counter at queue_unlock() when some error has
+	 * occurred and we don't end up adding the task to the list.
+	 */
+	hb_waiters_inc(hb);
+
 	q->lock_ptr = &hb->lock;
 
 	spin_lock(&hb->lock);
@@ -1474,6 +1593,7 @@ queue_unlock(struct futex_q *q, struct futex_hash_bucket *hb)
 	__releases(&hb->lock)
 {
 	spin_unlock(&hb->lock);
+	hb_waiters_dec(hb);
 }
 
 /**
@@ -2208,6 +2328,7 @@ int handle_early_requeue_pi_wakeup(struct futex_hash_bucket *hb,
 		 * Unqueue the futex_q and determine which it was.
 		 */
 		plist_del(&q->list, &hb->chain);
+		hb_waiters_dec(hb);
 
 		/* Handle spurious wakeups gracefully */
 		ret = -EWOULDBLOCK;
@@ -2707,10 +2828,102 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 	return do_futex(uaddr, op, val, tp, uaddr2, val2, val3);
 }
 
+static void futex_hash_init(struct futex_hash_bucket *queues,
+			    unsigned long size)
+{
+	unsigned long i;
+
+	for (i = 0; i < size; i++) {
+		atomic_set(&queues[i].waiters, 0);
+		plist_head_init(&queues[i].chain);
+		spin_lock_init(&queues[i].lock);
+	}
+}
+
+static void futex_private_hash_release(struct futex_private_hash *fph)
+{
+	if (is_vmalloc_addr(fph))
+		vfree(fph);
+	else
+		kfree(fph);
+}
+
+/**
+ * futex_hash_free() - Release the private futex hash of an mm
+ * @mm:		the mm going away
+ *
+ * Called from mmput() once the last user of @mm is gone.
+ */
+void futex_hash_free(struct mm_struct *mm)
+{
+	futex_private_hash_release(mm->futex_phash);
+	mm->futex_phash = NULL;
+}
+
+static int futex_hash_set_slots(unsigned int slots)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_private_hash *fph = NULL;
+
+	if (slots && (slots < 2 || slots > FUTEX_PRIVATE_HASH_MAX ||
+		      !is_power_of_2(slots)))
+		return -EINVAL;
+
+	/*
+	 * Waiters queued on the old hash would be lost.  As long as the
+	 * caller is the only user of the mm, nobody can be waiting on a
+	 * private futex of it.
+	 */
+	if (atomic_read(&mm->mm_users) != 1)
+		return -EBUSY;
+
+	if (slots) {
+		size_t size = sizeof(*fph) + slots * sizeof(fph->queues[0]);
+
+		if (size <= PAGE_SIZE)
+			fph = kzalloc(size, GFP_KERNEL);
+		else
+			fph = vzalloc(size);
+		if (!fph)
+			return -ENOMEM;
+
+		fph->hashsize = slots;
+		futex_hash_init(fph->queues, slots);
+	}
+
+	futex_private_hash_release(mm->futex_phash);
+	mm->futex_phash = fph;
+	return 0;
+}
+
+/**
+ * futex_hash_prctl() - prctl(PR_FUTEX_HASH) backend
+ * @arg2:	PR_FUTEX_HASH_SET_SLOTS or PR_FUTEX_HASH_GET_SLOTS
+ * @arg3:	number of buckets for PR_FUTEX_HASH_SET_SLOTS
+ *
+ * Returns the number of buckets of the private hash (0 when the global
+ * hash is in use) for GET_SLOTS, 0 or -errno for SET_SLOTS.
+ */
+int futex_hash_prctl(unsigned long arg2, unsigned long arg3)
+{
+	struct futex_private_hash *fph;
+
+	switch (arg2) {
+	case PR_FUTEX_HASH_SET_SLOTS:
+		if (arg3 > FUTEX_PRIVATE_HASH_MAX)
+			return -EINVAL;
+		return futex_hash_set_slots(arg3);
+	case PR_FUTEX_HASH_GET_SLOTS:
+		fph = current->mm->futex_phash;
+		return fph ? fph->hashsize : 0;
+	}
+	return -EINVAL;
+}
+
 static int __init futex_init(void)
 {
+	unsigned int futex_shift;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2725,10 +2938,22 @@ static int __init futex_init(void)
 	if (cmpxchg_futex_value_locked(&curval, NULL, 0, 0) == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+	/*
+	 * Size the global hash so that the buckets per CPU stay constant
+	 * instead of having every process contend on 256 buckets.
+	 */
+#if CONFIG_BASE_SMALL
+	futex_hashsize = 16;
+#else
+	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+#endif
+
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       futex_hashsize, 0, 0,
+					       &futex_shift, NULL,
+					       futex_hashsize);
+	futex_hashsize = 1UL << futex_shift;
+	futex_hash_init(futex_queues, futex_hashsize);
 
 	return 0;
 }
@@ -0,0 +1,279 @@
+/*
+ *  kernel/sched/cpudeadline.c
+ *
+ *  Global CPU deadline management
+ *
+ *  This code tracks the earliest deadline queued on each CPU so that the
+ *  -deadline push/pull logic can quickly find a CPU whose current task
+ *  would be preempted by a given task. It plays the same role for
+ *  SCHED_DEADLINE as cpupri.c does for the RT classes, but since
+ *  deadlines are not drawn from a small fixed set of values, a bitmap
+ *  per priority level is replaced by a max-heap keyed on deadline:
+ *
+ *   - CPUs with no -deadline task at all are kept in a separate mask
+ *     (free_cpus) and are always preferred;
+ *   - otherwise the root of the heap is the CPU running the latest
+ *     deadline, which is the only candidate worth checking.
+ *
+ *  Both lookups are O(1); updating a CPU's deadline is O(log nr_cpus).
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; version 2
+ *  of the License.
+ */
+
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include "sched.h"
+
+static inline int parent(int i)
+{
+	return (i - 1) >> 1;
+}
+
+static inline int left_child(int i)
+{
+	return (i << 1) + 1;
+}
+
+static inline int right_child(int i)
+{
+	return (i << 1) + 2;
+}
+
+static void cpudl_exchange(struct cpudl *cp, int a, int b)
+{
+	int cpu_a = cp->elements[a].cpu, cpu_b = cp->elements[b].cpu;
+
+	swap(cp->elements[a], cp->elements[b]);
+	swap(cp->cpu_to_idx[cpu_a], cp->cpu_to_idx[cpu_b]);
+}
+
+/* Move the element at @idx down until both its children are earlier. */
+static void cpudl_heapify_down(struct cpudl *cp, int idx)
+{
+	int l, r, largest;
+
+	for (;;) {
+		l = left_child(idx);
+		r = right_child(idx);
+		largest = idx;
+
+		if (l < cp->size && dl_time_before(cp->elements[largest].dl,
+						   cp->elements[l].dl))
+			largest = l;
+		if (r < cp->size && dl_time_before(cp->elements[largest].dl,
+						   cp->elements[r].dl))
+			largest = r;
+		if (largest == idx)
+			break;
+
+		cpudl_exchange(cp, largest, idx);
+		idx = largest;
+	}
+}
+
+/* Move the element at @idx up until its parent is later. */
+static void cpudl_heapify_up(struct cpudl *cp, int idx)
+{
+	while (idx > 0 && dl_time_before(cp->elements[parent(idx)].dl,
+					 cp->elements[idx].dl)) {
+		cpudl_exchange(cp, idx, parent(idx));
+		idx = parent(idx);
+	}
+}
+
+static void cpudl_heapify(struct cpudl *cp, int idx)
+{
+	if (idx > 0 && dl_time_before(cp->elements[parent(idx)].dl,
+				      cp->elements[idx].dl))
+		cpudl_heapify_up(cp, idx);
+	else
+		cpudl_heapify_down(cp, idx);
+}
+
+static inline int cpudl_maximum(struct cpudl *cp)
+{
+	return cp->elements[0].cpu;
+}
+
+/**
+ * cpudl_find - find the best (later-dl) CPU in the system
+ * @cp: the cpudl max-heap context
+ * @p: the task
+ * @later_mask: a mask to fill in with the selected CPUs (or NULL)
+ *
+ * As with cpupri_find(), the answer is only a hint: by the time the
+ * caller acts on it the CPUs may have changed their deadlines, and the
+ * push/pull code re-checks under the runqueue locks.
+ *
+ * Returns: a CPU on which @p would be the earliest deadline, or -1.
+ */
+int cpudl_find(struct cpudl *cp, struct task_struct *p,
+	       struct cpumask *later_mask)
+{
+	const struct sched_dl_entity *dl_se = &p->dl;
+	unsigned long flags;
+	int best_cpu = -1;
+
+	raw_spin_lock_irqsave(&cp->lock, flags);
+
+	if (later_mask &&
+	    cpumask_and(later_mask, cp->free_cpus, tsk_cpus_allowed(p))) {
+		best_cpu = cpumask_any(later_mask);
+		goto out;
+	}
+
+	if (!later_mask) {
+		best_cpu = cpumask_any_and(cp->free_cpus, tsk_cpus_allowed(p));
+		if (best_cpu < nr_cpu_ids)
+			goto out;
+		best_cpu = -1;
+	}
+
+	if (cp->size > 0 &&
+	    cpumask_test_cpu(cpudl_maximum(cp), tsk_cpus_allowed(p)) &&
+	    dl_time_before(dl_se->deadline, cp->elements[0].dl)) {
+		best_cpu = cpudl_maximum(cp);
+		if (later_mask)
+			cpumask_set_cpu(best_cpu, later_mask);
+	}
+
+out:
+	raw_spin_unlock_irqrestore(&cp->lock, flags);
+
+	return best_cpu;
+}
+
+/**
+ * cpudl_set - update the earliest deadline of a CPU
+ * @cp: the cpudl max-heap context
+ * @cpu: the target cpu
+ * @dl: the new earliest deadline for this cpu
+ *
+ * Called with the runqueue of @cpu locked, whenever the earliest
+ * -deadline task queued there changes.
+ */
+void cpudl_set(struct cpudl *cp, int cpu, u64 dl)
+{
+	unsigned long flags;
+	int idx;
+
+	WARN_ON(!cpu_present(cpu));
+
+	raw_spin_lock_irqsave(&cp->lock, flags);
+
+	idx = cp->cpu_to_idx[cpu];
+	if (idx == IDX_INVALID) {
+		idx = cp->size++;
+		cp->elements[idx].dl = dl;
+		cp->elements[idx].cpu = cpu;
+		cp->cpu_to_idx[cpu] = idx;
+		cpudl_heapify_up(cp, idx);
+		cpumask_clear_cpu(cpu, cp->free_cpus);
+	} else {
+		cp->elements[idx].dl = dl;
+		cpudl_heapify(cp, idx);
+	}
+
+	raw_spin_unlock_irqrestore(&cp->lock, flags);
+}
+
+/**
+ * cpudl_clear - remove a CPU from the heap
+ * @cp: the cpudl max-heap context
+ * @cpu: the target cpu
+ *
+ * Called when the last -deadline task leaves @cpu, or when @cpu leaves
+ * the root domain. The CPU is marked free; rq_offline callers clear
+ * that afterwards with cpudl_clear_freecpu().
+ */
+void cpudl_clear(struct cpudl *cp, int cpu)
+{
+	unsigned long flags;
+	int idx, last;
+
+	WARN_ON(!cpu_present(cpu));
+
+	raw_spin_lock_irqsave(&cp->lock, flags);
+
+	idx = cp->cpu_to_idx[cpu];
+	if (idx != IDX_INVALID) {
+		last = --cp->size;
+		if (idx != last) {
+			cpudl_exchange(cp, idx, last);
+			cpudl_heapify(cp, idx);
+		}
+		cp->cpu_to_idx[cpu] = IDX_INVALID;
+	}
+	cpumask_set_cpu(cpu, cp->free_cpus);
+
+	raw_spin_unlock_irqrestore(&cp->lock, flags);
+}
+
+/*
+ * cpudl_set_freecpu - set the cpudl.free_cpus
+ * @cp: the cpudl max-heap context
+ * @cpu: rd attached cpu
+ */
+void cpudl_set_freecpu(struct cpudl *cp, int cpu)
+{
+	cpumask_set_cpu(cpu, cp->free_cpus);
+}
+
+/*
+ * cpudl_clear_freecpu - clear the cpudl.free_cpus
+ * @cp: the cpudl max-heap context
+ * @cpu: rd attached cpu
+ */
+void cpudl_clear_freecpu(struct cpudl *cp, int cpu)
+{
+	cpumask_clear_cpu(cpu, cp->free_cpus);
+}
+
+/**
+ * cpudl_init - initialize the cpudl structure
+ * @cp: the cpudl max-heap context
+ */
+int cpudl_init(struct cpudl *cp)
+{
+	int i;
+
+	memset(cp, 0, sizeof(*cp));
+	raw_spin_lock_init(&cp->lock);
+
+	cp->elements = kcalloc(nr_cpu_ids, sizeof(struct cpudl_item),
+			       GFP_KERNEL);
+	if (!cp->elements)
+		return -ENOMEM;
+
+	cp->cpu_to_idx = kcalloc(nr_cpu_ids, sizeof(int), GFP_KERNEL);
+	if (!cp->cpu_to_idx)
+		goto free_elements;
+
+	if (!zalloc_cpumask_var(&cp->free_cpus, GFP_KERNEL))
+		goto free_idx;
+
+	for (i = 0; i < nr_cpu_ids; i++)
+		cp->cpu_to_idx[i] = IDX_INVALID;
+
+	return 0;
+
+free_idx:
+	kfree(cp->cpu_to_idx);
+free_elements:
+	kfree(cp->elements);
+	return -ENOMEM;
+}
+
+/**
+ * cpudl_cleanup - clean up the cpudl structure
+ * @cp: the cpudl max-heap context
+ */
+void cpudl_cleanup(struct cpudl *cp)
+{
+	free_cpumask_var(cp->free_cpus);
+	kfree(cp->cpu_to_idx);
+	kfree(cp->elements);
+}
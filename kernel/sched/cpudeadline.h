@@ -0,0 +1,38 @@
+#ifndef _LINUX_CPUDL_H
+#define _LINUX_CPUDL_H
+
+#include <linux/sched.h>
+
+#define IDX_INVALID     -1
+
+struct cpudl_item {
+	u64	dl;
+	int	cpu;
+};
+
+/*
+ * Max-heap of the earliest deadline queued on each cpu of a root domain:
+ * the root is the cpu whose most urgent -deadline task is the least
+ * urgent in the system, i.e. the best candidate for preemption. Cpus
+ * that are online but have no -deadline task are kept in free_cpus.
+ */
+struct cpudl {
+	raw_spinlock_t		lock;
+	int			size;
+	int			*cpu_to_idx;
+	struct cpudl_item	*elements;
+	cpumask_var_t		free_cpus;
+};
+
+#ifdef CONFIG_SMP
+int  cpudl_find(struct cpudl *cp, struct task_struct *p,
+		struct cpumask *later_mask);
+void cpudl_set(struct cpudl *cp, int cpu, u64 dl);
+void cpudl_clear(struct cpudl *cp, int cpu);
+void cpudl_set_freecpu(struct cpudl *cp, int cpu);
+void cpudl_clear_freecpu(struct cpudl *cp, int cpu);
+int  cpudl_init(struct cpudl *cp);
+void cpudl_cleanup(struct cpudl *cp);
+#endif /* CONFIG_SMP */
+
+#endif /* _LINUX_CPUDL_H */
@@ -2629,6 +2629,120 @@ find_idlest_cpu(struct sched_group *group, struct task_struct *p, int this_cpu)
 	return idlest;
 }
 
+/**
+ * update_idle_cpumask - track idle entry and exit of a cpu
+ * @rq: the runqueue of the cpu
+ * @idle: whether the cpu is switching to or away from its idle task
+ *
+ * Maintains the idle cpumask of the cpu's last level cache domain that
+ * select_idle_cpu() searches.  Called with rq->lock held.
+ */
+void update_idle_cpumask(struct rq *rq, bool idle)
+{
+	struct sched_domain *sd;
+	int cpu = cpu_of(rq);
+
+	rcu_read_lock();
+	sd = rcu_dereference(per_cpu(sd_llc, cpu));
+	if (sd && sd->shared) {
+		struct cpumask *idle_cpus = sched_domain_idle_cpus(sd);
+
+		/* avoid dirtying the shared cacheline if nothing changes */
+		if (idle && !cpumask_test_cpu(cpu, idle_cpus))
+			cpumask_set_cpu(cpu, idle_cpus);
+		else if (!idle && cpumask_test_cpu(cpu, idle_cpus))
+			cpumask_clear_cpu(cpu, idle_cpus);
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Search the LLC domain of @target for an idle cpu, starting right after
+ * @target and wrapping around.  Only the cpus marked in the domain's idle
+ * cpumask are probed.  A cpu whose SMT siblings are all idle as well is
+ * preferred, otherwise the first idle cpu found is used.
+ *
+ * The number of cpus probed is bounded by the average idle time of the
+ * waking cpu relative to the average cost of a search, so that a cpu
+ * which is idle only briefly doesn't spend that time looking for
+ * another idle cpu.  Returns -1 if no idle cpu was found.
+ */
+static int select_idle_cpu(struct task_struct *p, struct sched_domain *this_sd,
+			   int target)
+{
+	struct sched_domain *sd;
+	struct cpumask *idle_cpus;
+	u64 avg_idle, avg_cost, time;
+	int cpu, nr = INT_MAX, found = -1, scanned = 0;
+	bool wrapped = false;
+	s64 delta;
+
+	sd = rcu_dereference(per_cpu(sd_llc, target));
+	if (!sd || !sd->shared || !this_sd)
+		return -1;
+
+	/*
+	 * Due to large variance we need a large fuzz factor; hackbench in
+	 * particularly is sensitive here.
+	 */
+	avg_idle = this_rq()->avg_idle / 512;
+	avg_cost = this_sd->avg_scan_cost + 1;
+
+	if (sched_feat(SIS_AVG_CPU) && avg_idle < avg_cost) {
+		schedstat_inc(this_sd, sis_skipped);
+		return -1;
+	}
+
+	if (sched_feat(SIS_PROP)) {
+		u64 span_avg = sd->span_weight * avg_idle;
+
+		if (span_avg > 4 * avg_cost)
+			nr = div64_u64(span_avg, avg_cost);
+		else
+			nr = 4;
+	}
+
+	idle_cpus = sched_domain_idle_cpus(sd);
+	time = local_clock();
+
+	for (cpu = target; ; ) {
+		cpu = cpumask_next_and(cpu, idle_cpus, tsk_cpus_allowed(p));
+		if (cpu >= nr_cpu_ids) {
+			if (wrapped)
+				break;
+			wrapped = true;
+			cpu = -1;
+			continue;
+		}
+		if (wrapped && cpu > target)
+			break;
+		if (scanned++ >= nr)
+			break;
+
+		if (!idle_cpu(cpu))
+			continue;
+
+		if (cpumask_subset(topology_thread_cpumask(cpu), idle_cpus)) {
+			found = cpu;
+			break;
+		}
+		if (found < 0)
+			found = cpu;
+	}
+
+	time = local_clock() - time;
+	delta = (s64)(time - this_sd->avg_scan_cost) / 8;
+	this_sd->avg_scan_cost += delta;
+
+	schedstat_add(this_sd, sis_scanned, scanned);
+	if (found >= 0)
+		schedstat_inc(this_sd, sis_found);
+	else
+		schedstat_inc(this_sd, sis_failed);
+
+	return found;
+}
+
 /*
  * Try and locate an idle CPU in the sched_domain.
  */
@@ -2636,48 +2750,39 @@ static int select_idle_sibling(struct task_struct *p, int target)
 {
 	int cpu = smp_processor_id();
 	int prev_cpu = task_cpu(p);
-	struct sched_domain *sd;
-	struct sched_group *sg;
+	struct sched_domain *this_sd;
 	int i;
 
+	/* search statistics are kept in the waking cpu's LLC domain */
+	this_sd = rcu_dereference(per_cpu(sd_llc, cpu));
+	if (this_sd)
+		schedstat_inc(this_sd, sis_attempts);
+
 	/*
 	 * If the task is going to be woken-up on this cpu and if it is
 	 * already idle, then it is the right target.
 	 */
 	if (target == cpu && idle_cpu(cpu))
-		return cpu;
+		goto hit;
 
 	/*
 	 * If the task is going to be woken-up on the cpu where it previously
 	 * ran and if it is currently idle, then it the right target.
 	 */
 	if (target == prev_cpu && idle_cpu(prev_cpu))
-		return prev_cpu;
+		goto hit;
 
 	/*
-	 * Otherwise, iterate the domains and find an elegible idle cpu.
+	 * Otherwise, look for an idle cpu sharing the cache with target.
 	 */
-	sd = rcu_dereference(per_cpu(sd_llc, target));
-	for_each_lower_domain(sd) {
-		sg = sd->groups;
-		do {
-			if (!cpumask_intersects(sched_group_cpus(sg),
-						tsk_cpus_allowed(p)))
-				goto next;
-
-			for_each_cpu(i, sched_group_cpus(sg)) {
-				if (!idle_cpu(i))
-					goto next;
-			}
+	i = select_idle_cpu(p, this_sd, target);
+	if (i >= 0)
+		return i;
 
-			target = cpumask_first_and(sched_group_cpus(sg),
-					tsk_cpus_allowed(p));
-			goto done;
-next:
-			sg = sg->next;
-		} while (sg != sd->groups);
-	}
-done:
+	return target;
+hit:
+	if (this_sd)
+		schedstat_inc(this_sd, sis_target);
 	return target;
 }
 
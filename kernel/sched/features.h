@@ -66,6 +66,18 @@ SCHED_FEAT(NONTASK_POWER, true)
  */
 SCHED_FEAT(TTWU_QUEUE, true)
 
+/*
+ * Don't search the LLC for an idle cpu on wakeup when the waking cpu's
+ * average idle time is shorter than the average cost of a search.
+ */
+SCHED_FEAT(SIS_AVG_CPU, true)
+
+/*
+ * Bound the number of cpus probed by the idle cpu search in proportion
+ * to the waking cpu's average idle time.
+ */
+SCHED_FEAT(SIS_PROP, true)
+
 SCHED_FEAT(FORCE_SD_OVERLAP, false)
 SCHED_FEAT(RT_RUNTIME_SHARE, true)
 SCHED_FEAT(LB_MIN, false)
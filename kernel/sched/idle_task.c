@@ -26,6 +26,7 @@ static struct task_struct *pick_next_task_idle(struct rq *rq)
 {
 	schedstat_inc(rq, sched_goidle);
 	calc_load_account_idle(rq);
+	update_idle_cpumask(rq, true);
 	return rq->idle;
 }
 
@@ -44,6 +45,7 @@ dequeue_task_idle(struct rq *rq, struct task_struct *p, int flags)
 
 static void put_prev_task_idle(struct rq *rq, struct task_struct *prev)
 {
+	update_idle_cpumask(rq, false);
 }
 
 static void task_tick_idle(struct rq *rq, struct task_struct *curr, int queued)
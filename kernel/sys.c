@@ -35,6 +35,7 @@
 #include <linux/cpu.h>
 #include <linux/personality.h>
 #include <linux/ptrace.h>
+#include <linux/futex.h>
 #include <linux/fs_struct.h>
 #include <linux/gfp.h>
 #include <linux/syscore_ops.h>
@@ -1979,6 +1980,11 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 			error = put_user(me->signal->is_child_subreaper,
 					 (int __user *) arg2);
 			break;
+		case PR_FUTEX_HASH:
+			if (arg4 || arg5)
+				return -EINVAL;
+			error = futex_hash_prctl(arg2, arg3);
+			break;
 		default:
 			error = -EINVAL;
 			break;
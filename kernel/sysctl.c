@@ -1416,6 +1416,24 @@ static struct ctl_table fs_table[] = {
 		.mode		= 0444,
 		.proc_handler	= proc_nr_dentry,
 	},
+#ifdef CONFIG_PATH_LOOKUP_CACHE
+	{
+		.procname	= "path-cache",
+		.data		= &sysctl_path_cache,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_path_cache,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+	{
+		.procname	= "path-cache-state",
+		.data		= &path_cache_stat,
+		.maxlen		= sizeof(path_cache_stat),
+		.mode		= 0444,
+		.proc_handler	= proc_path_cache_state,
+	},
+#endif
 	{
 		.procname	= "overflowuid",
 		.data		= &fs_overflowuid,
@@ -17,8 +17,11 @@
  * This is the generic async execution mechanism.  Work items as are
  * executed in process context.  The worker pool is shared and
  * automatically managed.  There is one worker pool for each CPU and
- * one extra for works which are better served by workers which are
- * not bound to any specific CPU.
+ * a set of dynamically created pools for works which are better
+ * served by workers which are not bound to any specific CPU.  The
+ * latter are keyed by their attributes (nice level and cpumask) and
+ * shared among all unbound workqueues with matching attributes, and
+ * each unbound workqueue uses one such pool per NUMA node.
  *
  * Please read Documentation/workqueue.txt for details.
  */
@@ -41,6 +44,9 @@
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
 #include <linux/idr.h>
+#include <linux/rculist.h>
+#include <linux/nodemask.h>
+#include <linux/device.h>
 
 #include "workqueue_sched.h"
 
@@ -51,6 +57,7 @@ enum {
 	GCWQ_DISASSOCIATED	= 1 << 2,	/* cpu can't serve workers */
 	GCWQ_FREEZING		= 1 << 3,	/* freeze in progress */
 	GCWQ_HIGHPRI_PENDING	= 1 << 4,	/* highpri works on queue */
+	GCWQ_RELEASING		= 1 << 5,	/* unbound gcwq being released */
 
 	/* worker flags */
 	WORKER_STARTED		= 1 << 0,	/* started */
@@ -91,6 +98,12 @@ enum {
 	 * all cpus.  Give -20.
 	 */
 	RESCUER_NICE_LEVEL	= -20,
+
+	/*
+	 * Unbound gcwqs are identified in work->data by an ID above
+	 * all valid cpu numbers and special cpu IDs.
+	 */
+	UNBOUND_GCWQ_ID_BASE	= WORK_CPU_LAST + 1,
 };
 
 /*
@@ -112,6 +125,17 @@ enum {
  * F: wq->flush_mutex protected.
  *
  * W: workqueue_lock protected.
+ *
+ * M: wq_pool_mutex protected.
+ *
+ * FW: wq->flush_mutex and workqueue_lock protected for writes.  Either
+ *     for reads.
+ *
+ * MD: wq_mayday_lock protected.
+ *
+ * R: Modifiable by initialization/destruction paths.  Readable under
+ *    sched-RCU (irq or preemption disabled) and freed after a sched-RCU
+ *    grace period.
  */
 
 struct global_cwq;
@@ -142,12 +166,15 @@ struct worker {
 /*
  * Global per-cpu workqueue.  There's one and only one for each cpu
  * and all works are queued and processed here regardless of their
- * target workqueues.
+ * target workqueues.  Unbound gcwqs have @cpu set to WORK_CPU_UNBOUND
+ * and are created on demand for each distinct set of attributes.
  */
 struct global_cwq {
 	spinlock_t		lock;		/* the gcwq lock */
 	struct list_head	worklist;	/* L: list of pending works */
 	unsigned int		cpu;		/* I: the associated cpu */
+	unsigned int		id;		/* I: ID recorded in work->data */
+	int			node;		/* I: preferred memory node */
 	unsigned int		flags;		/* L: GCWQ_* flags */
 
 	int			nr_workers;	/* L: total number of workers */
@@ -167,6 +194,12 @@ struct global_cwq {
 	unsigned int		trustee_state;	/* L: trustee state */
 	wait_queue_head_t	trustee_wait;	/* trustee wait */
 	struct worker		*first_idle;	/* L: first idle worker */
+
+	/* the following are used only by unbound gcwqs */
+	struct workqueue_attrs	*attrs;		/* I: worker attributes */
+	struct list_head	unbound_node;	/* M: unbound_gcwqs list */
+	int			refcnt;		/* M: cwqs using this gcwq */
+	struct rcu_head		rcu;		/* R: free with sched-RCU */
 } ____cacheline_aligned_in_smp;
 
 /*
@@ -184,6 +217,16 @@ struct cpu_workqueue_struct {
 	int			nr_active;	/* L: nr of active works */
 	int			max_active;	/* L: max active works */
 	struct list_head	delayed_works;	/* L: delayed works */
+	int			refcnt;		/* L: reference count */
+	struct list_head	cwqs_node;	/* FW: node on wq->cwqs */
+	struct list_head	mayday_node;	/* MD: node on wq->maydays */
+
+	/*
+	 * Release of unbound cwqs is punted to system_wq.  See
+	 * put_cwq_ref() and cwq_unbound_release_workfn() for details.
+	 */
+	struct work_struct	unbound_release_work;
+	struct rcu_head		rcu;		/* R: free with sched-RCU */
 };
 
 /*
@@ -195,38 +238,21 @@ struct wq_flusher {
 	struct completion	done;		/* flush completion */
 };
 
-/*
- * All cpumasks are assumed to be always set on UP and thus can't be
- * used to determine whether there's something to be done.
- */
-#ifdef CONFIG_SMP
-typedef cpumask_var_t mayday_mask_t;
-#define mayday_test_and_set_cpu(cpu, mask)	\
-	cpumask_test_and_set_cpu((cpu), (mask))
-#define mayday_clear_cpu(cpu, mask)		cpumask_clear_cpu((cpu), (mask))
-#define for_each_mayday_cpu(cpu, mask)		for_each_cpu((cpu), (mask))
-#define alloc_mayday_mask(maskp, gfp)		zalloc_cpumask_var((maskp), (gfp))
-#define free_mayday_mask(mask)			free_cpumask_var((mask))
-#else
-typedef unsigned long mayday_mask_t;
-#define mayday_test_and_set_cpu(cpu, mask)	test_and_set_bit(0, &(mask))
-#define mayday_clear_cpu(cpu, mask)		clear_bit(0, &(mask))
-#define for_each_mayday_cpu(cpu, mask)		if ((cpu) = 0, (mask))
-#define alloc_mayday_mask(maskp, gfp)		true
-#define free_mayday_mask(mask)			do { } while (0)
-#endif
+struct wq_device;
 
 /*
  * The externally visible workqueue abstraction is an array of
- * per-CPU workqueues:
+ * per-CPU workqueues for bound workqueues or an array of per-node
+ * workqueues for unbound ones:
  */
 struct workqueue_struct {
 	unsigned int		flags;		/* W: WQ_* flags */
 	union {
 		struct cpu_workqueue_struct __percpu	*pcpu;
-		struct cpu_workqueue_struct		*single;
+		struct cpu_workqueue_struct __rcu	**numa;
 		unsigned long				v;
 	} cpu_wq;				/* I: cwq's */
+	struct list_head	cwqs;		/* FW: all cwqs of this wq */
 	struct list_head	list;		/* W: list of all workqueues */
 
 	struct mutex		flush_mutex;	/* protects wq flushing */
@@ -237,11 +263,15 @@ struct workqueue_struct {
 	struct list_head	flusher_queue;	/* F: flush waiters */
 	struct list_head	flusher_overflow; /* F: flush overflow list */
 
-	mayday_mask_t		mayday_mask;	/* cpus requesting rescue */
+	struct list_head	maydays;	/* MD: cwqs requesting rescue */
 	struct worker		*rescuer;	/* I: rescue worker */
 
 	int			nr_drainers;	/* W: drain in progress */
 	int			saved_max_active; /* W: saved cwq max_active */
+	struct workqueue_attrs	*unbound_attrs;	/* M: only for unbound wqs */
+#ifdef CONFIG_SYSFS
+	struct wq_device	*wq_dev;	/* I: for sysfs interface */
+#endif
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map	lockdep_map;
 #endif
@@ -268,54 +298,20 @@ EXPORT_SYMBOL_GPL(system_nrt_freezable_wq);
 	for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)			\
 		hlist_for_each_entry(worker, pos, &gcwq->busy_hash[i], hentry)
 
-static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
-				  unsigned int sw)
-{
-	if (cpu < nr_cpu_ids) {
-		if (sw & 1) {
-			cpu = cpumask_next(cpu, mask);
-			if (cpu < nr_cpu_ids)
-				return cpu;
-		}
-		if (sw & 2)
-			return WORK_CPU_UNBOUND;
-	}
-	return WORK_CPU_NONE;
-}
-
-static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
-				struct workqueue_struct *wq)
-{
-	return __next_gcwq_cpu(cpu, mask, !(wq->flags & WQ_UNBOUND) ? 1 : 2);
-}
-
-/*
- * CPU iterators
+/**
+ * for_each_cwq - iterate through all cpu_workqueues of the specified wq
+ * @cwq: iteration cursor
+ * @wq: the target workqueue
  *
- * An extra gcwq is defined for an invalid cpu number
- * (WORK_CPU_UNBOUND) to host workqueues which are not bound to any
- * specific CPU.  The following iterators are similar to
- * for_each_*_cpu() iterators but also considers the unbound gcwq.
+ * Bound workqueues have one cwq per possible cpu.  Unbound workqueues
+ * have one cwq per distinct node gcwq plus the cwqs which have been
+ * replaced by apply_workqueue_attrs() but still have works in flight.
  *
- * for_each_gcwq_cpu()		: possible CPUs + WORK_CPU_UNBOUND
- * for_each_online_gcwq_cpu()	: online CPUs + WORK_CPU_UNBOUND
- * for_each_cwq_cpu()		: possible CPUs for bound workqueues,
- *				  WORK_CPU_UNBOUND for unbound workqueues
+ * This must be called with either wq->flush_mutex or workqueue_lock
+ * held.
  */
-#define for_each_gcwq_cpu(cpu)						\
-	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, 3);		\
-	     (cpu) < WORK_CPU_NONE;					\
-	     (cpu) = __next_gcwq_cpu((cpu), cpu_possible_mask, 3))
-
-#define for_each_online_gcwq_cpu(cpu)					\
-	for ((cpu) = __next_gcwq_cpu(-1, cpu_online_mask, 3);		\
-	     (cpu) < WORK_CPU_NONE;					\
-	     (cpu) = __next_gcwq_cpu((cpu), cpu_online_mask, 3))
-
-#define for_each_cwq_cpu(cpu, wq)					\
-	for ((cpu) = __next_wq_cpu(-1, cpu_possible_mask, (wq));	\
-	     (cpu) < WORK_CPU_NONE;					\
-	     (cpu) = __next_wq_cpu((cpu), cpu_possible_mask, (wq)))
+#define for_each_cwq(cwq, wq)						\
+	list_for_each_entry((cwq), &(wq)->cwqs, cwqs_node)
 
 #ifdef CONFIG_DEBUG_OBJECTS_WORK
 
@@ -447,21 +443,37 @@ static DEFINE_PER_CPU(struct global_cwq, global_cwq);
 static DEFINE_PER_CPU_SHARED_ALIGNED(atomic_t, gcwq_nr_running);
 
 /*
- * Global cpu workqueue and nr_running counter for unbound gcwq.  The
- * gcwq is always online, has GCWQ_DISASSOCIATED set, and all its
- * workers have WORKER_UNBOUND set.
+ * nr_running counter shared by all unbound gcwqs.  Unbound gcwqs are
+ * always online, have GCWQ_DISASSOCIATED set, and all their workers
+ * have WORKER_UNBOUND set.
  */
-static struct global_cwq unbound_global_cwq;
 static atomic_t unbound_gcwq_nr_running = ATOMIC_INIT(0);	/* always 0 */
 
+/*
+ * Unbound gcwqs.  They're created on demand by get_unbound_gcwq(),
+ * shared by all unbound cwqs with the same attributes and released
+ * when the last user goes away.  The IDR maps gcwq->id recorded in
+ * work->data back to the gcwq and is looked up under sched-RCU.
+ */
+static DEFINE_MUTEX(wq_pool_mutex);	/* protects unbound gcwqs */
+static LIST_HEAD(unbound_gcwqs);	/* M: all unbound gcwqs */
+static DEFINE_IDR(unbound_gcwq_idr);	/* M: unbound gcwq ID -> gcwq */
+
+/* protects wq->maydays of all workqueues, nests inside gcwq->lock */
+static DEFINE_SPINLOCK(wq_mayday_lock);
+
+/* possible CPUs of each node, used to derive per-node unbound attrs */
+static cpumask_var_t *wq_numa_possible_cpumask;
+static bool wq_numa_enabled;		/* unbound NUMA affinity enabled */
+
+/* default attributes of unbound workqueues */
+static struct workqueue_attrs *unbound_std_attrs;
+
 static int worker_thread(void *__worker);
 
 static struct global_cwq *get_gcwq(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
-		return &per_cpu(global_cwq, cpu);
-	else
-		return &unbound_global_cwq;
+	return &per_cpu(global_cwq, cpu);
 }
 
 static atomic_t *get_gcwq_nr_running(unsigned int cpu)
@@ -475,25 +487,44 @@ static atomic_t *get_gcwq_nr_running(unsigned int cpu)
 static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 					    struct workqueue_struct *wq)
 {
-	if (!(wq->flags & WQ_UNBOUND)) {
-		if (likely(cpu < nr_cpu_ids))
-			return per_cpu_ptr(wq->cpu_wq.pcpu, cpu);
-	} else if (likely(cpu == WORK_CPU_UNBOUND))
-		return wq->cpu_wq.single;
+	if (likely(!(wq->flags & WQ_UNBOUND) && cpu < nr_cpu_ids))
+		return per_cpu_ptr(wq->cpu_wq.pcpu, cpu);
 	return NULL;
 }
 
+/**
+ * unbound_cwq_by_node - return the unbound cwq for the given node
+ * @wq: the target unbound workqueue
+ * @node: the node ID
+ *
+ * CONTEXT:
+ * sched-RCU read lock (irq or preemption disabled) or wq_pool_mutex.
+ * The returned cwq may already have been replaced by
+ * apply_workqueue_attrs() and have zero refcnt by the time its gcwq
+ * is locked; see __queue_work().
+ */
+static struct cpu_workqueue_struct *unbound_cwq_by_node(
+				struct workqueue_struct *wq, int node)
+{
+	return rcu_dereference_sched(wq->cpu_wq.numa[node]);
+}
+
 static unsigned int work_color_to_flags(int color)
 {
 	return color << WORK_STRUCT_COLOR_SHIFT;
 }
 
-static int get_work_color(struct work_struct *work)
+static int get_work_color_data(unsigned long data)
 {
-	return (*work_data_bits(work) >> WORK_STRUCT_COLOR_SHIFT) &
+	return (data >> WORK_STRUCT_COLOR_SHIFT) &
 		((1 << WORK_STRUCT_COLOR_BITS) - 1);
 }
 
+static int get_work_color(struct work_struct *work)
+{
+	return get_work_color_data(*work_data_bits(work));
+}
+
 static int work_next_color(int color)
 {
 	return (color + 1) % WORK_NR_COLORS;
@@ -548,6 +579,12 @@ static struct cpu_workqueue_struct *get_work_cwq(struct work_struct *work)
 		return NULL;
 }
 
+/*
+ * Unbound gcwqs can be released while works still carry their IDs.
+ * get_work_gcwq() must be called under sched-RCU (irq disabled) and
+ * the returned gcwq is guaranteed to stay accessible only until the
+ * read-side critical section ends or its lock is grabbed.
+ */
 static struct global_cwq *get_work_gcwq(struct work_struct *work)
 {
 	unsigned long data = atomic_long_read(&work->data);
@@ -561,7 +598,10 @@ static struct global_cwq *get_work_gcwq(struct work_struct *work)
 	if (cpu == WORK_CPU_NONE)
 		return NULL;
 
-	BUG_ON(cpu >= nr_cpu_ids && cpu != WORK_CPU_UNBOUND);
+	if (cpu >= UNBOUND_GCWQ_ID_BASE)
+		return idr_find(&unbound_gcwq_idr, cpu);
+
+	BUG_ON(cpu >= nr_cpu_ids);
 	return get_gcwq(cpu);
 }
 
@@ -903,6 +943,60 @@ static inline struct list_head *gcwq_determine_ins_pos(struct global_cwq *gcwq,
 	return &twork->entry;
 }
 
+/**
+ * get_cwq_ref - get an extra reference on the specified cwq
+ * @cwq: cwq to get
+ *
+ * Obtain an extra reference on @cwq.  The caller should guarantee
+ * that @cwq has positive refcnt.
+ *
+ * CONTEXT:
+ * spin_lock_irq(gcwq->lock).
+ */
+static void get_cwq_ref(struct cpu_workqueue_struct *cwq)
+{
+	WARN_ON_ONCE(cwq->refcnt <= 0);
+	cwq->refcnt++;
+}
+
+/**
+ * put_cwq_ref - put a cwq reference
+ * @cwq: cwq to put
+ *
+ * Drop a reference of @cwq.  If its refcnt reaches zero, schedule its
+ * destruction.  Only unbound cwqs can be released this way; the base
+ * reference of a per-cpu cwq is never dropped.
+ *
+ * CONTEXT:
+ * spin_lock_irq(gcwq->lock).
+ */
+static void put_cwq_ref(struct cpu_workqueue_struct *cwq)
+{
+	if (likely(--cwq->refcnt))
+		return;
+	if (WARN_ON_ONCE(!(cwq->wq->flags & WQ_UNBOUND)))
+		return;
+	/*
+	 * @cwq can't be released under gcwq->lock, bounce to
+	 * cwq_unbound_release_workfn().  This never recurses on the same
+	 * gcwq->lock as this path is taken only for unbound workqueues
+	 * and the release work item is scheduled on a per-cpu workqueue.
+	 * To avoid lockdep warning, unbound gcwq->locks are given lockdep
+	 * subclass of 1 in get_unbound_gcwq().
+	 */
+	schedule_work(&cwq->unbound_release_work);
+}
+
+/* put_cwq_ref() for callers not holding gcwq->lock */
+static void put_cwq_ref_unlocked(struct cpu_workqueue_struct *cwq)
+{
+	struct global_cwq *gcwq = cwq->gcwq;
+
+	spin_lock_irq(&gcwq->lock);
+	put_cwq_ref(cwq);
+	spin_unlock_irq(&gcwq->lock);
+}
+
 /**
  * insert_work - insert a work into gcwq
  * @cwq: cwq @work belongs to
@@ -924,6 +1018,7 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 
 	/* we own @work, set data and link */
 	set_work_cwq(work, cwq, extra_flags);
+	get_cwq_ref(cwq);
 
 	/*
 	 * Ensure that we get the right work->data if we see the
@@ -946,43 +1041,34 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 
 /*
  * Test whether @work is being queued from another work executing on the
- * same workqueue.  This is rather expensive and should only be used from
- * cold paths.
+ * same workqueue.
  */
 static bool is_chained_work(struct workqueue_struct *wq)
 {
-	unsigned long flags;
-	unsigned int cpu;
+	struct worker *worker;
 
-	for_each_gcwq_cpu(cpu) {
-		struct global_cwq *gcwq = get_gcwq(cpu);
-		struct worker *worker;
-		struct hlist_node *pos;
-		int i;
+	if (wq->rescuer && wq->rescuer->task == current)
+		return true;
 
-		spin_lock_irqsave(&gcwq->lock, flags);
-		for_each_busy_worker(worker, i, pos, gcwq) {
-			if (worker->task != current)
-				continue;
-			spin_unlock_irqrestore(&gcwq->lock, flags);
-			/*
-			 * I'm @worker, no locking necessary.  See if @work
-			 * is headed to the same workqueue.
-			 */
-			return worker->current_cwq->wq == wq;
-		}
-		spin_unlock_irqrestore(&gcwq->lock, flags);
-	}
-	return false;
+	if (!(current->flags & PF_WQ_WORKER))
+		return false;
+
+	/*
+	 * I'm a worker, no locking necessary.  See if @work is headed
+	 * to the same workqueue.
+	 */
+	worker = kthread_data(current);
+	return worker->current_cwq && worker->current_cwq->wq == wq;
 }
 
 static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
-	struct global_cwq *gcwq;
+	struct global_cwq *gcwq, *last_gcwq;
 	struct cpu_workqueue_struct *cwq;
 	struct list_head *worklist;
 	unsigned int work_flags;
+	unsigned int req_cpu = cpu;
 	unsigned long flags;
 
 	debug_work_activate(work);
@@ -992,45 +1078,64 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 	    WARN_ON_ONCE(!is_chained_work(wq)))
 		return;
 
-	/* determine gcwq to use */
-	if (!(wq->flags & WQ_UNBOUND)) {
-		struct global_cwq *last_gcwq;
+	/*
+	 * Disabling irq also holds off sched-RCU, which protects unbound
+	 * gcwqs and cwqs looked up below.
+	 */
+	local_irq_save(flags);
+retry:
+	if (unlikely(req_cpu == WORK_CPU_UNBOUND))
+		cpu = raw_smp_processor_id();
 
-		if (unlikely(cpu == WORK_CPU_UNBOUND))
-			cpu = raw_smp_processor_id();
+	/* determine cwq to use, unbound wqs use the one of the cpu's node */
+	if (!(wq->flags & WQ_UNBOUND))
+		cwq = get_cwq(cpu, wq);
+	else
+		cwq = unbound_cwq_by_node(wq, cpu_to_node(cpu));
+	gcwq = cwq->gcwq;
 
-		/*
-		 * It's multi cpu.  If @wq is non-reentrant and @work
-		 * was previously on a different cpu, it might still
-		 * be running there, in which case the work needs to
-		 * be queued on that cpu to guarantee non-reentrance.
-		 */
-		gcwq = get_gcwq(cpu);
-		if (wq->flags & WQ_NON_REENTRANT &&
-		    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
-			struct worker *worker;
+	/*
+	 * If @wq is non-reentrant or unbound and @work was previously
+	 * on a different gcwq, it might still be running there, in
+	 * which case the work needs to be queued on that gcwq to
+	 * guarantee non-reentrance.
+	 */
+	last_gcwq = get_work_gcwq(work);
+	if (wq->flags & (WQ_NON_REENTRANT | WQ_UNBOUND) &&
+	    last_gcwq && last_gcwq != gcwq) {
+		struct worker *worker;
 
-			spin_lock_irqsave(&last_gcwq->lock, flags);
+		spin_lock(&last_gcwq->lock);
 
-			worker = find_worker_executing_work(last_gcwq, work);
+		worker = find_worker_executing_work(last_gcwq, work);
 
-			if (worker && worker->current_cwq->wq == wq)
-				gcwq = last_gcwq;
-			else {
-				/* meh... not running there, queue here */
-				spin_unlock_irqrestore(&last_gcwq->lock, flags);
-				spin_lock_irqsave(&gcwq->lock, flags);
-			}
-		} else
-			spin_lock_irqsave(&gcwq->lock, flags);
-	} else {
-		gcwq = get_gcwq(WORK_CPU_UNBOUND);
-		spin_lock_irqsave(&gcwq->lock, flags);
+		if (worker && worker->current_cwq->wq == wq) {
+			cwq = worker->current_cwq;
+			gcwq = last_gcwq;
+		} else {
+			/* meh... not running there, queue here */
+			spin_unlock(&last_gcwq->lock);
+			spin_lock(&gcwq->lock);
+		}
+	} else
+		spin_lock(&gcwq->lock);
+
+	/*
+	 * cwq is determined and locked.  For unbound cwqs, we could
+	 * have raced with apply_workqueue_attrs() and the cwq may
+	 * already be on its way out.  If its refcnt is zero, repeat
+	 * cwq selection.  Note that cwqs never die without draining
+	 * their works, so a running work keeps its cwq alive.
+	 */
+	if (unlikely(!cwq->refcnt)) {
+		if (!WARN_ON_ONCE(!(wq->flags & WQ_UNBOUND))) {
+			spin_unlock(&gcwq->lock);
+			cpu_relax();
+			goto retry;
+		}
 	}
 
-	/* gcwq determined, get cwq and queue */
-	cwq = get_cwq(gcwq->cpu, wq);
-	trace_workqueue_queue_work(cpu, cwq, work);
+	trace_workqueue_queue_work(req_cpu, cwq, work);
 
 	BUG_ON(!list_empty(&work->entry));
 
@@ -1099,9 +1204,8 @@ EXPORT_SYMBOL_GPL(queue_work_on);
 static void delayed_work_timer_fn(unsigned long __data)
 {
 	struct delayed_work *dwork = (struct delayed_work *)__data;
-	struct cpu_workqueue_struct *cwq = get_work_cwq(&dwork->work);
 
-	__queue_work(smp_processor_id(), cwq->wq, &dwork->work);
+	__queue_work(smp_processor_id(), dwork->wq, &dwork->work);
 }
 
 /**
@@ -1139,29 +1243,19 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 	struct work_struct *work = &dwork->work;
 
 	if (!test_and_set_bit(WORK_STRUCT_PENDING_BIT, work_data_bits(work))) {
-		unsigned int lcpu;
-
 		BUG_ON(timer_pending(timer));
 		BUG_ON(!list_empty(&work->entry));
 
 		timer_stats_timer_set_start_info(&dwork->timer);
 
 		/*
-		 * This stores cwq for the moment, for the timer_fn.
-		 * Note that the work's gcwq is preserved to allow
-		 * reentrance detection for delayed works.
+		 * Remember @wq for the timer_fn.  The work's data is left
+		 * alone so that the last gcwq is preserved to allow
+		 * reentrance detection for delayed works.  Unbound cwqs
+		 * can go away while the timer is pending and must not be
+		 * recorded here.
 		 */
-		if (!(wq->flags & WQ_UNBOUND)) {
-			struct global_cwq *gcwq = get_work_gcwq(work);
-
-			if (gcwq && gcwq->cpu != WORK_CPU_UNBOUND)
-				lcpu = gcwq->cpu;
-			else
-				lcpu = raw_smp_processor_id();
-		} else
-			lcpu = WORK_CPU_UNBOUND;
-
-		set_work_cwq(work, get_cwq(lcpu, wq), 0);
+		dwork->wq = wq;
 
 		timer->expires = jiffies + delay;
 		timer->data = (unsigned long)dwork;
@@ -1380,11 +1474,18 @@ static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 						      cpu_to_node(gcwq->cpu),
 						      "kworker/%u:%d", gcwq->cpu, id);
 	else
-		worker->task = kthread_create(worker_thread, worker,
-					      "kworker/u:%d", id);
+		worker->task = kthread_create_on_node(worker_thread,
+					worker, gcwq->node, "kworker/u%u:%d",
+					gcwq->id - UNBOUND_GCWQ_ID_BASE, id);
 	if (IS_ERR(worker->task))
 		goto fail;
 
+	/* unbound workers follow the nice level and cpumask of their gcwq */
+	if (on_unbound_cpu) {
+		set_user_nice(worker->task, gcwq->attrs->nice);
+		set_cpus_allowed_ptr(worker->task, gcwq->attrs->cpumask);
+	}
+
 	/*
 	 * A rogue worker will become a regular one if CPU comes
 	 * online later on.  Make sure every worker has
@@ -1487,22 +1588,29 @@ static void idle_worker_timeout(unsigned long __gcwq)
 	spin_unlock_irq(&gcwq->lock);
 }
 
+/*
+ * Ask the rescuer of @work's workqueue to process the works of its
+ * cwq.  A reference on the cwq is held while it's on wq->maydays.
+ *
+ * CONTEXT:
+ * spin_lock_irq(gcwq->lock).
+ */
 static bool send_mayday(struct work_struct *work)
 {
 	struct cpu_workqueue_struct *cwq = get_work_cwq(work);
 	struct workqueue_struct *wq = cwq->wq;
-	unsigned int cpu;
 
 	if (!(wq->flags & WQ_RESCUER))
 		return false;
 
 	/* mayday mayday mayday */
-	cpu = cwq->gcwq->cpu;
-	/* WORK_CPU_UNBOUND can't be set in cpumask, use cpu 0 instead */
-	if (cpu == WORK_CPU_UNBOUND)
-		cpu = 0;
-	if (!mayday_test_and_set_cpu(cpu, wq->mayday_mask))
+	spin_lock(&wq_mayday_lock);
+	if (list_empty(&cwq->mayday_node)) {
+		get_cwq_ref(cwq);
+		list_add_tail(&cwq->mayday_node, &wq->maydays);
 		wake_up_process(wq->rescuer->task);
+	}
+	spin_unlock(&wq_mayday_lock);
 	return true;
 }
 
@@ -1671,10 +1779,10 @@ static bool manage_workers(struct worker *worker)
 	gcwq->flags &= ~GCWQ_MANAGING_WORKERS;
 
 	/*
-	 * The trustee might be waiting to take over the manager
-	 * position, tell it we're done.
+	 * The trustee or put_unbound_gcwq() might be waiting to take
+	 * over the manager position, tell it we're done.
 	 */
-	if (unlikely(gcwq->trustee))
+	if (unlikely(gcwq->trustee || gcwq->flags & GCWQ_RELEASING))
 		wake_up_all(&gcwq->trustee_wait);
 
 	return ret;
@@ -1748,9 +1856,9 @@ static void cwq_activate_first_delayed(struct cpu_workqueue_struct *cwq)
 static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color,
 				 bool delayed)
 {
-	/* ignore uncolored works */
+	/* uncolored works don't participate in flushing */
 	if (color == WORK_NO_COLOR)
-		return;
+		goto out_put;
 
 	cwq->nr_in_flight[color]--;
 
@@ -1765,11 +1873,11 @@ static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color,
 
 	/* is flush in progress and are we at the flushing tip? */
 	if (likely(cwq->flush_color != color))
-		return;
+		goto out_put;
 
 	/* are there still in-flight works? */
 	if (cwq->nr_in_flight[color])
-		return;
+		goto out_put;
 
 	/* this cwq is done, clear flush_color */
 	cwq->flush_color = -1;
@@ -1780,6 +1888,9 @@ static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color,
 	 */
 	if (atomic_dec_and_test(&cwq->wq->nr_cwqs_to_flush))
 		complete(&cwq->wq->first_flusher->done);
+out_put:
+	/* drop the reference taken by insert_work() */
+	put_cwq_ref(cwq);
 }
 
 /**
@@ -1836,8 +1947,8 @@ __acquires(&gcwq->lock)
 	worker->current_cwq = cwq;
 	work_color = get_work_color(work);
 
-	/* record the current cpu number in the work data and dequeue */
-	set_work_cpu(work, gcwq->cpu);
+	/* record the current gcwq ID in the work data and dequeue */
+	set_work_cpu(work, gcwq->id);
 	list_del_init(&work->entry);
 
 	/*
@@ -1926,7 +2037,7 @@ static void process_scheduled_works(struct worker *worker)
  * @__worker: self
  *
  * The gcwq worker thread function.  There's a single dynamic pool of
- * these per each cpu.  These workers process all works regardless of
+ * these per each cpu and per each unbound gcwq.  These workers process all works regardless of
  * their specific target workqueue.  The only exception is works which
  * belong to workqueues with a rescuer which will be explained in
  * rescuer_thread().
@@ -2031,28 +2142,34 @@ static int rescuer_thread(void *__wq)
 	struct workqueue_struct *wq = __wq;
 	struct worker *rescuer = wq->rescuer;
 	struct list_head *scheduled = &rescuer->scheduled;
-	bool is_unbound = wq->flags & WQ_UNBOUND;
-	unsigned int cpu;
+	bool should_stop;
 
 	set_user_nice(current, RESCUER_NICE_LEVEL);
 repeat:
 	set_current_state(TASK_INTERRUPTIBLE);
 
-	if (kthread_should_stop())
-		return 0;
-
 	/*
-	 * See whether any cpu is asking for help.  Unbounded
-	 * workqueues use cpu 0 in mayday_mask for CPU_UNBOUND.
+	 * By the time the rescuer is requested to stop, the workqueue
+	 * shouldn't have any work pending, but @wq->maydays may still
+	 * have cwqs on it, each holding a reference.  Go through
+	 * @wq->maydays processing before acting on should_stop so that
+	 * the list is always empty on exit.
 	 */
-	for_each_mayday_cpu(cpu, wq->mayday_mask) {
-		unsigned int tcpu = is_unbound ? WORK_CPU_UNBOUND : cpu;
-		struct cpu_workqueue_struct *cwq = get_cwq(tcpu, wq);
+	should_stop = kthread_should_stop();
+
+	/* see whether any cwq is asking for help */
+	spin_lock_irq(&wq_mayday_lock);
+
+	while (!list_empty(&wq->maydays)) {
+		struct cpu_workqueue_struct *cwq = list_first_entry(&wq->maydays,
+					struct cpu_workqueue_struct, mayday_node);
 		struct global_cwq *gcwq = cwq->gcwq;
 		struct work_struct *work, *n;
 
 		__set_current_state(TASK_RUNNING);
-		mayday_clear_cpu(cpu, wq->mayday_mask);
+		list_del_init(&cwq->mayday_node);
+
+		spin_unlock_irq(&wq_mayday_lock);
 
 		/* migrate to the target cpu if possible */
 		rescuer->gcwq = gcwq;
@@ -2077,7 +2194,17 @@ repeat:
 		if (keep_working(gcwq))
 			wake_up_worker(gcwq);
 
+		/* drop the reference taken by send_mayday() */
+		put_cwq_ref(cwq);
 		spin_unlock_irq(&gcwq->lock);
+		spin_lock_irq(&wq_mayday_lock);
+	}
+
+	spin_unlock_irq(&wq_mayday_lock);
+
+	if (should_stop) {
+		__set_current_state(TASK_RUNNING);
+		return 0;
 	}
 
 	schedule();
@@ -2190,16 +2317,15 @@ static void insert_wq_barrier(struct cpu_workqueue_struct *cwq,
 static bool flush_workqueue_prep_cwqs(struct workqueue_struct *wq,
 				      int flush_color, int work_color)
 {
+	struct cpu_workqueue_struct *cwq;
 	bool wait = false;
-	unsigned int cpu;
 
 	if (flush_color >= 0) {
 		BUG_ON(atomic_read(&wq->nr_cwqs_to_flush));
 		atomic_set(&wq->nr_cwqs_to_flush, 1);
 	}
 
-	for_each_cwq_cpu(cpu, wq) {
-		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	for_each_cwq(cwq, wq) {
 		struct global_cwq *gcwq = cwq->gcwq;
 
 		spin_lock_irq(&gcwq->lock);
@@ -2398,7 +2524,7 @@ EXPORT_SYMBOL_GPL(flush_workqueue);
 void drain_workqueue(struct workqueue_struct *wq)
 {
 	unsigned int flush_cnt = 0;
-	unsigned int cpu;
+	struct cpu_workqueue_struct *cwq;
 
 	/*
 	 * __queue_work() needs to test whether there are drainers, is much
@@ -2412,8 +2538,9 @@ void drain_workqueue(struct workqueue_struct *wq)
 reflush:
 	flush_workqueue(wq);
 
-	for_each_cwq_cpu(cpu, wq) {
-		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	mutex_lock(&wq->flush_mutex);
+
+	for_each_cwq(cwq, wq) {
 		bool drained;
 
 		spin_lock_irq(&cwq->gcwq->lock);
@@ -2427,9 +2554,13 @@ reflush:
 		    (flush_cnt % 100 == 0 && flush_cnt <= 1000))
 			pr_warning("workqueue %s: flush on destruction isn't complete after %u tries\n",
 				   wq->name, flush_cnt);
+
+		mutex_unlock(&wq->flush_mutex);
 		goto reflush;
 	}
 
+	mutex_unlock(&wq->flush_mutex);
+
 	spin_lock(&workqueue_lock);
 	if (!--wq->nr_drainers)
 		wq->flags &= ~WQ_DRAINING;
@@ -2445,11 +2576,15 @@ static bool start_flush_work(struct work_struct *work, struct wq_barrier *barr,
 	struct cpu_workqueue_struct *cwq;
 
 	might_sleep();
+
+	local_irq_disable();
 	gcwq = get_work_gcwq(work);
-	if (!gcwq)
+	if (!gcwq) {
+		local_irq_enable();
 		return false;
+	}
 
-	spin_lock_irq(&gcwq->lock);
+	spin_lock(&gcwq->lock);
 	if (!list_empty(&work->entry)) {
 		/*
 		 * See the comment near try_to_grab_pending()->smp_rmb().
@@ -2520,13 +2655,16 @@ bool flush_work(struct work_struct *work)
 }
 EXPORT_SYMBOL_GPL(flush_work);
 
+/*
+ * Wait for @work executing on @gcwq to finish.  Called with irq
+ * disabled and releases gcwq->lock grabbed by the caller.
+ */
 static bool wait_on_cpu_work(struct global_cwq *gcwq, struct work_struct *work)
+__releases(&gcwq->lock)
 {
 	struct wq_barrier barr;
 	struct worker *worker;
 
-	spin_lock_irq(&gcwq->lock);
-
 	worker = find_worker_executing_work(gcwq, work);
 	if (unlikely(worker))
 		insert_wq_barrier(worker->current_cwq, &barr, work, worker);
@@ -2543,6 +2681,7 @@ static bool wait_on_cpu_work(struct global_cwq *gcwq, struct work_struct *work)
 
 static bool wait_on_work(struct work_struct *work)
 {
+	struct global_cwq *gcwq;
 	bool ret = false;
 	int cpu;
 
@@ -2551,8 +2690,24 @@ static bool wait_on_work(struct work_struct *work)
 	lock_map_acquire(&work->lockdep_map);
 	lock_map_release(&work->lockdep_map);
 
-	for_each_gcwq_cpu(cpu)
-		ret |= wait_on_cpu_work(get_gcwq(cpu), work);
+	for_each_possible_cpu(cpu) {
+		gcwq = get_gcwq(cpu);
+		spin_lock_irq(&gcwq->lock);
+		ret |= wait_on_cpu_work(gcwq, work);
+	}
+
+	/*
+	 * Works on unbound workqueues are non-reentrant and can be
+	 * executing only on the unbound gcwq they were last queued on.
+	 */
+	local_irq_disable();
+	gcwq = get_work_gcwq(work);
+	if (gcwq && gcwq->cpu == WORK_CPU_UNBOUND) {
+		spin_lock(&gcwq->lock);
+		ret |= wait_on_cpu_work(gcwq, work);
+	} else
+		local_irq_enable();
+
 	return ret;
 }
 
@@ -2607,11 +2762,14 @@ static int try_to_grab_pending(struct work_struct *work)
 	 * The queueing is in progress, or it is already queued. Try to
 	 * steal it from ->worklist without clearing WORK_STRUCT_PENDING.
 	 */
+	local_irq_disable();
 	gcwq = get_work_gcwq(work);
-	if (!gcwq)
+	if (!gcwq) {
+		local_irq_enable();
 		return ret;
+	}
 
-	spin_lock_irq(&gcwq->lock);
+	spin_lock(&gcwq->lock);
 	if (!list_empty(&work->entry)) {
 		/*
 		 * This work is queued, but perhaps we locked the wrong gcwq.
@@ -2620,11 +2778,21 @@ static int try_to_grab_pending(struct work_struct *work)
 		 */
 		smp_rmb();
 		if (gcwq == get_work_gcwq(work)) {
+			struct cpu_workqueue_struct *cwq = get_work_cwq(work);
+			unsigned long data = *work_data_bits(work);
+
 			debug_work_deactivate(work);
 			list_del_init(&work->entry);
-			cwq_dec_nr_in_flight(get_work_cwq(work),
-				get_work_color(work),
-				*work_data_bits(work) & WORK_STRUCT_DELAYED);
+
+			/*
+			 * Record the gcwq ID before the cwq reference is
+			 * dropped.  Unbound cwqs may be released once
+			 * their last work leaves and must not be left
+			 * behind in work->data.
+			 */
+			set_work_cpu(work, gcwq->id);
+			cwq_dec_nr_in_flight(cwq, get_work_color_data(data),
+					     data & WORK_STRUCT_DELAYED);
 			ret = 1;
 		}
 	}
@@ -2688,8 +2856,7 @@ EXPORT_SYMBOL_GPL(cancel_work_sync);
 bool flush_delayed_work(struct delayed_work *dwork)
 {
 	if (del_timer_sync(&dwork->timer))
-		__queue_work(raw_smp_processor_id(),
-			     get_work_cwq(&dwork->work)->wq, &dwork->work);
+		__queue_work(raw_smp_processor_id(), dwork->wq, &dwork->work);
 	return flush_work(&dwork->work);
 }
 EXPORT_SYMBOL(flush_delayed_work);
@@ -2709,8 +2876,7 @@ EXPORT_SYMBOL(flush_delayed_work);
 bool flush_delayed_work_sync(struct delayed_work *dwork)
 {
 	if (del_timer_sync(&dwork->timer))
-		__queue_work(raw_smp_processor_id(),
-			     get_work_cwq(&dwork->work)->wq, &dwork->work);
+		__queue_work(raw_smp_processor_id(), dwork->wq, &dwork->work);
 	return flush_work_sync(&dwork->work);
 }
 EXPORT_SYMBOL(flush_delayed_work_sync);
@@ -2889,100 +3055,622 @@ int keventd_up(void)
 	return system_wq != NULL;
 }
 
-static int alloc_cwqs(struct workqueue_struct *wq)
+/*
+ * cwqs are forced aligned according to WORK_STRUCT_FLAG_BITS.  Make
+ * sure that the alignment isn't lower than that of unsigned long long.
+ */
+#define CWQ_ALIGN	max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,	\
+			      __alignof__(unsigned long long))
+
+/**
+ * free_workqueue_attrs - free a workqueue_attrs
+ * @attrs: workqueue_attrs to free
+ *
+ * Undo alloc_workqueue_attrs().
+ */
+void free_workqueue_attrs(struct workqueue_attrs *attrs)
 {
-	/*
-	 * cwqs are forced aligned according to WORK_STRUCT_FLAG_BITS.
-	 * Make sure that the alignment isn't lower than that of
-	 * unsigned long long.
-	 */
-	const size_t size = sizeof(struct cpu_workqueue_struct);
-	const size_t align = max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,
-				   __alignof__(unsigned long long));
+	if (attrs) {
+		free_cpumask_var(attrs->cpumask);
+		kfree(attrs);
+	}
+}
+EXPORT_SYMBOL_GPL(free_workqueue_attrs);
 
-	if (!(wq->flags & WQ_UNBOUND))
-		wq->cpu_wq.pcpu = __alloc_percpu(size, align);
-	else {
-		void *ptr;
+/**
+ * alloc_workqueue_attrs - allocate a workqueue_attrs
+ * @gfp_mask: allocation mask to use
+ *
+ * Allocate a new workqueue_attrs, initialize with default settings and
+ * return it.  Returns NULL on failure.
+ */
+struct workqueue_attrs *alloc_workqueue_attrs(gfp_t gfp_mask)
+{
+	struct workqueue_attrs *attrs;
 
-		/*
-		 * Allocate enough room to align cwq and put an extra
-		 * pointer at the end pointing back to the originally
-		 * allocated pointer which will be used for free.
-		 */
-		ptr = kzalloc(size + align + sizeof(void *), GFP_KERNEL);
-		if (ptr) {
-			wq->cpu_wq.single = PTR_ALIGN(ptr, align);
-			*(void **)(wq->cpu_wq.single + 1) = ptr;
-		}
-	}
+	attrs = kzalloc(sizeof(*attrs), gfp_mask);
+	if (!attrs)
+		goto fail;
+	if (!alloc_cpumask_var(&attrs->cpumask, gfp_mask))
+		goto fail;
 
-	/* just in case, make sure it's actually aligned */
-	BUG_ON(!IS_ALIGNED(wq->cpu_wq.v, align));
-	return wq->cpu_wq.v ? 0 : -ENOMEM;
+	cpumask_copy(attrs->cpumask, cpu_possible_mask);
+	return attrs;
+fail:
+	free_workqueue_attrs(attrs);
+	return NULL;
 }
+EXPORT_SYMBOL_GPL(alloc_workqueue_attrs);
 
-static void free_cwqs(struct workqueue_struct *wq)
+static void copy_workqueue_attrs(struct workqueue_attrs *to,
+				 const struct workqueue_attrs *from)
 {
-	if (!(wq->flags & WQ_UNBOUND))
-		free_percpu(wq->cpu_wq.pcpu);
-	else if (wq->cpu_wq.single) {
-		/* the pointer to free is stored right after the cwq */
-		kfree(*(void **)(wq->cpu_wq.single + 1));
-	}
+	to->nice = from->nice;
+	cpumask_copy(to->cpumask, from->cpumask);
 }
 
-static int wq_clamp_max_active(int max_active, unsigned int flags,
-			       const char *name)
+static bool wqattrs_equal(const struct workqueue_attrs *a,
+			  const struct workqueue_attrs *b)
 {
-	int lim = flags & WQ_UNBOUND ? WQ_UNBOUND_MAX_ACTIVE : WQ_MAX_ACTIVE;
-
-	if (max_active < 1 || max_active > lim)
-		printk(KERN_WARNING "workqueue: max_active %d requested for %s "
-		       "is out of range, clamping between %d and %d\n",
-		       max_active, name, 1, lim);
+	return a->nice == b->nice && cpumask_equal(a->cpumask, b->cpumask);
+}
 
-	return clamp_val(max_active, 1, lim);
+/**
+ * wq_calc_node_cpumask - calculate a wq_attrs' cpumask for the given node
+ * @attrs: the wq_attrs of interest
+ * @node: the target NUMA node
+ * @cpumask: outarg, the resulting cpumask
+ *
+ * Unbound workers of @attrs serving @node are restricted to the
+ * possible CPUs of @node within @attrs->cpumask.  If NUMA affinity is
+ * disabled or @attrs->cpumask doesn't intersect @node, the workers
+ * use @attrs->cpumask as-is.
+ */
+static void wq_calc_node_cpumask(const struct workqueue_attrs *attrs,
+				 int node, struct cpumask *cpumask)
+{
+	if (wq_numa_enabled) {
+		cpumask_and(cpumask, attrs->cpumask,
+			    wq_numa_possible_cpumask[node]);
+		if (!cpumask_empty(cpumask))
+			return;
+	}
+	cpumask_copy(cpumask, attrs->cpumask);
 }
 
-struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
-					       unsigned int flags,
-					       int max_active,
-					       struct lock_class_key *key,
-					       const char *lock_name, ...)
+static void init_gcwq(struct global_cwq *gcwq)
 {
-	va_list args, args1;
-	struct workqueue_struct *wq;
-	unsigned int cpu;
-	size_t namelen;
+	int i;
 
-	/* determine namelen, allocate wq and format name */
-	va_start(args, lock_name);
-	va_copy(args1, args);
-	namelen = vsnprintf(NULL, 0, fmt, args) + 1;
+	spin_lock_init(&gcwq->lock);
+	INIT_LIST_HEAD(&gcwq->worklist);
+	gcwq->flags |= GCWQ_DISASSOCIATED;
 
-	wq = kzalloc(sizeof(*wq) + namelen, GFP_KERNEL);
-	if (!wq)
-		goto err;
+	INIT_LIST_HEAD(&gcwq->idle_list);
+	for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&gcwq->busy_hash[i]);
 
-	vsnprintf(wq->name, namelen, fmt, args1);
-	va_end(args);
-	va_end(args1);
+	init_timer_deferrable(&gcwq->idle_timer);
+	gcwq->idle_timer.function = idle_worker_timeout;
+	gcwq->idle_timer.data = (unsigned long)gcwq;
 
-	/*
-	 * Workqueues which may be used during memory reclaim should
-	 * have a rescuer to guarantee forward progress.
-	 */
-	if (flags & WQ_MEM_RECLAIM)
-		flags |= WQ_RESCUER;
+	setup_timer(&gcwq->mayday_timer, gcwq_mayday_timeout,
+		    (unsigned long)gcwq);
 
-	/*
-	 * Unbound workqueues aren't concurrency managed and should be
-	 * dispatched to workers immediately.
+	ida_init(&gcwq->worker_ida);
+
+	gcwq->trustee_state = TRUSTEE_DONE;
+	init_waitqueue_head(&gcwq->trustee_wait);
+
+	INIT_LIST_HEAD(&gcwq->unbound_node);
+}
+
+static void rcu_free_gcwq(struct rcu_head *rcu)
+{
+	struct global_cwq *gcwq = container_of(rcu, struct global_cwq, rcu);
+
+	ida_destroy(&gcwq->worker_ida);
+	free_workqueue_attrs(gcwq->attrs);
+	kfree(gcwq);
+}
+
+/**
+ * put_unbound_gcwq - put an unbound gcwq
+ * @gcwq: unbound gcwq to put
+ *
+ * Put @gcwq.  If its refcnt reaches zero, it gets destroyed in a
+ * sched-RCU safe manner.
+ *
+ * CONTEXT:
+ * mutex_lock(wq_pool_mutex).
+ */
+static void put_unbound_gcwq(struct global_cwq *gcwq)
+{
+	struct worker *worker;
+
+	lockdep_assert_held(&wq_pool_mutex);
+
+	if (--gcwq->refcnt)
+		return;
+
+	/* sanity checks */
+	if (WARN_ON(gcwq->cpu != WORK_CPU_UNBOUND) ||
+	    WARN_ON(!list_empty(&gcwq->worklist)))
+		return;
+
+	list_del_init(&gcwq->unbound_node);
+	idr_remove(&unbound_gcwq_idr, gcwq->id);
+
+	/*
+	 * No cwq is left on @gcwq and thus no work can be queued on it.
+	 * Become the manager and destroy all workers.  A manager which
+	 * is still around can only be trimming idle workers, wait for
+	 * it to finish.
+	 */
+	spin_lock_irq(&gcwq->lock);
+	gcwq->flags |= GCWQ_RELEASING;
+	while (gcwq->flags & GCWQ_MANAGING_WORKERS) {
+		spin_unlock_irq(&gcwq->lock);
+		wait_event(gcwq->trustee_wait,
+			   !(gcwq->flags & GCWQ_MANAGING_WORKERS));
+		spin_lock_irq(&gcwq->lock);
+	}
+	gcwq->flags |= GCWQ_MANAGING_WORKERS;
+
+	while ((worker = first_worker(gcwq)))
+		destroy_worker(worker);
+	WARN_ON(gcwq->nr_workers || gcwq->nr_idle);
+
+	spin_unlock_irq(&gcwq->lock);
+
+	del_timer_sync(&gcwq->idle_timer);
+	del_timer_sync(&gcwq->mayday_timer);
+
+	/* sched-RCU protected to allow dereferences from get_work_gcwq() */
+	call_rcu_sched(&gcwq->rcu, rcu_free_gcwq);
+}
+
+/**
+ * get_unbound_gcwq - get an unbound gcwq with the specified attributes
+ * @attrs: the attributes of the gcwq to get
+ *
+ * Obtain an unbound gcwq matching @attrs and bump its refcnt.  If
+ * there already is a matching gcwq, it will be used; otherwise, this
+ * function attempts to create a new one.
+ *
+ * CONTEXT:
+ * mutex_lock(wq_pool_mutex).  Does GFP_KERNEL allocations.
+ *
+ * RETURNS:
+ * On success, a gcwq with the same attributes as @attrs.  On failure,
+ * %NULL.
+ */
+static struct global_cwq *get_unbound_gcwq(const struct workqueue_attrs *attrs)
+{
+	struct global_cwq *gcwq;
+	struct worker *worker;
+	int node = NUMA_NO_NODE;
+	int n, id, ret;
+
+	lockdep_assert_held(&wq_pool_mutex);
+
+	/* do we already have a matching gcwq? */
+	list_for_each_entry(gcwq, &unbound_gcwqs, unbound_node) {
+		if (wqattrs_equal(gcwq->attrs, attrs)) {
+			gcwq->refcnt++;
+			return gcwq;
+		}
+	}
+
+	/* if cpumask is contained inside a NUMA node, we belong to that node */
+	if (wq_numa_enabled) {
+		for_each_node(n) {
+			if (cpumask_subset(attrs->cpumask,
+					   wq_numa_possible_cpumask[n])) {
+				node = n;
+				break;
+			}
+		}
+	}
+
+	/* nope, create a new one */
+	gcwq = kzalloc_node(sizeof(*gcwq), GFP_KERNEL, node);
+	if (!gcwq)
+		return NULL;
+
+	gcwq->attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!gcwq->attrs)
+		goto fail;
+	copy_workqueue_attrs(gcwq->attrs, attrs);
+
+	init_gcwq(gcwq);
+	lockdep_set_subclass(&gcwq->lock, 1);	/* see put_cwq_ref() */
+	gcwq->cpu = WORK_CPU_UNBOUND;
+	gcwq->node = node;
+	gcwq->refcnt = 1;
+
+	do {
+		if (!idr_pre_get(&unbound_gcwq_idr, GFP_KERNEL))
+			goto fail;
+		ret = idr_get_new_above(&unbound_gcwq_idr, gcwq,
+					UNBOUND_GCWQ_ID_BASE, &id);
+	} while (ret == -EAGAIN);
+	if (ret)
+		goto fail;
+	gcwq->id = id;
+
+	/* create and start the initial worker */
+	worker = create_worker(gcwq, true);
+	if (!worker) {
+		idr_remove(&unbound_gcwq_idr, gcwq->id);
+		goto fail;
+	}
+	spin_lock_irq(&gcwq->lock);
+	start_worker(worker);
+	spin_unlock_irq(&gcwq->lock);
+
+	list_add(&gcwq->unbound_node, &unbound_gcwqs);
+	return gcwq;
+fail:
+	ida_destroy(&gcwq->worker_ida);
+	free_workqueue_attrs(gcwq->attrs);
+	kfree(gcwq);
+	return NULL;
+}
+
+static void init_cwq(struct cpu_workqueue_struct *cwq,
+		     struct workqueue_struct *wq, struct global_cwq *gcwq)
+{
+	BUG_ON((unsigned long)cwq & WORK_STRUCT_FLAG_MASK);
+
+	cwq->gcwq = gcwq;
+	cwq->wq = wq;
+	cwq->flush_color = -1;
+	cwq->refcnt = 1;
+	INIT_LIST_HEAD(&cwq->delayed_works);
+	INIT_LIST_HEAD(&cwq->cwqs_node);
+	INIT_LIST_HEAD(&cwq->mayday_node);
+}
+
+/**
+ * link_cwq - make a cwq visible to flushing and freezing
+ * @cwq: cwq to link
+ *
+ * Sync @cwq's work color and max_active with the rest of its workqueue
+ * and put it on wq->cwqs.
+ *
+ * CONTEXT:
+ * mutex_lock(wq->flush_mutex).
+ */
+static void link_cwq(struct cpu_workqueue_struct *cwq)
+{
+	struct workqueue_struct *wq = cwq->wq;
+
+	lockdep_assert_held(&wq->flush_mutex);
+
+	/*
+	 * Set the matching work_color.  This is synchronized with
+	 * flush_mutex to avoid confusing flush_workqueue().
+	 */
+	cwq->work_color = wq->work_color;
+
+	spin_lock(&workqueue_lock);
+	if (workqueue_freezing && wq->flags & WQ_FREEZABLE)
+		cwq->max_active = 0;
+	else
+		cwq->max_active = wq->saved_max_active;
+	list_add_tail(&cwq->cwqs_node, &wq->cwqs);
+	spin_unlock(&workqueue_lock);
+}
+
+/*
+ * Unbound cwqs are allocated individually.  Allocate enough room to
+ * align the cwq and put an extra pointer at the end pointing back to
+ * the originally allocated pointer which will be used for free.
+ */
+static void free_unbound_cwq(struct cpu_workqueue_struct *cwq)
+{
+	kfree(*(void **)(cwq + 1));
+}
+
+static void rcu_free_cwq(struct rcu_head *rcu)
+{
+	free_unbound_cwq(container_of(rcu, struct cpu_workqueue_struct, rcu));
+}
+
+static void free_wq(struct workqueue_struct *wq)
+{
+	if (!(wq->flags & WQ_UNBOUND))
+		free_percpu(wq->cpu_wq.pcpu);
+	else
+		kfree(wq->cpu_wq.numa);
+	free_workqueue_attrs(wq->unbound_attrs);
+	kfree(wq->rescuer);
+	kfree(wq);
+}
+
+/*
+ * Scheduled on system_wq by put_cwq_ref() when an unbound cwq's refcnt
+ * reaches zero.  Unlink the cwq from its workqueue, put its gcwq and
+ * free it.  The last cwq of a destroyed workqueue frees the workqueue.
+ */
+static void cwq_unbound_release_workfn(struct work_struct *work)
+{
+	struct cpu_workqueue_struct *cwq = container_of(work,
+				struct cpu_workqueue_struct, unbound_release_work);
+	struct workqueue_struct *wq = cwq->wq;
+	struct global_cwq *gcwq = cwq->gcwq;
+	bool is_last;
+
+	mutex_lock(&wq->flush_mutex);
+	spin_lock(&workqueue_lock);
+	list_del(&cwq->cwqs_node);
+	is_last = list_empty(&wq->cwqs);
+	spin_unlock(&workqueue_lock);
+	mutex_unlock(&wq->flush_mutex);
+
+	mutex_lock(&wq_pool_mutex);
+	put_unbound_gcwq(gcwq);
+	mutex_unlock(&wq_pool_mutex);
+
+	/* __queue_work() may still be looking at @cwq under sched-RCU */
+	call_rcu_sched(&cwq->rcu, rcu_free_cwq);
+
+	/*
+	 * If we're the last cwq going away, @wq is already dead and no
+	 * one is gonna access it anymore.  Free it.
+	 */
+	if (is_last)
+		free_wq(wq);
+}
+
+static struct cpu_workqueue_struct *
+alloc_unbound_cwq(struct workqueue_struct *wq,
+		  const struct workqueue_attrs *attrs)
+{
+	const size_t size = sizeof(struct cpu_workqueue_struct);
+	struct cpu_workqueue_struct *cwq;
+	struct global_cwq *gcwq;
+	void *ptr;
+
+	lockdep_assert_held(&wq_pool_mutex);
+
+	gcwq = get_unbound_gcwq(attrs);
+	if (!gcwq)
+		return NULL;
+
+	ptr = kzalloc_node(size + CWQ_ALIGN + sizeof(void *), GFP_KERNEL,
+			   gcwq->node);
+	if (!ptr) {
+		put_unbound_gcwq(gcwq);
+		return NULL;
+	}
+
+	cwq = PTR_ALIGN(ptr, CWQ_ALIGN);
+	*(void **)(cwq + 1) = ptr;
+
+	init_cwq(cwq, wq, gcwq);
+	INIT_WORK(&cwq->unbound_release_work, cwq_unbound_release_workfn);
+	return cwq;
+}
+
+/**
+ * apply_workqueue_attrs - apply new workqueue_attrs to an unbound workqueue
+ * @wq: the target workqueue
+ * @attrs: the workqueue_attrs to apply, allocated with alloc_workqueue_attrs()
+ *
+ * Apply @attrs to an unbound workqueue @wq.  For each NUMA node, the
+ * workers serving the works queued from the node are restricted to
+ * the node's CPUs within @attrs->cpumask and run at @attrs->nice.
+ * Nodes ending up with identical attributes share a cwq, and gcwqs
+ * are shared among all workqueues with the same attributes.  Works
+ * already queued keep executing on the gcwqs they were queued on.
+ *
+ * Ordered workqueues use a single cwq for all nodes and can't be
+ * modified once created.
+ *
+ * Performs GFP_KERNEL allocations.  Returns 0 on success and -errno
+ * on failure.
+ */
+int apply_workqueue_attrs(struct workqueue_struct *wq,
+			  const struct workqueue_attrs *attrs)
+{
+	struct workqueue_attrs *new_attrs = NULL, *tmp_attrs = NULL;
+	struct cpu_workqueue_struct **cwq_tbl;
+	int node, ret;
+
+	/* only unbound workqueues can change attributes */
+	if (WARN_ON(!(wq->flags & WQ_UNBOUND)))
+		return -EINVAL;
+
+	/* creating multiple cwqs breaks ordering guarantee */
+	if (WARN_ON((wq->flags & __WQ_ORDERED) && !list_empty(&wq->cwqs)))
+		return -EINVAL;
+
+	if (attrs->nice < -20 || attrs->nice > 19)
+		return -EINVAL;
+
+	ret = -ENOMEM;
+	cwq_tbl = kcalloc(nr_node_ids, sizeof(cwq_tbl[0]), GFP_KERNEL);
+	new_attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	tmp_attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!cwq_tbl || !new_attrs || !tmp_attrs)
+		goto out_free;
+
+	/* make a copy of @attrs and sanitize it */
+	copy_workqueue_attrs(new_attrs, attrs);
+	cpumask_and(new_attrs->cpumask, new_attrs->cpumask, cpu_possible_mask);
+	ret = -EINVAL;
+	if (cpumask_empty(new_attrs->cpumask))
+		goto out_free;
+
+	mutex_lock(&wq_pool_mutex);
+
+	/*
+	 * Build the new per-node cwq table.  Nodes whose attributes end
+	 * up identical share a cwq, which also gives ordered workqueues
+	 * a single cwq.  Each table slot holds a reference.
+	 */
+	for_each_node(node) {
+		struct cpu_workqueue_struct *cwq = NULL;
+		int n;
+
+		copy_workqueue_attrs(tmp_attrs, new_attrs);
+		if (!(wq->flags & __WQ_ORDERED))
+			wq_calc_node_cpumask(new_attrs, node,
+					     tmp_attrs->cpumask);
+
+		for_each_node(n) {
+			if (n == node)
+				break;
+			if (wqattrs_equal(cwq_tbl[n]->gcwq->attrs, tmp_attrs)) {
+				cwq = cwq_tbl[n];
+				/* not visible yet, no need for gcwq->lock */
+				cwq->refcnt++;
+				break;
+			}
+		}
+
+		if (!cwq) {
+			cwq = alloc_unbound_cwq(wq, tmp_attrs);
+			if (!cwq)
+				goto enomem_unlock;
+		}
+		cwq_tbl[node] = cwq;
+	}
+
+	/* all cwqs have been created successfully, let's install'em */
+	mutex_lock(&wq->flush_mutex);
+	for_each_node(node) {
+		struct cpu_workqueue_struct *cwq = cwq_tbl[node];
+
+		/* the first slot of a cwq links it */
+		if (list_empty(&cwq->cwqs_node))
+			link_cwq(cwq);
+
+		cwq_tbl[node] = rcu_dereference_protected(wq->cpu_wq.numa[node],
+					lockdep_is_held(&wq_pool_mutex));
+		rcu_assign_pointer(wq->cpu_wq.numa[node], cwq);
+	}
+	mutex_unlock(&wq->flush_mutex);
+
+	copy_workqueue_attrs(wq->unbound_attrs, new_attrs);
+	mutex_unlock(&wq_pool_mutex);
+
+	/* drop the table references of the replaced cwqs */
+	for_each_node(node)
+		if (cwq_tbl[node])
+			put_cwq_ref_unlocked(cwq_tbl[node]);
+	ret = 0;
+out_free:
+	free_workqueue_attrs(tmp_attrs);
+	free_workqueue_attrs(new_attrs);
+	kfree(cwq_tbl);
+	return ret;
+
+enomem_unlock:
+	/* none of the new cwqs is visible, release them directly */
+	for_each_node(node) {
+		struct cpu_workqueue_struct *cwq = cwq_tbl[node];
+
+		if (cwq && !--cwq->refcnt) {
+			put_unbound_gcwq(cwq->gcwq);
+			free_unbound_cwq(cwq);
+		}
+	}
+	mutex_unlock(&wq_pool_mutex);
+	ret = -ENOMEM;
+	goto out_free;
+}
+EXPORT_SYMBOL_GPL(apply_workqueue_attrs);
+
+static int alloc_and_link_cwqs(struct workqueue_struct *wq)
+{
+	unsigned int cpu;
+
+	if (!(wq->flags & WQ_UNBOUND)) {
+		wq->cpu_wq.pcpu = __alloc_percpu(sizeof(struct cpu_workqueue_struct),
+						 CWQ_ALIGN);
+		if (!wq->cpu_wq.pcpu)
+			return -ENOMEM;
+
+		mutex_lock(&wq->flush_mutex);
+		for_each_possible_cpu(cpu) {
+			struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+
+			init_cwq(cwq, wq, get_gcwq(cpu));
+			link_cwq(cwq);
+		}
+		mutex_unlock(&wq->flush_mutex);
+		return 0;
+	}
+
+	wq->cpu_wq.numa = kcalloc(nr_node_ids, sizeof(wq->cpu_wq.numa[0]),
+				  GFP_KERNEL);
+	wq->unbound_attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!wq->cpu_wq.numa || !wq->unbound_attrs)
+		return -ENOMEM;
+
+	return apply_workqueue_attrs(wq, unbound_std_attrs);
+}
+
+static int wq_clamp_max_active(int max_active, unsigned int flags,
+			       const char *name)
+{
+	int lim = flags & WQ_UNBOUND ? WQ_UNBOUND_MAX_ACTIVE : WQ_MAX_ACTIVE;
+
+	if (max_active < 1 || max_active > lim)
+		printk(KERN_WARNING "workqueue: max_active %d requested for %s "
+		       "is out of range, clamping between %d and %d\n",
+		       max_active, name, 1, lim);
+
+	return clamp_val(max_active, 1, lim);
+}
+
+struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
+					       unsigned int flags,
+					       int max_active,
+					       struct lock_class_key *key,
+					       const char *lock_name, ...)
+{
+	va_list args, args1;
+	struct workqueue_struct *wq;
+	size_t namelen;
+
+	/* determine namelen, allocate wq and format name */
+	va_start(args, lock_name);
+	va_copy(args1, args);
+	namelen = vsnprintf(NULL, 0, fmt, args) + 1;
+
+	wq = kzalloc(sizeof(*wq) + namelen, GFP_KERNEL);
+	if (!wq)
+		goto err;
+
+	vsnprintf(wq->name, namelen, fmt, args1);
+	va_end(args);
+	va_end(args1);
+
+	/*
+	 * Workqueues which may be used during memory reclaim should
+	 * have a rescuer to guarantee forward progress.
+	 */
+	if (flags & WQ_MEM_RECLAIM)
+		flags |= WQ_RESCUER;
+
+	/*
+	 * Unbound workqueues aren't concurrency managed and should be
+	 * dispatched to workers immediately.
 	 */
 	if (flags & WQ_UNBOUND)
 		flags |= WQ_HIGHPRI;
 
+	/*
+	 * Unbound workqueues with @max_active of one are relied upon to
+	 * execute works in the queued order.  Don't split them per node.
+	 */
+	if ((flags & WQ_UNBOUND) && max_active == 1)
+		flags |= __WQ_ORDERED;
+
 	max_active = max_active ?: WQ_DFL_ACTIVE;
 	max_active = wq_clamp_max_active(max_active, flags, wq->name);
 
@@ -2991,33 +3679,17 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 	wq->saved_max_active = max_active;
 	mutex_init(&wq->flush_mutex);
 	atomic_set(&wq->nr_cwqs_to_flush, 0);
+	INIT_LIST_HEAD(&wq->cwqs);
 	INIT_LIST_HEAD(&wq->flusher_queue);
 	INIT_LIST_HEAD(&wq->flusher_overflow);
+	INIT_LIST_HEAD(&wq->maydays);
 
 	lockdep_init_map(&wq->lockdep_map, lock_name, key, 0);
 	INIT_LIST_HEAD(&wq->list);
 
-	if (alloc_cwqs(wq) < 0)
-		goto err;
-
-	for_each_cwq_cpu(cpu, wq) {
-		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
-		struct global_cwq *gcwq = get_gcwq(cpu);
-
-		BUG_ON((unsigned long)cwq & WORK_STRUCT_FLAG_MASK);
-		cwq->gcwq = gcwq;
-		cwq->wq = wq;
-		cwq->flush_color = -1;
-		cwq->max_active = max_active;
-		INIT_LIST_HEAD(&cwq->delayed_works);
-	}
-
 	if (flags & WQ_RESCUER) {
 		struct worker *rescuer;
 
-		if (!alloc_mayday_mask(&wq->mayday_mask, GFP_KERNEL))
-			goto err;
-
 		wq->rescuer = rescuer = alloc_worker();
 		if (!rescuer)
 			goto err;
@@ -3033,31 +3705,39 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 
 	/*
 	 * workqueue_lock protects global freeze state and workqueues
-	 * list.  Grab it, set max_active accordingly and add the new
-	 * workqueue to workqueues list.
+	 * list.  Add the new workqueue to workqueues list before creating
+	 * its cwqs; link_cwq() picks up the freeze state under the same
+	 * lock so that a concurrent freeze can't miss any of them.
 	 */
 	spin_lock(&workqueue_lock);
+	list_add(&wq->list, &workqueues);
+	spin_unlock(&workqueue_lock);
 
-	if (workqueue_freezing && wq->flags & WQ_FREEZABLE)
-		for_each_cwq_cpu(cpu, wq)
-			get_cwq(cpu, wq)->max_active = 0;
+	if (alloc_and_link_cwqs(wq) < 0)
+		goto err_unlist;
 
-	list_add(&wq->list, &workqueues);
+	if (wq->flags & WQ_SYSFS && workqueue_sysfs_register(wq)) {
+		destroy_workqueue(wq);
+		return NULL;
+	}
 
+	return wq;
+err_unlist:
+	spin_lock(&workqueue_lock);
+	list_del(&wq->list);
 	spin_unlock(&workqueue_lock);
 
-	return wq;
+	if (wq->rescuer)
+		kthread_stop(wq->rescuer->task);
 err:
-	if (wq) {
-		free_cwqs(wq);
-		free_mayday_mask(wq->mayday_mask);
-		kfree(wq->rescuer);
-		kfree(wq);
-	}
+	if (wq)
+		free_wq(wq);
 	return NULL;
 }
 EXPORT_SYMBOL_GPL(__alloc_workqueue_key);
 
+static void workqueue_sysfs_unregister(struct workqueue_struct *wq);
+
 /**
  * destroy_workqueue - safely terminate a workqueue
  * @wq: target workqueue
@@ -3066,7 +3746,8 @@ EXPORT_SYMBOL_GPL(__alloc_workqueue_key);
  */
 void destroy_workqueue(struct workqueue_struct *wq)
 {
-	unsigned int cpu;
+	struct cpu_workqueue_struct *cwq, *last_cwq = NULL;
+	int node;
 
 	/* drain it before proceeding with destruction */
 	drain_workqueue(wq);
@@ -3079,9 +3760,11 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	list_del(&wq->list);
 	spin_unlock(&workqueue_lock);
 
+	workqueue_sysfs_unregister(wq);
+
 	/* sanity check */
-	for_each_cwq_cpu(cpu, wq) {
-		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	mutex_lock(&wq->flush_mutex);
+	for_each_cwq(cwq, wq) {
 		int i;
 
 		for (i = 0; i < WORK_NR_COLORS; i++)
@@ -3089,15 +3772,34 @@ void destroy_workqueue(struct workqueue_struct *wq)
 		BUG_ON(cwq->nr_active);
 		BUG_ON(!list_empty(&cwq->delayed_works));
 	}
+	mutex_unlock(&wq->flush_mutex);
 
-	if (wq->flags & WQ_RESCUER) {
+	/* the rescuer drops the cwq references held by wq->maydays */
+	if (wq->flags & WQ_RESCUER)
 		kthread_stop(wq->rescuer->task);
-		free_mayday_mask(wq->mayday_mask);
-		kfree(wq->rescuer);
+
+	if (!(wq->flags & WQ_UNBOUND)) {
+		free_wq(wq);
+		return;
 	}
 
-	free_cwqs(wq);
-	kfree(wq);
+	/*
+	 * Drop the references held by the node table.  The last cwq to
+	 * be released frees @wq.  Keep a reference on a linked cwq while
+	 * walking the table so that @wq stays around until we're done.
+	 */
+	mutex_lock(&wq_pool_mutex);
+	for_each_node(node) {
+		cwq = rcu_dereference_protected(wq->cpu_wq.numa[node],
+					lockdep_is_held(&wq_pool_mutex));
+		RCU_INIT_POINTER(wq->cpu_wq.numa[node], NULL);
+		if (last_cwq)
+			put_cwq_ref_unlocked(last_cwq);
+		last_cwq = cwq;
+	}
+	mutex_unlock(&wq_pool_mutex);
+
+	put_cwq_ref_unlocked(last_cwq);
 }
 EXPORT_SYMBOL_GPL(destroy_workqueue);
 
@@ -3106,14 +3808,15 @@ EXPORT_SYMBOL_GPL(destroy_workqueue);
  * @wq: target workqueue
  * @max_active: new max_active value.
  *
- * Set max_active of @wq to @max_active.
+ * Set max_active of @wq to @max_active.  For unbound workqueues, the
+ * limit applies to each node separately.
  *
  * CONTEXT:
  * Don't call from IRQ context.
  */
 void workqueue_set_max_active(struct workqueue_struct *wq, int max_active)
 {
-	unsigned int cpu;
+	struct cpu_workqueue_struct *cwq;
 
 	max_active = wq_clamp_max_active(max_active, wq->flags, wq->name);
 
@@ -3121,14 +3824,13 @@ void workqueue_set_max_active(struct workqueue_struct *wq, int max_active)
 
 	wq->saved_max_active = max_active;
 
-	for_each_cwq_cpu(cpu, wq) {
-		struct global_cwq *gcwq = get_gcwq(cpu);
+	for_each_cwq(cwq, wq) {
+		struct global_cwq *gcwq = cwq->gcwq;
 
 		spin_lock_irq(&gcwq->lock);
 
-		if (!(wq->flags & WQ_FREEZABLE) ||
-		    !(gcwq->flags & GCWQ_FREEZING))
-			get_cwq(gcwq->cpu, wq)->max_active = max_active;
+		if (!(wq->flags & WQ_FREEZABLE) || !workqueue_freezing)
+			cwq->max_active = max_active;
 
 		spin_unlock_irq(&gcwq->lock);
 	}
@@ -3137,23 +3839,56 @@ void workqueue_set_max_active(struct workqueue_struct *wq, int max_active)
 }
 EXPORT_SYMBOL_GPL(workqueue_set_max_active);
 
+/**
+ * current_is_workqueue_rescuer - is %current the rescuer of a workqueue?
+ * @wq: workqueue of interest
+ *
+ * Determine whether %current is the rescuer of @wq.  Can be used from
+ * work functions to avoid hogging the rescuer when the workqueue could
+ * not get enough workers, e.g. under memory pressure.
+ *
+ * RETURNS:
+ * %true if %current is @wq's rescuer, %false otherwise.
+ */
+bool current_is_workqueue_rescuer(struct workqueue_struct *wq)
+{
+	return wq->rescuer && wq->rescuer->task == current;
+}
+EXPORT_SYMBOL_GPL(current_is_workqueue_rescuer);
+
 /**
  * workqueue_congested - test whether a workqueue is congested
  * @cpu: CPU in question
  * @wq: target workqueue
  *
- * Test whether @wq's cpu workqueue for @cpu is congested.  There is
- * no synchronization around this function and the test result is
- * unreliable and only useful as advisory hints or for debugging.
+ * Test whether @wq's cpu workqueue for @cpu is congested.  For unbound
+ * workqueues, the cwq of @cpu's node is tested.  WORK_CPU_UNBOUND
+ * selects the local CPU.  There is no synchronization around this
+ * function and the test result is unreliable and only useful as
+ * advisory hints or for debugging.
  *
  * RETURNS:
  * %true if congested, %false otherwise.
  */
 bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq)
 {
-	struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	struct cpu_workqueue_struct *cwq;
+	bool ret;
 
-	return !list_empty(&cwq->delayed_works);
+	rcu_read_lock_sched();
+
+	if (cpu == WORK_CPU_UNBOUND)
+		cpu = smp_processor_id();
+
+	if (!(wq->flags & WQ_UNBOUND))
+		cwq = get_cwq(cpu, wq);
+	else
+		cwq = unbound_cwq_by_node(wq, cpu_to_node(cpu));
+
+	ret = !list_empty(&cwq->delayed_works);
+	rcu_read_unlock_sched();
+
+	return ret;
 }
 EXPORT_SYMBOL_GPL(workqueue_congested);
 
@@ -3162,13 +3897,20 @@ EXPORT_SYMBOL_GPL(workqueue_congested);
  * @work: the work of interest
  *
  * RETURNS:
- * CPU number if @work was ever queued.  WORK_CPU_NONE otherwise.
+ * CPU number if @work was ever queued on a bound workqueue,
+ * WORK_CPU_UNBOUND if on an unbound one.  WORK_CPU_NONE otherwise.
  */
 unsigned int work_cpu(struct work_struct *work)
 {
-	struct global_cwq *gcwq = get_work_gcwq(work);
+	struct global_cwq *gcwq;
+	unsigned int cpu;
+
+	rcu_read_lock_sched();
+	gcwq = get_work_gcwq(work);
+	cpu = gcwq ? gcwq->cpu : WORK_CPU_NONE;
+	rcu_read_unlock_sched();
 
-	return gcwq ? gcwq->cpu : WORK_CPU_NONE;
+	return cpu;
 }
 EXPORT_SYMBOL_GPL(work_cpu);
 
@@ -3187,14 +3929,19 @@ EXPORT_SYMBOL_GPL(work_cpu);
  */
 unsigned int work_busy(struct work_struct *work)
 {
-	struct global_cwq *gcwq = get_work_gcwq(work);
+	struct global_cwq *gcwq;
 	unsigned long flags;
 	unsigned int ret = 0;
 
-	if (!gcwq)
+	local_irq_save(flags);
+
+	gcwq = get_work_gcwq(work);
+	if (!gcwq) {
+		local_irq_restore(flags);
 		return false;
+	}
 
-	spin_lock_irqsave(&gcwq->lock, flags);
+	spin_lock(&gcwq->lock);
 
 	if (work_pending(work))
 		ret |= WORK_BUSY_PENDING;
@@ -3207,6 +3954,304 @@ unsigned int work_busy(struct work_struct *work)
 }
 EXPORT_SYMBOL_GPL(work_busy);
 
+/*
+ * Workqueues with WQ_SYSFS flag set are visible to userland via
+ * /sys/bus/workqueue/devices/WQ_NAME.  All visible workqueues have the
+ * following attributes.
+ *
+ *  per_cpu	RO bool	: whether the workqueue is per-cpu or unbound
+ *  max_active	RW int	: maximum number of in-flight work items
+ *
+ * Unbound workqueues have the following extra attributes.
+ *
+ *  pool_ids	RO int	: the associated gcwq IDs for each node
+ *  nice	RW int	: nice value of the workers
+ *  cpumask	RW mask	: bitmask of allowed CPUs for the workers
+ */
+#ifdef CONFIG_SYSFS
+struct wq_device {
+	struct workqueue_struct		*wq;
+	struct device			dev;
+};
+
+static bool wq_sysfs_registered;
+
+static struct workqueue_struct *dev_to_wq(struct device *dev)
+{
+	struct wq_device *wq_dev = container_of(dev, struct wq_device, dev);
+
+	return wq_dev->wq;
+}
+
+static ssize_t wq_per_cpu_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", !(wq->flags & WQ_UNBOUND));
+}
+
+static ssize_t wq_max_active_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", wq->saved_max_active);
+}
+
+static ssize_t wq_max_active_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int val;
+
+	/* ordered workqueues depend on max_active of one */
+	if (wq->flags & __WQ_ORDERED)
+		return -EINVAL;
+
+	if (sscanf(buf, "%d", &val) != 1 || val <= 0)
+		return -EINVAL;
+
+	workqueue_set_max_active(wq, val);
+	return count;
+}
+
+static struct device_attribute wq_sysfs_attrs[] = {
+	__ATTR(per_cpu, 0444, wq_per_cpu_show, NULL),
+	__ATTR(max_active, 0644, wq_max_active_show, wq_max_active_store),
+	__ATTR_NULL,
+};
+
+static ssize_t wq_pool_ids_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	const char *delim = "";
+	int node, written = 0;
+
+	rcu_read_lock_sched();
+	for_each_node(node) {
+		written += scnprintf(buf + written, PAGE_SIZE - written,
+				     "%s%d:%u", delim, node,
+				     unbound_cwq_by_node(wq, node)->gcwq->id);
+		delim = " ";
+	}
+	written += scnprintf(buf + written, PAGE_SIZE - written, "\n");
+	rcu_read_unlock_sched();
+
+	return written;
+}
+
+static ssize_t wq_nice_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int written;
+
+	mutex_lock(&wq_pool_mutex);
+	written = scnprintf(buf, PAGE_SIZE, "%d\n", wq->unbound_attrs->nice);
+	mutex_unlock(&wq_pool_mutex);
+
+	return written;
+}
+
+/* prepare workqueue_attrs for sysfs store operations */
+static struct workqueue_attrs *wq_sysfs_prep_attrs(struct workqueue_struct *wq)
+{
+	struct workqueue_attrs *attrs;
+
+	attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!attrs)
+		return NULL;
+
+	mutex_lock(&wq_pool_mutex);
+	copy_workqueue_attrs(attrs, wq->unbound_attrs);
+	mutex_unlock(&wq_pool_mutex);
+	return attrs;
+}
+
+static ssize_t wq_nice_store(struct device *dev, struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	struct workqueue_attrs *attrs;
+	int ret;
+
+	attrs = wq_sysfs_prep_attrs(wq);
+	if (!attrs)
+		return -ENOMEM;
+
+	if (sscanf(buf, "%d", &attrs->nice) == 1)
+		ret = apply_workqueue_attrs(wq, attrs);
+	else
+		ret = -EINVAL;
+
+	free_workqueue_attrs(attrs);
+	return ret ?: count;
+}
+
+static ssize_t wq_cpumask_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	int written;
+
+	mutex_lock(&wq_pool_mutex);
+	written = cpumask_scnprintf(buf, PAGE_SIZE, wq->unbound_attrs->cpumask);
+	mutex_unlock(&wq_pool_mutex);
+
+	written += scnprintf(buf + written, PAGE_SIZE - written, "\n");
+	return written;
+}
+
+static ssize_t wq_cpumask_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = dev_to_wq(dev);
+	struct workqueue_attrs *attrs;
+	int ret;
+
+	attrs = wq_sysfs_prep_attrs(wq);
+	if (!attrs)
+		return -ENOMEM;
+
+	ret = bitmap_parse(buf, count, cpumask_bits(attrs->cpumask),
+			   nr_cpumask_bits);
+	if (!ret)
+		ret = apply_workqueue_attrs(wq, attrs);
+
+	free_workqueue_attrs(attrs);
+	return ret ?: count;
+}
+
+static struct device_attribute wq_sysfs_unbound_attrs[] = {
+	__ATTR(pool_ids, 0444, wq_pool_ids_show, NULL),
+	__ATTR(nice, 0644, wq_nice_show, wq_nice_store),
+	__ATTR(cpumask, 0644, wq_cpumask_show, wq_cpumask_store),
+	__ATTR_NULL,
+};
+
+static struct bus_type wq_subsys = {
+	.name				= "workqueue",
+	.dev_attrs			= wq_sysfs_attrs,
+};
+
+static int __init wq_sysfs_init(void)
+{
+	int ret;
+
+	ret = bus_register(&wq_subsys);
+	if (ret)
+		return ret;
+
+	wq_sysfs_registered = true;
+
+	/* the system workqueues are created before the bus exists */
+	return workqueue_sysfs_register(system_unbound_wq);
+}
+core_initcall(wq_sysfs_init);
+
+static void wq_device_release(struct device *dev)
+{
+	struct wq_device *wq_dev = container_of(dev, struct wq_device, dev);
+
+	kfree(wq_dev);
+}
+
+/**
+ * workqueue_sysfs_register - make a workqueue visible in sysfs
+ * @wq: the workqueue to register
+ *
+ * Expose @wq in sysfs under /sys/bus/workqueue/devices.
+ * alloc_workqueue*() automatically calls this function if WQ_SYSFS is set
+ * which is the preferred method.
+ *
+ * Workqueue user should use this function directly iff it wants to apply
+ * workqueue_attrs before making the workqueue visible in sysfs; otherwise,
+ * apply_workqueue_attrs() may race against userland updating the
+ * attributes.
+ *
+ * Returns 0 on success, -errno on failure.
+ */
+int workqueue_sysfs_register(struct workqueue_struct *wq)
+{
+	struct wq_device *wq_dev;
+	int ret;
+
+	/* the bus is registered from a core_initcall */
+	if (WARN_ON(!wq_sysfs_registered))
+		return -EBUSY;
+
+	/*
+	 * Adjusting max_active or creating new cwqs by applying
+	 * attributes breaks ordering guarantee.  Disallow exposing ordered
+	 * workqueues.
+	 */
+	if (WARN_ON(wq->flags & __WQ_ORDERED))
+		return -EINVAL;
+
+	wq->wq_dev = wq_dev = kzalloc(sizeof(*wq_dev), GFP_KERNEL);
+	if (!wq_dev)
+		return -ENOMEM;
+
+	wq_dev->wq = wq;
+	wq_dev->dev.bus = &wq_subsys;
+	wq_dev->dev.init_name = wq->name;
+	wq_dev->dev.release = wq_device_release;
+
+	/*
+	 * unbound_attrs are created separately.  Suppress uevent until
+	 * everything is ready.
+	 */
+	dev_set_uevent_suppress(&wq_dev->dev, true);
+
+	ret = device_register(&wq_dev->dev);
+	if (ret) {
+		put_device(&wq_dev->dev);
+		wq->wq_dev = NULL;
+		return ret;
+	}
+
+	if (wq->flags & WQ_UNBOUND) {
+		struct device_attribute *attr;
+
+		for (attr = wq_sysfs_unbound_attrs; attr->attr.name; attr++) {
+			ret = device_create_file(&wq_dev->dev, attr);
+			if (ret) {
+				device_unregister(&wq_dev->dev);
+				wq->wq_dev = NULL;
+				return ret;
+			}
+		}
+	}
+
+	dev_set_uevent_suppress(&wq_dev->dev, false);
+	kobject_uevent(&wq_dev->dev.kobj, KOBJ_ADD);
+	return 0;
+}
+
+/**
+ * workqueue_sysfs_unregister - undo workqueue_sysfs_register()
+ * @wq: the workqueue to unregister
+ *
+ * If @wq is registered to sysfs by workqueue_sysfs_register(), unregister.
+ */
+static void workqueue_sysfs_unregister(struct workqueue_struct *wq)
+{
+	struct wq_device *wq_dev = wq->wq_dev;
+
+	if (!wq->wq_dev)
+		return;
+
+	wq->wq_dev = NULL;
+	device_unregister(&wq_dev->dev);
+}
+#else	/* CONFIG_SYSFS */
+static void workqueue_sysfs_unregister(struct workqueue_struct *wq)	{ }
+#endif	/* CONFIG_SYSFS */
+
 /*
  * CPU hotplug.
  *
@@ -3643,6 +4688,8 @@ EXPORT_SYMBOL_GPL(work_on_cpu);
  */
 void freeze_workqueues_begin(void)
 {
+	struct workqueue_struct *wq;
+	struct cpu_workqueue_struct *cwq;
 	unsigned int cpu;
 
 	spin_lock(&workqueue_lock);
@@ -3650,23 +4697,24 @@ void freeze_workqueues_begin(void)
 	BUG_ON(workqueue_freezing);
 	workqueue_freezing = true;
 
-	for_each_gcwq_cpu(cpu) {
+	for_each_possible_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
-		struct workqueue_struct *wq;
 
 		spin_lock_irq(&gcwq->lock);
-
 		BUG_ON(gcwq->flags & GCWQ_FREEZING);
 		gcwq->flags |= GCWQ_FREEZING;
+		spin_unlock_irq(&gcwq->lock);
+	}
 
-		list_for_each_entry(wq, &workqueues, list) {
-			struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	list_for_each_entry(wq, &workqueues, list) {
+		if (!(wq->flags & WQ_FREEZABLE))
+			continue;
 
-			if (cwq && wq->flags & WQ_FREEZABLE)
-				cwq->max_active = 0;
+		for_each_cwq(cwq, wq) {
+			spin_lock_irq(&cwq->gcwq->lock);
+			cwq->max_active = 0;
+			spin_unlock_irq(&cwq->gcwq->lock);
 		}
-
-		spin_unlock_irq(&gcwq->lock);
 	}
 
 	spin_unlock(&workqueue_lock);
@@ -3687,25 +4735,22 @@ void freeze_workqueues_begin(void)
  */
 bool freeze_workqueues_busy(void)
 {
-	unsigned int cpu;
+	struct workqueue_struct *wq;
+	struct cpu_workqueue_struct *cwq;
 	bool busy = false;
 
 	spin_lock(&workqueue_lock);
 
 	BUG_ON(!workqueue_freezing);
 
-	for_each_gcwq_cpu(cpu) {
-		struct workqueue_struct *wq;
+	list_for_each_entry(wq, &workqueues, list) {
+		if (!(wq->flags & WQ_FREEZABLE))
+			continue;
 		/*
 		 * nr_active is monotonically decreasing.  It's safe
 		 * to peek without lock.
 		 */
-		list_for_each_entry(wq, &workqueues, list) {
-			struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
-
-			if (!cwq || !(wq->flags & WQ_FREEZABLE))
-				continue;
-
+		for_each_cwq(cwq, wq) {
 			BUG_ON(cwq->nr_active < 0);
 			if (cwq->nr_active) {
 				busy = true;
@@ -3729,6 +4774,8 @@ out_unlock:
  */
 void thaw_workqueues(void)
 {
+	struct workqueue_struct *wq;
+	struct cpu_workqueue_struct *cwq;
 	unsigned int cpu;
 
 	spin_lock(&workqueue_lock);
@@ -3736,20 +4783,23 @@ void thaw_workqueues(void)
 	if (!workqueue_freezing)
 		goto out_unlock;
 
-	for_each_gcwq_cpu(cpu) {
+	for_each_possible_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
-		struct workqueue_struct *wq;
 
 		spin_lock_irq(&gcwq->lock);
-
 		BUG_ON(!(gcwq->flags & GCWQ_FREEZING));
 		gcwq->flags &= ~GCWQ_FREEZING;
+		spin_unlock_irq(&gcwq->lock);
+	}
 
-		list_for_each_entry(wq, &workqueues, list) {
-			struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	list_for_each_entry(wq, &workqueues, list) {
+		if (!(wq->flags & WQ_FREEZABLE))
+			continue;
 
-			if (!cwq || !(wq->flags & WQ_FREEZABLE))
-				continue;
+		for_each_cwq(cwq, wq) {
+			struct global_cwq *gcwq = cwq->gcwq;
+
+			spin_lock_irq(&gcwq->lock);
 
 			/* restore max_active and repopulate worklist */
 			cwq->max_active = wq->saved_max_active;
@@ -3757,11 +4807,11 @@ void thaw_workqueues(void)
 			while (!list_empty(&cwq->delayed_works) &&
 			       cwq->nr_active < cwq->max_active)
 				cwq_activate_first_delayed(cwq);
-		}
 
-		wake_up_worker(gcwq);
+			wake_up_worker(gcwq);
 
-		spin_unlock_irq(&gcwq->lock);
+			spin_unlock_irq(&gcwq->lock);
+		}
 	}
 
 	workqueue_freezing = false;
@@ -3770,46 +4820,64 @@ out_unlock:
 }
 #endif /* CONFIG_FREEZER */
 
+static void __init wq_numa_init(void)
+{
+	cpumask_var_t *tbl;
+	int node, cpu;
+
+	if (num_possible_nodes() <= 1)
+		return;
+
+	/*
+	 * We want masks of possible CPUs of each node which isn't readily
+	 * available.  Build one from cpu_to_node() which should have been
+	 * fully initialized by now.
+	 */
+	tbl = kzalloc(nr_node_ids * sizeof(tbl[0]), GFP_KERNEL);
+	BUG_ON(!tbl);
+
+	for_each_node(node)
+		BUG_ON(!alloc_cpumask_var_node(&tbl[node], GFP_KERNEL, node));
+
+	for_each_possible_cpu(cpu) {
+		node = cpu_to_node(cpu);
+		if (WARN_ON(node == NUMA_NO_NODE)) {
+			pr_warning("workqueue: NUMA node mapping not available for cpu%d, disabling NUMA support\n",
+				cpu);
+			/* happens iff arch is bonkers, let's just proceed */
+			return;
+		}
+		cpumask_set_cpu(cpu, tbl[node]);
+	}
+
+	wq_numa_possible_cpumask = tbl;
+	wq_numa_enabled = true;
+}
+
 static int __init init_workqueues(void)
 {
 	unsigned int cpu;
-	int i;
 
 	cpu_notifier(workqueue_cpu_callback, CPU_PRI_WORKQUEUE);
 
+	wq_numa_init();
+
 	/* initialize gcwqs */
-	for_each_gcwq_cpu(cpu) {
+	for_each_possible_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
 
-		spin_lock_init(&gcwq->lock);
-		INIT_LIST_HEAD(&gcwq->worklist);
+		init_gcwq(gcwq);
 		gcwq->cpu = cpu;
-		gcwq->flags |= GCWQ_DISASSOCIATED;
-
-		INIT_LIST_HEAD(&gcwq->idle_list);
-		for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)
-			INIT_HLIST_HEAD(&gcwq->busy_hash[i]);
-
-		init_timer_deferrable(&gcwq->idle_timer);
-		gcwq->idle_timer.function = idle_worker_timeout;
-		gcwq->idle_timer.data = (unsigned long)gcwq;
-
-		setup_timer(&gcwq->mayday_timer, gcwq_mayday_timeout,
-			    (unsigned long)gcwq);
-
-		ida_init(&gcwq->worker_ida);
-
-		gcwq->trustee_state = TRUSTEE_DONE;
-		init_waitqueue_head(&gcwq->trustee_wait);
+		gcwq->id = cpu;
+		gcwq->node = cpu_to_node(cpu);
 	}
 
 	/* create the initial worker */
-	for_each_online_gcwq_cpu(cpu) {
+	for_each_online_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
 		struct worker *worker;
 
-		if (cpu != WORK_CPU_UNBOUND)
-			gcwq->flags &= ~GCWQ_DISASSOCIATED;
+		gcwq->flags &= ~GCWQ_DISASSOCIATED;
 		worker = create_worker(gcwq, true);
 		BUG_ON(!worker);
 		spin_lock_irq(&gcwq->lock);
@@ -3817,6 +4885,10 @@ static int __init init_workqueues(void)
 		spin_unlock_irq(&gcwq->lock);
 	}
 
+	/* default attributes for unbound workqueues */
+	unbound_std_attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	BUG_ON(!unbound_std_attrs);
+
 	system_wq = alloc_workqueue("events", 0, 0);
 	system_long_wq = alloc_workqueue("events_long", 0, 0);
 	system_nrt_wq = alloc_workqueue("events_nrt", WQ_NON_REENTRANT, 0);
@@ -0,0 +1,117 @@
+/*
+ * lib/lockref.c
+ *
+ * Spinlock-protected reference counts with a lockless fast path.
+ */
+#include <linux/export.h>
+#include <linux/lockref.h>
+
+#ifdef CONFIG_CMPXCHG_LOCKREF
+
+/*
+ * Try to apply CODE to a copy of the lockref and install it with a
+ * single cmpxchg of the lock and count word, for as long as the lock
+ * is observed unlocked.  CODE may "break" to fall back to the locked
+ * slow path; SUCCESS is run once the cmpxchg went through.  cmpxchg
+ * hands back the current value on failure, so there is no need to
+ * reload it before trying again.
+ */
+#define CMPXCHG_LOOP(CODE, SUCCESS) do {				\
+	struct lockref old;						\
+	BUILD_BUG_ON(sizeof(old) != 8);					\
+	old.lock_count = ACCESS_ONCE(lockref->lock_count);		\
+	while (likely(arch_spin_value_unlocked(old.lock.rlock.raw_lock))) { \
+		struct lockref new = old, prev = old;			\
+		CODE							\
+		old.lock_count = cmpxchg64(&lockref->lock_count,	\
+					   old.lock_count,		\
+					   new.lock_count);		\
+		if (likely(old.lock_count == prev.lock_count)) {	\
+			SUCCESS;					\
+		}							\
+		cpu_relax();						\
+	}								\
+} while (0)
+
+#else
+
+#define CMPXCHG_LOOP(CODE, SUCCESS) do { } while (0)
+
+#endif
+
+/**
+ * lockref_get - increment reference count
+ * @lockref: pointer to lockref structure
+ *
+ * This operation is only valid if you already hold a reference
+ * to the object, so you know the count cannot be zero.
+ */
+void lockref_get(struct lockref *lockref)
+{
+	CMPXCHG_LOOP(
+		new.count++;
+	,
+		return;
+	);
+
+	spin_lock(&lockref->lock);
+	lockref->count++;
+	spin_unlock(&lockref->lock);
+}
+EXPORT_SYMBOL(lockref_get);
+
+/**
+ * lockref_get_not_zero - increment reference count unless it is zero
+ * @lockref: pointer to lockref structure
+ *
+ * Returns 1 if the count was incremented, 0 if it was zero.
+ */
+int lockref_get_not_zero(struct lockref *lockref)
+{
+	int retval;
+
+	CMPXCHG_LOOP(
+		new.count++;
+		if (!old.count)
+			return 0;
+	,
+		return 1;
+	);
+
+	spin_lock(&lockref->lock);
+	retval = 0;
+	if (lockref->count) {
+		lockref->count++;
+		retval = 1;
+	}
+	spin_unlock(&lockref->lock);
+	return retval;
+}
+EXPORT_SYMBOL(lockref_get_not_zero);
+
+/**
+ * lockref_put_or_lock - decrement reference count unless it is the last one
+ * @lockref: pointer to lockref structure
+ *
+ * Returns 1 if the count was decremented.  Returns 0 with the lock held
+ * if the count is one or less, so that the caller can deal with the
+ * final reference under the lock.
+ */
+int lockref_put_or_lock(struct lockref *lockref)
+{
+	CMPXCHG_LOOP(
+		new.count--;
+		if (old.count <= 1)
+			break;
+	,
+		return 1;
+	);
+
+	spin_lock(&lockref->lock);
+	if (lockref->count <= 1)
+		return 0;
+	lockref->count--;
+	spin_unlock(&lockref->lock);
+	return 1;
+}
+EXPORT_SYMBOL(lockref_put_or_lock);
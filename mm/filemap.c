@@ -634,6 +634,62 @@ int __lock_page_killable(struct page *page)
 }
 EXPORT_SYMBOL_GPL(__lock_page_killable);
 
+/*
+ * Wake function for an AIO read waiting on a page lock: once PG_locked
+ * is clear, unhook the iocb and kick it so that the retry resumes the
+ * copy from where it stopped.
+ */
+static int kiocb_wake_page_function(wait_queue_t *wait, unsigned mode,
+				    int sync, void *arg)
+{
+	struct wait_bit_key *key = arg;
+	struct wait_bit_queue *wait_bit
+		= container_of(wait, struct wait_bit_queue, wait);
+	struct kiocb *iocb = container_of(wait_bit, struct kiocb, ki_wait);
+
+	if (wait_bit->key.flags != key->flags ||
+	    wait_bit->key.bit_nr != key->bit_nr ||
+	    test_bit(key->bit_nr, key->flags))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	kick_iocb(iocb);
+	return 1;
+}
+
+/*
+ * Queue @iocb on the lock of @page instead of sleeping on it.  Returns
+ * -EIOCBRETRY if the iocb will be kicked when the page is unlocked, or
+ * 0 if the page is already unlocked and the caller should look again.
+ *
+ * unlock_page() checks for waiters without taking the wait queue lock,
+ * so the entry is added before the lock bit is tested, with a barrier in
+ * between.  A racing unlock_page() then either sees the entry, or has
+ * cleared the bit before we test it and the entry is taken off again.
+ */
+static int kiocb_wait_on_page_locked(struct kiocb *iocb, struct page *page)
+{
+	wait_queue_head_t *q = page_waitqueue(page);
+	struct wait_bit_queue *wait = &iocb->ki_wait;
+	unsigned long flags;
+	int ret = -EIOCBRETRY;
+
+	init_waitqueue_func_entry(&wait->wait, kiocb_wake_page_function);
+	wait->key.flags = &page->flags;
+	wait->key.bit_nr = PG_locked;
+
+	spin_lock_irqsave(&q->lock, flags);
+	__add_wait_queue(q, &wait->wait);
+	smp_mb();
+	if (!PageLocked(page)) {
+		__remove_wait_queue(q, &wait->wait);
+		ret = 0;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	return ret;
+}
+
 int __lock_page_or_retry(struct page *page, struct mm_struct *mm,
 			 unsigned int flags)
 {
@@ -1072,15 +1128,21 @@ static void shrink_readahead_size_eio(struct file *filp,
  * @ppos:	current file position
  * @desc:	read_descriptor
  * @actor:	read method
+ * @iocb:	async iocb to park on a page lock, or NULL to sleep
  *
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
  *
+ * With @iocb set the read never sleeps waiting for a page to be read in.
+ * It returns what it has copied so far, or, if that is nothing, queues
+ * @iocb on the page lock and sets desc->error to -EIOCBRETRY; the unlock
+ * then kicks the iocb so that the aio core retries the read.
+ *
  * This is really ugly. But the goto's actually try to clarify some
  * of the logic when it comes to error handling etc.
  */
 static void do_generic_file_read(struct file *filp, loff_t *ppos,
-		read_descriptor_t *desc, read_actor_t actor)
+		read_descriptor_t *desc, read_actor_t actor, struct kiocb *iocb)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
@@ -1200,6 +1262,11 @@ page_ok:
 
 page_not_up_to_date:
 		/* Get exclusive access to the page ... */
+		if (iocb) {
+			if (!trylock_page(page))
+				goto would_block;
+			goto page_not_up_to_date_locked;
+		}
 		error = lock_page_killable(page);
 		if (unlikely(error))
 			goto readpage_error;
@@ -1223,7 +1290,12 @@ readpage:
 		 * A previous I/O error may have been due to temporary
 		 * failures, eg. multipath errors.
 		 * PG_error will be set again if readpage fails.
+		 * An async read waits for such a retry synchronously,
+		 * so that a persistent error gets reported instead of
+		 * being reissued on every kick.
 		 */
+		if (PageError(page))
+			iocb = NULL;
 		ClearPageError(page);
 		/* Start the actual read. The read will unlock the page. */
 		error = mapping->a_ops->readpage(filp, page);
@@ -1237,6 +1309,8 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
+			if (iocb)
+				goto would_block;
 			error = lock_page_killable(page);
 			if (unlikely(error))
 				goto readpage_error;
@@ -1259,6 +1333,22 @@ readpage:
 
 		goto page_ok;
 
+would_block:
+		/*
+		 * The page is locked, most likely for read I/O.  Return
+		 * the partial read, or queue the iocb if there is none.
+		 */
+		if (!desc->written) {
+			error = kiocb_wait_on_page_locked(iocb, page);
+			if (!error) {
+				page_cache_release(page);
+				goto find_page;
+			}
+			desc->error = error;
+		}
+		page_cache_release(page);
+		goto out;
+
 readpage_error:
 		/* UHHUH! A synchronous read error occurred. Report it */
 		desc->error = error;
@@ -1463,8 +1553,16 @@ generic_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
 		desc.count = iov[seg].iov_len - offset;
 		if (desc.count == 0)
 			continue;
+		/*
+		 * An async read may only queue itself while it has
+		 * copied nothing, so return at a segment boundary and
+		 * let the retry carry on with the next one.
+		 */
+		if (!is_sync_kiocb(iocb) && retval > 0)
+			break;
 		desc.error = 0;
-		do_generic_file_read(filp, ppos, &desc, file_read_actor);
+		do_generic_file_read(filp, ppos, &desc, file_read_actor,
+				     is_sync_kiocb(iocb) ? NULL : iocb);
 		retval += desc.written;
 		if (desc.error) {
 			retval = retval ?: desc.error;
@@ -0,0 +1,280 @@
+/*
+ *
+ * fs-fsync.c
+ *
+ * fsync: Benchmark for journal commits
+ *
+ * Every thread appends small writes to a file of its own and calls
+ * fsync() after each one, so every call has to commit a transaction
+ * with a size change.  Reports commits/sec and the distribution of
+ * fsync() latencies.  Run it on the same filesystem with and without
+ * journal checksums to see what they cost per commit.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+
+static unsigned int nthreads = 1;
+static unsigned int nsecs = 10;
+static unsigned int bsize = 4096;
+static const char *dir = ".";
+static bool datasync, overwrite;
+
+static volatile int done;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct worker {
+	int fd;
+	char *path;
+	pthread_t thread;
+	u64 *lat;		/* fsync latencies in nsecs */
+	unsigned long nr_lat;
+	unsigned long max_lat;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_UINTEGER('b', "block-size", &bsize,
+		     "Specify size of each write (in bytes)"),
+	OPT_STRING('d', "directory", &dir, "path",
+		   "Create the files in this directory"),
+	OPT_BOOLEAN('D', "datasync", &datasync,
+		    "Use fdatasync() instead of fsync()"),
+	OPT_BOOLEAN('o', "overwrite", &overwrite,
+		    "Rewrite the first block instead of appending"),
+	OPT_END()
+};
+
+static const char * const bench_fs_fsync_usage[] = {
+	"perf bench fs fsync <options>",
+	NULL
+};
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	off_t pos = 0;
+	char *buf;
+
+	buf = malloc(bsize);
+	if (!buf)
+		err(EXIT_FAILURE, "malloc");
+	memset(buf, 0x5a, bsize);
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	do {
+		u64 start;
+		int ret;
+
+		if (pwrite(w->fd, buf, bsize, pos) != (ssize_t)bsize)
+			err(EXIT_FAILURE, "pwrite(%s)", w->path);
+		if (!overwrite)
+			pos += bsize;
+
+		start = now_ns();
+		ret = datasync ? fdatasync(w->fd) : fsync(w->fd);
+		if (ret)
+			err(EXIT_FAILURE, "fsync(%s)", w->path);
+
+		if (w->nr_lat == w->max_lat) {
+			w->max_lat = w->max_lat ? w->max_lat * 2 : 4096;
+			w->lat = realloc(w->lat, w->max_lat * sizeof(*w->lat));
+			if (!w->lat)
+				err(EXIT_FAILURE, "realloc");
+		}
+		w->lat[w->nr_lat++] = now_ns() - start;
+	} while (!done);
+
+	free(buf);
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Latency at the given percentile of the sorted array, in usecs */
+static double percentile(u64 *lat, unsigned long nr, double pct)
+{
+	unsigned long idx = nr * pct / 100;
+
+	if (!nr)
+		return 0;
+	if (idx >= nr)
+		idx = nr - 1;
+	return lat[idx] / 1000.0;
+}
+
+int bench_fs_fsync(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	struct sigaction act;
+	struct worker *worker;
+	struct timeval start, stop, runtime;
+	unsigned long total = 0;
+	unsigned int i;
+	u64 *lat;
+	double secs;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_fsync_usage, 0);
+	if (argc) {
+		usage_with_options(bench_fs_fsync_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!bsize)
+		bsize = 1;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	sigfillset(&act.sa_mask);
+	act.sa_flags = 0;
+	act.sa_handler = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGALRM, &act, NULL);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# Run summary [PID %d]: %d threads, each %s %d bytes and calling %s, in %s for %d secs.\n\n",
+		       getpid(), nthreads,
+		       overwrite ? "rewriting" : "appending", bsize,
+		       datasync ? "fdatasync()" : "fsync()", dir, nsecs);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		if (asprintf(&worker[i].path, "%s/perf-bench-fsync.%d.%u",
+			     dir, getpid(), i) < 0)
+			err(EXIT_FAILURE, "asprintf");
+		worker[i].fd = open(worker[i].path,
+				    O_CREAT | O_TRUNC | O_WRONLY, 0644);
+		if (worker[i].fd < 0)
+			err(EXIT_FAILURE, "open(%s)", worker[i].path);
+
+		if (pthread_create(&worker[i].thread, NULL, workerfn,
+				   &worker[i]))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+	while (!done)
+		pause();
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &runtime);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			err(EXIT_FAILURE, "pthread_join");
+		close(worker[i].fd);
+		unlink(worker[i].path);
+		free(worker[i].path);
+		total += worker[i].nr_lat;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	lat = malloc(total * sizeof(*lat));
+	if (!lat)
+		err(EXIT_FAILURE, "malloc");
+	for (total = 0, i = 0; i < nthreads; i++) {
+		memcpy(lat + total, worker[i].lat,
+		       worker[i].nr_lat * sizeof(*lat));
+		total += worker[i].nr_lat;
+		free(worker[i].lat);
+	}
+	qsort(lat, total, sizeof(*lat), cmp_u64);
+
+	secs = runtime.tv_sec + runtime.tv_usec / 1000000.0;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14s: %lu.%03lu [sec]\n", "Total time",
+		       runtime.tv_sec,
+		       (unsigned long) (runtime.tv_usec / 1000));
+		printf(" %14ld commits/sec (total)\n", (long)(total / secs));
+		printf(" %14ld commits/sec per thread (avg)\n",
+		       (long)(total / secs / nthreads));
+		printf("\n # fsync latency [usec]\n");
+		printf(" %14s: %.1f\n", "min", percentile(lat, total, 0));
+		printf(" %14s: %.1f\n", "50th", percentile(lat, total, 50));
+		printf(" %14s: %.1f\n", "90th", percentile(lat, total, 90));
+		printf(" %14s: %.1f\n", "99th", percentile(lat, total, 99));
+		printf(" %14s: %.1f\n", "99.9th", percentile(lat, total, 99.9));
+		printf(" %14s: %.1f\n", "max", percentile(lat, total, 100));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%ld %.1f %.1f %.1f\n", (long)(total / secs),
+		       percentile(lat, total, 50), percentile(lat, total, 99),
+		       percentile(lat, total, 99.9));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(lat);
+	free(worker);
+	return 0;
+}
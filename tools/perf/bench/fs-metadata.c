@@ -0,0 +1,293 @@
+/*
+ *
+ * fs-metadata.c
+ *
+ * metadata: Benchmark for metadata-heavy workloads
+ *
+ * Every thread works in a directory of its own, and in a loop creates
+ * a batch of empty files, stats them, reads the directory back and
+ * unlinks them again.  This touches inodes, bitmaps, group descriptors
+ * and directory blocks far more than file data, which is where
+ * metadata checksums cost.  Run it on the same filesystem with and
+ * without checksums to compare.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+enum {
+	PHASE_CREATE,
+	PHASE_STAT,
+	PHASE_READDIR,
+	PHASE_UNLINK,
+	NR_PHASES
+};
+
+static const char * const phase_names[NR_PHASES] = {
+	"create", "stat", "readdir", "unlink"
+};
+
+static unsigned int nthreads;
+static unsigned int nsecs = 10;
+static unsigned int nfiles = 1000;
+static const char *dir = ".";
+
+static volatile int done;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct worker {
+	char *dir;
+	pthread_t thread;
+	unsigned long ops[NR_PHASES];
+	u64 ns[NR_PHASES];
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_UINTEGER('n', "files", &nfiles,
+		     "Specify amount of files per thread and batch"),
+	OPT_STRING('d', "directory", &dir, "path",
+		   "Create the files below this directory"),
+	OPT_END()
+};
+
+static const char * const bench_fs_metadata_usage[] = {
+	"perf bench fs metadata <options>",
+	NULL
+};
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void file_path(char *buf, size_t len, struct worker *w,
+		      unsigned int i)
+{
+	snprintf(buf, len, "%s/f%u", w->dir, i);
+}
+
+/* Runs one phase over the batch, returns the number of ops done */
+static unsigned long do_phase(struct worker *w, int phase)
+{
+	char path[PATH_MAX];
+	unsigned long ops = 0;
+	struct stat st;
+	struct dirent *de;
+	DIR *d;
+	unsigned int i;
+	int fd;
+
+	if (phase == PHASE_READDIR) {
+		d = opendir(w->dir);
+		if (!d)
+			err(EXIT_FAILURE, "opendir(%s)", w->dir);
+		while ((de = readdir(d)))
+			ops++;
+		closedir(d);
+		return ops;
+	}
+
+	for (i = 0; i < nfiles; i++, ops++) {
+		file_path(path, sizeof(path), w, i);
+
+		switch (phase) {
+		case PHASE_CREATE:
+			fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+			if (fd < 0)
+				err(EXIT_FAILURE, "open(%s)", path);
+			close(fd);
+			break;
+		case PHASE_STAT:
+			if (stat(path, &st))
+				err(EXIT_FAILURE, "stat(%s)", path);
+			break;
+		case PHASE_UNLINK:
+			if (unlink(path))
+				err(EXIT_FAILURE, "unlink(%s)", path);
+			break;
+		}
+	}
+
+	return ops;
+}
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	int phase;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	/* Always finish a batch, so no files are left behind */
+	do {
+		for (phase = 0; phase < NR_PHASES; phase++) {
+			u64 start = now_ns();
+
+			w->ops[phase] += do_phase(w, phase);
+			w->ns[phase] += now_ns() - start;
+		}
+	} while (!done);
+
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+int bench_fs_metadata(int argc, const char **argv,
+		      const char *prefix __used)
+{
+	struct sigaction act;
+	struct worker *worker;
+	struct timeval start, stop, runtime;
+	unsigned long ops[NR_PHASES] = { 0 }, total = 0;
+	u64 ns[NR_PHASES] = { 0 };
+	unsigned int i;
+	int phase;
+	char *top;
+	double secs;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_metadata_usage, 0);
+	if (argc) {
+		usage_with_options(bench_fs_metadata_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nfiles)
+		nfiles = 1;
+
+	if (asprintf(&top, "%s/perf-bench-metadata.XXXXXX", dir) < 0)
+		err(EXIT_FAILURE, "asprintf");
+	if (!mkdtemp(top))
+		err(EXIT_FAILURE, "mkdtemp(%s)", top);
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	sigfillset(&act.sa_mask);
+	act.sa_flags = 0;
+	act.sa_handler = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGALRM, &act, NULL);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# Run summary [PID %d]: %d threads, each cycling %d files through create/stat/readdir/unlink in %s for %d secs.\n\n",
+		       getpid(), nthreads, nfiles, top, nsecs);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		if (asprintf(&worker[i].dir, "%s/t%u", top, i) < 0)
+			err(EXIT_FAILURE, "asprintf");
+		if (mkdir(worker[i].dir, 0755))
+			err(EXIT_FAILURE, "mkdir(%s)", worker[i].dir);
+
+		if (pthread_create(&worker[i].thread, NULL, workerfn,
+				   &worker[i]))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+	while (!done)
+		pause();
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			err(EXIT_FAILURE, "pthread_join");
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &runtime);
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		for (phase = 0; phase < NR_PHASES; phase++) {
+			ops[phase] += worker[i].ops[phase];
+			ns[phase] += worker[i].ns[phase];
+		}
+		rmdir(worker[i].dir);
+		free(worker[i].dir);
+	}
+	rmdir(top);
+
+	for (phase = 0; phase < NR_PHASES; phase++)
+		total += ops[phase];
+	secs = runtime.tv_sec + runtime.tv_usec / 1000000.0;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14s: %lu.%03lu [sec]\n", "Total time",
+		       runtime.tv_sec,
+		       (unsigned long) (runtime.tv_usec / 1000));
+		printf(" %14ld ops/sec (total)\n", (long)(total / secs));
+		/* rates while the threads were in the phase */
+		for (phase = 0; phase < NR_PHASES; phase++)
+			printf(" %14ld %s/sec\n",
+			       (long)(ops[phase] * 1e9 * nthreads /
+				      (ns[phase] ? ns[phase] : 1)),
+			       phase_names[phase]);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%ld\n", (long)(total / secs));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(worker);
+	free(top);
+	return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ *
+ * fs-stat.c
+ *
+ * stat: Benchmark for concurrent path lookups
+ *
+ * Builds a short directory chain in a scratch directory and lets a
+ * number of threads stat() a file at the end of it as fast as they
+ * can.  All threads walk the same dentries, so the reference counting
+ * of hot dentries during lookup dominates.  The run is repeated with
+ * 1, 2, 4, ... threads up to the requested number.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int nsecs = 5;
+static unsigned int depth = 4;
+static const char *dir = "/tmp";
+static bool private_files;
+
+static volatile int done, interrupted;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct worker {
+	char *path;
+	pthread_t thread;
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify the maximum amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime of each run (in seconds)"),
+	OPT_UINTEGER('D', "depth", &depth,
+		     "Specify depth of the directory chain"),
+	OPT_STRING('d', "directory", &dir, "path",
+		   "Create the files below this directory"),
+	OPT_BOOLEAN('p', "private", &private_files,
+		    "Give each thread its own file at the end of the chain"),
+	OPT_END()
+};
+
+static const char * const bench_fs_stat_usage[] = {
+	"perf bench fs stat <options>",
+	NULL
+};
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	struct stat st;
+	unsigned long ops = 0;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	do {
+		if (stat(w->path, &st))
+			err(EXIT_FAILURE, "stat(%s)", w->path);
+		ops++;
+	} while (!done);
+
+	w->ops = ops;
+	return NULL;
+}
+
+static void toggle_done(int sig)
+{
+	done = 1;
+	if (sig == SIGINT)
+		interrupted = 1;
+}
+
+static char *file_path(const char *top, unsigned int i)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/file%u", top, i) < 0)
+		err(EXIT_FAILURE, "asprintf");
+	return path;
+}
+
+static void create_file(const char *path)
+{
+	int fd;
+
+	fd = open(path, O_CREAT | O_WRONLY, 0644);
+	if (fd < 0)
+		err(EXIT_FAILURE, "open(%s)", path);
+	close(fd);
+}
+
+/* Returns the number of ops done by n threads in one run */
+static unsigned long run(struct worker *worker, unsigned int n,
+			 double *secs)
+{
+	struct timeval start, stop, runtime;
+	unsigned long total = 0;
+	unsigned int i;
+
+	done = 0;
+	threads_starting = n;
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&worker[i].thread, NULL, workerfn,
+				   &worker[i]))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+	while (!done)
+		pause();
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &runtime);
+
+	for (i = 0; i < n; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			err(EXIT_FAILURE, "pthread_join");
+		total += worker[i].ops;
+	}
+
+	*secs = runtime.tv_sec + runtime.tv_usec / 1000000.0;
+	return total;
+}
+
+int bench_fs_stat(int argc, const char **argv,
+		  const char *prefix __used)
+{
+	struct sigaction act;
+	struct worker *worker;
+	char *top, *path;
+	unsigned int i, n;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_stat_usage, 0);
+	if (argc) {
+		usage_with_options(bench_fs_stat_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (asprintf(&top, "%s/perf-bench-stat.XXXXXX", dir) < 0)
+		err(EXIT_FAILURE, "asprintf");
+	if (!mkdtemp(top))
+		err(EXIT_FAILURE, "mkdtemp(%s)", top);
+	path = strdup(top);
+	for (i = 0; i < depth; i++) {
+		char *sub;
+
+		if (asprintf(&sub, "%s/d%u", path, i) < 0)
+			err(EXIT_FAILURE, "asprintf");
+		if (mkdir(sub, 0755))
+			err(EXIT_FAILURE, "mkdir(%s)", sub);
+		free(path);
+		path = sub;
+	}
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	for (i = 0; i < nthreads; i++) {
+		worker[i].path = file_path(path, private_files ? i : 0);
+		if (private_files || !i)
+			create_file(worker[i].path);
+	}
+
+	sigfillset(&act.sa_mask);
+	act.sa_flags = 0;
+	act.sa_handler = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGALRM, &act, NULL);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT) {
+		printf("# Run summary [PID %d]: stat() of %s, %d secs per run.\n\n",
+		       getpid(), worker[0].path, nsecs);
+		printf(" %8s %14s %14s\n", "threads", "ops/sec",
+		       "ops/sec/thread");
+	}
+
+	for (n = 1; !interrupted; n = min(n * 2, nthreads)) {
+		unsigned long total;
+		double secs;
+
+		total = run(worker, n, &secs);
+
+		switch (bench_format) {
+		case BENCH_FORMAT_DEFAULT:
+			printf(" %8u %14ld %14ld\n", n, (long)(total / secs),
+			       (long)(total / secs / n));
+			break;
+
+		case BENCH_FORMAT_SIMPLE:
+			printf("%u %ld\n", n, (long)(total / secs));
+			break;
+
+		default:
+			/* reaching here is something disaster */
+			fprintf(stderr, "Unknown format:%d\n", bench_format);
+			exit(1);
+			break;
+		}
+
+		if (n == nthreads)
+			break;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	/* Tear the chain down again, innermost first */
+	for (i = 0; i < nthreads; i++) {
+		if (private_files || !i)
+			unlink(worker[i].path);
+		free(worker[i].path);
+	}
+	for (i = depth; i > 0; i--) {
+		rmdir(path);
+		*strrchr(path, '/') = '\0';
+	}
+	rmdir(top);
+
+	free(path);
+	free(top);
+	free(worker);
+	return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ *
+ * futex-hash.c
+ *
+ * hash: Benchmark for the futex hash table
+ *
+ * Spawns a number of threads which hammer FUTEX_WAIT on a set of
+ * futexes of their own.  The futex values never match, so every call
+ * returns -EWOULDBLOCK right after taking and dropping the hash bucket
+ * lock.  This measures how well the futex hash spreads unrelated
+ * futexes and how much the bucket locks are contended.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int nsecs = 10;
+static unsigned int nfutexes = 1024;
+static int slots = -1;
+static bool fshared, silent;
+
+static volatile int done;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+static int futex_flag;
+
+struct worker {
+	int tid;
+	u_int32_t *futex;
+	pthread_t thread;
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_UINTEGER('f', "futexes", &nfutexes,
+		     "Specify amount of futexes per threads"),
+	OPT_INTEGER('b', "buckets", &slots,
+		    "Use a private futex hash of this many buckets (0: global hash)"),
+	OPT_BOOLEAN('s', "silent", &silent,
+		    "Silent mode: do not display data/details"),
+	OPT_BOOLEAN('S', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_hash_usage[] = {
+	"perf bench futex hash <options>",
+	NULL
+};
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int i;
+	unsigned long ops = 0;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	do {
+		for (i = 0; i < nfutexes; i++, ops++) {
+			/*
+			 * We want the futex calls to fail in order to
+			 * stress the hashing of uaddr and not measure
+			 * other steps, such as internal waitqueue
+			 * handling, thus enlarging the critical region
+			 * protected by hb->lock.
+			 */
+			futex_wait(&w->futex[i], 1234, NULL, futex_flag);
+		}
+	} while (!done);
+
+	w->ops = ops;
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+int bench_futex_hash(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct sigaction act;
+	struct worker *worker;
+	struct timeval start, stop, runtime;
+	unsigned long total = 0, min = ~0UL, max = 0;
+	unsigned int i;
+	double secs;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_hash_usage, 0);
+	if (argc) {
+		usage_with_options(bench_futex_hash_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nfutexes)
+		nfutexes = 1;
+
+	/* the process is still single threaded here, as required */
+	if (slots >= 0 && futex_hash_slots(slots))
+		err(EXIT_FAILURE, "prctl(PR_FUTEX_HASH)");
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		err(EXIT_FAILURE, "calloc");
+
+	if (!fshared)
+		futex_flag = FUTEX_PRIVATE_FLAG;
+
+	sigfillset(&act.sa_mask);
+	act.sa_flags = 0;
+	act.sa_handler = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGALRM, &act, NULL);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# Run summary [PID %d]: %d threads, each operating on %d [%s] futexes for %d secs.\n\n",
+		       getpid(), nthreads, nfutexes,
+		       fshared ? "shared" : "private", nsecs);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		worker[i].tid = i;
+		worker[i].futex = calloc(nfutexes, sizeof(*worker[i].futex));
+		if (!worker[i].futex)
+			err(EXIT_FAILURE, "calloc");
+
+		if (pthread_create(&worker[i].thread, NULL, workerfn,
+				   &worker[i]))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+	while (!done)
+		pause();
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &runtime);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			err(EXIT_FAILURE, "pthread_join");
+		free(worker[i].futex);
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	secs = runtime.tv_sec + runtime.tv_usec / 1000000.0;
+
+	for (i = 0; i < nthreads; i++) {
+		total += worker[i].ops;
+		if (worker[i].ops < min)
+			min = worker[i].ops;
+		if (worker[i].ops > max)
+			max = worker[i].ops;
+
+		if (!silent && bench_format == BENCH_FORMAT_DEFAULT)
+			printf("[thread %2d] futexes: %p ... %p [ %ld ops/sec ]\n",
+			       worker[i].tid, &worker[i].futex[0],
+			       &worker[i].futex[nfutexes - 1],
+			       (long)(worker[i].ops / secs));
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("\n %14s: %lu.%03lu [sec]\n", "Total time",
+		       runtime.tv_sec,
+		       (unsigned long) (runtime.tv_usec / 1000));
+		printf(" %14ld ops/sec (total)\n", (long)(total / secs));
+		printf(" %14ld ops/sec per thread (avg)\n",
+		       (long)(total / secs / nthreads));
+		printf(" %14ld ops/sec per thread (min), %ld (max)\n",
+		       (long)(min / secs), (long)(max / secs));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%ld\n", (long)(total / secs));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(worker);
+	return 0;
+}